@@ -0,0 +1,183 @@
+/**
+ * @file   evset_stress.c
+ * @brief  Stress LwqqAsyncEvset across event threads and user threads
+ *
+ * each user thread builds evsets of random size, and hands their events to
+ * a pool of finisher threads, which play the event thread. half of evsets
+ * are waited with lwqq_async_evset_wait, the other half get a listener and
+ * are dropped with lwqq_async_evset_unref. every evset must complete once,
+ * with err_count equal to events finished with an error.
+ *
+ * $ ./lwqq-evset-stress -u 4 -f 4 -n 20000
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwqq.h"
+
+#define QUEUE_SIZE 4096
+#define MAX_EVENTS 16
+
+static struct {
+   int users;
+   int finishers;
+   int sets; /** < evsets of each user thread */
+} opt = { 4, 4, 20000 };
+
+/** bounded queue of events to finish */
+static struct {
+   pthread_mutex_t lock;
+   pthread_cond_t not_empty;
+   pthread_cond_t not_full;
+   LwqqAsyncEvent* ev[QUEUE_SIZE];
+   size_t head, count;
+   int quit;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER };
+
+static struct {
+   pthread_mutex_t lock;
+   unsigned long completed;
+   unsigned long mismatch;
+} result = { PTHREAD_MUTEX_INITIALIZER };
+
+typedef struct Expect {
+   LwqqAsyncEvset* set;
+   int errors;
+   int calls;
+} Expect;
+
+static void queue_push(LwqqAsyncEvent* ev)
+{
+   pthread_mutex_lock(&queue.lock);
+   while (queue.count == QUEUE_SIZE)
+      pthread_cond_wait(&queue.not_full, &queue.lock);
+   queue.ev[(queue.head + queue.count++) % QUEUE_SIZE] = ev;
+   pthread_cond_signal(&queue.not_empty);
+   pthread_mutex_unlock(&queue.lock);
+}
+
+static void* finisher(void* data)
+{
+   for (;;) {
+      LwqqAsyncEvent* ev;
+      pthread_mutex_lock(&queue.lock);
+      while (queue.count == 0 && !queue.quit)
+         pthread_cond_wait(&queue.not_empty, &queue.lock);
+      if (queue.count == 0) {
+         pthread_mutex_unlock(&queue.lock);
+         return NULL;
+      }
+      ev = queue.ev[queue.head];
+      queue.head = (queue.head + 1) % QUEUE_SIZE;
+      queue.count--;
+      pthread_cond_signal(&queue.not_full);
+      pthread_mutex_unlock(&queue.lock);
+      lwqq_async_event_finish(ev);
+   }
+}
+
+static void record(Expect* e, int err_count)
+{
+   pthread_mutex_lock(&result.lock);
+   result.completed++;
+   if (err_count != e->errors || ++e->calls != 1)
+      result.mismatch++;
+   pthread_mutex_unlock(&result.lock);
+}
+
+/** listener of an unwaited evset, runs on the thread of last unref */
+static void set_done(Expect* e)
+{
+   record(e, e->set->err_count);
+   s_free(e);
+}
+
+static void* user(void* data)
+{
+   unsigned seed = (unsigned)(size_t)data;
+   LwqqAsyncEvent* evs[MAX_EVENTS];
+   int i, j;
+   for (i = 0; i < opt.sets; i++) {
+      int n = rand_r(&seed) % MAX_EVENTS + 1;
+      int wait = rand_r(&seed) & 1;
+      Expect* e = s_malloc0(sizeof(*e));
+      e->set = lwqq_async_evset_new();
+      for (j = 0; j < n; j++) {
+         evs[j] = lwqq_async_event_new(NULL);
+         if (rand_r(&seed) % 4 == 0) {
+            evs[j]->result = LWQQ_EC_ERROR;
+            e->errors++;
+         }
+         lwqq_async_evset_add_event(e->set, evs[j]);
+      }
+      if (!wait)
+         lwqq_async_add_evset_listener(e->set, _C_(p, set_done, e));
+      // events may finish before the user thread drops its reference
+      for (j = 0; j < n; j++)
+         queue_push(evs[j]);
+      if (wait) {
+         record(e, lwqq_async_evset_wait(e->set));
+         s_free(e);
+      } else
+         lwqq_async_evset_unref(e->set);
+   }
+   return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+   pthread_t* users, *finishers;
+   unsigned long total;
+   int c, i;
+
+   while ((c = getopt(argc, argv, "u:f:n:h")) != -1) {
+      switch (c) {
+      case 'u':
+         opt.users = atoi(optarg);
+         break;
+      case 'f':
+         opt.finishers = atoi(optarg);
+         break;
+      case 'n':
+         opt.sets = atoi(optarg);
+         break;
+      default:
+         fprintf(stderr, "Usage: %s [-u user threads] [-f finisher threads] "
+                         "[-n evsets of each user]\n",
+                 argv[0]);
+         return 1;
+      }
+   }
+   if (opt.users < 1 || opt.finishers < 1 || opt.sets < 1) {
+      fprintf(stderr, "thread and evset counts must be positive\n");
+      return 1;
+   }
+
+   users = s_malloc0(sizeof(*users) * opt.users);
+   finishers = s_malloc0(sizeof(*finishers) * opt.finishers);
+   for (i = 0; i < opt.finishers; i++)
+      pthread_create(&finishers[i], NULL, finisher, NULL);
+   for (i = 0; i < opt.users; i++)
+      pthread_create(&users[i], NULL, user, (void*)(size_t)(i + 1));
+   for (i = 0; i < opt.users; i++)
+      pthread_join(users[i], NULL);
+
+   pthread_mutex_lock(&queue.lock);
+   queue.quit = 1;
+   pthread_cond_broadcast(&queue.not_empty);
+   pthread_mutex_unlock(&queue.lock);
+   for (i = 0; i < opt.finishers; i++)
+      pthread_join(finishers[i], NULL);
+
+   total = (unsigned long)opt.users * opt.sets;
+   printf("evsets: %lu completed: %lu mismatch: %lu\n", total,
+          result.completed, result.mismatch);
+   s_free(users);
+   s_free(finishers);
+   return (result.completed == total && result.mismatch == 0) ? 0 : 1;
+}
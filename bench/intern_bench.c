@@ -0,0 +1,205 @@
+/**
+ * @file   intern_bench.c
+ * @brief  Compare roster memory and message metadata cost with interning
+ *
+ * builds a synthetic roster, groups whose members are drawn from a shared
+ * pool of uins like real accounts in many groups, and then creates and
+ * frees group messages the way poll does. each phase runs once with
+ * s_intern disabled and once enabled, and reports heap bytes, time and
+ * copies shared by the intern table.
+ *
+ * $ ./lwqq-intern-bench -g 200 -m 300 -u 20000 -k 200000
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "lwqq.h"
+#include "metrics.h"
+
+static struct {
+   int groups;
+   int members; /** < members of each group */
+   int pool; /** < distinct uins of all groups */
+   int messages;
+} opt = { 200, 300, 20000, 200000 };
+
+static const char* fonts[] = { "宋体", "Arial", "微软雅黑", "Tahoma" };
+
+/** bytes in use by malloc, resident size when it is unknown */
+static size_t heap_bytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+   return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+   return (unsigned)mallinfo().uordblks;
+#else
+   unsigned long size = 0, rss = 0;
+   FILE* f = fopen("/proc/self/statm", "r");
+   if (!f)
+      return 0;
+   if (fscanf(f, "%lu %lu", &size, &rss) != 2)
+      rss = 0;
+   fclose(f);
+   return rss * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void uin_of(char* buf, size_t sz, unsigned idx)
+{
+   snprintf(buf, sz, "%u", 1000000000u + idx * 7919u);
+}
+
+static LwqqGroup** roster_build(unsigned* seed)
+{
+   LwqqGroup** groups = s_malloc0(sizeof(*groups) * opt.groups);
+   char buf[32];
+   int i, j;
+   for (i = 0; i < opt.groups; i++) {
+      LwqqGroup* g = lwqq_group_new(LWQQ_GROUP_QUN);
+      uin_of(buf, sizeof(buf), i);
+      g->gid = s_strdup(buf);
+      g->name = s_strdup("bench group");
+      for (j = 0; j < opt.members; j++) {
+         LwqqSimpleBuddy* sb = lwqq_simple_buddy_new();
+         uin_of(buf, sizeof(buf), rand_r(seed) % opt.pool);
+         sb->uin = s_intern(buf);
+         sb->nick = s_strdup("member");
+         LIST_INSERT_HEAD(&g->members, sb, entries);
+      }
+      groups[i] = g;
+   }
+   return groups;
+}
+
+static void roster_free(LwqqGroup** groups)
+{
+   int i;
+   for (i = 0; i < opt.groups; i++)
+      lwqq_group_free(groups[i]);
+   s_free(groups);
+}
+
+/** same interned fields as parse_new_msg fills for a group message */
+static LwqqMsg* message_new(unsigned* seed)
+{
+   LwqqMsgMessage* msg = (LwqqMsgMessage*)lwqq_msg_new(LWQQ_MS_GROUP_MSG);
+   char buf[32];
+   uin_of(buf, sizeof(buf), rand_r(seed) % opt.pool);
+   msg->group.send = s_intern(buf);
+   msg->group.group_code = s_strdup("123456");
+   msg->f_name = s_intern_take(
+       s_strdup(fonts[rand_r(seed) % (sizeof(fonts) / sizeof(fonts[0]))]));
+   return (LwqqMsg*)msg;
+}
+
+typedef struct Result {
+   size_t roster_bytes;
+   double roster_ms;
+   double msg_ns; /** < create and free of one message */
+   size_t msg_peak; /** < bytes of messages kept alive at once */
+   size_t shared;
+} Result;
+
+static void run(int intern, Result* r)
+{
+   unsigned seed = 1;
+   size_t base, hits0, hits1;
+   uint64_t t0;
+   int i, k, n;
+
+   s_intern_enable(intern);
+   s_intern_stats(NULL, NULL, &hits0);
+
+   base = heap_bytes();
+   t0 = lwqq__metrics_now();
+   LwqqGroup** groups = roster_build(&seed);
+   r->roster_ms = (lwqq__metrics_now() - t0) / 1000.0;
+   r->roster_bytes = heap_bytes() - base;
+
+   // messages are kept in small batches, like a poll response
+   LwqqMsg* batch[64];
+   t0 = lwqq__metrics_now();
+   r->msg_peak = 0;
+   for (i = 0; i < opt.messages; i += n) {
+      n = opt.messages - i < 64 ? opt.messages - i : 64;
+      base = heap_bytes();
+      for (k = 0; k < n; k++)
+         batch[k] = message_new(&seed);
+      if (heap_bytes() - base > r->msg_peak)
+         r->msg_peak = heap_bytes() - base;
+      for (k = 0; k < n; k++)
+         lwqq_msg_free(batch[k]);
+   }
+   r->msg_ns = (lwqq__metrics_now() - t0) * 1000.0 / opt.messages;
+
+   s_intern_stats(NULL, NULL, &hits1);
+   r->shared = hits1 - hits0;
+   roster_free(groups);
+}
+
+static void usage(const char* prog)
+{
+   fprintf(stderr,
+           "Usage: %s [options]\n"
+           "  -g n   groups (default 200)\n"
+           "  -m n   members of each group (default 300)\n"
+           "  -u n   distinct member uins (default 20000)\n"
+           "  -k n   messages (default 200000)\n",
+           prog);
+}
+
+int main(int argc, char* argv[])
+{
+   Result off, on;
+   int c;
+
+   while ((c = getopt(argc, argv, "g:m:u:k:h")) != -1) {
+      switch (c) {
+      case 'g':
+         opt.groups = atoi(optarg);
+         break;
+      case 'm':
+         opt.members = atoi(optarg);
+         break;
+      case 'u':
+         opt.pool = atoi(optarg);
+         break;
+      case 'k':
+         opt.messages = atoi(optarg);
+         break;
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (opt.groups < 1 || opt.members < 1 || opt.pool < 1
+       || opt.messages < 1) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   run(0, &off);
+   run(1, &on);
+   s_intern_enable(0);
+
+   printf("roster: %d groups x %d members, %d distinct uins\n", opt.groups,
+          opt.members, opt.pool);
+   printf("%-10s %14s %12s %14s %14s %10s\n", "", "roster bytes",
+          "roster ms", "msg ns", "64 msg bytes", "shared");
+   printf("%-10s %14zu %12.2f %14.1f %14zu %10zu\n", "strdup",
+          off.roster_bytes, off.roster_ms, off.msg_ns, off.msg_peak,
+          off.shared);
+   printf("%-10s %14zu %12.2f %14.1f %14zu %10zu\n", "intern",
+          on.roster_bytes, on.roster_ms, on.msg_ns, on.msg_peak, on.shared);
+   if (off.roster_bytes)
+      printf("roster memory %.1f%% of strdup\n",
+             100.0 * on.roster_bytes / off.roster_bytes);
+   return 0;
+}
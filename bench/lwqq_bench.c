@@ -0,0 +1,347 @@
+/**
+ * @file   lwqq_bench.c
+ * @brief  Benchmark lwqq against mock_server
+ *
+ * start N clients, which login, fetch friends, poll message and send
+ * message to mock_server as fast as possible for a while. reports login
+ * time, poll-to-delivery latency, sends per second and resident memory.
+ *
+ * $ ./mock_server -p 8080 &
+ * $ ./lwqq-bench -u http://127.0.0.1:8080 -n 10 -d 30
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "lwqq.h"
+#include "metrics.h"
+#include "capture.h"
+#include "sendq.h"
+
+typedef struct BenchClient {
+   LwqqClient* lc;
+   uint64_t login_start;
+   int login_err;
+} BenchClient;
+
+typedef struct SendCtx {
+   BenchClient* bc;
+   LwqqMsg* msg;
+   uint64_t start;
+} SendCtx;
+
+static struct {
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   int running;
+   int inflight;
+   unsigned long received;
+   unsigned long sent;
+   unsigned long send_err;
+   LwqqHistogram login;
+   LwqqHistogram delivery;
+   LwqqHistogram send;
+} bench = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static struct {
+   const char* base;
+   int clients;
+   int duration;
+   int window; /** < sends in flight of each client */
+   int verbose;
+   const char* record; /** < capture file for lwqq-replay */
+   double rate; /** < send through sendq with this rate, 0 to send directly */
+} opt = { NULL, 10, 10, 4, 0, NULL, 0 };
+
+static uint64_t realtime_us()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static size_t rss_bytes()
+{
+   unsigned long size = 0, rss = 0;
+   FILE* f = fopen("/proc/self/statm", "r");
+   if (!f)
+      return 0;
+   if (fscanf(f, "%lu %lu", &size, &rss) != 2)
+      rss = 0;
+   fclose(f);
+   return rss * sysconf(_SC_PAGESIZE);
+}
+
+static void login_done(BenchClient* bc, LwqqAsyncEvent* ev)
+{
+   uint64_t us = lwqq__metrics_now() - bc->login_start;
+   bc->login_err = ev->result;
+   pthread_mutex_lock(&bench.lock);
+   if (bc->login_err == LWQQ_EC_OK)
+      lwqq_histogram_record(&bench.login, us);
+   pthread_mutex_unlock(&bench.lock);
+}
+
+/** message text from mock_server is 'bench <realtime us> <seq>' */
+static void received_msg(LwqqRecvMsgList* list)
+{
+   LwqqMsg* msg;
+   while ((msg = lwqq_msglist_read(list))) {
+      unsigned long long ts = 0;
+      LwqqMsgContent* c;
+      if (msg->type == LWQQ_MS_BUDDY_MSG) {
+         TAILQ_FOREACH(c, &((LwqqMsgMessage*)msg)->content, entries)
+         {
+            if (c->type == LWQQ_CONTENT_STRING
+                && sscanf(c->data.str, "bench %llu", &ts) == 1)
+               break;
+         }
+      }
+      if (ts) {
+         uint64_t now = realtime_us();
+         pthread_mutex_lock(&bench.lock);
+         bench.received++;
+         lwqq_histogram_record(&bench.delivery, now > ts ? now - ts : 0);
+         pthread_mutex_unlock(&bench.lock);
+      }
+      lwqq_msg_free(msg);
+   }
+}
+
+static void send_one(BenchClient* bc);
+
+static void send_done(SendCtx* ctx, LwqqAsyncEvent* ev)
+{
+   uint64_t us = lwqq__metrics_now() - ctx->start;
+   BenchClient* bc = ctx->bc;
+   int again;
+   pthread_mutex_lock(&bench.lock);
+   if (ev->result == LWQQ_EC_OK) {
+      bench.sent++;
+      lwqq_histogram_record(&bench.send, us);
+   } else
+      bench.send_err++;
+   again = bench.running;
+   if (!again) {
+      bench.inflight--;
+      pthread_cond_broadcast(&bench.cond);
+   }
+   pthread_mutex_unlock(&bench.lock);
+   lwqq_msg_free(ctx->msg);
+   s_free(ctx);
+   if (again)
+      send_one(bc);
+}
+
+static void send_one(BenchClient* bc)
+{
+   LwqqMsg* msg = lwqq_msg_new(LWQQ_MS_BUDDY_MSG);
+   LwqqMsgMessage* mmsg = (LwqqMsgMessage*)msg;
+   LwqqMsgContent* c = s_malloc0(sizeof(*c));
+   SendCtx* ctx = s_malloc0(sizeof(*ctx));
+
+   mmsg->super.to = s_strdup("1000001");
+   mmsg->f_name = s_strdup("Arial");
+   mmsg->f_size = 10;
+   strcpy(mmsg->f_color, "000000");
+   c->type = LWQQ_CONTENT_STRING;
+   c->data.str = s_strdup("bench send");
+   TAILQ_INSERT_TAIL(&mmsg->content, c, entries);
+
+   ctx->bc = bc;
+   ctx->msg = msg;
+   ctx->start = lwqq__metrics_now();
+   LwqqAsyncEvent* ev = opt.rate > 0 ? lwqq_sendq_push(bc->lc, mmsg)
+                                     : lwqq_msg_send(bc->lc, mmsg);
+   if (ev == NULL) {
+      // don't spin on a client which can't send
+      pthread_mutex_lock(&bench.lock);
+      bench.send_err++;
+      bench.inflight--;
+      pthread_cond_broadcast(&bench.cond);
+      pthread_mutex_unlock(&bench.lock);
+      lwqq_msg_free(msg);
+      s_free(ctx);
+      return;
+   }
+   lwqq_async_add_event_listener(ev, _C_(2p, send_done, ctx, ev));
+}
+
+static void print_histogram(const char* name, const LwqqHistogram* h)
+{
+   printf("%-10s count:%-8llu p50:%8.2fms p90:%8.2fms p99:%8.2fms "
+          "max:%8.2fms\n",
+          name, (unsigned long long)h->count,
+          lwqq_histogram_percentile(h, 50) / 1000.0,
+          lwqq_histogram_percentile(h, 90) / 1000.0,
+          lwqq_histogram_percentile(h, 99) / 1000.0, h->max / 1000.0);
+}
+
+static void usage(const char* prog)
+{
+   fprintf(stderr,
+           "Usage: %s -u base [options]\n"
+           "  -u base     mock server, e.g. http://127.0.0.1:8080\n"
+           "              default is environment variable LWQQ_BASE_HOST\n"
+           "  -n n        simulated clients (default 10)\n"
+           "  -d seconds  duration of poll and send phase (default 10)\n"
+           "  -w n        sends in flight of each client (default 4)\n"
+           "  -r file     record http traffic into capture file\n"
+           "  -q rate     send through send queue, at most rate/s of each "
+           "client\n"
+           "  -v          verbose lwqq log\n",
+           prog);
+}
+
+int main(int argc, char* argv[])
+{
+   int c, i, ok = 0;
+   BenchClient* clients;
+   LwqqAsyncEvset* set;
+   uint64_t t0, t1;
+   size_t rss_base, rss_login, rss_peak = 0;
+
+   while ((c = getopt(argc, argv, "u:n:d:w:r:q:vh")) != -1) {
+      switch (c) {
+      case 'u':
+         opt.base = optarg;
+         break;
+      case 'n':
+         opt.clients = atoi(optarg);
+         break;
+      case 'd':
+         opt.duration = atoi(optarg);
+         break;
+      case 'w':
+         opt.window = atoi(optarg);
+         break;
+      case 'r':
+         opt.record = optarg;
+         break;
+      case 'q':
+         opt.rate = atof(optarg);
+         break;
+      case 'v':
+         opt.verbose = 1;
+         break;
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (!opt.base)
+      opt.base = getenv("LWQQ_BASE_HOST");
+   if (!opt.base || opt.clients < 1) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   lwqq_log_set_level(opt.verbose ? 4 : 0);
+   lwqq_http_set_base_host(opt.base);
+   if (opt.record && lwqq_http_capture_open(LWQQ_CAPTURE_RECORD, opt.record)) {
+      fprintf(stderr, "can't record into %s\n", opt.record);
+      return 1;
+   }
+   rss_base = rss_bytes();
+
+   /* login */
+   clients = s_malloc0(sizeof(*clients) * opt.clients);
+   set = lwqq_async_evset_new();
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < opt.clients; i++) {
+      char user[32];
+      BenchClient* bc = &clients[i];
+      snprintf(user, sizeof(user), "%d", 100000 + i);
+      bc->lc = lwqq_client_new(user, "bench");
+      lwqq_add_event(bc->lc->events->poll_msg,
+                     _C_(p, received_msg, bc->lc->msg_list));
+      bc->login_start = lwqq__metrics_now();
+      bc->login_err = LWQQ_EC_ERROR;
+      LwqqAsyncEvent* ev = lwqq_login(bc->lc, LWQQ_STATUS_ONLINE);
+      lwqq_async_add_event_listener(ev, _C_(2p, login_done, bc, ev));
+      lwqq_async_evset_add_event(set, ev);
+   }
+   lwqq_async_evset_wait(set);
+   t1 = lwqq__metrics_now();
+   for (i = 0; i < opt.clients; i++)
+      ok += clients[i].login_err == LWQQ_EC_OK;
+   rss_login = rss_bytes();
+   printf("login: %d/%d clients in %.2fs\n", ok, opt.clients,
+          (t1 - t0) / 1e6);
+   if (ok == 0)
+      goto done;
+
+   /* roster */
+   set = lwqq_async_evset_new();
+   for (i = 0; i < opt.clients; i++) {
+      if (clients[i].login_err == LWQQ_EC_OK)
+         lwqq_async_evset_add_event(
+             set, lwqq_info_get_friends_info(clients[i].lc, NULL, NULL));
+   }
+   lwqq_async_evset_wait(set);
+
+   /* poll and send */
+   bench.running = 1;
+   for (i = 0; i < opt.clients; i++) {
+      BenchClient* bc = &clients[i];
+      if (bc->login_err != LWQQ_EC_OK)
+         continue;
+      lwqq_msglist_poll(bc->lc->msg_list, 0);
+      if (opt.rate > 0)
+         lwqq_sendq_set_rate(bc->lc, opt.rate, 0, opt.window);
+      pthread_mutex_lock(&bench.lock);
+      bench.inflight += opt.window;
+      pthread_mutex_unlock(&bench.lock);
+      for (c = 0; c < opt.window; c++)
+         send_one(bc);
+   }
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < opt.duration; i++) {
+      unsigned long sent = bench.sent, recv = bench.received;
+      size_t rss;
+      sleep(1);
+      rss = rss_bytes();
+      if (rss > rss_peak)
+         rss_peak = rss;
+      printf("[%3ds] sends/s:%-7lu recv/s:%-7lu rss:%.1fMB\n", i + 1,
+             bench.sent - sent, bench.received - recv, rss / 1048576.0);
+      fflush(stdout);
+   }
+   pthread_mutex_lock(&bench.lock);
+   bench.running = 0;
+   while (bench.inflight > 0)
+      pthread_cond_wait(&bench.cond, &bench.lock);
+   pthread_mutex_unlock(&bench.lock);
+   t1 = lwqq__metrics_now();
+
+   printf("\nclients:%d ok:%d duration:%.2fs\n", opt.clients, ok,
+          (t1 - t0) / 1e6);
+   printf("sends: %lu (%.1f/s) errors: %lu\n", bench.sent,
+          bench.sent / ((t1 - t0) / 1e6), bench.send_err);
+   printf("received: %lu (%.1f/s)\n", bench.received,
+          bench.received / ((t1 - t0) / 1e6));
+   print_histogram("login", &bench.login);
+   print_histogram("delivery", &bench.delivery);
+   print_histogram("send", &bench.send);
+   printf("rss: base %.1fMB, after login %.1fMB (%.1fKB/client), "
+          "peak %.1fMB\n",
+          rss_base / 1048576.0, rss_login / 1048576.0,
+          ((double)rss_login - rss_base) / 1024.0 / opt.clients,
+          rss_peak / 1048576.0);
+
+done:
+   for (i = 0; i < opt.clients; i++) {
+      lwqq_msglist_close(clients[i].lc->msg_list);
+      lwqq_client_free(clients[i].lc);
+   }
+   s_free(clients);
+   lwqq_http_global_free(LWQQ_CLEANUP_IGNORE);
+   lwqq_async_global_quit();
+   lwqq_http_capture_close();
+   return 0;
+}
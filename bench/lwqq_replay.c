@@ -0,0 +1,197 @@
+/**
+ * @file   lwqq_replay.c
+ * @brief  Replay a http capture and report cpu time of each subsystem
+ *
+ * no network is used, so the numbers only depend on lwqq itself: login
+ * (password encryption and ptlogin parsing), roster building of friends and
+ * groups, and message decoding of channel/poll2. record a capture with
+ * lwqq-bench -n 1 -r file, or with lwqq_http_capture_open in any client.
+ *
+ * $ ./lwqq-replay bench.cap
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lwqq.h"
+#include "capture.h"
+
+typedef struct Phase {
+   const char* name;
+   double wall;
+   double cpu;
+   unsigned long items;
+} Phase;
+
+static struct {
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   int poll_done;
+   unsigned long messages;
+} replay = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static double clock_sec(clockid_t id)
+{
+   struct timespec ts;
+   clock_gettime(id, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void phase_begin(Phase* p, const char* name)
+{
+   p->name = name;
+   p->items = 0;
+   p->wall = clock_sec(CLOCK_MONOTONIC);
+   p->cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static void phase_end(Phase* p)
+{
+   p->wall = clock_sec(CLOCK_MONOTONIC) - p->wall;
+   p->cpu = clock_sec(CLOCK_PROCESS_CPUTIME_ID) - p->cpu;
+}
+
+static void received_msg(LwqqRecvMsgList* list)
+{
+   LwqqMsg* msg;
+   unsigned long n = 0;
+   while ((msg = lwqq_msglist_read(list))) {
+      lwqq_msg_free(msg);
+      n++;
+   }
+   pthread_mutex_lock(&replay.lock);
+   replay.messages += n;
+   pthread_mutex_unlock(&replay.lock);
+}
+
+/** poll fails when channel/poll2 records are used up */
+static void poll_lost(void* noused)
+{
+   pthread_mutex_lock(&replay.lock);
+   replay.poll_done = 1;
+   pthread_cond_broadcast(&replay.cond);
+   pthread_mutex_unlock(&replay.lock);
+}
+
+static void usage(const char* prog)
+{
+   fprintf(stderr,
+           "Usage: %s [options] capture\n"
+           "  -t          replay with recorded timing, default is full speed\n"
+           "  -w seconds  max time to wait for poll to drain (default 60)\n"
+           "  -v          verbose lwqq log\n",
+           prog);
+}
+
+int main(int argc, char* argv[])
+{
+   int c, timed = 0, verbose = 0, wait = 60, n = 0, i;
+   Phase phases[4];
+   LwqqAsyncEvset* set;
+   LwqqGroup* g;
+   LwqqBuddy* b;
+   LwqqClient* lc;
+   LwqqAsyncEvent* ev;
+
+   while ((c = getopt(argc, argv, "tw:vh")) != -1) {
+      switch (c) {
+      case 't':
+         timed = 1;
+         break;
+      case 'w':
+         wait = atoi(optarg);
+         break;
+      case 'v':
+         verbose = 1;
+         break;
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (optind != argc - 1) {
+      usage(argv[0]);
+      return 1;
+   }
+   lwqq_log_set_level(verbose ? 4 : 0);
+   if (lwqq_http_capture_open(timed ? LWQQ_CAPTURE_REPLAY_TIMED
+                                    : LWQQ_CAPTURE_REPLAY,
+                              argv[optind])) {
+      fprintf(stderr, "can't replay %s\n", argv[optind]);
+      return 1;
+   }
+
+   lc = lwqq_client_new("100000", "bench");
+   lwqq_add_event(lc->events->poll_msg, _C_(p, received_msg, lc->msg_list));
+   lwqq_add_event(lc->events->poll_lost, _C_(p, poll_lost, NULL));
+
+   phase_begin(&phases[n], "login");
+   set = lwqq_async_evset_new();
+   ev = lwqq_login(lc, LWQQ_STATUS_ONLINE);
+   lwqq_async_evset_add_event(set, ev);
+   lwqq_async_evset_wait(set);
+   phase_end(&phases[n++]);
+   if (!lwqq_client_logined(lc)) {
+      fprintf(stderr, "login failed, capture has no complete login\n");
+      goto done;
+   }
+
+   phase_begin(&phases[n], "friends");
+   set = lwqq_async_evset_new();
+   lwqq_async_evset_add_event(set, lwqq_info_get_friends_info(lc, NULL, NULL));
+   lwqq_async_evset_wait(set);
+   phase_end(&phases[n]);
+   LIST_FOREACH(b, &lc->friends, entries)
+   {
+      phases[n].items++;
+   }
+   n++;
+
+   phase_begin(&phases[n], "groups");
+   set = lwqq_async_evset_new();
+   lwqq_async_evset_add_event(set,
+                              lwqq_info_get_group_name_list(lc, NULL, NULL));
+   lwqq_async_evset_wait(set);
+   set = lwqq_async_evset_new();
+   LIST_FOREACH(g, &lc->groups, entries)
+   {
+      lwqq_async_evset_add_event(set,
+                                 lwqq_info_get_group_detail_info(lc, g, NULL));
+      phases[n].items++;
+   }
+   lwqq_async_evset_wait(set);
+   phase_end(&phases[n++]);
+
+   phase_begin(&phases[n], "poll");
+   lwqq_msglist_poll(lc->msg_list, 0);
+   pthread_mutex_lock(&replay.lock);
+   struct timespec until;
+   clock_gettime(CLOCK_REALTIME, &until);
+   until.tv_sec += wait;
+   while (!replay.poll_done) {
+      if (pthread_cond_timedwait(&replay.cond, &replay.lock, &until))
+         break;
+   }
+   phases[n].items = replay.messages;
+   pthread_mutex_unlock(&replay.lock);
+   phase_end(&phases[n++]);
+
+   printf("%-10s %10s %10s %10s %12s\n", "phase", "wall(ms)", "cpu(ms)",
+          "items", "cpu/item(us)");
+   for (i = 0; i < n; i++) {
+      Phase* p = &phases[i];
+      printf("%-10s %10.2f %10.2f %10lu %12.2f\n", p->name, p->wall * 1e3,
+             p->cpu * 1e3, p->items, p->items ? p->cpu * 1e6 / p->items : 0);
+   }
+
+done:
+   lwqq_msglist_close(lc->msg_list);
+   lwqq_client_free(lc);
+   lwqq_http_global_free(LWQQ_CLEANUP_IGNORE);
+   lwqq_async_global_quit();
+   lwqq_http_capture_close();
+   return 0;
+}
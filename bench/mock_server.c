@@ -0,0 +1,669 @@
+/**
+ * @file   mock_server.c
+ * @brief  Offline mock of the webqq servers used by lwqq
+ *
+ * a single threaded http/1.1 server which answers every endpoint lwqq calls
+ * while login, fetching roster, polling and sending message. point lwqq to
+ * it with lwqq_http_set_base_host() or LWQQ_BASE_HOST=http://127.0.0.1:port
+ *
+ * channel/poll2 is a firehose: each session gets buddy messages at a fixed
+ * rate, a poll is held until a message is due or the hold time passed.
+ * message text is 'bench <us> <seq>', <us> is CLOCK_REALTIME in microseconds
+ * when it becomes due, so receiver can compute poll-to-delivery latency.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONN 4096
+#define FRIEND_UIN_BASE 1000001
+#define GROUP_GID_BASE 2000001
+#define GROUP_CODE_BASE 3000001
+#define MEMBER_UIN_BASE 4000001
+#define SELF_UIN_BASE 10001
+/* messages older than this are dropped instead of delivered */
+#define MAX_BACKLOG_US (5 * 1000000ULL)
+
+typedef struct Buf {
+   char* data;
+   size_t len;
+   size_t cap;
+} Buf;
+
+typedef struct Session {
+   char id[32];
+   int index;
+   uint64_t next_due; /** < realtime us when next message is due */
+   unsigned long seq;
+} Session;
+
+typedef struct Conn {
+   int fd;
+   Buf in;
+   Buf out;
+   size_t out_off;
+   int expect_sent; /** < 100-continue already sent */
+   int close_after;
+   Session* hold; /** < poll2 held on this connection */
+   uint64_t hold_until;
+} Conn;
+
+static struct {
+   int port;
+   double rate; /** < messages per second per session */
+   int batch;
+   int hold_ms;
+   int friends;
+   int groups;
+   int members;
+   size_t avatar_size;
+   int quiet;
+} opt = { 8080, 10, 20, 1000, 50, 5, 100, 4096, 0 };
+
+static struct {
+   unsigned long requests;
+   unsigned long logins;
+   unsigned long polls;
+   unsigned long delivered;
+   unsigned long dropped;
+   unsigned long sends;
+   unsigned long uploads;
+} stat_;
+
+static Session** sessions;
+static int n_session;
+static Conn* conns[MAX_CONN];
+static struct pollfd pfds[MAX_CONN + 1];
+static volatile sig_atomic_t quit;
+
+static uint64_t now_us()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void buf_reserve(Buf* b, size_t more)
+{
+   if (b->len + more + 1 <= b->cap)
+      return;
+   while (b->len + more + 1 > b->cap)
+      b->cap = b->cap ? b->cap * 2 : 4096;
+   b->data = realloc(b->data, b->cap);
+}
+
+static void buf_add(Buf* b, const void* p, size_t len)
+{
+   buf_reserve(b, len);
+   memcpy(b->data + b->len, p, len);
+   b->len += len;
+   b->data[b->len] = '\0';
+}
+
+static void buf_printf(Buf* b, const char* fmt, ...)
+{
+   va_list va;
+   int n;
+   va_start(va, fmt);
+   n = vsnprintf(NULL, 0, fmt, va);
+   va_end(va);
+   buf_reserve(b, n);
+   va_start(va, fmt);
+   vsnprintf(b->data + b->len, n + 1, fmt, va);
+   va_end(va);
+   b->len += n;
+}
+
+static void url_decode(char* s)
+{
+   char* o = s;
+   for (; *s; s++) {
+      if (*s == '%' && s[1] && s[2]) {
+         char hex[3] = { s[1], s[2], 0 };
+         *o++ = strtol(hex, NULL, 16);
+         s += 2;
+      } else
+         *o++ = (*s == '+') ? ' ' : *s;
+   }
+   *o = '\0';
+}
+
+static Session* session_get(const char* id)
+{
+   int i;
+   for (i = 0; i < n_session; i++)
+      if (strcmp(sessions[i]->id, id) == 0)
+         return sessions[i];
+   Session* s = calloc(1, sizeof(*s));
+   snprintf(s->id, sizeof(s->id), "%s", id);
+   s->index = n_session;
+   s->next_due = opt.rate > 0 ? now_us() : UINT64_MAX;
+   sessions = realloc(sessions, sizeof(Session*) * (n_session + 1));
+   sessions[n_session++] = s;
+   return s;
+}
+
+/** find psessionid in urlencoded post body */
+static Session* session_of_body(char* body)
+{
+   char id[32] = { 0 };
+   url_decode(body);
+   const char* p = strstr(body, "\"psessionid\":\"");
+   if (!p)
+      return NULL;
+   sscanf(p + 14, "%31[^\"]", id);
+   return id[0] ? session_get(id) : NULL;
+}
+
+static void respond(Conn* c, int code, const char* type, const char* extra,
+                    const void* body, size_t len)
+{
+   buf_printf(&c->out, "HTTP/1.1 %d %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "Content-Length: %zu\r\n"
+                       "%s%s\r\n",
+              code, code == 200 ? "OK" : "Not Found", type, len,
+              extra ? extra : "",
+              c->close_after ? "Connection: close\r\n" : "");
+   buf_add(&c->out, body, len);
+}
+
+static void respond_text(Conn* c, const char* type, const char* extra,
+                         Buf* body)
+{
+   respond(c, 200, type, extra, body->data ? body->data : "", body->len);
+   free(body->data);
+}
+
+#define JSON "application/json;charset=utf-8"
+#define HTML "text/html;charset=utf-8"
+
+/** collect due messages of s, return number of message */
+static int poll_collect(Session* s, Buf* body)
+{
+   uint64_t now = now_us();
+   int n = 0;
+   if (s->next_due != UINT64_MAX && now > s->next_due + MAX_BACKLOG_US) {
+      uint64_t skip = (now - s->next_due - MAX_BACKLOG_US) * opt.rate / 1e6;
+      stat_.dropped += skip;
+      s->next_due += skip * 1e6 / opt.rate;
+   }
+   while (s->next_due <= now && n < opt.batch) {
+      s->seq++;
+      buf_printf(body,
+                 "%s{\"poll_type\":\"message\",\"value\":{\"msg_id\":%lu,"
+                 "\"from_uin\":%d,\"to_uin\":%d,\"msg_id2\":%lu,"
+                 "\"msg_type\":9,\"reply_ip\":1,\"time\":%lu,\"content\":"
+                 "[[\"font\",{\"size\":10,\"color\":\"000000\",\"style\":"
+                 "[0,0,0],\"name\":\"Arial\"}],\"bench %llu %lu\"]}}",
+                 n ? "," : "", s->seq,
+                 FRIEND_UIN_BASE + (int)(s->seq % opt.friends),
+                 SELF_UIN_BASE + s->index, s->seq,
+                 (unsigned long)(s->next_due / 1000000),
+                 (unsigned long long)s->next_due, s->seq);
+      s->next_due += 1e6 / opt.rate;
+      n++;
+   }
+   return n;
+}
+
+/** answer held poll, @return 0 when nothing due yet */
+static int poll_reply(Conn* c, Session* s, int force)
+{
+   Buf body = { 0 };
+   buf_printf(&body, "{\"retcode\":0,\"result\":[");
+   int n = poll_collect(s, &body);
+   if (n == 0 && !force) {
+      free(body.data);
+      return 0;
+   }
+   if (n == 0) {
+      body.len = 0;
+      buf_printf(&body, "{\"retcode\":102,\"errmsg\":\"\"}");
+   } else
+      buf_printf(&body, "]}");
+   stat_.delivered += n;
+   c->hold = NULL;
+   respond_text(c, JSON, NULL, &body);
+   return 1;
+}
+
+static void handle_poll(Conn* c, char* body)
+{
+   Session* s = session_of_body(body);
+   stat_.polls++;
+   if (s == NULL) {
+      respond(c, 200, JSON, NULL, "{\"retcode\":103}", 15);
+      return;
+   }
+   if (poll_reply(c, s, 0))
+      return;
+   // long poll: hold until next message due or timeout
+   c->hold = s;
+   c->hold_until = now_us() + opt.hold_ms * 1000ULL;
+}
+
+static void handle_login2(Conn* c)
+{
+   char id[32];
+   Buf body = { 0 };
+   snprintf(id, sizeof(id), "bench%d", n_session);
+   Session* s = session_get(id);
+   stat_.logins++;
+   buf_printf(&body, "{\"retcode\":0,\"result\":{\"uin\":%d,\"cip\":1,"
+                     "\"index\":1075,\"port\":1,\"status\":\"online\","
+                     "\"vfwebqq\":\"benchvf%d\",\"psessionid\":\"%s\","
+                     "\"user_state\":0,\"f\":0}}",
+              SELF_UIN_BASE + s->index, s->index, s->id);
+   respond_text(c, JSON, NULL, &body);
+}
+
+static void handle_friends(Conn* c)
+{
+   Buf body = { 0 };
+   int i;
+   buf_printf(&body, "{\"retcode\":0,\"result\":{\"friends\":[");
+   for (i = 0; i < opt.friends; i++)
+      buf_printf(&body, "%s{\"flag\":0,\"uin\":%d,\"categories\":1}",
+                 i ? "," : "", FRIEND_UIN_BASE + i);
+   buf_printf(&body, "],\"marknames\":[],\"categories\":[{\"index\":1,"
+                     "\"sort\":1,\"name\":\"bench\"}],\"vipinfo\":[],"
+                     "\"info\":[");
+   for (i = 0; i < opt.friends; i++)
+      buf_printf(&body, "%s{\"face\":0,\"flag\":0,\"nick\":\"friend%d\","
+                        "\"uin\":%d}",
+                 i ? "," : "", i, FRIEND_UIN_BASE + i);
+   buf_printf(&body, "]}}");
+   respond_text(c, JSON, NULL, &body);
+}
+
+static void handle_group_list(Conn* c)
+{
+   Buf body = { 0 };
+   int i;
+   buf_printf(&body, "{\"retcode\":0,\"result\":{\"gmasklist\":[],"
+                     "\"gmarklist\":[],\"gnamelist\":[");
+   for (i = 0; i < opt.groups; i++)
+      buf_printf(&body, "%s{\"flag\":1,\"name\":\"group%d\",\"gid\":%d,"
+                        "\"code\":%d}",
+                 i ? "," : "", i, GROUP_GID_BASE + i, GROUP_CODE_BASE + i);
+   buf_printf(&body, "]}}");
+   respond_text(c, JSON, NULL, &body);
+}
+
+static void handle_group_info(Conn* c, const char* query)
+{
+   Buf body = { 0 };
+   int i, code = GROUP_CODE_BASE;
+   const char* p = query ? strstr(query, "gcode=") : NULL;
+   if (p)
+      code = atoi(p + 6);
+   buf_printf(&body, "{\"retcode\":0,\"result\":{\"stats\":[");
+   for (i = 0; i < opt.members; i++)
+      buf_printf(&body, "%s{\"client_type\":1,\"uin\":%d,\"stat\":10}",
+                 i ? "," : "", MEMBER_UIN_BASE + i);
+   buf_printf(&body, "],\"minfo\":[");
+   for (i = 0; i < opt.members; i++)
+      buf_printf(&body, "%s{\"nick\":\"member%d\",\"province\":\"\","
+                        "\"gender\":\"male\",\"uin\":%d,\"country\":\"\","
+                        "\"city\":\"\"}",
+                 i ? "," : "", i, MEMBER_UIN_BASE + i);
+   buf_printf(&body, "],\"ginfo\":{\"face\":0,\"memo\":\"\",\"class\":1,"
+                     "\"fingermemo\":\"\",\"code\":%d,\"createtime\":0,"
+                     "\"flag\":1,\"level\":0,\"name\":\"group%d\","
+                     "\"gid\":%d,\"owner\":%d,\"option\":2,\"members\":[",
+              code, code - GROUP_CODE_BASE,
+              GROUP_GID_BASE + code - GROUP_CODE_BASE, MEMBER_UIN_BASE);
+   for (i = 0; i < opt.members; i++)
+      buf_printf(&body, "%s{\"muin\":%d,\"mflag\":0}", i ? "," : "",
+                 MEMBER_UIN_BASE + i);
+   buf_printf(&body, "]},\"cards\":[],\"vipinfo\":[]}}");
+   respond_text(c, JSON, NULL, &body);
+}
+
+static void handle_avatar(Conn* c)
+{
+   char* img = calloc(1, opt.avatar_size);
+   // looks like a jpeg
+   img[0] = 0xff, img[1] = 0xd8;
+   img[opt.avatar_size - 2] = 0xff, img[opt.avatar_size - 1] = 0xd9;
+   respond(c, 200, "image/jpeg", NULL, img, opt.avatar_size);
+   free(img);
+}
+
+static void handle_request(Conn* c, const char* method, char* target,
+                           const char* host, char* body)
+{
+   char* query = strchr(target, '?');
+   const char* path = target;
+   Buf resp = { 0 };
+   char cookie[128];
+   if (query)
+      *query++ = '\0';
+   stat_.requests++;
+
+   snprintf(cookie, sizeof(cookie),
+            "Set-Cookie: ptwebqq=%016llx; PATH=/\r\n",
+            (unsigned long long)now_us());
+   if (strcmp(path, "/cgi-bin/login") == 0) {
+      buf_printf(&resp, "<html>login sig</html>");
+      respond_text(c, HTML, NULL, &resp);
+   } else if (strcmp(path, "/check") == 0) {
+      buf_printf(&resp, "ptui_checkVC('0','!BEN','\\x00\\x00\\x00\\x00\\x00"
+                        "\\x00\\x27\\x10','benchsession','0');");
+      respond_text(c, HTML, NULL, &resp);
+   } else if (strcmp(path, "/login") == 0) {
+      buf_printf(&resp, "ptuiCB('0','0','http://%s/check_sig?pttype=1','0',"
+                        "'ok', 'bench');",
+                 host);
+      respond_text(c, HTML, cookie, &resp);
+   } else if (strcmp(path, "/check_sig") == 0) {
+      respond(c, 200, HTML, cookie, "", 0);
+   } else if (strcmp(path, "/getimage") == 0) {
+      handle_avatar(c);
+   } else if (strcmp(path, "/channel/login2") == 0) {
+      handle_login2(c);
+   } else if (strcmp(path, "/channel/poll2") == 0) {
+      handle_poll(c, body);
+   } else if (strncmp(path, "/channel/send_", 14) == 0) {
+      stat_.sends++;
+      buf_printf(&resp, "{\"retcode\":0,\"result\":\"ok\"}");
+      respond_text(c, JSON, NULL, &resp);
+   } else if (strcmp(path, "/api/get_user_friends2") == 0) {
+      handle_friends(c);
+   } else if (strcmp(path, "/api/get_group_name_list_mask2") == 0) {
+      handle_group_list(c);
+   } else if (strcmp(path, "/api/get_group_info_ext2") == 0) {
+      handle_group_info(c, query);
+   } else if (strcmp(path, "/cgi/svr/face/getface") == 0) {
+      handle_avatar(c);
+   } else if (strcmp(path, "/cgi-bin/cface_upload") == 0) {
+      stat_.uploads++;
+      buf_printf(&resp, "<head><script>parent.EQQ.View.ChatBox."
+                        "uploadCustomFaceCallback({'ret':0,'msg':"
+                        "'bench%lu.jpg'});</script></head>",
+                 stat_.uploads);
+      respond_text(c, HTML, NULL, &resp);
+   } else {
+      // anything else is a successful empty result
+      buf_printf(&resp, "{\"retcode\":0,\"result\":{}}");
+      respond_text(c, JSON, NULL, &resp);
+   }
+   (void)method;
+}
+
+static const char* header_value(const char* head, const char* name,
+                                char* buf, size_t size)
+{
+   const char* p = head;
+   size_t len = strlen(name);
+   buf[0] = '\0';
+   while ((p = strstr(p, "\r\n"))) {
+      p += 2;
+      if (strncasecmp(p, name, len) == 0 && p[len] == ':') {
+         p += len + 1;
+         while (*p == ' ')
+            p++;
+         size_t n = strcspn(p, "\r\n");
+         if (n >= size)
+            n = size - 1;
+         memcpy(buf, p, n);
+         buf[n] = '\0';
+         return buf;
+      }
+   }
+   return NULL;
+}
+
+/** parse as much requests as buffered */
+static void conn_parse(Conn* c)
+{
+   while (c->hold == NULL && c->in.len) {
+      char* end = strstr(c->in.data, "\r\n\r\n");
+      char value[256], host[256], method[16], target[2048];
+      size_t head_len, body_len = 0;
+      if (!end)
+         return;
+      head_len = end + 4 - c->in.data;
+      if (header_value(c->in.data, "Content-Length", value, sizeof(value)))
+         body_len = strtoul(value, NULL, 10);
+      if (c->in.len < head_len + body_len) {
+         if (!c->expect_sent
+             && header_value(c->in.data, "Expect", value, sizeof(value))) {
+            buf_printf(&c->out, "HTTP/1.1 100 Continue\r\n\r\n");
+            c->expect_sent = 1;
+         }
+         return;
+      }
+      c->expect_sent = 0;
+      if (sscanf(c->in.data, "%15s %2047s", method, target) != 2) {
+         c->close_after = 1;
+         return;
+      }
+      if (!header_value(c->in.data, "Host", host, sizeof(host)))
+         snprintf(host, sizeof(host), "127.0.0.1:%d", opt.port);
+      if (header_value(c->in.data, "Connection", value, sizeof(value))
+          && strcasecmp(value, "close") == 0)
+         c->close_after = 1;
+
+      char* body = malloc(body_len + 1);
+      memcpy(body, c->in.data + head_len, body_len);
+      body[body_len] = '\0';
+      memmove(c->in.data, c->in.data + head_len + body_len,
+              c->in.len - head_len - body_len);
+      c->in.len -= head_len + body_len;
+      c->in.data[c->in.len] = '\0';
+
+      handle_request(c, method, target, host, body);
+      free(body);
+   }
+}
+
+static void conn_close(int i)
+{
+   Conn* c = conns[i];
+   close(c->fd);
+   free(c->in.data);
+   free(c->out.data);
+   free(c);
+   conns[i] = NULL;
+}
+
+static int conn_flush(Conn* c)
+{
+   while (c->out_off < c->out.len) {
+      ssize_t n = write(c->fd, c->out.data + c->out_off,
+                        c->out.len - c->out_off);
+      if (n < 0)
+         return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+      c->out_off += n;
+   }
+   c->out.len = c->out_off = 0;
+   return c->close_after && c->hold == NULL ? -1 : 0;
+}
+
+static void accept_all(int lfd)
+{
+   int fd, i, one = 1;
+   while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+      for (i = 0; i < MAX_CONN && conns[i]; i++)
+         ;
+      if (i == MAX_CONN) {
+         close(fd);
+         continue;
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      conns[i] = calloc(1, sizeof(Conn));
+      conns[i]->fd = fd;
+   }
+}
+
+static void print_stat(const char* prefix)
+{
+   if (opt.quiet && strcmp(prefix, "total") != 0)
+      return;
+   fprintf(stderr, "[%s] sessions:%d requests:%lu logins:%lu polls:%lu "
+                   "delivered:%lu dropped:%lu sends:%lu uploads:%lu\n",
+           prefix, n_session, stat_.requests, stat_.logins, stat_.polls,
+           stat_.delivered, stat_.dropped, stat_.sends, stat_.uploads);
+}
+
+static void on_signal(int sig) { quit = 1; }
+
+static void usage(const char* prog)
+{
+   fprintf(stderr,
+           "Usage: %s [options]\n"
+           "  -p port     listen port, 0 to pick one (default 8080)\n"
+           "  -r rate     poll messages per second per session (default 10)\n"
+           "  -b batch    max messages in one poll response (default 20)\n"
+           "  -w ms       hold an empty poll for ms (default 1000)\n"
+           "  -f n        friends of each session (default 50)\n"
+           "  -g n        groups of each session (default 5)\n"
+           "  -m n        members of each group (default 100)\n"
+           "  -a bytes    avatar size (default 4096)\n"
+           "  -q          don't print statistics periodically\n",
+           prog);
+}
+
+int main(int argc, char* argv[])
+{
+   int c, lfd, one = 1, i;
+   struct sockaddr_in addr = { 0 };
+   socklen_t addr_len = sizeof(addr);
+   uint64_t last_stat;
+
+   while ((c = getopt(argc, argv, "p:r:b:w:f:g:m:a:qh")) != -1) {
+      switch (c) {
+      case 'p':
+         opt.port = atoi(optarg);
+         break;
+      case 'r':
+         opt.rate = atof(optarg);
+         break;
+      case 'b':
+         opt.batch = atoi(optarg);
+         break;
+      case 'w':
+         opt.hold_ms = atoi(optarg);
+         break;
+      case 'f':
+         opt.friends = atoi(optarg);
+         break;
+      case 'g':
+         opt.groups = atoi(optarg);
+         break;
+      case 'm':
+         opt.members = atoi(optarg);
+         break;
+      case 'a':
+         opt.avatar_size = strtoul(optarg, NULL, 10);
+         break;
+      case 'q':
+         opt.quiet = 1;
+         break;
+      default:
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if (opt.friends < 1)
+      opt.friends = 1;
+   if (opt.avatar_size < 4)
+      opt.avatar_size = 4;
+
+   signal(SIGPIPE, SIG_IGN);
+   signal(SIGINT, on_signal);
+   signal(SIGTERM, on_signal);
+
+   lfd = socket(AF_INET, SOCK_STREAM, 0);
+   setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port = htons(opt.port);
+   if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+       || listen(lfd, 512) < 0) {
+      perror("listen");
+      return 1;
+   }
+   getsockname(lfd, (struct sockaddr*)&addr, &addr_len);
+   opt.port = ntohs(addr.sin_port);
+   fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+   printf("http://127.0.0.1:%d\n", opt.port);
+   fflush(stdout);
+
+   last_stat = now_us();
+   while (!quit) {
+      int n = 0, timeout = 1000;
+      uint64_t now = now_us();
+      pfds[n].fd = lfd;
+      pfds[n++].events = POLLIN;
+      for (i = 0; i < MAX_CONN; i++) {
+         Conn* cn = conns[i];
+         if (!cn)
+            continue;
+         if (cn->hold) {
+            uint64_t due = cn->hold->next_due < cn->hold_until
+                               ? cn->hold->next_due
+                               : cn->hold_until;
+            int ms = due > now ? (due - now + 999) / 1000 : 0;
+            if (ms < timeout)
+               timeout = ms;
+         }
+         pfds[n].fd = cn->fd;
+         pfds[n].events = POLLIN | (cn->out.len ? POLLOUT : 0);
+         n++;
+      }
+      if (poll(pfds, n, timeout) < 0 && errno != EINTR)
+         break;
+      if (pfds[0].revents & POLLIN)
+         accept_all(lfd);
+
+      now = now_us();
+      for (i = 0, n = 1; i < MAX_CONN; i++) {
+         Conn* cn = conns[i];
+         char buf[16384];
+         ssize_t r;
+         if (!cn || pfds[n].fd != cn->fd)
+            continue;
+         short ev = pfds[n++].revents;
+         if (ev & (POLLIN | POLLHUP | POLLERR)) {
+            while ((r = read(cn->fd, buf, sizeof(buf))) > 0)
+               buf_add(&cn->in, buf, r);
+            if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+               conn_close(i);
+               continue;
+            }
+         }
+         if (cn->hold)
+            poll_reply(cn, cn->hold, now >= cn->hold_until);
+         conn_parse(cn);
+         if (conn_flush(cn) < 0)
+            conn_close(i);
+      }
+      if (now - last_stat >= 5000000) {
+         print_stat("stat");
+         last_stat = now;
+      }
+   }
+   print_stat("total");
+   for (i = 0; i < MAX_CONN; i++)
+      if (conns[i])
+         conn_close(i);
+   close(lfd);
+   return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file   vplist_bench.c
+ * @brief  Cost of making and running vp_command
+ *
+ * every http completion, dispatch and event listener makes a command with
+ * _C_ and runs it once. this measures make+do of the usual shapes, which
+ * keep arguments inline, against a shape too large for the inline buffer,
+ * which still takes the heap path. link+do_repeat+unlink of a listener is
+ * measured too.
+ *
+ * $ ./lwqq-vplist-bench -n 10000000
+ */
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwqq.h"
+#include "metrics.h"
+
+/** larger than VP_INLINE_WORDS, so it is stored on heap */
+typedef struct Wide {
+   void* w[3];
+} Wide;
+
+static VP_DISPATCHER_2(bench_wide, void, Wide, Wide)
+
+static volatile unsigned long sink;
+
+static void cb_p(void* a)
+{
+   sink += (size_t)a;
+}
+
+static void cb_2p(void* a, void* b)
+{
+   sink += (size_t)a + (size_t)b;
+}
+
+static void cb_3pi(void* a, void* b, void* c, int d)
+{
+   sink += (size_t)a + (size_t)b + (size_t)c + d;
+}
+
+static int cb_2p_i(void* a, void* b)
+{
+   return (int)((size_t)a + (size_t)b);
+}
+
+static void cb_wide(Wide a, Wide b)
+{
+   sink += (size_t)a.w[0] + (size_t)b.w[2];
+}
+
+static double per_op(uint64_t t0, long n)
+{
+   return (lwqq__metrics_now() - t0) * 1000.0 / n;
+}
+
+int main(int argc, char* argv[])
+{
+   long n = 10000000, i;
+   uint64_t t0;
+   int c, ret;
+   Wide w = { { (void*)1, (void*)2, (void*)3 } };
+
+   while ((c = getopt(argc, argv, "n:h")) != -1) {
+      switch (c) {
+      case 'n':
+         n = atol(optarg);
+         break;
+      default:
+         fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (n < 1)
+      n = 1;
+
+   printf("%-24s %10s\n", "shape", "ns/op");
+
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < n; i++)
+      vp_do(_C_(p, cb_p, (void*)i), NULL);
+   printf("%-24s %10.1f\n", "p make+do", per_op(t0, n));
+
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < n; i++)
+      vp_do(_C_(2p, cb_2p, (void*)i, (void*)i), NULL);
+   printf("%-24s %10.1f\n", "2p make+do", per_op(t0, n));
+
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < n; i++)
+      vp_do(_C_(3pi, cb_3pi, (void*)i, (void*)i, (void*)i, (int)i), NULL);
+   printf("%-24s %10.1f\n", "3pi make+do", per_op(t0, n));
+
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < n; i++) {
+      vp_do(_C_(2p_i, cb_2p_i, (void*)i, (void*)i), &ret);
+      sink += ret;
+   }
+   printf("%-24s %10.1f\n", "2p_i make+do", per_op(t0, n));
+
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < n; i++)
+      vp_do(_C_(bench_wide, cb_wide, w, w), NULL);
+   printf("%-24s %10.1f\n", "heap (48 bytes) make+do", per_op(t0, n));
+
+   vp_command head = { 0 };
+   t0 = lwqq__metrics_now();
+   for (i = 0; i < n; i++) {
+      vp_command cmd = _C_(p, cb_p, (void*)i);
+      const vp_command* id = vp_link(&head, &cmd);
+      vp_do_repeat(head, NULL);
+      vp_unlink(&head, id);
+   }
+   printf("%-24s %10.1f\n", "link+repeat+unlink", per_op(t0, n));
+
+   return sink == 0x5a5a5a5a;
+}
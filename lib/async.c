@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include "smemory.h"
 #include "http.h"
@@ -35,21 +36,31 @@ typedef struct LwqqAsyncEntry {
 typedef struct async_dispatch_data {
    LwqqCommand cmd;
    LwqqAsyncTimerHandle timer;
+   LwqqTraceSpan span;
 } async_dispatch_data;
-typedef struct LwqqAsyncEvset_ {
-   LwqqAsyncEvset parent;
+/* only exists when someone waits on evset */
+struct evset_waiter {
    pthread_mutex_t lock;
    pthread_cond_t cond;
-   int cond_waiting;
-   int ref_count;
+   int done;
+};
+typedef struct LwqqAsyncEvset_ {
+   LwqqAsyncEvset parent;
+   atomic_int ref_count;
+   /* parent.err_count is a plain int, it is copied out before cmd called */
+   atomic_int err_count;
+   struct evset_waiter* _Atomic waiter;
    LwqqCommand cmd;
+   LwqqTraceSpan span;
 } LwqqAsyncEvset_;
 typedef struct LwqqAsyncEvent_ {
    LwqqAsyncEvent parent;
    LwqqAsyncEvset* host_lock;
    LwqqCommand cmd;
    LwqqAsyncEvent* chained;
+   LwqqTraceSpan span;
 } LwqqAsyncEvent_;
+static SSlab event_slab = S_SLAB_INIT("LwqqAsyncEvent", LwqqAsyncEvent_);
 
 LwqqAsyncImplList lwqq__async_impl_list_ = LIST_HEAD_INITIALIZER();
 LwqqAsyncImpl* lwqq__async_impl_ = NULL;
@@ -91,7 +102,10 @@ void lwqq_async_init(LwqqClient* lc)
 static void dispatch_wrap(LwqqAsyncTimerHandle timer, void* p)
 {
    async_dispatch_data* data = (async_dispatch_data*)p;
+   LwqqTraceCtx prev = lwqq_trace_resume(data->span.ctx);
    vp_do(data->cmd, NULL);
+   lwqq_trace_end(&data->span, NULL);
+   lwqq_trace_resume(prev);
    lwqq_async_timer_stop(timer);
    lwqq_async_timer_free(timer);
 
@@ -108,6 +122,7 @@ void lwqq_async_dispatch_delay(LwqqCommand cmd, unsigned long timeout)
       timeout = 10;
    async_dispatch_data* data = s_malloc0(sizeof(*data));
    data->cmd = cmd;
+   lwqq_trace_begin(&data->span, "dispatch");
    data->timer = lwqq_async_timer_new();
    lwqq_async_timer_watch(data->timer, timeout, dispatch_wrap, data);
 #else
@@ -117,22 +132,30 @@ void lwqq_async_dispatch_delay(LwqqCommand cmd, unsigned long timeout)
 
 LwqqAsyncEvent* lwqq_async_event_new(void* req)
 {
-   LwqqAsyncEvent* event = s_malloc0(sizeof(LwqqAsyncEvent_));
+   LwqqAsyncEvent* event = s_slab_alloc(&event_slab);
    LwqqHttpRequest* request = req;
    event->lc = req ? LWQQ_HTTP_EV(request)->lc : NULL;
    event->result = LWQQ_EC_OK;
+   if (LWQQ_TRACE_ON())
+      lwqq_trace_begin(&((LwqqAsyncEvent_*)event)->span,
+                       req ? "http" : "event");
    return event;
 }
 
+LWQQ_EXPORT
+LwqqTraceCtx lwqq_async_event_trace(LwqqAsyncEvent* event)
+{
+   return ((LwqqAsyncEvent_*)event)->span.ctx;
+}
+
 LWQQ_EXPORT
 LwqqAsyncEvset* lwqq_async_evset_new()
 {
    LwqqAsyncEvset_* l = s_malloc0(sizeof(LwqqAsyncEvset_));
-   pthread_mutex_init(&l->lock, NULL);
-   pthread_cond_init(&l->cond, NULL);
-   pthread_mutex_lock(&l->lock);
-   l->ref_count = 1;
-   pthread_mutex_unlock(&l->lock);
+   atomic_init(&l->ref_count, 1);
+   atomic_init(&l->err_count, 0);
+   atomic_init(&l->waiter, NULL);
+   lwqq_trace_begin(&l->span, "evset");
    return (LwqqAsyncEvset*)l;
 }
 
@@ -141,46 +164,80 @@ static void _lwqq_async_evset_free(LwqqAsyncEvset* set)
    if (!set)
       return;
    LwqqAsyncEvset_* evset_ = (LwqqAsyncEvset_*)set;
-   pthread_mutex_destroy(&evset_->lock);
-   pthread_cond_destroy(&evset_->cond);
    s_free(evset_);
 }
 
 void lwqq_async_evset_unref(LwqqAsyncEvset* set)
 {
-   int flag = 0;
    if (!set)
       return;
    LwqqAsyncEvset_* evset_ = (LwqqAsyncEvset_*)set;
-   pthread_mutex_lock(&evset_->lock);
-   if (--evset_->ref_count == 0)
-      flag = 1;
-   pthread_mutex_unlock(&evset_->lock);
-   if (flag) {
-      vp_do(evset_->cmd, NULL);
-      if (evset_->cond_waiting)
-         pthread_cond_signal(&evset_->cond);
-      else {
-         _lwqq_async_evset_free(set);
-      }
+   // acq_rel: the last one sees every err_count and waiter stored before
+   if (atomic_fetch_sub_explicit(&evset_->ref_count, 1, memory_order_acq_rel)
+       != 1)
+      return;
+   evset_->parent.err_count = atomic_load_explicit(&evset_->err_count,
+                                                   memory_order_relaxed);
+   LwqqTraceCtx prev = lwqq_trace_resume(evset_->span.ctx);
+   vp_do(evset_->cmd, NULL);
+   lwqq_trace_end(&evset_->span, NULL);
+   lwqq_trace_resume(prev);
+   struct evset_waiter* w
+       = atomic_load_explicit(&evset_->waiter, memory_order_relaxed);
+   if (w) {
+      // waiter frees set, don't touch it after signal
+      pthread_mutex_lock(&w->lock);
+      w->done = 1;
+      pthread_cond_signal(&w->cond);
+      pthread_mutex_unlock(&w->lock);
+   } else {
+      _lwqq_async_evset_free(set);
    }
 }
 
+LWQQ_EXPORT
+int lwqq_async_evset_wait(LwqqAsyncEvset* set)
+{
+   if (!set)
+      return 0;
+   LwqqAsyncEvset_* evset_ = (LwqqAsyncEvset_*)set;
+   struct evset_waiter w = { .done = 0 };
+   pthread_mutex_init(&w.lock, NULL);
+   pthread_cond_init(&w.cond, NULL);
+   // we still hold a reference, so it must be seen by the last unref
+   atomic_store_explicit(&evset_->waiter, &w, memory_order_relaxed);
+   lwqq_async_evset_unref(set);
+   pthread_mutex_lock(&w.lock);
+   while (!w.done)
+      pthread_cond_wait(&w.cond, &w.lock);
+   pthread_mutex_unlock(&w.lock);
+   pthread_cond_destroy(&w.cond);
+   pthread_mutex_destroy(&w.lock);
+   int err = set->err_count;
+   _lwqq_async_evset_free(set);
+   return err;
+}
+
 void lwqq_async_event_finish(LwqqAsyncEvent* event)
 {
    LwqqAsyncEvent_* internal = (LwqqAsyncEvent_*)event;
+   LwqqTraceCtx prev = lwqq_trace_resume(internal->span.ctx);
    vp_do(internal->cmd, NULL);
    LwqqAsyncEvset_* evset_ = (LwqqAsyncEvset_*)internal->host_lock;
    if (evset_ != NULL) {
       // this store evset err count.
-      if (event->result != LWQQ_EC_OK) {
-         pthread_mutex_lock(&evset_->lock);
-         evset_->parent.err_count++;
-         pthread_mutex_unlock(&evset_->lock);
-      }
+      if (event->result != LWQQ_EC_OK)
+         atomic_fetch_add_explicit(&evset_->err_count, 1,
+                                   memory_order_relaxed);
       lwqq_async_evset_unref(internal->host_lock);
    }
-   s_free(event);
+   if (internal->span.ctx.trace_id) {
+      char arg[32];
+      snprintf(arg, sizeof(arg), "result=%d", event->result);
+      lwqq_trace_end(&internal->span, arg);
+   }
+   lwqq_trace_resume(prev);
+   s_slab_free(&event_slab, event);
 }
 
 LWQQ_EXPORT
@@ -189,10 +246,8 @@ void lwqq_async_evset_add_event(LwqqAsyncEvset* host, LwqqAsyncEvent* handle)
    if (!host || !handle)
       return;
    LwqqAsyncEvset_* set_ = (LwqqAsyncEvset_*)host;
-   pthread_mutex_lock(&set_->lock);
    ((LwqqAsyncEvent_*)handle)->host_lock = host;
-   ++set_->ref_count;
-   pthread_mutex_unlock(&set_->lock);
+   atomic_fetch_add_explicit(&set_->ref_count, 1, memory_order_relaxed);
 }
 
 LWQQ_EXPORT
@@ -239,6 +294,89 @@ void lwqq_async_add_event_chain(LwqqAsyncEvent* caller, LwqqAsyncEvent* called)
    }
 }
 
+/** one request in flight, which later callers of same key wait on */
+typedef struct LwqqFlight {
+   LwqqClient* lc;
+   char* key;
+   void* result;
+   LIST_HEAD(, LwqqFlightWaiter) waiters;
+   LIST_ENTRY(LwqqFlight) entries;
+} LwqqFlight;
+typedef struct LwqqFlightWaiter {
+   LwqqAsyncEvent* ev;
+   LIST_ENTRY(LwqqFlightWaiter) entries;
+} LwqqFlightWaiter;
+
+static struct {
+   pthread_mutex_t lock;
+   LIST_HEAD(, LwqqFlight) list;
+} flights = { PTHREAD_MUTEX_INITIALIZER, LIST_HEAD_INITIALIZER() };
+
+static LwqqFlight* flight_find(LwqqClient* lc, const char* key)
+{
+   LwqqFlight* f;
+   LIST_FOREACH(f, &flights.list, entries)
+   {
+      if (f->lc == lc && strcmp(f->key, key) == 0)
+         return f;
+   }
+   return NULL;
+}
+/** flight is landed, every waiter gets its result */
+static void flight_land(LwqqFlight* f, LwqqAsyncEvent* ev)
+{
+   LwqqFlightWaiter* w;
+   pthread_mutex_lock(&flights.lock);
+   LIST_REMOVE(f, entries);
+   pthread_mutex_unlock(&flights.lock);
+   while ((w = LIST_FIRST(&f->waiters))) {
+      LIST_REMOVE(w, entries);
+      w->ev->result = ev ? ev->result : LWQQ_EC_ERROR;
+      lwqq_async_event_finish(w->ev);
+      s_free(w);
+   }
+   s_free(f->key);
+   s_free(f);
+}
+
+int lwqq__flight_join(LwqqClient* lc, const char* key, LwqqAsyncEvset* set,
+                      void** result)
+{
+   LwqqFlight* f;
+   LwqqFlightWaiter* w;
+   pthread_mutex_lock(&flights.lock);
+   f = flight_find(lc, key);
+   if (f == NULL) {
+      pthread_mutex_unlock(&flights.lock);
+      return 0;
+   }
+   w = s_malloc0(sizeof(*w));
+   w->ev = lwqq_async_event_new(NULL);
+   w->ev->lc = lc;
+   // added before flight can land, which finishes it
+   lwqq_async_evset_add_event(set, w->ev);
+   LIST_INSERT_HEAD(&f->waiters, w, entries);
+   if (result)
+      *result = f->result;
+   pthread_mutex_unlock(&flights.lock);
+   return 1;
+}
+
+void lwqq__flight_begin(LwqqClient* lc, const char* key, LwqqAsyncEvent* ev,
+                        void* result)
+{
+   LwqqFlight* f = s_malloc0(sizeof(*f));
+   f->lc = lc;
+   f->key = s_strdup(key);
+   f->result = result;
+   LIST_INIT(&f->waiters);
+   pthread_mutex_lock(&flights.lock);
+   LIST_INSERT_HEAD(&flights.list, f, entries);
+   pthread_mutex_unlock(&flights.lock);
+   // NULL or synced event lands at once
+   lwqq_async_add_event_listener(ev, _C_(2p, flight_land, f, ev));
+}
+
 LWQQ_EXPORT
 void lwqq_async_add_evset_listener(LwqqAsyncEvset* evset, LwqqCommand cmd)
 {
@@ -10,6 +10,7 @@
 #ifndef LWQQ_ASYNC_H
 #define LWQQ_ASYNC_H
 #include "type.h"
+#include "trace.h"
 
 /**======================EVSET API=====================================**/
 /**
@@ -59,6 +60,13 @@ LwqqAsyncEvset* lwqq_async_evset_new();
  */
 //#define lwqq_async_evset_unref(set)
 void lwqq_async_evset_unref(LwqqAsyncEvset* set);
+/**
+ * block until every event of set finished, it gives up your own reference
+ * like lwqq_async_evset_unref and set is freed when it returns.
+ * never call it in the event loop thread, it would dead lock.
+ * @return err_count of set
+ */
+int lwqq_async_evset_wait(LwqqAsyncEvset* set);
 
 /**
  * create a new event.
@@ -77,6 +85,11 @@ LwqqAsyncEvent* lwqq_async_event_new(void* req);
 void lwqq_async_event_finish(LwqqAsyncEvent* event);
 /** this is same as lwqq_async_event_finish */
 #define lwqq_async_event_emit(event) lwqq_async_event_finish(event)
+/**
+ * trace context of event, its listeners run with this context.
+ * trace_id is 0 when event created with tracing disabled.
+ */
+LwqqTraceCtx lwqq_async_event_trace(LwqqAsyncEvent* event);
 /**
  * this would add a event to a evset.
  * @note one event can add to only one evset.
@@ -0,0 +1,273 @@
+/**
+ * @file   capture.c
+ * @brief  Record and replay http traffic
+ *
+ * file format, every integer is an unsigned LEB128 varint:
+ *
+ *    magic  'LWQQCAP' version(1 byte)
+ *    record method http_code curl_code offset duration
+ *           len url len req_head len body len resp_head len response
+ *
+ * a NULL body is stored as length 0, the same as an empty body.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "metrics.h"
+#include "smemory.h"
+#include "logger.h"
+#include "internal.h"
+
+#define CAPTURE_MAGIC "LWQQCAP"
+#define CAPTURE_VERSION 1
+
+/** replay queue of one method and endpoint */
+typedef struct ReplayQueue {
+   int method;
+   char endpoint[LWQQ_METRIC_ENDPOINT_LEN];
+   size_t* idx;
+   size_t count;
+   size_t cursor;
+} ReplayQueue;
+
+static struct {
+   pthread_mutex_t lock;
+   LwqqCaptureMode mode;
+   FILE* f;
+   uint64_t opened;
+   LwqqCaptureEntry* entries;
+   size_t n_entry;
+   ReplayQueue* queues;
+   size_t n_queue;
+} cap = { PTHREAD_MUTEX_INITIALIZER };
+
+static void put_varint(FILE* f, uint64_t v)
+{
+   while (v >= 0x80) {
+      fputc((int)(v & 0x7f) | 0x80, f);
+      v >>= 7;
+   }
+   fputc((int)v, f);
+}
+
+static int get_varint(FILE* f, uint64_t* v)
+{
+   int c, shift = 0;
+   *v = 0;
+   do {
+      if ((c = fgetc(f)) == EOF || shift > 63)
+         return -1;
+      *v |= (uint64_t)(c & 0x7f) << shift;
+      shift += 7;
+   } while (c & 0x80);
+   return 0;
+}
+
+static void put_bytes(FILE* f, const char* s, size_t len)
+{
+   put_varint(f, s ? len : 0);
+   if (s && len)
+      fwrite(s, 1, len, f);
+}
+
+/** read bytes, always NUL terminated */
+static int get_bytes(FILE* f, char** s, size_t* len)
+{
+   uint64_t n;
+   if (get_varint(f, &n) || n > (1u << 30))
+      return -1;
+   *s = s_malloc(n + 1);
+   if (fread(*s, 1, n, f) != n) {
+      s_free(*s);
+      return -1;
+   }
+   (*s)[n] = '\0';
+   if (len)
+      *len = n;
+   return 0;
+}
+
+static void entry_free(LwqqCaptureEntry* e)
+{
+   s_free(e->url);
+   s_free(e->req_head);
+   s_free(e->body);
+   s_free(e->resp_head);
+   s_free(e->response);
+}
+
+static int read_entry(FILE* f, LwqqCaptureEntry* e)
+{
+   uint64_t v[5];
+   int i;
+   memset(e, 0, sizeof(*e));
+   for (i = 0; i < 5; i++) {
+      if (get_varint(f, &v[i]))
+         return -1;
+   }
+   e->method = v[0];
+   e->http_code = v[1];
+   e->curl_code = v[2];
+   e->offset = v[3];
+   e->duration = v[4];
+   if (get_bytes(f, &e->url, NULL) || get_bytes(f, &e->req_head, NULL)
+       || get_bytes(f, &e->body, &e->body_len)
+       || get_bytes(f, &e->resp_head, NULL)
+       || get_bytes(f, &e->response, &e->resp_len)) {
+      entry_free(e);
+      return -1;
+   }
+   return 0;
+}
+
+static ReplayQueue* queue_get(int method, const char* endpoint, int create)
+{
+   size_t i;
+   for (i = 0; i < cap.n_queue; i++) {
+      ReplayQueue* q = &cap.queues[i];
+      if (q->method == method && strcmp(q->endpoint, endpoint) == 0)
+         return q;
+   }
+   if (!create)
+      return NULL;
+   cap.queues = s_realloc(cap.queues, sizeof(ReplayQueue) * (cap.n_queue + 1));
+   ReplayQueue* q = &cap.queues[cap.n_queue++];
+   memset(q, 0, sizeof(*q));
+   q->method = method;
+   strncpy(q->endpoint, endpoint, sizeof(q->endpoint) - 1);
+   return q;
+}
+
+static int load_replay(FILE* f)
+{
+   LwqqCaptureEntry e;
+   size_t cap_entry = 0, i;
+   char endpoint[LWQQ_METRIC_ENDPOINT_LEN];
+
+   while (read_entry(f, &e) == 0) {
+      if (cap.n_entry == cap_entry) {
+         cap_entry = cap_entry ? cap_entry * 2 : 64;
+         cap.entries = s_realloc(cap.entries,
+                                 sizeof(LwqqCaptureEntry) * cap_entry);
+      }
+      cap.entries[cap.n_entry++] = e;
+   }
+   if (!feof(f))
+      lwqq_log(LOG_WARNING, "capture is truncated after %zu records\n",
+               cap.n_entry);
+   for (i = 0; i < cap.n_entry; i++) {
+      lwqq__http_endpoint(cap.entries[i].url, endpoint, sizeof(endpoint));
+      ReplayQueue* q = queue_get(cap.entries[i].method, endpoint, 1);
+      q->idx = s_realloc(q->idx, sizeof(size_t) * (q->count + 1));
+      q->idx[q->count++] = i;
+   }
+   return 0;
+}
+
+static void capture_close(void)
+{
+   size_t i;
+   if (cap.f)
+      fclose(cap.f);
+   cap.f = NULL;
+   for (i = 0; i < cap.n_entry; i++)
+      entry_free(&cap.entries[i]);
+   s_free(cap.entries);
+   cap.n_entry = 0;
+   for (i = 0; i < cap.n_queue; i++)
+      s_free(cap.queues[i].idx);
+   s_free(cap.queues);
+   cap.n_queue = 0;
+   cap.mode = LWQQ_CAPTURE_OFF;
+}
+
+LWQQ_EXPORT
+int lwqq_http_capture_open(LwqqCaptureMode mode, const char* file)
+{
+   char magic[sizeof(CAPTURE_MAGIC)];
+   int ret = -1;
+   FILE* f;
+
+   pthread_mutex_lock(&cap.lock);
+   capture_close();
+   if (mode == LWQQ_CAPTURE_OFF || !file) {
+      ret = 0;
+      goto done;
+   }
+   if (mode == LWQQ_CAPTURE_RECORD) {
+      if (!(f = fopen(file, "wb")))
+         goto done;
+      fwrite(CAPTURE_MAGIC, 1, sizeof(magic) - 1, f);
+      fputc(CAPTURE_VERSION, f);
+      cap.f = f;
+   } else {
+      if (!(f = fopen(file, "rb")))
+         goto done;
+      if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)
+          || memcmp(magic, CAPTURE_MAGIC, sizeof(magic) - 1)
+          || magic[sizeof(magic) - 1] != CAPTURE_VERSION) {
+         lwqq_log(LOG_ERROR, "%s is not a lwqq capture\n", file);
+         fclose(f);
+         goto done;
+      }
+      load_replay(f);
+      fclose(f);
+   }
+   cap.mode = mode;
+   cap.opened = lwqq__metrics_now();
+   ret = 0;
+done:
+   pthread_mutex_unlock(&cap.lock);
+   return ret;
+}
+
+LWQQ_EXPORT
+void lwqq_http_capture_close(void)
+{
+   pthread_mutex_lock(&cap.lock);
+   capture_close();
+   pthread_mutex_unlock(&cap.lock);
+}
+
+LWQQ_EXPORT
+LwqqCaptureMode lwqq_http_capture_mode(void) { return cap.mode; }
+
+void lwqq__capture_record(const LwqqCaptureEntry* e)
+{
+   uint64_t now = lwqq__metrics_now();
+   pthread_mutex_lock(&cap.lock);
+   if (cap.mode != LWQQ_CAPTURE_RECORD) {
+      pthread_mutex_unlock(&cap.lock);
+      return;
+   }
+   // offset is derived here, the transfer started duration ago
+   uint64_t start = now - e->duration;
+   put_varint(cap.f, e->method);
+   put_varint(cap.f, e->http_code);
+   put_varint(cap.f, e->curl_code);
+   put_varint(cap.f, start > cap.opened ? start - cap.opened : 0);
+   put_varint(cap.f, e->duration);
+   put_bytes(cap.f, e->url, e->url ? strlen(e->url) : 0);
+   put_bytes(cap.f, e->req_head, e->req_head ? strlen(e->req_head) : 0);
+   put_bytes(cap.f, e->body, e->body_len);
+   put_bytes(cap.f, e->resp_head, e->resp_head ? strlen(e->resp_head) : 0);
+   put_bytes(cap.f, e->response, e->resp_len);
+   pthread_mutex_unlock(&cap.lock);
+}
+
+const LwqqCaptureEntry* lwqq__capture_next(int method, const char* url)
+{
+   char endpoint[LWQQ_METRIC_ENDPOINT_LEN];
+   const LwqqCaptureEntry* e = NULL;
+   lwqq__http_endpoint(url, endpoint, sizeof(endpoint));
+   pthread_mutex_lock(&cap.lock);
+   ReplayQueue* q = queue_get(method, endpoint, 0);
+   if (q && q->cursor < q->count)
+      e = &cap.entries[q->idx[q->cursor++]];
+   pthread_mutex_unlock(&cap.lock);
+   return e;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file   capture.h
+ * @brief  Record and replay http traffic
+ *
+ * in record mode every finished http request, with its url, headers, body,
+ * response and timing, is appended to a capture file. in replay mode no
+ * network is used, requests are answered from the capture instead.
+ *
+ * replay matches a request by method and endpoint (url path without host
+ * and query, see metrics.h), because query of webqq urls contains random
+ * numbers and timestamps. records of one endpoint are served in recorded
+ * order. a request fails with LWQQ_EC_NETWORK_ERROR after its endpoint is
+ * used up, so polling stops at end of capture.
+ */
+
+#ifndef LWQQ_CAPTURE_H
+#define LWQQ_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+   LWQQ_CAPTURE_OFF,
+   LWQQ_CAPTURE_RECORD,
+   LWQQ_CAPTURE_REPLAY, /** < answer immediately */
+   LWQQ_CAPTURE_REPLAY_TIMED /** < answer after recorded duration */
+} LwqqCaptureMode;
+
+/**
+ * start record into file or replay from file. the previous capture is
+ * closed first. it affects every client.
+ * @return 0 on success, -1 if file can't be opened or it isn't a capture
+ */
+int lwqq_http_capture_open(LwqqCaptureMode mode, const char* file);
+/** flush and close capture, back to network */
+void lwqq_http_capture_close(void);
+LwqqCaptureMode lwqq_http_capture_mode(void);
+
+typedef struct LwqqCaptureEntry {
+   int method; /** < 0 GET, 1 POST */
+   int http_code;
+   int curl_code;
+   uint64_t offset; /** < start time since capture opened, microseconds */
+   uint64_t duration;
+   char* url;
+   char* req_head; /** < 'Name: value\r\n' lines */
+   char* body; /** < post body, NULL if none */
+   size_t body_len;
+   char* resp_head; /** < 'Name: value\r\n' lines as received */
+   char* response; /** < decoded response */
+   size_t resp_len;
+} LwqqCaptureEntry;
+
+/**
+ * append entry to capture, noop if it is not recording.
+ * offset of e is ignored, it is computed from now and duration.
+ */
+void lwqq__capture_record(const LwqqCaptureEntry* e);
+/**
+ * next unused entry of the same method and endpoint of url
+ * @return NULL if there is none, else valid until capture is closed
+ */
+const LwqqCaptureEntry* lwqq__capture_next(int method, const char* url);
+
+#endif
@@ -1,11 +1,17 @@
 #include <curl/curl.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <zlib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 #ifdef WIN32
 #undef SLIST_ENTRY
@@ -24,6 +30,9 @@
 #include "utility.h"
 #include "async_impl.h"
 #include "internal.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
 
 //#define LWQQ_HTTP_USER_AGENT "Mozilla/5.0 (X11; Linux x86_64; rv:10.0)
 // Gecko/20100101 Firefox/10.0"
@@ -43,6 +52,9 @@ static void lwqq_http_add_file_content(LwqqHttpRequest* request,
                                        const char* name, const char* filename,
                                        const void* data, size_t size,
                                        const char* extension);
+static void lwqq_http_add_file_path(LwqqHttpRequest* request, const char* name,
+                                    const char* filename, const char* path,
+                                    const char* extension);
 static LwqqAsyncEvent* lwqq_http_do_request_async(LwqqHttpRequest* request,
                                                   int method, char* body,
                                                   LwqqCommand);
@@ -67,7 +79,8 @@ typedef enum {
    HTTP_UNEXPECTED_RECV = 1 << 0,
    HTTP_FORCE_CANCEL    = 1 << 1,
    HTTP_SYNCED          = 1 << 2,
-   HTTP_FILE_MODE       = 1 << 3
+   HTTP_FILE_MODE       = 1 << 3,
+   HTTP_REPLAYED        = 1 << 4
 } HttpBits;
 
 struct trunk_entry {
@@ -76,6 +89,25 @@ struct trunk_entry {
    SIMPLEQ_ENTRY(trunk_entry) entries;
 };
 
+/** where body goes instead of response, set by LWQQ_HTTP_SAVE_* */
+typedef struct HttpSink {
+   enum { SINK_NONE, SINK_FILE, SINK_FD, SINK_MMAP, SINK_CALLBACK } type;
+   FILE* file;
+   int fd;
+   int own_fd; /** < fd is opened by LWQQ_HTTP_SAVE_MMAP */
+   off_t start; /** < offset of file or fd when transfer begins */
+   char* map;
+   size_t map_size;
+   LwqqHttpSinkFunc func;
+   void* data;
+   char* buf;
+   size_t buf_size;
+   size_t buf_len;
+   size_t written; /** < bytes of current transfer */
+   char* rec; /** < copy of current transfer, only kept for capture record */
+   size_t rec_cap;
+} HttpSink;
+
 typedef struct LwqqHttpRequest_ {
    LwqqHttpRequest parent;
    char* cookie; // cookie used in current request
@@ -84,6 +116,11 @@ typedef struct LwqqHttpRequest_ {
    short retry_;
    short timeout; // timeout orginal
    short tmo_inc; // timeout increment
+   LwqqEndpoint* endpoint; // route of url, for connection limit
+   struct LwqqHttpHandle_* handle; // cookie jar, NULL if not from client
+   int method;
+   char* post; // copy of post body, only kept for capture record
+   HttpSink sink;
 #ifdef HAVE_OPEN_MEMSTREAM
    FILE* mem_buf;
 #else
@@ -91,10 +128,26 @@ typedef struct LwqqHttpRequest_ {
 #endif
 } LwqqHttpRequest_;
 
+#define COOKIE_BUCKETS 64
+
+/** a cookie seen in Set-Cookie, mirrors what curl cookie engine keeps */
+typedef struct CookieNode {
+   char* name;
+   char* value;
+   char* domain; /** < without leading dot */
+   int host_only; /** < no Domain attribute, only exact host matches */
+   struct CookieNode* next;
+} CookieNode;
+
 typedef struct LwqqHttpHandle_ {
    LwqqHttpHandle parent;
    CURLSH* share;
    pthread_mutex_t share_lock[4];
+   /** cookies by name, so reading one doesn't copy curl cookie list */
+   pthread_mutex_t jar_lock;
+   CookieNode* jar[COOKIE_BUCKETS];
+   /** endpoints list, and base and unix_socket of them */
+   pthread_mutex_t endpoint_lock;
 } LwqqHttpHandle_;
 
 struct CookieExt {
@@ -122,10 +175,17 @@ TR(CURLE_SSL_CONNECT_ERROR, LWQQ_EC_SSL_ERROR);
 TABLE_END();
 
 static GLOBAL global = { 0 };
+static char* base_host = NULL;
+static pthread_once_t base_host_once = PTHREAD_ONCE_INIT;
+/* request threads read base_host while user may change it */
+static pthread_mutex_t base_host_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
 static pthread_cond_t ev_block_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t add_lock = PTHREAD_MUTEX_INITIALIZER;
+/* running and max_conn of every endpoint, async and sync requests share it */
+static pthread_mutex_t endpoint_conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t endpoint_conn_cond = PTHREAD_COND_INITIALIZER;
 
 typedef struct S_ITEM {
    /**@brief 全局事件循环*/
@@ -140,9 +200,62 @@ typedef struct D_ITEM {
    LwqqCommand cmd;
    LwqqHttpRequest* req;
    LwqqAsyncEvent* event;
+   uint64_t queued; /** < time inserted to add_link, then time waited */
+   LwqqEndpoint* endpoint; /** < counted in its running while in conn_link */
    // void* data;
    TAILQ_ENTRY(D_ITEM) entries;
 } D_ITEM;
+static SSlab s_item_slab = S_SLAB_INIT("S_ITEM", S_ITEM);
+static SSlab d_item_slab = S_SLAB_INIT("D_ITEM", D_ITEM);
+
+/**
+ * take a connection of ep
+ * @param wait_sec 0 to fail at once when ep is full, otherwise wait at most
+ *        this long, then go over the limit rather than block forever
+ * @return 0 if ep is full
+ */
+static int endpoint_acquire(LwqqEndpoint* ep, int wait_sec)
+{
+   struct timespec until;
+   int ok = 1, over = 0;
+   pthread_mutex_lock(&endpoint_conn_lock);
+   if (wait_sec) {
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_sec += wait_sec;
+   }
+   while (ep->max_conn > 0 && ep->running >= ep->max_conn) {
+      if (!wait_sec
+          || pthread_cond_timedwait(&endpoint_conn_cond, &endpoint_conn_lock,
+                                    &until) == ETIMEDOUT) {
+         ok = over = wait_sec != 0;
+         break;
+      }
+   }
+   if (ok)
+      ep->running++;
+   pthread_mutex_unlock(&endpoint_conn_lock);
+   if (over)
+      lwqq_log(LOG_WARNING, "endpoint %s is full, go over limit\n", ep->host);
+   return ok;
+}
+
+static void endpoint_release(LwqqEndpoint* ep)
+{
+   pthread_mutex_lock(&endpoint_conn_lock);
+   ep->running--;
+   pthread_cond_broadcast(&endpoint_conn_cond);
+   pthread_mutex_unlock(&endpoint_conn_lock);
+}
+
+static void conn_link_remove(D_ITEM* di)
+{
+   TAILQ_REMOVE(&global.conn_link, di, entries);
+   global.conn_length--;
+   if (di->endpoint)
+      endpoint_release(di->endpoint);
+   di->endpoint = NULL;
+}
+
 /* For async request */
 
 #ifndef NDEBUG
@@ -169,7 +282,19 @@ LwqqFeatures lwqq__http_check_feature()
               : 0;
 }
 
+int lwqq__http_waiting()
+{
+   D_ITEM* di;
+   int n = 0;
+   pthread_mutex_lock(&add_lock);
+   TAILQ_FOREACH(di, &global.add_link, entries) { n++; }
+   pthread_mutex_unlock(&add_lock);
+   return n;
+}
+
 #ifndef HAVE_OPEN_MEMSTREAM
+static SSlab trunk_slab = S_SLAB_INIT("trunk_entry", struct trunk_entry);
+
 static size_t write_content(const char* ptr, size_t size, size_t nmemb,
                             void* userdata)
 {
@@ -201,7 +326,7 @@ static size_t write_content(const char* ptr, size_t size, size_t nmemb,
          return 0;
       }
    } else {
-      struct trunk_entry* trunk = s_malloc0(sizeof(*trunk));
+      struct trunk_entry* trunk = s_slab_alloc(&trunk_slab);
       trunk->size = sz_;
       trunk->trunk = s_malloc0(sz_);
       position = trunk->trunk;
@@ -226,14 +351,184 @@ static void composite_trunks(LwqqHttpRequest* req)
       memcpy(req->response + req->resp_len, trunk->trunk, trunk->size);
       req->resp_len += trunk->size;
       s_free(trunk->trunk);
-      s_free(trunk);
+      s_slab_free(&trunk_slab, trunk);
    }
 }
 #endif
+static void sink_unmap(HttpSink* sink)
+{
+#ifndef WIN32
+   if (sink->map)
+      munmap(sink->map, sink->map_size);
+#endif
+   sink->map = NULL;
+   sink->map_size = 0;
+}
+static int sink_flush(HttpSink* sink)
+{
+   size_t len = sink->buf_len;
+   sink->buf_len = 0;
+   return len && sink->func(sink->data, sink->buf, len) != len ? -1 : 0;
+}
+/** mapping grows to Content-Length at once, else it doubles */
+static int sink_map(LwqqHttpRequest* req, HttpSink* sink, size_t need)
+{
+#ifndef WIN32
+   double length = 0.0;
+   size_t size = sink->map_size ? sink->map_size * 2 : 64 * 1024;
+   curl_easy_getinfo(req->req, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+   if (length > 0 && (size_t)length > size)
+      size = length;
+   if (need > size)
+      size = need;
+   sink_unmap(sink);
+   if (ftruncate(sink->fd, size))
+      return -1;
+   sink->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd,
+                    0);
+   if (sink->map == MAP_FAILED) {
+      sink->map = NULL;
+      return -1;
+   }
+   sink->map_size = size;
+   return 0;
+#else
+   return -1;
+#endif
+}
+/** keep what sink is given, so capture records it as response */
+static void sink_tee(HttpSink* sink, const char* ptr, size_t len)
+{
+   if (sink->written + len > sink->rec_cap) {
+      sink->rec_cap = (sink->written + len) * 2;
+      sink->rec = s_realloc(sink->rec, sink->rec_cap);
+   }
+   memcpy(sink->rec + sink->written, ptr, len);
+}
+/** @return 0 if all of ptr is taken */
+static int sink_feed(LwqqHttpRequest* req, const char* ptr, size_t len)
+{
+   HttpSink* sink = &((LwqqHttpRequest_*)req)->sink;
+   size_t n;
+   ssize_t w;
+   switch (sink->type) {
+   case SINK_FILE:
+      if (fwrite(ptr, 1, len, sink->file) != len)
+         return -1;
+      break;
+   case SINK_FD:
+      for (n = 0; n < len; n += w) {
+         if ((w = write(sink->fd, ptr + n, len - n)) <= 0)
+            return -1;
+      }
+      break;
+   case SINK_MMAP:
+      if (sink->written + len > sink->map_size
+          && sink_map(req, sink, sink->written + len))
+         return -1;
+      memcpy(sink->map + sink->written, ptr, len);
+      break;
+   case SINK_CALLBACK:
+      for (n = 0; n < len; n += w) {
+         w = sink->buf_size - sink->buf_len;
+         if (w > len - n)
+            w = len - n;
+         memcpy(sink->buf + sink->buf_len, ptr + n, w);
+         sink->buf_len += w;
+         if (sink->buf_len == sink->buf_size && sink_flush(sink))
+            return -1;
+      }
+      break;
+   default:
+      return -1;
+   }
+   if (lwqq_http_capture_mode() == LWQQ_CAPTURE_RECORD)
+      sink_tee(sink, ptr, len);
+   sink->written += len;
+   return 0;
+}
+static size_t sink_write(const char* ptr, size_t size, size_t nmemb,
+                         void* userdata)
+{
+   LwqqHttpRequest* req = (LwqqHttpRequest*)userdata;
+   long http_code = 0;
+   size_t sz_ = size * nmemb;
+   curl_easy_getinfo(req->req, CURLINFO_RESPONSE_CODE, &http_code);
+   // this is a redirection. ignore it.
+   if (http_code == 301 || http_code == 302)
+      return sz_;
+   return sink_feed(req, ptr, sz_) ? 0 : sz_;
+}
+/** body is complete, resp_len is its size */
+static void sink_finish(LwqqHttpRequest* req)
+{
+   HttpSink* sink = &((LwqqHttpRequest_*)req)->sink;
+   switch (sink->type) {
+   case SINK_FILE:
+      fflush(sink->file);
+      break;
+   case SINK_MMAP:
+      // mapping is larger than body, cut the file to real size
+      sink_unmap(sink);
+      if (ftruncate(sink->fd, sink->written))
+         lwqq_log(LOG_WARNING, "can't truncate download\n");
+      break;
+   case SINK_CALLBACK:
+      sink_flush(sink);
+      break;
+   default:
+      break;
+   }
+   req->resp_len = sink->written;
+}
+/** keep body of last call, next do_request appends after it */
+static void sink_commit(HttpSink* sink)
+{
+   // mapping always starts at beginning of file
+   if (sink->type != SINK_MMAP)
+      sink->start += sink->written;
+   sink->written = 0;
+}
+/** a transfer is retried, drop what it wrote */
+static void sink_rewind(HttpSink* sink)
+{
+   if (sink->written == 0 && sink->buf_len == 0)
+      return;
+   switch (sink->type) {
+   case SINK_FILE:
+      fseek(sink->file, sink->start, SEEK_SET);
+      break;
+   case SINK_FD:
+      if (lseek(sink->fd, sink->start, SEEK_SET) == sink->start)
+         ftruncate(sink->fd, sink->start);
+      break;
+   case SINK_MMAP:
+      sink_unmap(sink);
+      break;
+   case SINK_CALLBACK:
+      // tell callback that body starts over
+      sink->buf_len = 0;
+      sink->func(sink->data, NULL, 0);
+      break;
+   default:
+      break;
+   }
+   sink->written = 0;
+}
+static void sink_close(HttpSink* sink)
+{
+   sink_unmap(sink);
+   if (sink->own_fd && sink->fd >= 0)
+      close(sink->fd);
+   s_free(sink->buf);
+   s_free(sink->rec);
+   memset(sink, 0, sizeof(*sink));
+}
 // clean states between two curl request
 static void http_clean(LwqqHttpRequest* req)
 {
    LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+   sink_rewind(&req_->sink);
 #ifdef HAVE_OPEN_MEMSTREAM
    if (req_->mem_buf)
       fclose(req_->mem_buf);
@@ -246,12 +541,13 @@ static void http_clean(LwqqHttpRequest* req)
    req->http_code = 0;
    curl_slist_free_all(req->recv_head);
    req->recv_head = NULL;
-   req_->bits &= ~(HTTP_UNEXPECTED_RECV | HTTP_FORCE_CANCEL);
+   req_->bits &= ~(HTTP_UNEXPECTED_RECV | HTTP_FORCE_CANCEL | HTTP_REPLAYED);
 }
 static void http_reset(LwqqHttpRequest* req)
 // clean and reset between two call do_request_*
 {
    LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+   sink_commit(&req_->sink);
    http_clean(req);
    req_->retry_ = req->retry;
    lwqq_http_set_option(req, LWQQ_HTTP_TIMEOUT, req_->timeout);
@@ -332,12 +628,144 @@ static const char* lwqq_http_get_header(LwqqHttpRequest* request,
    return h;
 }
 
-char* lwqq_http_get_cookie(LwqqHttpRequest* req, const char* name)
+static unsigned cookie_bucket(const char* name)
 {
-   if (!name) {
-      lwqq_log(LOG_ERROR, "Invalid parameter\n");
-      return NULL;
+   unsigned h = 5381;
+   while (*name)
+      h = h * 33 + (unsigned char)*name++;
+   return h % COOKIE_BUCKETS;
+}
+/** copy host of url into buf */
+static const char* url_host(const char* url, char* buf, size_t size)
+{
+   const char* p = url ? strstr(url, "://") : NULL;
+   size_t len;
+   p = p ? p + 3 : (url ? url : "");
+   len = strcspn(p, ":/?#");
+   if (len >= size)
+      len = size - 1;
+   memcpy(buf, p, len);
+   buf[len] = '\0';
+   return buf;
+}
+static int cookie_match(const CookieNode* c, const char* host)
+{
+   size_t hl = strlen(host), dl = strlen(c->domain);
+   if (strcasecmp(host, c->domain) == 0)
+      return 1;
+   return !c->host_only && hl > dl && host[hl - dl - 1] == '.'
+          && strcasecmp(host + hl - dl, c->domain) == 0;
+}
+static void cookie_node_free(CookieNode* c)
+{
+   s_free(c->name);
+   s_free(c->value);
+   s_free(c->domain);
+   s_free(c);
+}
+/** value NULL removes cookie */
+static void jar_store(LwqqHttpHandle_* h, const char* name, const char* value,
+                      const char* domain, int host_only)
+{
+   CookieNode** pc, *c;
+   if (*domain == '.')
+      domain++;
+   pthread_mutex_lock(&h->jar_lock);
+   for (pc = &h->jar[cookie_bucket(name)]; (c = *pc); pc = &c->next) {
+      if (strcmp(c->name, name) == 0 && strcasecmp(c->domain, domain) == 0)
+         break;
+   }
+   if (c && value == NULL) {
+      *pc = c->next;
+      cookie_node_free(c);
+   } else if (c) {
+      lwqq_override(c->value, s_strdup(value));
+      c->host_only = host_only;
+   } else if (value) {
+      c = s_malloc0(sizeof(*c));
+      c->name = s_strdup(name);
+      c->value = s_strdup(value);
+      c->domain = s_strdup(domain);
+      c->host_only = host_only;
+      c->next = *pc;
+      *pc = c;
+   }
+   pthread_mutex_unlock(&h->jar_lock);
+}
+/** @return copy of cookie with longest domain matching host, or NULL */
+static char* jar_lookup(LwqqHttpHandle_* h, const char* name, const char* host)
+{
+   CookieNode* c, *best = NULL;
+   char* ret = NULL;
+   pthread_mutex_lock(&h->jar_lock);
+   for (c = h->jar[cookie_bucket(name)]; c; c = c->next) {
+      if (strcmp(c->name, name) == 0 && cookie_match(c, host)
+          && (!best || strlen(c->domain) > strlen(best->domain)))
+         best = c;
    }
+   if (best)
+      ret = s_strdup(best->value);
+   pthread_mutex_unlock(&h->jar_lock);
+   return ret;
+}
+static void jar_free(LwqqHttpHandle_* h)
+{
+   CookieNode* c;
+   int i;
+   for (i = 0; i < COOKIE_BUCKETS; i++) {
+      while ((c = h->jar[i])) {
+         h->jar[i] = c->next;
+         cookie_node_free(c);
+      }
+   }
+   pthread_mutex_destroy(&h->jar_lock);
+}
+/** parse one 'Set-Cookie: n=v; Domain=d; Expires=...' header into jar */
+static void jar_set_cookie(LwqqHttpHandle_* h, const char* line,
+                           const char* host)
+{
+   char buf[2048], domain[256];
+   char* p, *attr, *save = NULL, *name, *value;
+   int host_only = 1, expired = 0;
+   snprintf(buf, sizeof(buf), "%s", line + strlen("Set-Cookie:"));
+   buf[strcspn(buf, "\r\n")] = '\0';
+   snprintf(domain, sizeof(domain), "%s", host);
+   p = strtok_r(buf, ";", &save);
+   if (!p || !(value = strchr(p, '=')))
+      return;
+   *value++ = '\0';
+   name = p + strspn(p, " \t");
+   name[strcspn(name, " \t")] = '\0';
+   while ((attr = strtok_r(NULL, ";", &save))) {
+      attr += strspn(attr, " \t");
+      if (strncasecmp(attr, "domain=", 7) == 0 && attr[7]) {
+         snprintf(domain, sizeof(domain), "%s", attr + 7);
+         host_only = 0;
+      } else if (strncasecmp(attr, "max-age=", 8) == 0)
+         expired = atol(attr + 8) <= 0;
+      else if (strncasecmp(attr, "expires=", 8) == 0) {
+         time_t t = curl_getdate(attr + 8, NULL);
+         expired = t != -1 && t < time(NULL);
+      }
+   }
+   domain[strcspn(domain, " \t")] = '\0';
+   if (*name)
+      jar_store(h, name, expired ? NULL : value, domain, host_only);
+}
+/** a Set-Cookie is received by req, curl keeps it too */
+static void cookie_received(LwqqHttpRequest* req, const char* line)
+{
+   LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+   char host[256];
+   if (req_->handle && strncasecmp(line, "Set-Cookie:", 11) == 0)
+      jar_set_cookie(req_->handle, line,
+                     url_host(lwqq_http_get_url(req), host, sizeof(host)));
+}
+/** slow path, search whole curl cookie list.
+ * domain and host_only of found cookie are filled if domain is not NULL */
+static char* curl_cookie(LwqqHttpRequest* req, const char* name, char* domain,
+                         size_t size, int* host_only)
+{
    struct curl_slist* list, *cookie;
    curl_easy_getinfo(req->req, CURLINFO_COOKIELIST, &cookie);
    list = cookie;
@@ -351,12 +779,66 @@ char* lwqq_http_get_cookie(LwqqHttpRequest* req, const char* name)
       if (v - n - 1 == strlen(name) && strncmp(name, n, v - n - 1) == 0) {
          break;
       }
+      v = NULL;
       list = list->next;
    }
+   if (v && domain) {
+      // netscape format: domain \t tailmatch \t path \t ...
+      const char* d = list->data;
+      size_t len;
+      if (strncmp(d, "#HttpOnly_", 10) == 0)
+         d += 10;
+      len = strcspn(d, "\t");
+      *host_only = strncmp(d + len, "\tTRUE\t", 6) != 0;
+      if (len >= size)
+         len = size - 1;
+      memcpy(domain, d, len);
+      domain[len] = '\0';
+   }
    char* res = s_strdup(v);
    curl_slist_free_all(cookie);
    return res;
 }
+
+char* lwqq_http_get_cookie(LwqqHttpRequest* req, const char* name)
+{
+   if (!name) {
+      lwqq_log(LOG_ERROR, "Invalid parameter\n");
+      return NULL;
+   }
+   LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+   char host[256];
+   char* v;
+   int host_only;
+   if (!req_->handle)
+      return curl_cookie(req, name, NULL, 0, NULL);
+   url_host(lwqq_http_get_url(req), host, sizeof(host));
+   v = jar_lookup(req_->handle, name, host);
+   // cookie loaded by curl itself, such as from cookie file. keep it under
+   // domain of curl, so a later Set-Cookie of that domain replaces it
+   if (v == NULL
+       && (v = curl_cookie(req, name, host, sizeof(host), &host_only)))
+      jar_store(req_->handle, name, v, host, host_only);
+   return v;
+}
+
+LWQQ_EXPORT
+char* lwqq_http_client_cookie(LwqqClient* lc, const char* url,
+                              const char* name)
+{
+   LwqqHttpHandle_* h = (LwqqHttpHandle_*)lwqq_get_http_handle(lc);
+   char host[256];
+   char* v;
+   if (!name || !url)
+      return NULL;
+   v = jar_lookup(h, name, url_host(url, host, sizeof(host)));
+   if (v == NULL) {
+      LwqqHttpRequest* req = lwqq_http_create_default_request(lc, url, 0);
+      v = lwqq_http_get_cookie(req, name);
+      lwqq_http_request_free(req);
+   }
+   return v;
+}
 void lwqq_http_set_cookie(LwqqHttpRequest* req, const char* name,
                           const char* val, int store)
 {
@@ -373,6 +855,7 @@ void lwqq_http_set_cookie(LwqqHttpRequest* req, const char* name,
    if (store) {
       snprintf(buf, sizeof(buf), "Set-Cookie: %s=%s;", name, val);
       ret = curl_easy_setopt(req->req, CURLOPT_COOKIELIST, buf);
+      cookie_received(req, buf);
    } else {
       snprintf(buf, sizeof(buf), "%s %s=%s;", req_->cookie ?: "", name, val);
       lwqq_override(req_->cookie, strdup(buf));
@@ -394,6 +877,7 @@ int lwqq_http_request_free(LwqqHttpRequest* request)
    LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)request;
 
    if (request) {
+      sink_close(&req_->sink);
       http_clean(request);
       s_free(request->response);
       curl_slist_free_all(request->header);
@@ -403,6 +887,7 @@ int lwqq_http_request_free(LwqqHttpRequest* request)
          curl_easy_cleanup(request->req);
       }
       s_free(req_->cookie);
+      s_free(req_->post);
       s_free(request);
    }
    return 0;
@@ -431,6 +916,11 @@ static size_t write_header(void* ptr, size_t size, size_t nmemb, void* userdata)
 	}
 #endif
    request->recv_head = curl_slist_append(request->recv_head, (char*)ptr);
+   if (size * nmemb > 11 && strncasecmp(ptr, "Set-Cookie:", 11) == 0) {
+      char line[2048];
+      snprintf(line, sizeof(line), "%.*s", (int)(size * nmemb), (char*)ptr);
+      cookie_received(request, line);
+   }
    return size * nmemb;
 }
 static int curl_debug_redirect(CURL* h, curl_infotype t, char* msg, size_t len,
@@ -444,6 +934,137 @@ static int curl_debug_redirect(CURL* h, curl_infotype t, char* msg, size_t len,
    lwqq_verbose(3, "%s", buffer);
    return 0;
 }
+
+static void base_host_init()
+{
+   const char* env = getenv("LWQQ_BASE_HOST");
+   if (env && *env && !base_host)
+      base_host = s_strdup(env);
+}
+
+LWQQ_EXPORT
+void lwqq_http_set_base_host(const char* base)
+{
+   pthread_once(&base_host_once, base_host_init);
+   pthread_mutex_lock(&base_host_lock);
+   lwqq_override(base_host, s_strdup(base));
+   pthread_mutex_unlock(&base_host_lock);
+}
+
+/**
+ * replace scheme and host of uri with base
+ * @return new url, free it with s_free. NULL if uri has no scheme
+ */
+static char* replace_base(const char* uri, const char* base)
+{
+   const char* path = strstr(uri, "://");
+   if (!path)
+      return NULL;
+   path = strchr(path + 3, '/');
+   path = path ?: "/";
+   size_t len = strlen(base) + strlen(path) + 1;
+   char* url = s_malloc(len);
+   snprintf(url, len, "%s%s", base, path);
+   return url;
+}
+
+/** @return uri on base host, NULL if it is not rewritten */
+static char* rewrite_url(const char* uri)
+{
+   char* url = NULL;
+   pthread_once(&base_host_once, base_host_init);
+   pthread_mutex_lock(&base_host_lock);
+   if (base_host)
+      url = replace_base(uri, base_host);
+   pthread_mutex_unlock(&base_host_lock);
+   return url;
+}
+
+/** exact host first, then the longest matched '*' pattern */
+static LwqqEndpoint* endpoint_find(LwqqHttpHandle* h, const char* url)
+{
+   const char* host = url ? strstr(url, "://") : NULL;
+   LwqqEndpoint* ep, *match = NULL;
+   size_t len, best = 0;
+   if (!host)
+      return NULL;
+   host += 3;
+   len = strcspn(host, ":/?#");
+   LIST_FOREACH(ep, &h->endpoints, entries)
+   {
+      const char* pat = ep->host;
+      size_t plen = strlen(pat);
+      if (plen == len && strncmp(pat, host, len) == 0)
+         return ep;
+      if (pat[0] != '*' || plen > len + 1 || (match && plen <= best))
+         continue;
+      if (strncmp(host + len - (plen - 1), pat + 1, plen - 1) == 0) {
+         match = ep;
+         best = plen;
+      }
+   }
+   return match;
+}
+
+/** route request to endpoint of url */
+static void endpoint_apply(LwqqHttpHandle* h, LwqqHttpRequest* req,
+                           const char* url)
+{
+   LwqqHttpHandle_* h_ = (LwqqHttpHandle_*)h;
+   pthread_mutex_lock(&h_->endpoint_lock);
+   if (LIST_EMPTY(&h->endpoints)) {
+      pthread_mutex_unlock(&h_->endpoint_lock);
+      return;
+   }
+   LwqqEndpoint* ep = endpoint_find(h, url);
+   ((LwqqHttpRequest_*)req)->endpoint = ep;
+   if (ep && ep->base) {
+      char* rewritten = replace_base(url, ep->base);
+      if (rewritten)
+         curl_easy_setopt(req->req, CURLOPT_URL, rewritten);
+      s_free(rewritten);
+   }
+#if LIBCURL_VERSION_NUM >= 0x072800
+   curl_easy_setopt(req->req, CURLOPT_UNIX_SOCKET_PATH,
+                    ep ? ep->unix_socket : NULL);
+#else
+   if (ep && ep->unix_socket)
+      lwqq_log(LOG_WARNING, "unix socket needs libcurl 7.40.0\n");
+#endif
+   pthread_mutex_unlock(&h_->endpoint_lock);
+}
+
+LWQQ_EXPORT
+void lwqq_http_set_endpoint(LwqqHttpHandle* handle, const char* host,
+                            const char* base, const char* unix_socket,
+                            int max_conn)
+{
+   LwqqEndpoint* ep;
+   if (!handle || !host)
+      return;
+   LwqqHttpHandle_* h_ = (LwqqHttpHandle_*)handle;
+   pthread_mutex_lock(&h_->endpoint_lock);
+   LIST_FOREACH(ep, &handle->endpoints, entries)
+   {
+      if (strcmp(ep->host, host) == 0)
+         break;
+   }
+   // never free a route, queued requests still point to it
+   if (ep == NULL) {
+      ep = s_malloc0(sizeof(*ep));
+      ep->host = s_strdup(host);
+      LIST_INSERT_HEAD(&handle->endpoints, ep, entries);
+   }
+   lwqq_override(ep->base, s_strdup(base));
+   lwqq_override(ep->unix_socket, s_strdup(unix_socket));
+   pthread_mutex_lock(&endpoint_conn_lock);
+   ep->max_conn = max_conn;
+   // a raised limit lets waiting sync requests go
+   pthread_cond_broadcast(&endpoint_conn_cond);
+   pthread_mutex_unlock(&endpoint_conn_lock);
+   pthread_mutex_unlock(&h_->endpoint_lock);
+}
+
 /**
  * Create a new Http request instance
  *
@@ -454,6 +1075,7 @@ static int curl_debug_redirect(CURL* h, curl_infotype t, char* msg, size_t len,
 LWQQ_EXPORT
 LwqqHttpRequest* lwqq_http_request_new(const char* uri)
 {
+   char* rewritten = NULL;
    if (!uri) {
       return NULL;
    }
@@ -470,10 +1092,12 @@ LwqqHttpRequest* lwqq_http_request_new(const char* uri)
       /* Seem like request->req must be non null. FIXME */
       goto failed;
    }
-   if (curl_easy_setopt(request->req, CURLOPT_URL, uri) != 0) {
-      lwqq_log(LOG_WARNING, "Invalid uri: %s\n", uri);
+   rewritten = rewrite_url(uri);
+   if (curl_easy_setopt(request->req, CURLOPT_URL, rewritten ?: uri) != 0) {
+      lwqq_log(LOG_WARNING, "Invalid uri: %s\n", rewritten ?: uri);
       goto failed;
    }
+   s_free(rewritten);
    curl_easy_setopt(request->req, CURLOPT_HEADERFUNCTION, write_header);
    curl_easy_setopt(request->req, CURLOPT_HEADERDATA, request);
    curl_easy_setopt(request->req, CURLOPT_NOSIGNAL, 1);
@@ -496,9 +1120,11 @@ LwqqHttpRequest* lwqq_http_request_new(const char* uri)
    request->get_header = lwqq_http_get_header;
    request->add_form = lwqq_http_add_form;
    request->add_file_content = lwqq_http_add_file_content;
+   request->add_file_path = lwqq_http_add_file_path;
    return request;
 
 failed:
+   s_free(rewritten);
    if (request) {
       lwqq_http_request_free(request);
    }
@@ -627,6 +1253,8 @@ LwqqHttpRequest* lwqq_http_create_default_request(LwqqClient* lc,
    LwqqHttpHandle_* h_ = (LwqqHttpHandle_*)h;
    curl_easy_setopt(req->req, CURLOPT_SHARE, h_->share);
    lwqq_http_proxy_apply(h, req);
+   endpoint_apply(h, req, url);
+   ((LwqqHttpRequest_*)req)->handle = h_;
    LWQQ_HTTP_EV(req)->lc = lc;
    return req;
 }
@@ -654,14 +1282,21 @@ static void uncompress_response(LwqqHttpRequest* req)
 static void curl_network_begin(LwqqHttpRequest* req)
 {
    LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+#ifndef HAVE_OPEN_MEMSTREAM
+   SIMPLEQ_INIT(&req_->trunks);
+#endif
+   if (req_->bits & HTTP_FILE_MODE) {
+      // body is streamed as is, let curl decode it
+      curl_easy_setopt(req->req, CURLOPT_ACCEPT_ENCODING, "");
+      curl_easy_setopt(req->req, CURLOPT_WRITEFUNCTION, sink_write);
+      curl_easy_setopt(req->req, CURLOPT_WRITEDATA, req);
+      return;
+   }
 #ifdef HAVE_OPEN_MEMSTREAM
    curl_easy_setopt(req->req, CURLOPT_WRITEFUNCTION, NULL);
    req_->mem_buf = open_memstream(&req->response, &req->resp_len);
    curl_easy_setopt(req->req, CURLOPT_WRITEDATA, req_->mem_buf);
 #else
-   SIMPLEQ_INIT(&req_->trunks);
-   if(req_->bits & HTTP_FILE_MODE)
-      return;
    curl_easy_setopt(req->req, CURLOPT_WRITEFUNCTION, write_content);
    curl_easy_setopt(req->req, CURLOPT_WRITEDATA, req);
 #endif
@@ -670,8 +1305,15 @@ static void curl_network_begin(LwqqHttpRequest* req)
 static void curl_network_complete(LwqqHttpRequest* req)
 {
    long http_code = 0;
+   // response is filled from capture
+   if (((LwqqHttpRequest_*)req)->bits & HTTP_REPLAYED)
+      return;
    curl_easy_getinfo(req->req, CURLINFO_RESPONSE_CODE, &http_code);
    req->http_code = http_code;
+   if (((LwqqHttpRequest_*)req)->bits & HTTP_FILE_MODE) {
+      sink_finish(req);
+      return;
+   }
 
 #ifdef HAVE_OPEN_MEMSTREAM
    LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
@@ -692,17 +1334,112 @@ static void curl_network_complete(LwqqHttpRequest* req)
    }
 }
 
+static char* slist_join(struct curl_slist* list, const char* eol)
+{
+   size_t len = 1, eol_len = strlen(eol);
+   struct curl_slist* l;
+   for (l = list; l; l = l->next)
+      len += strlen(l->data) + eol_len;
+   char* str = s_malloc(len), *p = str;
+   for (l = list; l; l = l->next)
+      p += sprintf(p, "%s%s", l->data, eol);
+   *p = '\0';
+   return str;
+}
+
+static void capture_record(LwqqHttpRequest* req, CURLcode code)
+{
+   LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+   LwqqCaptureEntry e = { 0 };
+   double total = 0;
+   curl_easy_getinfo(req->req, CURLINFO_TOTAL_TIME, &total);
+   e.method = req_->method;
+   e.http_code = req->http_code;
+   e.curl_code = code;
+   e.duration = total * 1000000;
+   e.url = (char*)lwqq_http_get_url(req);
+   e.req_head = slist_join(req->header, "\r\n");
+   e.body = req_->post;
+   e.body_len = req_->post ? strlen(req_->post) : 0;
+   e.resp_head = slist_join(req->recv_head, "");
+   if (req_->bits & HTTP_FILE_MODE) {
+      // body went to sink, record the copy it kept
+      e.response = req_->sink.rec;
+      e.resp_len = req_->sink.rec ? req_->sink.written : 0;
+   } else {
+      e.response = req->response;
+      e.resp_len = req->response ? req->resp_len : 0;
+   }
+   lwqq__capture_record(&e);
+   s_free(e.req_head);
+   s_free(e.resp_head);
+}
+
+/**
+ * fill response of req from capture
+ * @param delay recorded duration in microseconds
+ * @return error code of the recorded request
+ */
+static int capture_replay(LwqqHttpRequest* req, uint64_t* delay)
+{
+   LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)req;
+   const LwqqCaptureEntry* e
+       = lwqq__capture_next(req_->method, lwqq_http_get_url(req));
+   char line[4096];
+   const char* p, *eol;
+
+   req_->bits |= HTTP_REPLAYED;
+   *delay = 0;
+   if (e == NULL) {
+      req_->ev.err = LWQQ_EC_NETWORK_ERROR;
+      req_->ev.conn_err = CURLE_COULDNT_CONNECT;
+      return req_->ev.err;
+   }
+   *delay = e->duration;
+   req->http_code = e->http_code;
+   if (req_->bits & HTTP_FILE_MODE) {
+      if (e->resp_len)
+         sink_feed(req, e->response, e->resp_len);
+      sink_finish(req);
+   } else if (e->resp_len) {
+      req->response = s_malloc(e->resp_len + 1);
+      memcpy(req->response, e->response, e->resp_len);
+      req->response[e->resp_len] = '\0';
+      req->resp_len = e->resp_len;
+   }
+   for (p = e->resp_head; *p; p = eol) {
+      eol = strchr(p, '\n');
+      eol = eol ? eol + 1 : p + strlen(p);
+      snprintf(line, sizeof(line), "%.*s", (int)(eol - p), p);
+      req->recv_head = curl_slist_append(req->recv_head, line);
+      // let curl cookie engine see cookies as if they were received
+      if (strncasecmp(line, "Set-Cookie:", 11) == 0) {
+         line[strcspn(line, "\r\n")] = '\0';
+         curl_easy_setopt(req->req, CURLOPT_COOKIELIST, line);
+         cookie_received(req, line);
+      }
+   }
+   req_->ev.err = e->curl_code ? errno_map(e->curl_code) : LWQQ_EC_OK;
+   req_->ev.conn_err = e->curl_code;
+   return req_->ev.err;
+}
+
 static void async_complete(D_ITEM* conn)
 {
    LwqqHttpRequest* request = conn->req;
    LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)conn->req;
 
    curl_network_complete(request);
+   if (lwqq_http_capture_mode() == LWQQ_CAPTURE_RECORD
+       && !(req_->bits & HTTP_REPLAYED))
+      capture_record(request, req_->ev.err ? req_->ev.conn_err : CURLE_OK);
 
    if (!lwqq_client_valid(LWQQ_HTTP_EV(request)->lc))
       goto cleanup;
    int res = 0;
+   LwqqTraceCtx prev = lwqq_trace_resume(lwqq_async_event_trace(conn->event));
    vp_do(conn->cmd, &res);
+   lwqq_trace_resume(prev);
    // copy out error code internal
    *conn->event = req_->ev;
    // req's ev.result is http status, only used in internal, req only exists in
@@ -711,7 +1448,22 @@ static void async_complete(D_ITEM* conn)
    conn->event->result = res;
    lwqq_async_event_finish(conn->event);
 cleanup:
-   s_free(conn);
+   s_slab_free(&d_item_slab, conn);
+}
+/** record curl transfer as a span, the endpoint is its arg */
+static void trace_transfer(CURL* easy, LwqqTraceCtx parent)
+{
+   if (!LWQQ_TRACE_ON() || parent.trace_id == 0)
+      return;
+   char* url = NULL;
+   char endpoint[LWQQ_TRACE_ARG_LEN];
+   double total = 0;
+   curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+   curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME, &total);
+   lwqq__http_endpoint(url, endpoint, sizeof(endpoint));
+   uint64_t dur = total * 1000000;
+   lwqq_trace_record(&parent, "curl", endpoint, lwqq__metrics_now() - dur,
+                     dur);
 }
 static int set_error_code(LwqqHttpRequest* req, CURLcode err, LwqqErrorCode* ec)
 {
@@ -751,27 +1503,28 @@ static void check_multi_info(GLOBAL* g)
          curl_easy_getinfo(easy, CURLINFO_PRIVATE, &pridat);
          conn = (D_ITEM*)pridat;
          req = conn->req;
+         trace_transfer(easy, lwqq_async_event_trace(conn->event));
          if (ret != CURLE_OK) {
             lwqq_log(LOG_WARNING, "async retcode:%d %s\n", ret,
                      curl_easy_strerror(ret));
             LwqqErrorCode ec;
             if (set_error_code(req, ret, &ec)) {
+               lwqq__http_metrics_done(easy, ret, 1, conn->queued);
                // re add it to libcurl
                curl_multi_remove_handle(g->multi, easy);
                http_clean(req);
-               TAILQ_REMOVE(&global.conn_link, conn, entries);
+               conn_link_remove(conn);
+               conn->queued = lwqq__metrics_now();
                TAILQ_INSERT_TAIL(&global.add_link, conn, entries);
-               global.conn_length--;
                lwqq_log(LOG_WARNING, "retry left:%d\n",
                         ((LwqqHttpRequest_*)req)->retry_);
                continue;
             }
          }
+         lwqq__http_metrics_done(easy, ret, 0, conn->queued);
 
          curl_multi_remove_handle(g->multi, easy);
-         TAILQ_REMOVE(&global.conn_link, conn, entries);
-
-         global.conn_length--;
+         conn_link_remove(conn);
 
          LwqqClient* lc = LWQQ_HTTP_EV(conn->req)->lc;
 
@@ -857,13 +1610,13 @@ static int sock_cb(CURL* e, curl_socket_t s, int what, void* cbp, void* sockp)
          if (si->evset)
             lwqq_async_io_stop(si->ev);
          lwqq_async_io_free(si->ev);
-         s_free(si);
+         s_slab_free(&s_item_slab, si);
          si = NULL;
       }
    } else {
       if (si == NULL) {
          //关联socket;
-         si = s_malloc0(sizeof(*si));
+         si = s_slab_alloc(&s_item_slab);
          si->ev = lwqq_async_io_new();
          setsock(si, s, e, what, g);
          curl_multi_assign(g->multi, s, si);
@@ -878,11 +1631,18 @@ static int sock_cb(CURL* e, curl_socket_t s, int what, void* cbp, void* sockp)
 static void check_handle_and_add_to_conn_link()
 {
    D_ITEM* di, *tvar;
+   uint64_t now = lwqq__metrics_now();
    TAILQ_FOREACH_SAFE(di, &global.add_link, entries, tvar)
    {
       if (global.conn_length >= global.cache_size)
          break;
+      LwqqEndpoint* ep = ((LwqqHttpRequest_*)di->req)->endpoint;
+      // endpoint is full, let requests to other hosts go first
+      if (ep && !endpoint_acquire(ep, 0))
+         continue;
       TAILQ_REMOVE(&global.add_link, di, entries);
+      di->queued = now - di->queued;
+      di->endpoint = ep;
       TAILQ_INSERT_TAIL(&global.conn_link, di, entries);
       CURLMcode rc = curl_multi_add_handle(global.multi, di->req->req);
       global.conn_length++;
@@ -954,17 +1714,32 @@ static LwqqAsyncEvent* lwqq_http_do_request_async(LwqqHttpRequest* request,
       goto failed;
    }
 
+   LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)request;
+   req_->method = method;
+   if (lwqq_http_capture_mode() == LWQQ_CAPTURE_RECORD)
+      lwqq_override(req_->post, s_strdup(body));
+
+   D_ITEM* di = s_slab_alloc(&d_item_slab);
+   di->cmd = command;
+   di->req = request;
+   di->event = lwqq_async_event_new(request);
+   if (lwqq_http_capture_mode() >= LWQQ_CAPTURE_REPLAY) {
+      uint64_t delay;
+      capture_replay(request, &delay);
+      if (lwqq_http_capture_mode() != LWQQ_CAPTURE_REPLAY_TIMED)
+         delay = 0;
+      lc->dispatch(_C_(p, async_complete, di), delay / 1000);
+      return di->event;
+   }
+
    if (global.multi == NULL) {
       lwqq_http_global_init();
    }
 
    curl_network_begin(request);
 
-   D_ITEM* di = s_malloc0(sizeof(*di));
    curl_easy_setopt(request->req, CURLOPT_PRIVATE, di);
-   di->cmd = command;
-   di->req = request;
-   di->event = lwqq_async_event_new(request);
+   di->queued = lwqq__metrics_now();
    pthread_mutex_lock(&add_lock);
    TAILQ_INSERT_TAIL(&global.add_link, di, entries);
    pthread_mutex_unlock(&add_lock);
@@ -980,9 +1755,10 @@ static int lwqq_http_do_request(LwqqHttpRequest* request, int method,
    if (!request->req)
       return -1;
    CURLcode ret;
+   LwqqHttpRequest_* req_ = (LwqqHttpRequest_*)request;
    http_reset(request);
    // mark this request is synced
-   ((LwqqHttpRequest_*)request)->bits |= HTTP_SYNCED;
+   req_->bits |= HTTP_SYNCED;
 retry:
    ret = 0;
 
@@ -998,21 +1774,44 @@ retry:
       lwqq_log(LOG_WARNING, "Wrong http method\n");
       return -1;
    }
+   req_->method = method;
+   if (lwqq_http_capture_mode() >= LWQQ_CAPTURE_REPLAY) {
+      uint64_t delay;
+      int err = capture_replay(request, &delay);
+      if (lwqq_http_capture_mode() == LWQQ_CAPTURE_REPLAY_TIMED)
+         usleep(delay);
+      return err;
+   }
+   if (lwqq_http_capture_mode() == LWQQ_CAPTURE_RECORD)
+      lwqq_override(req_->post, s_strdup(body));
 
    curl_network_begin(request);
 
+   // sync requests count in max_conn of endpoint too
+   if (req_->endpoint)
+      endpoint_acquire(req_->endpoint, req_->timeout > 0 ? req_->timeout : 1);
    ret = curl_easy_perform(request->req);
+   if (req_->endpoint)
+      endpoint_release(req_->endpoint);
 
    curl_network_complete(request);
+   trace_transfer(request->req, lwqq_trace_current());
 
    if (ret != CURLE_OK) {
       lwqq_log(LOG_ERROR, "do_request fail curlcode:%d\n", ret);
       LwqqErrorCode ec;
       if (set_error_code(request, ret, &ec)) {
+         lwqq__http_metrics_done(request->req, ret, 1, -1);
          goto retry;
       }
+      lwqq__http_metrics_done(request->req, ret, 0, -1);
+      if (lwqq_http_capture_mode() == LWQQ_CAPTURE_RECORD)
+         capture_record(request, ret);
       return ec;
    }
+   lwqq__http_metrics_done(request->req, ret, 0, -1);
+   if (lwqq_http_capture_mode() == LWQQ_CAPTURE_RECORD)
+      capture_record(request, ret);
 
    return 0;
 }
@@ -1134,13 +1933,13 @@ void lwqq_http_global_free(LwqqCleanUp cleanup)
       D_ITEM* item, *tvar;
       TAILQ_FOREACH_SAFE(item, &global.conn_link, entries, tvar)
       {
-         TAILQ_REMOVE(&global.conn_link, item, entries);
+         conn_link_remove(item);
          // let callback delete data
          LWQQ_HTTP_EV(item->req)->err = item->event->result = LWQQ_EC_CANCELED;
          vp_do(item->cmd, NULL);
          if (cleanup == LWQQ_CLEANUP_WAITALL)
             lwqq_async_event_finish(item->event);
-         s_free(item);
+         s_slab_free(&d_item_slab, item);
       }
 
       curl_multi_cleanup(global.multi);
@@ -1186,7 +1985,7 @@ void lwqq_http_cleanup(LwqqClient* lc, LwqqCleanUp cleanup)
       {
          if (LWQQ_HTTP_EV(item->req)->lc != lc)
             continue;
-         TAILQ_REMOVE(&global.conn_link, item, entries);
+         conn_link_remove(item);
          LWQQ_HTTP_EV(item->req)->err = item->event->result = LWQQ_EC_CANCELED;
          // let callback delete data
          vp_do(item->cmd, NULL);
@@ -1194,7 +1993,7 @@ void lwqq_http_cleanup(LwqqClient* lc, LwqqCleanUp cleanup)
          if (cleanup == LWQQ_CLEANUP_WAITALL) {
             lwqq_async_event_finish(item->event);
          }
-         s_free(item);
+         s_slab_free(&d_item_slab, item);
       }
       if(LWQQ__ASYNC_IMPL(flags) & USE_THREAD){
          pthread_mutex_lock(&async_lock);
@@ -1222,14 +2021,11 @@ static void lwqq_http_add_form(LwqqHttpRequest* request, LWQQ_FORM form,
    }
    curl_easy_setopt(request->req, CURLOPT_HTTPPOST, request->form_start);
 }
-static void lwqq_http_add_file_content(LwqqHttpRequest* request,
-                                       const char* name, const char* filename,
-                                       const void* data, size_t size,
-                                       const char* extension)
+/** @return content type by extension, or by suffix of filename */
+static const char* file_content_type(const char* filename,
+                                     const char* extension)
 {
-   struct curl_httppost** post = (struct curl_httppost**)&request->form_start;
-   struct curl_httppost** last = (struct curl_httppost**)&request->form_end;
-   char* type = NULL;
+   const char* type = NULL;
    if (extension == NULL) {
       extension = strrchr(filename, '.');
       if (extension != NULL)
@@ -1249,6 +2045,16 @@ static void lwqq_http_add_file_content(LwqqHttpRequest* request,
       else
          type = NULL;
    }
+   return type;
+}
+static void lwqq_http_add_file_content(LwqqHttpRequest* request,
+                                       const char* name, const char* filename,
+                                       const void* data, size_t size,
+                                       const char* extension)
+{
+   struct curl_httppost** post = (struct curl_httppost**)&request->form_start;
+   struct curl_httppost** last = (struct curl_httppost**)&request->form_end;
+   const char* type = file_content_type(filename, extension);
    if (type == NULL) {
       curl_formadd(post, last, CURLFORM_COPYNAME, name, CURLFORM_BUFFER,
                    filename, CURLFORM_BUFFERPTR, data, CURLFORM_BUFFERLENGTH,
@@ -1260,6 +2066,24 @@ static void lwqq_http_add_file_content(LwqqHttpRequest* request,
    }
    curl_easy_setopt(request->req, CURLOPT_HTTPPOST, request->form_start);
 }
+/** curl reads path in small pieces while sending, it is never loaded whole */
+static void lwqq_http_add_file_path(LwqqHttpRequest* request, const char* name,
+                                    const char* filename, const char* path,
+                                    const char* extension)
+{
+   struct curl_httppost** post = (struct curl_httppost**)&request->form_start;
+   struct curl_httppost** last = (struct curl_httppost**)&request->form_end;
+   const char* type = file_content_type(filename, extension);
+   if (type == NULL) {
+      curl_formadd(post, last, CURLFORM_COPYNAME, name, CURLFORM_FILE, path,
+                   CURLFORM_FILENAME, filename, CURLFORM_END);
+   } else {
+      curl_formadd(post, last, CURLFORM_COPYNAME, name, CURLFORM_FILE, path,
+                   CURLFORM_FILENAME, filename, CURLFORM_CONTENTTYPE, type,
+                   CURLFORM_END);
+   }
+   curl_easy_setopt(request->req, CURLOPT_HTTPPOST, request->form_start);
+}
 
 static int lwqq_http_progress_trans(void* d, double dt, double dn, double ut,
                                     double un)
@@ -1317,13 +2141,57 @@ void lwqq_http_set_option(LwqqHttpRequest* req, LwqqHttpOption opt, ...)
       curl_easy_setopt(req->req, CURLOPT_FOLLOWLOCATION, !va_arg(args, long));
       break;
    case LWQQ_HTTP_SAVE_FILE:
-      curl_easy_setopt(req->req, CURLOPT_WRITEFUNCTION, NULL);
-      curl_easy_setopt(req->req, CURLOPT_WRITEDATA, va_arg(args, FILE*));
+      sink_close(&req_->sink);
+      req_->sink.type = SINK_FILE;
+      req_->sink.file = va_arg(args, FILE*);
+      req_->sink.start = ftell(req_->sink.file);
+      req_->bits |= HTTP_FILE_MODE;
+      break;
+   case LWQQ_HTTP_SAVE_FD:
+      sink_close(&req_->sink);
+      req_->sink.type = SINK_FD;
+      req_->sink.fd = va_arg(args, int);
+      req_->sink.start = lseek(req_->sink.fd, 0, SEEK_CUR);
+      if (req_->sink.start < 0)
+         req_->sink.start = 0;
+      req_->bits |= HTTP_FILE_MODE;
+      break;
+   case LWQQ_HTTP_SAVE_MMAP:
+      sink_close(&req_->sink);
+      req_->sink.fd = open(va_arg(args, const char*),
+                           O_RDWR | O_CREAT | O_TRUNC, 0644);
+      req_->sink.own_fd = 1;
+#ifndef WIN32
+      req_->sink.type = SINK_MMAP;
+#else
+      req_->sink.type = SINK_FD;
+#endif
+      if (req_->sink.fd < 0) {
+         lwqq_log(LOG_ERROR, "can't open download file\n");
+         req_->sink.type = SINK_NONE;
+      }
       req_->bits |= HTTP_FILE_MODE;
       break;
-   case LWQQ_HTTP_RESET_URL:
-      curl_easy_setopt(req->req, CURLOPT_URL, va_arg(args, const char*));
+   case LWQQ_HTTP_SAVE_SINK:
+      sink_close(&req_->sink);
+      req_->sink.type = SINK_CALLBACK;
+      req_->sink.func = va_arg(args, LwqqHttpSinkFunc);
+      req_->sink.data = va_arg(args, void*);
+      req_->sink.buf_size = va_arg(args, size_t);
+      if (req_->sink.buf_size == 0)
+         req_->sink.buf_size = CURL_MAX_WRITE_SIZE;
+      req_->sink.buf = s_malloc(req_->sink.buf_size);
+      req_->bits |= HTTP_FILE_MODE;
       break;
+   case LWQQ_HTTP_RESET_URL: {
+      const char* url = va_arg(args, const char*);
+      char* rewritten = rewrite_url(url);
+      LwqqClient* lc = LWQQ_HTTP_EV(req)->lc;
+      curl_easy_setopt(req->req, CURLOPT_URL, rewritten ?: url);
+      s_free(rewritten);
+      if (lc)
+         endpoint_apply(lwqq_get_http_handle(lc), req, url);
+   } break;
    case LWQQ_HTTP_VERBOSE:
       curl_easy_setopt(req->req, CURLOPT_VERBOSE, va_arg(args, long));
       break;
@@ -1371,6 +2239,8 @@ LwqqHttpHandle* lwqq_http_handle_new()
    int i;
    for (i = 0; i < 4; i++)
       pthread_mutex_init(&h_->share_lock[i], NULL);
+   pthread_mutex_init(&h_->jar_lock, NULL);
+   pthread_mutex_init(&h_->endpoint_lock, NULL);
    return (LwqqHttpHandle*)h_;
 }
 void lwqq_http_handle_free(LwqqHttpHandle* http)
@@ -1380,9 +2250,19 @@ void lwqq_http_handle_free(LwqqHttpHandle* http)
       s_free(http->proxy.username);
       s_free(http->proxy.password);
       s_free(http->proxy.host);
+      LwqqEndpoint* ep;
+      while ((ep = LIST_FIRST(&http->endpoints))) {
+         LIST_REMOVE(ep, entries);
+         s_free(ep->host);
+         s_free(ep->base);
+         s_free(ep->unix_socket);
+         s_free(ep);
+      }
       int i;
       for (i = 0; i < 4; i++)
          pthread_mutex_destroy(&h_->share_lock[i]);
+      pthread_mutex_destroy(&h_->endpoint_lock);
+      jar_free(h_);
       curl_share_cleanup(h_->share);
       s_free(http);
    }
@@ -1480,9 +2360,9 @@ LwqqExtension* lwqq_make_cookie_extension(LwqqClient* lc, const char* filename)
    return (LwqqExtension*)ext;
 }
 
-const char* lwqq_http_impl_errstr(int errno)
+const char* lwqq_http_impl_errstr(int err)
 {
-   return curl_easy_strerror(errno);
+   return curl_easy_strerror(err);
 }
 
 LwqqAsyncEvent* lwqq_http_get_as_ev(LwqqHttpRequest* req)
@@ -24,13 +24,22 @@ typedef enum {
    LWQQ_HTTP_TIMEOUT, // connection timeout
    LWQQ_HTTP_TIMEOUT_INCRE, // auto increment timeout
    LWQQ_HTTP_NOT_FOLLOW,
-   LWQQ_HTTP_SAVE_FILE,
+   LWQQ_HTTP_SAVE_FILE, // FILE*, body is written into it
    LWQQ_HTTP_RESET_URL,
    LWQQ_HTTP_VERBOSE,
    LWQQ_HTTP_CANCELABLE,
    LWQQ_HTTP_MAXREDIRS,
+   LWQQ_HTTP_SAVE_FD, // int, body is written at current offset of fd
+   LWQQ_HTTP_SAVE_MMAP, // const char* path, body is copied into its mapping
+   LWQQ_HTTP_SAVE_SINK, // LwqqHttpSinkFunc, void* data, size_t buffer size
    LWQQ_HTTP_MAX_LINK = 1000
 } LwqqHttpOption;
+/**
+ * receive body of LWQQ_HTTP_SAVE_SINK in pieces of at most buffer size.
+ * ptr NULL means the transfer is retried and body starts over.
+ * @return bytes taken, less than size aborts transfer
+ */
+typedef size_t (*LwqqHttpSinkFunc)(void* data, const char* ptr, size_t size);
 /**
  * Lwqq Http request struct, this http object worked done for lwqq,
  * But for other app, it may work bad.
@@ -84,12 +93,28 @@ typedef struct LwqqHttpRequest {
    void (*add_file_content)(LwqqHttpRequest* request, const char* name,
                             const char* filename, const void* data, size_t size,
                             const char* extension);
+   // add http form file type, read from path while sending
+   void (*add_file_path)(LwqqHttpRequest* request, const char* name,
+                         const char* filename, const char* path,
+                         const char* extension);
    // progressing function callback
    LwqqProgressFunc progress_func;
    void* prog_data;
    time_t last_prog;
 } LwqqHttpRequest;
 
+/**
+ * a runtime route of one webqq host, see lwqq_http_set_endpoint
+ */
+typedef struct LwqqEndpoint {
+   char* host; /** < pattern of original host */
+   char* base; /** < replace scheme and host of url, NULL to keep */
+   char* unix_socket; /** < connect through unix domain socket */
+   int max_conn; /** < max running transfers, 0 is unlimited */
+   int running;
+   LIST_ENTRY(LwqqEndpoint) entries;
+} LwqqEndpoint;
+
 typedef struct LwqqHttpHandle {
    struct {
       enum {
@@ -107,6 +132,7 @@ typedef struct LwqqHttpHandle {
    int quit;
    int synced;
    int ssl;
+   LIST_HEAD(, LwqqEndpoint) endpoints;
 } LwqqHttpHandle;
 
 LwqqHttpHandle* lwqq_http_handle_new();
@@ -124,6 +150,26 @@ void lwqq_http_handle_free(LwqqHttpHandle* http);
 
 void lwqq_http_proxy_apply(LwqqHttpHandle* handle, LwqqHttpRequest* req);
 
+/**
+ * route requests of a host to another endpoint, e.g. a local gateway or
+ * a mock server. it applies to requests created after it by
+ * lwqq_http_create_default_request. setting a host again replaces its
+ * route.
+ * @param host original host, like 'd.web2.qq.com'. '*.web.qq.com' matches
+ *        face1.web.qq.com to face10.web.qq.com, '*' matches every host.
+ *        an exact host is tried before patterns.
+ * @param base 'scheme://host[:port]' replaces scheme and host of url, path
+ *        and query are kept. NULL keeps url.
+ * @param unix_socket path of unix domain socket to connect to instead of
+ *        tcp, NULL to use tcp.
+ * @param max_conn max running transfers to this endpoint, more requests
+ *        wait in queue. sync requests wait too, at most their timeout.
+ *        0 is unlimited.
+ */
+void lwqq_http_set_endpoint(LwqqHttpHandle* handle, const char* host,
+                            const char* base, const char* unix_socket,
+                            int max_conn);
+
 /**
  * Free Http Request
  * always return 0
@@ -163,6 +209,16 @@ const char* lwqq_http_impl_errstr(int);
 
 void lwqq_http_global_init();
 void lwqq_http_global_free(LwqqCleanUp cleanup);
+/**
+ * send every request to base instead of the webqq servers, scheme and host
+ * of url are replaced, path and query are kept.
+ * e.g. with base 'http://127.0.0.1:8080',
+ * 'https://d.web2.qq.com/channel/poll2' goes to
+ * 'http://127.0.0.1:8080/channel/poll2'.
+ * environment variable LWQQ_BASE_HOST is used when it is never set.
+ * @param base NULL to restore the real servers
+ */
+void lwqq_http_set_base_host(const char* base);
 /** stop a client all http progressing request */
 void lwqq_http_cleanup(LwqqClient* lc, LwqqCleanUp cleanup);
 /** set the other option of request, like curl_easy_setopt */
@@ -178,6 +234,11 @@ int lwqq_http_is_synced(LwqqHttpRequest* req);
  *  then a req with url='pp.com' couldn't get this cookie
  */
 char* lwqq_http_get_cookie(LwqqHttpRequest* req, const char* name);
+/** get cookie of client which a request to url would send,
+ *  without creating a request when it is already received
+ */
+char* lwqq_http_client_cookie(LwqqClient* lc, const char* url,
+                              const char* name);
 /** add a cookie with name=val to request,
  * if @store, this would store in cache,
  * if not, this would only affect single request
@@ -10,11 +10,13 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <utime.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "info.h"
 #include "url.h"
@@ -25,10 +27,14 @@
 #include "async.h"
 #include "utility.h"
 #include "internal.h"
+#include "member.h"
+#include "media.h"
+#include "sendq.h"
 
 static int get_avatar_back(LwqqHttpRequest* req, LwqqBuddy* buddy,
                            LwqqGroup* group);
 static int get_friends_info_back(LwqqHttpRequest* req, LwqqAsyncEvent* called);
+static LwqqAsyncEvent* get_friends_info_parallel(LwqqClient* lc);
 static int get_group_name_list_back(LwqqHttpRequest* req,
                                     LwqqAsyncEvent* called);
 static int group_detail_back(LwqqHttpRequest* req, LwqqClient* lc,
@@ -42,16 +48,84 @@ static int add_group_stage_2(LwqqHttpRequest* req, LwqqGroup* g);
 static void add_group_stage_4(LwqqAsyncEvent* called, LwqqVerifyCode* c,
                               LwqqGroup* g, char* msg);
 
+/** at most hash entries of a client, see lwqq_hash_add_entry */
+#define HASH_PROBE_MAX 8
+
 struct LwqqDiscuMemChange {
    struct str_list_* buddies;
    struct str_list_* group_members;
    struct str_list_* relate_groups;
 };
+
+/** move all elements from list @from to empty list @to, keep order */
+#define list_move_all(to, from, field)                                         \
+   do {                                                                        \
+      LIST_FIRST(to) = LIST_FIRST(from);                                       \
+      if (LIST_FIRST(to))                                                      \
+         LIST_FIRST(to)->field.le_prev = &LIST_FIRST(to);                     \
+      LIST_INIT(from);                                                         \
+   } while (0)
+
+/**
+ * take out an existing buddy for refresh, so pointers hold by user keep valid.
+ * only uin is matched, nick is not unique. a buddy restored from snapshot of
+ * an older login has another uin, it is dropped and made again
+ */
+static LwqqBuddy* take_buddy(LwqqFriendList* list, const char* uin)
+{
+   LwqqBuddy* b;
+   if (uin == NULL)
+      return NULL;
+   LIST_FOREACH(b, list, entries)
+   {
+      if (b->uin && strcmp(b->uin, uin) == 0) {
+         LIST_REMOVE(b, entries);
+         return b;
+      }
+   }
+   return NULL;
+}
+
+/** same as take_buddy, matched by gid/did only */
+static LwqqGroup* take_group(LwqqClient* lc, int type, const char* gid)
+{
+   LwqqGroup* g;
+   LwqqGroup* first = (type == LWQQ_GROUP_QUN) ? LIST_FIRST(&lc->groups)
+                                               : LIST_FIRST(&lc->discus);
+   if (gid == NULL)
+      return NULL;
+   for (g = first; g != NULL; g = LIST_NEXT(g, entries)) {
+      if (g->gid && strcmp(g->gid, gid) == 0) {
+         LIST_REMOVE(g, entries);
+         return g;
+      }
+   }
+   return NULL;
+}
+
+/** groups left in old list are gone from server */
+static void drop_stale_groups(LwqqClient* lc, LwqqGroup* g)
+{
+   LwqqGroup* next;
+   for (; g != NULL; g = next) {
+      next = LIST_NEXT(g, entries);
+      LIST_REMOVE(g, entries);
+      lc->args->deleted_group = g;
+      vp_do_repeat(lc->events->delete_group, NULL);
+      lwqq_group_free(g);
+   }
+}
+
+static void roster_refreshed(LwqqClient* lc)
+{
+   vp_do_repeat(lc->events->roster_refresh, NULL);
+}
 #ifndef NDEBUG
 int lwqq_gdb_list_group_member(LwqqGroup* g)
 {
    LwqqSimpleBuddy* sb;
    int count = 0;
+   lwqq__member_unpack(g);
    LIST_FOREACH(sb, &g->members, entries)
    {
       lwqq_verbose(1, "[uin:%s nick:%s card:%s ]", sb->uin, sb->nick, sb->card);
@@ -278,6 +352,8 @@ static void do_change_discu_mem(LwqqAsyncEvent* ev, LwqqGroup* discu,
    int err = 0;
    LwqqClient* lc = ev->lc;
    lwqq__jump_if_ev_fail(ev, err);
+   // members are inserted directly, finds below never pack it again
+   lwqq__member_unpack(discu);
    struct str_list_* ptr = chg->buddies, *g = NULL;
    while (ptr) {
       if (!lwqq_group_find_group_member_by_uin(discu, ptr->str)) {
@@ -287,7 +363,7 @@ static void do_change_discu_mem(LwqqAsyncEvent* ev, LwqqGroup* discu,
             sb->qq = s_strdup(target->qqnumber);
             sb->nick = s_strdup(target->nick);
             sb->card = s_strdup(target->markname);
-            sb->uin = s_strdup(target->uin);
+            sb->uin = s_intern(target->uin);
             LIST_INSERT_HEAD(&discu->members, sb, entries);
          }
       }
@@ -306,7 +382,7 @@ static void do_change_discu_mem(LwqqAsyncEvent* ev, LwqqGroup* discu,
                sb->qq = s_strdup(target->qq);
                sb->nick = s_strdup(target->nick);
                sb->card = s_strdup(target->card);
-               sb->uin = s_strdup(target->uin);
+               sb->uin = s_intern(target->uin);
                LIST_INSERT_HEAD(&discu->members, sb, entries);
             }
          }
@@ -317,6 +393,7 @@ static void do_change_discu_mem(LwqqAsyncEvent* ev, LwqqGroup* discu,
 done:
    if (err)
       lwqq_puts("[change discu member failed]");
+   lwqq__member_touch(lc, discu);
    lc->args->group = discu;
    vp_do_repeat(lc->events->group_member_chg, NULL);
    lwqq_discu_mem_change_free(chg);
@@ -653,22 +730,35 @@ static void parse_categories_child(LwqqClient* lc, json_t* json)
       return;
    }
 
+   // count is recalculated in parse_friends_child
+   LIST_FOREACH(cate, &lc->categories, entries)
+   {
+      cate->count = 0;
+   }
+
    json = json->child; // point to the array.[]
    for (cur = json->child; cur != NULL; cur = cur->next) {
-      cate = s_malloc0(sizeof(*cate));
-      cate->index = s_atoi(json_parse_simple_value(cur, "index"), 0);
+      int index = s_atoi(json_parse_simple_value(cur, "index"), 0);
+      cate = lwqq_category_find_by_id(lc, index);
+      if (cate == NULL) {
+         cate = s_malloc0(sizeof(*cate));
+         cate->index = index;
+         /* Add to categories list */
+         LIST_INSERT_HEAD(&lc->categories, cate, entries);
+      }
       cate->sort = s_atoi(json_parse_simple_value(cur, "sort"), 0);
-      cate->name = s_strdup(json_parse_simple_value(cur, "name"));
-
-      /* Add to categories list */
-      LIST_INSERT_HEAD(&lc->categories, cate, entries);
+      lwqq_override(cate->name,
+                    s_strdup(json_parse_simple_value(cur, "name")));
    }
 
    /* add the default category */
-   cate = s_malloc0(sizeof(*cate));
-   cate->index = 0;
-   cate->name = s_strdup(LWQQ_DEFAULT_CATE);
-   LIST_INSERT_HEAD(&lc->categories, cate, entries);
+   cate = lwqq_category_find_by_id(lc, 0);
+   if (cate == NULL) {
+      cate = s_malloc0(sizeof(*cate));
+      cate->index = 0;
+      LIST_INSERT_HEAD(&lc->categories, cate, entries);
+   }
+   lwqq_override(cate->name, s_strdup(LWQQ_DEFAULT_CATE));
 }
 
 /**
@@ -693,17 +783,35 @@ static void parse_info_child(LwqqClient* lc, json_t* json)
       return;
    }
 
+   // refresh existing buddies in place, and drop those not in list anymore
+   LwqqFriendList fresh = { NULL };
+   LwqqBuddy* next;
    json = json->child; // point to the array.[]
    for (cur = json->child; cur != NULL; cur = cur->next) {
-      buddy = lwqq_buddy_new();
-      buddy->face = s_strdup(json_parse_simple_value(cur, "face"));
-      buddy->flag = s_strdup(json_parse_simple_value(cur, "flag"));
-      buddy->nick = json_unescape(json_parse_simple_value(cur, "nick"));
-      buddy->uin = s_strdup(json_parse_simple_value(cur, "uin"));
+      char* uin = json_parse_simple_value(cur, "uin");
+      char* nick = json_unescape(json_parse_simple_value(cur, "nick"));
+      buddy = take_buddy(&lc->friends, uin);
+      if (buddy == NULL)
+         buddy = lwqq_buddy_new();
+      buddy->cate_index = LWQQ_FRIEND_CATE_IDX_DEFAULT;
+      lwqq_override(buddy->face, s_strdup(json_parse_simple_value(cur, "face")));
+      lwqq_override(buddy->flag, s_strdup(json_parse_simple_value(cur, "flag")));
+      lwqq_override(buddy->nick, nick);
+      lwqq_override(buddy->uin, s_strdup(uin));
 
       /* Add to buddies list */
-      LIST_INSERT_HEAD(&lc->friends, buddy, entries);
+      LIST_INSERT_HEAD(&fresh, buddy, entries);
+   }
+   // buddies left in old list are gone from server
+   LIST_FOREACH_SAFE(buddy, &lc->friends, entries, next)
+   {
+      LIST_REMOVE(buddy, entries);
+      lc->args->deleted_buddy = buddy;
+      vp_do_repeat(lc->events->delete_buddy, NULL);
+      lwqq_buddy_free(buddy);
    }
+   lc->args->deleted_buddy = NULL;
+   list_move_all(&lc->friends, &fresh, entries);
 }
 
 /**
@@ -793,6 +901,27 @@ static void parse_friends_child(LwqqClient* lc, json_t* json)
    }
 }
 
+static void parse_friends_result(LwqqClient* lc, json_t* json_tmp)
+{
+   if (json_tmp->child) {
+      json_tmp = json_tmp->child;
+
+      /* Parse friend category information */
+      parse_categories_child(lc, json_tmp);
+
+      /**
+       * Parse friends information.
+       * Firse, we parse object's "info" child
+       * Then, parse object's "marknames" child
+       * Last, parse object's "friends" child
+       */
+      parse_info_child(lc, json_tmp);
+      parse_marknames_child(lc, json_tmp);
+      parse_friends_child(lc, json_tmp);
+   }
+   roster_refreshed(lc);
+}
+
 /**
  * Get QQ friends information. These information include basic friend
  * information, friends group information, and so on
@@ -808,6 +937,8 @@ LwqqAsyncEvent* lwqq_info_get_friends_info(LwqqClient* lc, LwqqHashFunc hash,
    LwqqHttpRequest* req = NULL;
    LwqqAsyncEvent* ret = NULL;
    void* data = userdata;
+   if (hash == lwqq_hash_parallel)
+      return get_friends_info_parallel(lc);
    if (hash == NULL) {
       hash = lwqq_hash_auto;
       data = lc;
@@ -884,59 +1015,227 @@ static int get_friends_info_back(LwqqHttpRequest* req, LwqqAsyncEvent* called)
    /** It seems everything is ok, we start parsing information
     * now
     */
-   if (json_tmp->child) {
-      json_tmp = json_tmp->child;
+   parse_friends_result(lc, json_tmp);
 
-      /* Parse friend category information */
-      parse_categories_child(lc, json_tmp);
+done:
+   lwqq__log_if_error(err, req);
+   lwqq__clean_json_and_req(json, req);
+   return err;
+}
 
-      /**
-       * Parse friends information.
-       * Firse, we parse object's "info" child
-       * Then, parse object's "marknames" child
-       * Last, parse object's "friends" child
-       */
-      parse_info_child(lc, json_tmp);
-      parse_marknames_child(lc, json_tmp);
-      parse_friends_child(lc, json_tmp);
+/** requests of all hash sent by lwqq_hash_parallel, only the first accepted
+ * one is parsed. it is freed after every request called back. requests are
+ * sent from caller thread and called back on event thread, so req, pending
+ * and winner are guarded by lock */
+typedef struct HashProbe {
+   LwqqClient* lc;
+   LwqqAsyncEvent* ret;
+   const LwqqHashEntry* entry[HASH_PROBE_MAX];
+   LwqqHttpRequest* req[HASH_PROBE_MAX];
+   pthread_mutex_t lock;
+   int count;
+   int pending;
+   int winner;
+   int err;
+   int synced;
+} HashProbe;
+
+static void hash_probe_finish(HashProbe* probe, int result)
+{
+   probe->ret->result = result;
+   // every request is done before a synced caller gets ret, so keep it
+   // readable a while like a synced http event, then finish it
+   if (probe->synced)
+      probe->lc->dispatch(_C_(p, lwqq_async_event_finish, probe->ret), 1000);
+   else
+      lwqq_async_event_finish(probe->ret);
+}
+
+static void hash_probe_unref(HashProbe* probe)
+{
+   pthread_mutex_lock(&probe->lock);
+   int last = (--probe->pending == 0);
+   pthread_mutex_unlock(&probe->lock);
+   if (!last)
+      return;
+   if (probe->winner < 0)
+      hash_probe_finish(probe, probe->err);
+   pthread_mutex_destroy(&probe->lock);
+   s_free(probe);
+}
+
+static int hash_probe_back(LwqqHttpRequest* req, HashProbe* probe, void* data)
+{
+   json_t* json = NULL, *json_tmp;
+   int idx = (long)data, i, lost;
+   int err = 0;
+   int retcode = 0;
+   LwqqClient* lc = probe->lc;
+
+   pthread_mutex_lock(&probe->lock);
+   probe->req[idx] = NULL;
+   lost = probe->winner >= 0;
+   pthread_mutex_unlock(&probe->lock);
+   if (lost) {
+      err = LWQQ_EC_CANCELED; // lost the race
+      goto done;
+   }
+   if (req->http_code != 200) {
+      err = LWQQ_EC_HTTP_ERROR;
+      goto done;
+   }
+   req->response[req->resp_len] = '\0';
+   if (json_parse_document(&json, req->response) != JSON_OK) {
+      lwqq_log(LOG_ERROR, "Parse json object of friends error: \n%s\n",
+               req->response);
+      err = LWQQ_EC_ERROR;
+      goto done;
+   }
+   json_tmp = lwqq__parse_retcode_result(json, &retcode);
+   if (retcode != LWQQ_EC_OK) {
+      err = retcode;
+      goto done;
+   }
+   if (!json_tmp) {
+      lwqq_log(LOG_ERROR, "Parse json object error: %s\n", req->response);
+      err = LWQQ_EC_ERROR;
+      goto done;
    }
 
+   lwqq_verbose(2, "[hash probe: %s accepted]\n", probe->entry[idx]->name);
+   lwqq_hash_set_beg(lc, probe->entry[idx]->name);
+   // requests are freed on event thread only, so they are alive here
+   pthread_mutex_lock(&probe->lock);
+   probe->winner = idx;
+   for (i = 0; i < probe->count; i++) {
+      if (probe->req[i])
+         lwqq_http_cancel(probe->req[i]);
+   }
+   pthread_mutex_unlock(&probe->lock);
+   parse_friends_result(lc, json_tmp);
+   hash_probe_finish(probe, LWQQ_EC_OK);
+
 done:
+   // a wrong hash is expected, keep the more meaningful error
+   if (err && err != LWQQ_EC_CANCELED
+       && (probe->err == LWQQ_EC_HASH_WRONG || err != LWQQ_EC_HASH_WRONG))
+      probe->err = err;
+   if (err == LWQQ_EC_CANCELED)
+      err = 0;
    lwqq__log_if_error(err, req);
    lwqq__clean_json_and_req(json, req);
+   hash_probe_unref(probe);
    return err;
 }
 
-LWQQ_EXPORT
-LwqqAsyncEvent* lwqq_info_get_avatar(LwqqClient* lc, LwqqBuddy* buddy,
-                                     LwqqGroup* group)
+static LwqqAsyncEvent* get_friends_info_parallel(LwqqClient* lc)
 {
-   static int serv_id = 0;
-   if (!(lc && (group || buddy)))
-      return NULL;
-   LwqqErrorCode error;
-   int isgroup = group > 0;
-   const char* uin = (isgroup) ? group->code : buddy->uin;
+   char post[512];
+   const char* url = WEBQQ_S_HOST "/api/get_user_friends2";
+   HashProbe* probe = s_malloc0(sizeof(*probe));
+   LwqqAsyncEvent* ret = lwqq_async_event_new(NULL);
+   int i;
+
+   ret->lc = lc;
+   probe->lc = lc;
+   probe->ret = ret;
+   probe->winner = -1;
+   probe->err = LWQQ_EC_HASH_WRONG;
+   probe->synced = LWQQ_SYNC_ENABLED(lc);
+   probe->count = lwqq_hash_list(lc, probe->entry, HASH_PROBE_MAX);
+   pthread_mutex_init(&probe->lock, NULL);
+   // hold a reference while sending, a synced request calls back at once
+   probe->pending = 1;
+   for (i = 0; i < probe->count; i++) {
+      const LwqqHashEntry* entry = probe->entry[i];
+      LwqqHttpRequest* req = lwqq_http_create_default_request(lc, url, NULL);
+      char* h = entry->func(lc->myself->uin, lc->session.ptwebqq, entry->data);
+      snprintf(post, sizeof(post),
+               "r={\"h\":\"hello\",\"hash\":\"%s\",\"vfwebqq\":\"%s\"}",
+               h ? h : "", lc->vfwebqq);
+      urlencode(post, 2);
+      s_free(h);
 
+      req->set_header(req, "Referer", WEBQQ_S_REF_URL);
+      req->set_header(req, "Accept-Encoding", "gzip,deflate,sdch");
+      req->set_header(req, "Content-Type", "application/x-www-form-urlencoded");
+      lwqq_http_set_option(req, LWQQ_HTTP_CANCELABLE, 1L);
+      pthread_mutex_lock(&probe->lock);
+      if (probe->winner >= 0) {
+         pthread_mutex_unlock(&probe->lock);
+         lwqq_http_request_free(req);
+         break;
+      }
+      probe->req[i] = req;
+      probe->pending++;
+      pthread_mutex_unlock(&probe->lock);
+      req->do_request_async(
+          req, lwqq__has_post(),
+          _C_(3p_i, hash_probe_back, req, probe, (void*)(long)i));
+   }
+   hash_probe_unref(probe);
+   return ret;
+}
+
+static LwqqHttpRequest* avatar_request(LwqqClient* lc, const char* uin,
+                                       int isgroup)
+{
+   static atomic_uint serv_id;
+   LwqqErrorCode error;
+   LwqqHttpRequest* req;
    // to avoid chinese character
    // setlocale(LC_TIME,"en_US.utf8");
-   LwqqHttpRequest* req;
    char url[512];
    char host[32];
    int type = (isgroup) ? 4 : 1;
+
    // there are face 1 to face 10 server to accelerate speed.
-   snprintf(host, sizeof(host), "face%d.web.qq.com", ++serv_id);
-   serv_id %= 10;
+   snprintf(host, sizeof(host), "face%u.web.qq.com",
+            atomic_fetch_add(&serv_id, 1) % 10 + 1);
    snprintf(
        url, sizeof(url),
        "http://%s/cgi/svr/face/getface?cache=0&type=%d&fid=0&uin=%s&vfwebqq=%s",
        host, type, uin, lc->vfwebqq);
    req = lwqq_http_create_default_request(lc, url, &error);
    req->set_header(req, "Referer", "http://web2.qq.com/webqq.html");
-   req->set_header(req, "Host", host);
    lwqq_http_set_option(req, LWQQ_HTTP_TIMEOUT, 15);
    req->retry = 1;
+   return req;
+}
 
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_info_get_avatar(LwqqClient* lc, LwqqBuddy* buddy,
+                                     LwqqGroup* group)
+{
+   if (!(lc && (group || buddy)))
+      return NULL;
+   int isgroup = group > 0;
+   const char* uin = (isgroup) ? group->code : buddy->uin;
+
+   LwqqHttpRequest* req;
+   char key[LWQQ_MEDIA_KEY_LEN];
+   LwqqMediaEntry cached = { 0 };
+   int hit;
+
+   snprintf(key, sizeof(key), "avatar/%c/%s", isgroup ? 'g' : 'b', uin);
+   hit = lwqq_media_cache_get(key, &cached) == 0;
+   if (hit && time(NULL) - cached.fetched < LWQQ_MEDIA_FRESH) {
+      char** avatar = isgroup ? &group->avatar : &buddy->avatar;
+      size_t* len = isgroup ? &group->avatar_len : &buddy->avatar_len;
+      lwqq_override(*avatar, cached.data);
+      *len = cached.size;
+      cached.data = NULL;
+      lwqq_media_entry_free(&cached);
+      return NULL;
+   }
+   req = avatar_request(lc, uin, isgroup);
+   if (hit) {
+      // stale, ask server whether it changed
+      lwqq__media_validate(req, &cached);
+      lwqq_media_entry_free(&cached);
+   }
+
+   const char* url = lwqq_http_get_url(req);
    return req->do_request_async(req, lwqq__hasnot_post(),
                                 _C_(3p_i, get_avatar_back, req, buddy, group));
 }
@@ -949,21 +1248,368 @@ static int get_avatar_back(LwqqHttpRequest* req, LwqqBuddy* buddy,
    char** avatar = (isgroup) ? &group->avatar : &buddy->avatar;
    size_t* len = (isgroup) ? &group->avatar_len : &buddy->avatar_len;
 
+   char key[LWQQ_MEDIA_KEY_LEN];
+   LwqqMediaEntry cached = { 0 };
+
    if ((req->http_code != 200 && req->http_code != 304)) {
       goto done;
    }
 
+   snprintf(key, sizeof(key), "avatar/%c/%s", isgroup ? 'g' : 'b',
+            isgroup ? group->code : buddy->uin);
    if (req->http_code == 200) {
-      *avatar = req->response;
+      lwqq__media_store(key, req);
+      lwqq_override(*avatar, req->response);
       *len = req->resp_len;
       req->response = NULL;
       req->resp_len = 0;
+   } else if (lwqq_media_cache_get(key, &cached) == 0) {
+      // not modified, cached one is fresh again
+      cached.fetched = time(NULL);
+      lwqq_media_cache_put(key, &cached);
+      lwqq_override(*avatar, cached.data);
+      *len = cached.size;
+      cached.data = NULL;
+      lwqq_media_entry_free(&cached);
    }
 done:
    lwqq_http_request_free(req);
    return -1;
 }
 
+static int download_avatar_back(LwqqHttpRequest* req, char* path)
+{
+   int err = LWQQ_EC_OK;
+   if (req->http_code != 200 || req->resp_len == 0) {
+      // don't leave a broken picture behind
+      unlink(path);
+      err = LWQQ_EC_HTTP_ERROR;
+   }
+   s_free(path);
+   lwqq_http_request_free(req);
+   return err;
+}
+
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_info_download_avatar(LwqqClient* lc, LwqqBuddy* buddy,
+                                          LwqqGroup* group, const char* path)
+{
+   if (!(lc && (group || buddy) && path))
+      return NULL;
+   int isgroup = group != NULL;
+   LwqqHttpRequest* req
+       = avatar_request(lc, isgroup ? group->code : buddy->uin, isgroup);
+   const char* url = lwqq_http_get_url(req);
+   lwqq_http_set_option(req, LWQQ_HTTP_SAVE_MMAP, path);
+   return req->do_request_async(
+       req, lwqq__hasnot_post(),
+       _C_(2p_i, download_avatar_back, req, s_strdup(path)));
+}
+
+typedef struct PrefetchItem {
+   char id[32]; /** < uin of buddy or gid of group */
+   int isgroup;
+   int rank; /** < 0 for online buddy and group has message */
+   time_t active; /** < last touched, 0 if never */
+   TAILQ_ENTRY(PrefetchItem) entries;
+} PrefetchItem;
+
+/** idle timer, dispatched pumps and fetches in flight hold a reference,
+ * so it outlives the client. it is only pumped on dispatch thread, where
+ * the client is freed, so a client read there stays valid while fetching */
+typedef struct LwqqAvatarPrefetch {
+   pthread_mutex_t lock;
+   LwqqClient* lc; /** < NULL once client is freed */
+   void (*dispatch)(LwqqCommand, unsigned long timeout);
+   int ref;
+   unsigned limit;
+   unsigned running;
+   int timer; /** < idle check is dispatched */
+   TAILQ_HEAD(, PrefetchItem) queue;
+} LwqqAvatarPrefetch;
+
+static pthread_mutex_t prefetch_create_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void prefetch_pump(LwqqAvatarPrefetch* pf);
+
+/** message and user requests go first, avatars wait until they are sent */
+static int prefetch_idle(LwqqClient* lc)
+{
+   LwqqSendqStats st;
+   lwqq_sendq_stats(lc, &st);
+   return st.queued == 0 && lwqq__http_waiting() == 0;
+}
+
+static int prefetch_cmp(const void* a, const void* b)
+{
+   const PrefetchItem* x = *(PrefetchItem**)a;
+   const PrefetchItem* y = *(PrefetchItem**)b;
+   if (x->active != y->active)
+      return x->active > y->active ? -1 : 1;
+   return x->rank - y->rank;
+}
+
+static PrefetchItem* prefetch_find(LwqqAvatarPrefetch* pf, const char* id,
+                                   int isgroup)
+{
+   PrefetchItem* item;
+   TAILQ_FOREACH(item, &pf->queue, entries)
+   {
+      if (item->isgroup == isgroup && strcmp(item->id, id) == 0)
+         return item;
+   }
+   return NULL;
+}
+
+static void prefetch_clear(LwqqAvatarPrefetch* pf)
+{
+   PrefetchItem* item;
+   while ((item = TAILQ_FIRST(&pf->queue))) {
+      TAILQ_REMOVE(&pf->queue, item, entries);
+      s_free(item);
+   }
+}
+
+static void prefetch_unref(LwqqAvatarPrefetch* pf)
+{
+   int last;
+   pthread_mutex_lock(&pf->lock);
+   last = --pf->ref == 0;
+   pthread_mutex_unlock(&pf->lock);
+   if (!last)
+      return;
+   prefetch_clear(pf);
+   pthread_mutex_destroy(&pf->lock);
+   s_free(pf);
+}
+
+static void prefetch_tick(LwqqAvatarPrefetch* pf)
+{
+   pthread_mutex_lock(&pf->lock);
+   pf->timer = 0;
+   pthread_mutex_unlock(&pf->lock);
+   prefetch_pump(pf);
+   prefetch_unref(pf);
+}
+
+static void prefetch_kick(LwqqAvatarPrefetch* pf)
+{
+   prefetch_pump(pf);
+   prefetch_unref(pf);
+}
+
+static void prefetch_back(LwqqAvatarPrefetch* pf)
+{
+   pthread_mutex_lock(&pf->lock);
+   pf->running--;
+   pthread_mutex_unlock(&pf->lock);
+   // reference of fetch goes to kick
+   pf->dispatch(_C_(p, prefetch_kick, pf), 0);
+}
+
+/** @return 1 if a request is sent */
+static int prefetch_fetch(LwqqClient* lc, LwqqAvatarPrefetch* pf,
+                          PrefetchItem* item)
+{
+   LwqqBuddy* buddy = NULL;
+   LwqqGroup* group = NULL;
+   LwqqAsyncEvent* ev;
+   // contact may be gone, or got its avatar from somewhere else
+   if (item->isgroup)
+      group = lwqq_group_find_group_by_gid(lc, item->id);
+   else
+      buddy = lc->find_buddy_by_uin(lc, item->id);
+   if (group ? group->avatar_len : buddy ? buddy->avatar_len : 1)
+      return 0;
+   // a fresh one in media cache is filled without request
+   ev = lwqq_info_get_avatar(lc, buddy, group);
+   if (ev == NULL)
+      return 0;
+   lwqq_async_add_event_listener(ev, _C_(p, prefetch_back, pf));
+   return 1;
+}
+
+static void prefetch_pump(LwqqAvatarPrefetch* pf)
+{
+   PrefetchItem* item;
+   LwqqClient* lc;
+   int wait = 0;
+   for (;;) {
+      pthread_mutex_lock(&pf->lock);
+      item = NULL;
+      lc = pf->lc;
+      // a stopped or freed prefetch has empty queue, timer is not armed
+      if (lc && lwqq_client_valid(lc) && pf->running < pf->limit && !TAILQ_EMPTY(&pf->queue)) {
+         if (!prefetch_idle(lc)) {
+            if (!pf->timer) {
+               wait = 1;
+               pf->timer = 1;
+               pf->ref++;
+            }
+         } else {
+            item = TAILQ_FIRST(&pf->queue);
+            TAILQ_REMOVE(&pf->queue, item, entries);
+            pf->running++;
+            pf->ref++;
+         }
+      }
+      pthread_mutex_unlock(&pf->lock);
+      if (item == NULL)
+         break;
+      if (!prefetch_fetch(lc, pf, item)) {
+         pthread_mutex_lock(&pf->lock);
+         pf->running--;
+         pthread_mutex_unlock(&pf->lock);
+         prefetch_unref(pf);
+      }
+      s_free(item);
+   }
+   if (wait)
+      pf->dispatch(_C_(p, prefetch_tick, pf), LWQQ_PREFETCH_IDLE_WAIT);
+}
+
+static LwqqAvatarPrefetch* prefetch_get(LwqqClient* lc)
+{
+   LwqqAvatarPrefetch** slot = lwqq__client_avatar_prefetch(lc);
+   LwqqAvatarPrefetch* pf;
+   pthread_mutex_lock(&prefetch_create_lock);
+   pf = *slot;
+   if (pf == NULL) {
+      pf = s_malloc0(sizeof(*pf));
+      pthread_mutex_init(&pf->lock, NULL);
+      pf->lc = lc;
+      pf->dispatch = lc->dispatch;
+      pf->ref = 1;
+      pf->limit = LWQQ_PREFETCH_CONCURRENCY;
+      TAILQ_INIT(&pf->queue);
+      *slot = pf;
+   }
+   pthread_mutex_unlock(&prefetch_create_lock);
+   return pf;
+}
+
+static PrefetchItem* prefetch_item(const char* id, int isgroup, int rank)
+{
+   PrefetchItem* item = s_malloc0(sizeof(*item));
+   snprintf(item->id, sizeof(item->id), "%s", id);
+   item->isgroup = isgroup;
+   item->rank = rank;
+   return item;
+}
+
+LWQQ_EXPORT
+void lwqq_info_prefetch_avatars(LwqqClient* lc, unsigned concurrency)
+{
+   if (!lc)
+      return;
+   LwqqAvatarPrefetch* pf = prefetch_get(lc);
+   PrefetchItem** items;
+   PrefetchItem* old;
+   LwqqBuddy* buddy;
+   LwqqGroup* group;
+   size_t n = 0, i;
+
+   LIST_FOREACH(buddy, &lc->friends, entries) { n++; }
+   LIST_FOREACH(group, &lc->groups, entries) { n++; }
+   items = s_malloc0(sizeof(*items) * (n + 1));
+   n = 0;
+   LIST_FOREACH(buddy, &lc->friends, entries)
+   {
+      if (buddy->uin && !buddy->avatar_len)
+         items[n++] = prefetch_item(buddy->uin, 0,
+                                    buddy->stat == LWQQ_STATUS_OFFLINE
+                                        || buddy->stat == LWQQ_STATUS_LOGOUT);
+   }
+   LIST_FOREACH(group, &lc->groups, entries)
+   {
+      if (group->gid && group->code && !group->avatar_len)
+         items[n++] = prefetch_item(group->gid, 1, group->last_seq == 0);
+   }
+
+   pthread_mutex_lock(&pf->lock);
+   if (concurrency)
+      pf->limit = concurrency;
+   for (i = 0; i < n; i++) {
+      // touched before, keep its activity
+      old = prefetch_find(pf, items[i]->id, items[i]->isgroup);
+      if (old) {
+         items[i]->active = old->active;
+         TAILQ_REMOVE(&pf->queue, old, entries);
+         s_free(old);
+      }
+   }
+   // stable order for same rank, friends come before groups
+   for (i = 0; i < n; i++)
+      items[i]->rank = items[i]->rank * (int)(n + 1) + (int)i;
+   qsort(items, n, sizeof(*items), prefetch_cmp);
+   for (i = 0; i < n; i++)
+      TAILQ_INSERT_TAIL(&pf->queue, items[i], entries);
+   pf->ref++;
+   pthread_mutex_unlock(&pf->lock);
+   s_free(items);
+
+   lwqq_client_dispatch(lc, _C_(p, prefetch_kick, pf));
+}
+
+LWQQ_EXPORT
+void lwqq_info_prefetch_touch(LwqqClient* lc, LwqqBuddy* buddy,
+                              LwqqGroup* group)
+{
+   if (!lc || !(buddy || group))
+      return;
+   LwqqAvatarPrefetch* pf = *lwqq__client_avatar_prefetch(lc);
+   const char* id = group ? group->gid : buddy->uin;
+   PrefetchItem* item;
+   if (pf == NULL || id == NULL)
+      return;
+   pthread_mutex_lock(&pf->lock);
+   item = prefetch_find(pf, id, group != NULL);
+   if (item) {
+      item->active = time(NULL);
+      TAILQ_REMOVE(&pf->queue, item, entries);
+      TAILQ_INSERT_HEAD(&pf->queue, item, entries);
+   }
+   pthread_mutex_unlock(&pf->lock);
+}
+
+LWQQ_EXPORT
+size_t lwqq_info_prefetch_pending(LwqqClient* lc)
+{
+   LwqqAvatarPrefetch* pf = lc ? *lwqq__client_avatar_prefetch(lc) : NULL;
+   PrefetchItem* item;
+   size_t n = 0;
+   if (pf == NULL)
+      return 0;
+   pthread_mutex_lock(&pf->lock);
+   TAILQ_FOREACH(item, &pf->queue, entries) { n++; }
+   n += pf->running;
+   pthread_mutex_unlock(&pf->lock);
+   return n;
+}
+
+LWQQ_EXPORT
+void lwqq_info_prefetch_stop(LwqqClient* lc)
+{
+   LwqqAvatarPrefetch* pf = lc ? *lwqq__client_avatar_prefetch(lc) : NULL;
+   if (pf == NULL)
+      return;
+   // an armed idle timer finds nothing to wait for, and is not armed again
+   pthread_mutex_lock(&pf->lock);
+   prefetch_clear(pf);
+   pthread_mutex_unlock(&pf->lock);
+}
+
+void lwqq__avatar_prefetch_free(LwqqAvatarPrefetch* pf)
+{
+   if (pf == NULL)
+      return;
+   pthread_mutex_lock(&pf->lock);
+   pf->lc = NULL;
+   prefetch_clear(pf);
+   pthread_mutex_unlock(&pf->lock);
+   prefetch_unref(pf);
+}
+
 LWQQ_EXPORT
 LwqqErrorCode lwqq_info_save_avatar(LwqqBuddy* b, LwqqGroup* g,
                                     const char* path)
@@ -1014,20 +1660,27 @@ static void parse_groups_gnamelist_child(LwqqClient* lc, json_t* json)
       return;
    }
 
+   LIST_HEAD(, LwqqGroup) fresh = { NULL };
    json = json->child; // point to the array.[]
    for (cur = json->child; cur != NULL; cur = cur->next) {
-      group = lwqq_group_new(0);
-      group->flag = s_strdup(json_parse_simple_value(cur, "flag"));
-      group->name = json_unescape(json_parse_simple_value(cur, "name"));
-      group->gid = s_strdup(json_parse_simple_value(cur, "gid"));
-      group->code = s_strdup(json_parse_simple_value(cur, "code"));
+      char* gid = json_parse_simple_value(cur, "gid");
+      char* name = json_unescape(json_parse_simple_value(cur, "name"));
+      group = take_group(lc, LWQQ_GROUP_QUN, gid);
+      if (group == NULL)
+         group = lwqq_group_new(LWQQ_GROUP_QUN);
+      lwqq_override(group->flag, s_strdup(json_parse_simple_value(cur, "flag")));
+      lwqq_override(group->name, name);
+      lwqq_override(group->gid, s_strdup(gid));
+      lwqq_override(group->code, s_strdup(json_parse_simple_value(cur, "code")));
 
       /* we got the 'code', so we can get the qq group number now */
       // group->account = get_group_qqnumber(lc, group->code);
 
       /* Add to groups list */
-      LIST_INSERT_HEAD(&lc->groups, group, entries);
+      LIST_INSERT_HEAD(&fresh, group, entries);
    }
+   drop_stale_groups(lc, LIST_FIRST(&lc->groups));
+   list_move_all(&lc->groups, &fresh, entries);
 }
 
 static void parse_groups_gmasklist_child(LwqqClient* lc, json_t* json)
@@ -1093,7 +1746,7 @@ static void parse_groups_gmarklist_child(LwqqClient* lc, json_t* json)
       group = lwqq_group_find_group_by_gid(lc, uin);
       if (!group)
          continue;
-      group->markname = json_unescape(markname);
+      lwqq_override(group->markname, json_unescape(markname));
    }
 }
 
@@ -1205,6 +1858,7 @@ static int get_group_name_list_back(LwqqHttpRequest* req,
       parse_groups_gmasklist_child(lc, json_tmp);
       parse_groups_gmarklist_child(lc, json_tmp);
    }
+   roster_refreshed(lc);
 
 done:
    lwqq__log_if_error(err, req);
@@ -1237,25 +1891,31 @@ static void parse_discus_discu_child(LwqqClient* lc, json_t* root)
    if (json == NULL)
       return;
    json = json->child->child;
-   char* name;
+   char* name, *did;
+   LIST_HEAD(, LwqqGroup) fresh = { NULL };
    while (json) {
-      LwqqGroup* discu = lwqq_group_new(LWQQ_GROUP_DISCU);
-      discu->did = s_strdup(json_parse_simple_value(json, "did"));
+      did = json_parse_simple_value(json, "did");
       // for compability
       name = json_parse_simple_value(json, "name");
       if (strcmp(name, "") == 0)
-         discu->name = s_strdup("未命名讨论组");
+         name = s_strdup("未命名讨论组");
       else
-         discu->name = json_unescape(name);
-      LIST_INSERT_HEAD(&lc->discus, discu, entries);
+         name = json_unescape(name);
+      LwqqGroup* discu = take_group(lc, LWQQ_GROUP_DISCU, did);
+      if (discu == NULL)
+         discu = lwqq_group_new(LWQQ_GROUP_DISCU);
+      lwqq_override(discu->did, s_strdup(did));
+      lwqq_override(discu->name, name);
+      LIST_INSERT_HEAD(&fresh, discu, entries);
       json = json->next;
    }
+   drop_stale_groups(lc, LIST_FIRST(&lc->discus));
+   list_move_all(&lc->discus, &fresh, entries);
 
    json = json_find_first_label(root, "dmasklist");
    if (json == NULL)
       return;
    json = json->child->child;
-   const char* did;
    int mask;
    LwqqGroup* group;
    while (json) {
@@ -1293,6 +1953,7 @@ static int get_discu_list_back(LwqqHttpRequest* req, void* data)
 
    if (json_temp) {
       parse_discus_discu_child(lc, json_temp);
+      roster_refreshed(lc);
    }
 
 done:
@@ -1302,9 +1963,117 @@ done:
    return err;
 }
 
+static int member_cmp(const void* a, const void* b)
+{
+   const LwqqSimpleBuddy* const* l = a;
+   const LwqqSimpleBuddy* const* r = b;
+   return strcmp((*l)->uin, (*r)->uin);
+}
+
+/** members of a group sorted by uin, built once for each detail refresh */
+typedef struct MemberIndex {
+   LwqqSimpleBuddy** v;
+   char* mark; /** < set by find, cleared by sweep */
+   size_t n;
+} MemberIndex;
+
+/** members without uin are not indexed */
+static void member_index_build(LwqqGroup* group, MemberIndex* idx)
+{
+   LwqqSimpleBuddy* sb;
+   size_t cap = 0;
+   memset(idx, 0, sizeof(*idx));
+   LIST_FOREACH(sb, &group->members, entries)
+   {
+      if (sb->uin == NULL)
+         continue;
+      if (idx->n == cap) {
+         cap = cap ? cap * 2 : 64;
+         idx->v = s_realloc(idx->v, sizeof(*idx->v) * cap);
+      }
+      idx->v[idx->n++] = sb;
+   }
+   if (idx->n) {
+      qsort(idx->v, idx->n, sizeof(*idx->v), member_cmp);
+      idx->mark = s_malloc0(idx->n);
+   }
+}
+
+static LwqqSimpleBuddy* member_index_find(MemberIndex* idx, const char* uin)
+{
+   LwqqSimpleBuddy key, *pkey = &key, **slot;
+   if (uin == NULL || idx->n == 0)
+      return NULL;
+   key.uin = (char*)uin;
+   slot = bsearch(&pkey, idx->v, idx->n, sizeof(*idx->v), member_cmp);
+   if (slot == NULL)
+      return NULL;
+   idx->mark[slot - idx->v] = 1;
+   return *slot;
+}
+
+/** call reset on every member not found since last sweep */
+static void member_index_sweep(MemberIndex* idx,
+                               void (*reset)(LwqqSimpleBuddy*))
+{
+   size_t i;
+   for (i = 0; i < idx->n; i++) {
+      if (!idx->mark[i])
+         reset(idx->v[i]);
+      idx->mark[i] = 0;
+   }
+}
+
+static void member_index_free(MemberIndex* idx)
+{
+   s_free(idx->v);
+   s_free(idx->mark);
+   idx->n = 0;
+}
+
+static void member_reset_mflag(LwqqSimpleBuddy* sb)
+{
+   sb->mflag = 0;
+}
+
+static void member_reset_card(LwqqSimpleBuddy* sb)
+{
+   lwqq_override(sb->card, NULL);
+}
+
+static void member_reset_stat(LwqqSimpleBuddy* sb)
+{
+   sb->client_type = 0;
+   sb->stat = LWQQ_STATUS_OFFLINE;
+}
+
+/**
+ * whether raw json text equals to str after unescape and convert.
+ * fast path for unchanged member info, so it doesn't alloc anything.
+ */
+static int member_text_same(const char* str, const char* raw)
+{
+   const char* p;
+   if (str == NULL)
+      return 0;
+   for (p = raw; *p; p++) {
+      if (*p == '\\' || (unsigned char)*p < 0x20)
+         break;
+   }
+   if (*p == '\0')
+      return strcmp(str, raw) == 0;
+   char* conv = ibmpc_ascii_character_convert(json_unescape(raw));
+   int same = strcmp(str, conv) == 0;
+   s_free(conv);
+   return same;
+}
+
 /**
  * Parse group members info
  * we only get the "nick" and the "uin", and get the members' qq number.
+ * existing members are matched by uin and updated in place, the added and
+ * removed members are reported by group_member_chg. removed members are
+ * freed after it is fired.
  *
  * "minfo":[
  *   {"nick":"evildoer","province":"......","gender":"male","uin":56360327,"country":"......","city":"......"},
@@ -1333,13 +2102,25 @@ static void parse_groups_minfo_child(LwqqClient* lc, LwqqGroup* group,
       return;
    }
 
-   // simple buddy can be safely removed
+   /* index old members by uin, so unchanged members are kept as is and only
+    * the difference is allocated or freed */
    LwqqSimpleBuddy* sb, *bsb;
+   MemberIndex old;
+   LwqqSimpleBuddy** fresh = NULL;
+   LwqqSimpleBuddy** gone;
+   size_t n_fresh = 0, cap = 0, n_old = 0, i;
+   int added = 0, removed = 0;
+   LIST_FOREACH(sb, &group->members, entries) { n_old++; }
+   // removed members are kept until listeners have seen them
+   gone = s_malloc0(sizeof(*gone) * (n_old ? n_old : 1));
    LIST_FOREACH_SAFE(sb, &group->members, entries, bsb)
    {
-      LIST_REMOVE(sb, entries);
-      lwqq_simple_buddy_free(sb);
+      if (sb->uin == NULL) {
+         LIST_REMOVE(sb, entries);
+         gone[removed++] = sb;
+      }
    }
+   member_index_build(group, &old);
 
    json = json->child; // point to the array.[]
    for (cur = json->child; cur != NULL; cur = cur->next) {
@@ -1349,16 +2130,61 @@ static void parse_groups_minfo_child(LwqqClient* lc, LwqqGroup* group,
       if (!uin || !nick)
          continue;
 
-      // may solve group member duplicated problem
+      member = member_index_find(&old, uin);
+      if (member) {
+         if (!member_text_same(member->nick, nick))
+            lwqq_override(member->nick, ibmpc_ascii_character_convert(
+                                            json_unescape(nick)));
+         continue;
+      }
 
       member = lwqq_simple_buddy_new();
-      member->uin = s_strdup(uin);
+      member->uin = s_intern(uin);
       member->nick = ibmpc_ascii_character_convert(json_unescape(nick));
+      if (n_fresh == cap) {
+         cap = cap ? cap * 2 : 16;
+         fresh = s_realloc(fresh, sizeof(*fresh) * cap);
+      }
+      fresh[n_fresh++] = member;
+   }
+
+   // may solve group member duplicated problem
+   if (n_fresh)
+      qsort(fresh, n_fresh, sizeof(*fresh), member_cmp);
+   for (i = 0; i < n_fresh; i++) {
+      if (i > 0 && strcmp(fresh[i]->uin, fresh[i - 1]->uin) == 0) {
+         lwqq_simple_buddy_free(fresh[i]);
+         continue;
+      }
       /* Add to members list */
-      LIST_INSERT_HEAD(&group->members, member, entries);
+      LIST_INSERT_HEAD(&group->members, fresh[i], entries);
+      fresh[added++] = fresh[i];
    }
-}
-static void parse_groups_ginfo_members_child(LwqqClient* lc, LwqqGroup* group,
+
+   for (i = 0; i < old.n; i++) {
+      if (old.mark[i])
+         continue;
+      LIST_REMOVE(old.v[i], entries);
+      gone[removed++] = old.v[i];
+   }
+   member_index_free(&old);
+
+   if (added || removed) {
+      lc->args->group = group;
+      lc->args->member_added = added;
+      lc->args->member_removed = removed;
+      lc->args->added_members = (const LwqqSimpleBuddy* const*)fresh;
+      lc->args->removed_members = (const LwqqSimpleBuddy* const*)gone;
+      vp_do_repeat(lc->events->group_member_chg, NULL);
+      lc->args->member_added = lc->args->member_removed = 0;
+      lc->args->added_members = lc->args->removed_members = NULL;
+   }
+   for (i = 0; i < (size_t)removed; i++)
+      lwqq_simple_buddy_free(gone[i]);
+   s_free(gone);
+   s_free(fresh);
+}
+static void parse_groups_ginfo_members_child(LwqqClient* lc, MemberIndex* idx,
                                              json_t* json)
 {
    while (json) {
@@ -1378,14 +2204,15 @@ static void parse_groups_ginfo_members_child(LwqqClient* lc, LwqqGroup* group,
    while (members) {
       uin = json_parse_simple_value(members, "muin");
       mflag = s_atoi(json_parse_simple_value(members, "mflag"), 0);
-      sb = lwqq_group_find_group_member_by_uin(group, uin);
+      sb = member_index_find(idx, uin);
       if (sb)
          sb->mflag = mflag;
 
       members = members->next;
    }
+   member_index_sweep(idx, member_reset_mflag);
 }
-static void parse_groups_cards_child(LwqqClient* lc, LwqqGroup* group,
+static void parse_groups_cards_child(LwqqClient* lc, MemberIndex* idx,
                                      json_t* json)
 {
    LwqqSimpleBuddy* member;
@@ -1401,6 +2228,7 @@ static void parse_groups_cards_child(LwqqClient* lc, LwqqGroup* group,
       json = json->next;
    }
    if (!json) {
+      member_index_sweep(idx, member_reset_card);
       return;
    }
 
@@ -1412,11 +2240,14 @@ static void parse_groups_cards_child(LwqqClient* lc, LwqqGroup* group,
       if (!uin || !card)
          continue;
 
-      member = lwqq_group_find_group_member_by_uin(group, uin);
-      if (member != NULL) {
-         member->card = ibmpc_ascii_character_convert(json_unescape(card));
+      member = member_index_find(idx, uin);
+      if (member != NULL && !member_text_same(member->card, card)) {
+         lwqq_override(member->card,
+                       ibmpc_ascii_character_convert(json_unescape(card)));
       }
    }
+   // a removed card is just missing in list
+   member_index_sweep(idx, member_reset_card);
 }
 
 /**
@@ -1428,7 +2259,7 @@ static void parse_groups_cards_child(LwqqClient* lc, LwqqGroup* group,
  * @param group
  * @param json Point to the first child of "result"'s value
  */
-static void parse_groups_stats_child(LwqqClient* lc, LwqqGroup* group,
+static void parse_groups_stats_child(LwqqClient* lc, MemberIndex* idx,
                                      json_t* json)
 {
    LwqqSimpleBuddy* member;
@@ -1443,6 +2274,7 @@ static void parse_groups_stats_child(LwqqClient* lc, LwqqGroup* group,
       json = json->next;
    }
    if (!json) {
+      member_index_sweep(idx, member_reset_stat);
       return;
    }
 
@@ -1452,7 +2284,7 @@ static void parse_groups_stats_child(LwqqClient* lc, LwqqGroup* group,
 
       if (!uin)
          continue;
-      member = lwqq_group_find_group_member_by_uin(group, uin);
+      member = member_index_find(idx, uin);
       if (!member)
          continue;
       member->client_type
@@ -1460,6 +2292,8 @@ static void parse_groups_stats_child(LwqqClient* lc, LwqqGroup* group,
       member->stat
           = s_atoi(json_parse_simple_value(cur, "stat"), LWQQ_STATUS_LOGOUT);
    }
+   // only online members are listed
+   member_index_sweep(idx, member_reset_stat);
 }
 
 /**
@@ -1582,12 +2416,19 @@ static int group_detail_back(LwqqHttpRequest* req, LwqqClient* lc,
       /* first , get group information */
       parse_group_info(parse_key_child(json_tmp->parent, "ginfo"), group);
       /* second , get group members */
+      lwqq__member_unpack(group);
       parse_groups_minfo_child(lc, group, json_tmp);
-      parse_groups_ginfo_members_child(lc, group, json_tmp);
-      parse_groups_cards_child(lc, group, json_tmp);
+      MemberIndex idx;
+      member_index_build(group, &idx);
+      parse_groups_ginfo_members_child(lc, &idx, json_tmp);
+      parse_groups_cards_child(lc, &idx, json_tmp);
       /* third , mark group's online members */
-      parse_groups_stats_child(lc, group, json_tmp);
+      parse_groups_stats_child(lc, &idx, json_tmp);
+      member_index_free(&idx);
       check_member_info_complection(group);
+      group->member_refresh = time(NULL);
+      lwqq__member_touch(lc, group);
+      roster_refreshed(lc);
    }
 
 done:
@@ -1627,7 +2468,7 @@ static void parse_discus_info_child(LwqqClient* lc, LwqqGroup* discu,
    json = json->child->child;
    while (json) {
       LwqqSimpleBuddy* sb = lwqq_simple_buddy_new();
-      sb->uin = s_strdup(json_parse_simple_value(json, "mem_uin"));
+      sb->uin = s_intern(json_parse_simple_value(json, "mem_uin"));
       sb->qq = s_strdup(json_parse_simple_value(json, "ruin"));
       LIST_INSERT_HEAD(&discu->members, sb, entries);
       json = json->next;
@@ -1677,9 +2518,13 @@ static int get_discu_detail_info_back(LwqqHttpRequest* req, LwqqClient* lc,
    json_parse_document(&root, req->response);
    json = lwqq__parse_retcode_result(root, &retcode);
    if (json) {
+      lwqq__member_unpack(discu);
       parse_discus_info_child(lc, discu, json);
       parse_discus_other_child(lc, discu, json);
       check_member_info_complection(discu);
+      discu->member_refresh = time(NULL);
+      lwqq__member_touch(lc, discu);
+      roster_refreshed(lc);
    }
 done:
    if (root)
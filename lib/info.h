@@ -43,6 +43,7 @@ typedef LIST_HEAD(, LwqqRecentItem) LwqqRecentList;
  *
  * @param lc
  * @param hash: NULL to use lwqq_hash_auto function, auto select existing hash
+ *              lwqq_hash_parallel to try all existing hash at the same time
  * @param userdata: the extra data push to hash function, most of time is NULL
  */
 LwqqAsyncEvent* lwqq_info_get_friends_info(LwqqClient* lc, LwqqHashFunc hash,
@@ -87,6 +88,33 @@ LwqqAsyncEvent* lwqq_info_get_avatar(LwqqClient* lc, LwqqBuddy* buddy,
 
 LwqqErrorCode lwqq_info_save_avatar(LwqqBuddy* b, LwqqGroup* g,
                                     const char* path);
+/**
+ * stream avatar of buddy or group into path without keeping it in memory,
+ * LwqqBuddy::avatar is not touched. path is removed if download fails.
+ */
+LwqqAsyncEvent* lwqq_info_download_avatar(LwqqClient* lc, LwqqBuddy* buddy,
+                                          LwqqGroup* group, const char* path);
+
+#define LWQQ_PREFETCH_CONCURRENCY 2
+/** ms to wait before checking again whether http is idle */
+#define LWQQ_PREFETCH_IDLE_WAIT 200
+/**
+ * fetch avatar of every friend and group in background, into
+ * LwqqBuddy::avatar and LwqqGroup::avatar. online friends and groups which
+ * have messages go first, one with avatar or a fresh one in media cache
+ * doesn't cost a request. a request is only sent when no message is queued
+ * and no http request waits for a free link. call it again after friends or
+ * groups are reloaded.
+ * @param concurrency max avatar requests in flight, 0 to keep current
+ */
+void lwqq_info_prefetch_avatars(LwqqClient* lc, unsigned concurrency);
+/** move contact to front of prefetch, it is done when a message comes */
+void lwqq_info_prefetch_touch(LwqqClient* lc, LwqqBuddy* buddy,
+                              LwqqGroup* group);
+/** avatars waiting or in flight */
+size_t lwqq_info_prefetch_pending(LwqqClient* lc);
+/** drop avatars not requested yet */
+void lwqq_info_prefetch_stop(LwqqClient* lc);
 
 /**
  * Get friend qqnumber
@@ -60,6 +60,7 @@
 
 typedef struct json_value json_t;
 typedef struct LwqqAsyncEvent LwqqAsyncEvent;
+typedef struct LwqqAsyncEvset LwqqAsyncEvset;
 typedef struct LwqqClient LwqqClient;
 typedef struct LwqqVerifyCode LwqqVerifyCode;
 typedef struct LwqqHttpRequest LwqqHttpRequest;
@@ -156,6 +157,41 @@ char* json_unescape_s(char* str);
 
 // =================== http.h ===============================
 LwqqFeatures lwqq__http_check_feature();
+/** requests waiting for a free link, 0 when http is idle */
+int lwqq__http_waiting();
+
+// =================== async.c ==============================
+/**
+ * single flight of requests keyed by endpoint and id, so a burst of same
+ * query shares one request.
+ * @param set gets an event which finishes with result of the flight
+ * @param result set to what the flight fills
+ * @return 1 if key is in flight. 0 if it isn't, then caller sends it and
+ *         calls lwqq__flight_begin
+ */
+int lwqq__flight_join(LwqqClient* lc, const char* key, LwqqAsyncEvset* set,
+                      void** result);
+/** key is in flight until ev finishes */
+void lwqq__flight_begin(LwqqClient* lc, const char* key, LwqqAsyncEvent* ev,
+                        void* result);
+
+// =================== type.c ===============================
+struct LwqqMemberStore** lwqq__client_member_store(LwqqClient* lc);
+struct LwqqUploadCache** lwqq__client_upload_cache(LwqqClient* lc);
+struct LwqqSendQueue** lwqq__client_send_queue(LwqqClient* lc);
+struct LwqqAvatarPrefetch** lwqq__client_avatar_prefetch(LwqqClient* lc);
+
+// =================== info.c ===============================
+void lwqq__avatar_prefetch_free(struct LwqqAvatarPrefetch* pf);
+
+// =================== msg.c ================================
+void lwqq__upload_cache_free(struct LwqqUploadCache* cache);
+/** whether poll of lc is running, messages can't be sent without it */
+int lwqq__msglist_running(LwqqClient* lc);
+
+// =================== sendq.c ==============================
+/** messages not sent yet are canceled, sends in flight finish later */
+void lwqq__send_queue_free(struct LwqqSendQueue* q);
 
 #endif
 
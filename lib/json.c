@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "json.h"
+#include "smemory.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -202,11 +203,13 @@ enum json_error json_stream_parse(FILE* file, json_t** document)
    return error;
 }
 
+static SSlab json_slab = S_SLAB_INIT("json_t", json_t);
+
 json_t* json_new_value(const enum json_value_type type)
 {
    json_t* new_object;
    /* allocate memory to the new object */
-   new_object = malloc(sizeof(json_t));
+   new_object = s_slab_alloc(&json_slab);
    if (new_object == NULL)
       return NULL;
 
@@ -229,7 +232,7 @@ json_t* json_new_string(const char* text)
    assert(text != NULL);
 
    /* allocate memory for the new object */
-   new_object = malloc(sizeof(json_t));
+   new_object = s_slab_alloc(&json_slab);
    if (new_object == NULL)
       return NULL;
 
@@ -237,7 +240,7 @@ json_t* json_new_string(const char* text)
    length = strlen(text) + 1;
    new_object->text = malloc(length * sizeof(char));
    if (new_object->text == NULL) {
-      free(new_object);
+      s_slab_free(&json_slab, new_object);
       return NULL;
    }
    strncpy(new_object->text, text, length);
@@ -258,7 +261,7 @@ json_t* json_new_number(const char* text)
    assert(text != NULL);
 
    /* allocate memory for the new object */
-   new_object = malloc(sizeof(json_t));
+   new_object = s_slab_alloc(&json_slab);
    if (new_object == NULL)
       return NULL;
 
@@ -266,7 +269,7 @@ json_t* json_new_number(const char* text)
    length = strlen(text) + 1;
    new_object->text = malloc(length * sizeof(char));
    if (new_object->text == NULL) {
-      free(new_object);
+      s_slab_free(&json_slab, new_object);
       return NULL;
    }
    strncpy(new_object->text, text, length);
@@ -339,7 +342,7 @@ static void intern_json_free_value(json_t** value)
    if ((*value)->text != NULL) {
       free((*value)->text);
    }
-   free(*value); /* the json value */
+   s_slab_free(&json_slab, *value); /* the json value */
    (*value) = NULL;
 }
 
@@ -8,8 +8,14 @@
  *
  */
 
+#include <ctype.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <sys/types.h>
@@ -17,6 +23,15 @@
 #include "logger.h"
 #include "internal.h"
 
+#ifdef WIN32
+#define localtime_r(t, tm) (localtime_s(tm, t) ? NULL : (tm))
+#endif
+
+/* must be power of 2 */
+#define LOG_RING_SIZE 4096
+#define LOG_DATA_SIZE 384
+#define LOG_LINE_SIZE 81920
+
 static char* levels[] = {
    "DEBUG", "NOTICE", "WARNING", "ERROR",
 };
@@ -30,6 +45,450 @@ static void log_direct_to_stderr(int l, const char* str)
 
 static LwqqLogRedirectFunc redirect_func_ = log_direct_to_stderr;
 
+enum {
+   ENTRY_LOG,
+   ENTRY_VERBOSE
+};
+
+enum {
+   ARG_INT,
+   ARG_LONG,
+   ARG_LLONG,
+   ARG_SIZE,
+   ARG_INTMAX,
+   ARG_PTRDIFF,
+   ARG_DOUBLE,
+   ARG_PTR,
+   ARG_STR, /** < uint16 length, then string copied inline */
+   ARG_HEAP_STR, /** < long string, strdup-ed pointer */
+   ARG_NULL_STR
+};
+
+/**
+ * arguments are copied into data as a type byte followed by its value,
+ * and formatted later with the same format string.
+ */
+typedef struct LogEntry {
+   atomic_size_t seq;
+   int kind;
+   int level;
+   const char* fmt;
+   const char* file;
+   int line;
+   const char* function;
+   time_t time;
+   unsigned char data[LOG_DATA_SIZE];
+} LogEntry;
+
+/* bounded queue of Dmitry Vyukov, many producers and the logger thread */
+static struct {
+   atomic_size_t tail;
+   size_t head; /** < only touched by logger thread */
+   atomic_size_t done; /** < entries written, for flush */
+   atomic_ulong dropped;
+   atomic_int sleeping;
+   LogEntry slot[LOG_RING_SIZE];
+} ring;
+
+static atomic_int async_mode = 0;
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * parse a conversion after '%', return type of its argument,
+ * -1 for what we can't copy ('*' width, %n, long double, wide char).
+ */
+static int conv_parse(const char* p, const char** end)
+{
+   int type = ARG_INT;
+   while (*p && strchr("-+ #0'", *p))
+      p++;
+   while (isdigit((unsigned char)*p))
+      p++;
+   if (*p == '.') {
+      p++;
+      while (isdigit((unsigned char)*p))
+         p++;
+   }
+   switch (*p) {
+   case 'h':
+      p += (p[1] == 'h') ? 2 : 1;
+      break;
+   case 'l':
+      type = (p[1] == 'l') ? ARG_LLONG : ARG_LONG;
+      p += (p[1] == 'l') ? 2 : 1;
+      break;
+   case 'q':
+      type = ARG_LLONG;
+      p++;
+      break;
+   case 'z':
+      type = ARG_SIZE;
+      p++;
+      break;
+   case 'j':
+      type = ARG_INTMAX;
+      p++;
+      break;
+   case 't':
+      type = ARG_PTRDIFF;
+      p++;
+      break;
+   }
+   *end = *p ? p + 1 : p;
+   switch (*p) {
+   case 'd':
+   case 'i':
+   case 'u':
+   case 'o':
+   case 'x':
+   case 'X':
+      return type;
+   case 'c':
+      return type == ARG_INT ? ARG_INT : -1;
+   case 'e':
+   case 'E':
+   case 'f':
+   case 'F':
+   case 'g':
+   case 'G':
+   case 'a':
+   case 'A':
+      return (type == ARG_INT || type == ARG_LONG) ? ARG_DOUBLE : -1;
+   case 's':
+      return type == ARG_INT ? ARG_STR : -1;
+   case 'p':
+      return ARG_PTR;
+   default:
+      return -1;
+   }
+}
+
+/** free strdup-ed strings of encoded arguments */
+static void args_release(const unsigned char* d, const unsigned char* end)
+{
+   while (d < end) {
+      int type = *d++;
+      if (type == ARG_STR) {
+         uint16_t len;
+         memcpy(&len, d, sizeof(len));
+         d += sizeof(len) + len;
+      } else if (type == ARG_HEAP_STR) {
+         char* str;
+         memcpy(&str, d, sizeof(str));
+         free(str);
+         d += sizeof(str);
+      } else if (type != ARG_NULL_STR)
+         d += sizeof(long long);
+   }
+}
+
+static int args_encode(LogEntry* e, const char* fmt, va_list va)
+{
+   unsigned char* d = e->data, *end = e->data + sizeof(e->data);
+   const char* p = fmt;
+   while ((p = strchr(p, '%'))) {
+      if (p[1] == '%') {
+         p += 2;
+         continue;
+      }
+      int type = conv_parse(p + 1, &p);
+      long long v = 0;
+      double f;
+      if (type < 0 || end - d < 1 + (ptrdiff_t)sizeof(v)) {
+         args_release(e->data, d);
+         return -1;
+      }
+      *d++ = type;
+      switch (type) {
+      case ARG_INT:
+         v = va_arg(va, int);
+         break;
+      case ARG_LONG:
+         v = va_arg(va, long);
+         break;
+      case ARG_LLONG:
+         v = va_arg(va, long long);
+         break;
+      case ARG_SIZE:
+         v = va_arg(va, size_t);
+         break;
+      case ARG_INTMAX:
+         v = va_arg(va, intmax_t);
+         break;
+      case ARG_PTRDIFF:
+         v = va_arg(va, ptrdiff_t);
+         break;
+      case ARG_DOUBLE:
+         f = va_arg(va, double);
+         memcpy(&v, &f, sizeof(f));
+         break;
+      case ARG_PTR:
+         v = (uintptr_t)va_arg(va, void*);
+         break;
+      case ARG_STR: {
+         const char* str = va_arg(va, const char*);
+         size_t len = str ? strlen(str) + 1 : 0;
+         if (str == NULL) {
+            d[-1] = ARG_NULL_STR;
+         } else if (len < UINT16_MAX
+                    && (size_t)(end - d) >= sizeof(uint16_t) + len) {
+            uint16_t len16 = len;
+            memcpy(d, &len16, sizeof(len16));
+            memcpy(d + sizeof(len16), str, len);
+            d += sizeof(len16) + len;
+         } else {
+            char* copy = strdup(str);
+            d[-1] = ARG_HEAP_STR;
+            memcpy(d, &copy, sizeof(copy));
+            d += sizeof(copy);
+         }
+         continue;
+      }
+      }
+      memcpy(d, &v, sizeof(v));
+      d += sizeof(v);
+   }
+   return 0;
+}
+
+static size_t format_entry(char* out, size_t cap, const LogEntry* e)
+{
+   const unsigned char* d = e->data;
+   const char* p = e->fmt, *start;
+   char spec[32];
+   size_t len = 0;
+   while (*p) {
+      if (*p != '%' || p[1] == '%') {
+         if (len < cap - 1)
+            out[len++] = *p;
+         p += (*p == '%') ? 2 : 1;
+         continue;
+      }
+      start = p;
+      int type = conv_parse(p + 1, &p);
+      size_t spec_len = p - start;
+      if (spec_len >= sizeof(spec))
+         spec_len = sizeof(spec) - 1;
+      memcpy(spec, start, spec_len);
+      spec[spec_len] = '\0';
+
+      // keep consuming arguments after out is full, to free heap strings
+      char* o = len < cap - 1 ? out + len : NULL;
+      size_t rem = o ? cap - len : 0;
+      long long v = 0;
+      double f;
+      int n = 0;
+      if (*d == ARG_STR) {
+         uint16_t l;
+         memcpy(&l, d + 1, sizeof(l));
+         n = snprintf(o, rem, spec, (const char*)d + 1 + sizeof(l));
+         d += 1 + sizeof(l) + l;
+      } else if (*d == ARG_HEAP_STR) {
+         char* str;
+         memcpy(&str, d + 1, sizeof(str));
+         n = snprintf(o, rem, spec, str);
+         free(str);
+         d += 1 + sizeof(str);
+      } else if (*d == ARG_NULL_STR) {
+         n = snprintf(o, rem, spec, "(null)");
+         d++;
+      } else {
+         memcpy(&v, d + 1, sizeof(v));
+         d += 1 + sizeof(v);
+         switch (type) {
+         case ARG_INT:
+            n = snprintf(o, rem, spec, (int)v);
+            break;
+         case ARG_LONG:
+            n = snprintf(o, rem, spec, (long)v);
+            break;
+         case ARG_LLONG:
+            n = snprintf(o, rem, spec, v);
+            break;
+         case ARG_SIZE:
+            n = snprintf(o, rem, spec, (size_t)v);
+            break;
+         case ARG_INTMAX:
+            n = snprintf(o, rem, spec, (intmax_t)v);
+            break;
+         case ARG_PTRDIFF:
+            n = snprintf(o, rem, spec, (ptrdiff_t)v);
+            break;
+         case ARG_DOUBLE:
+            memcpy(&f, &v, sizeof(f));
+            n = snprintf(o, rem, spec, f);
+            break;
+         case ARG_PTR:
+            n = snprintf(o, rem, spec, (void*)(uintptr_t)v);
+            break;
+         }
+      }
+      if (o && n > 0)
+         len = (len + n < cap - 1) ? len + n : cap - 1;
+   }
+   out[len] = '\0';
+   return len;
+}
+
+static void write_log_header(int level, time_t t, const char* file, int line,
+                             const char* function)
+{
+   struct tm tm;
+   char date[256];
+   if (level <= 1)
+      return;
+   strftime(date, sizeof(date), "%b %d %H:%M:%S", localtime_r(&t, &tm));
+   fprintf(stderr, "[%s] %s[%ld]: %s:%d %s: \n\t", date, levels[level],
+           (long)getpid(), file, line, function);
+}
+
+static void write_entry(LogEntry* e)
+{
+   static char line[LOG_LINE_SIZE];
+   format_entry(line, sizeof(line), e);
+   if (e->kind == ENTRY_LOG) {
+      write_log_header(e->level, e->time, e->file, e->line, e->function);
+      fputs(line, stderr);
+   } else if (redirect_func_)
+      redirect_func_(e->level, line);
+}
+
+static void* log_thread(void* unused)
+{
+   unsigned long reported = 0;
+   for (;;) {
+      LogEntry* e = &ring.slot[ring.head & (LOG_RING_SIZE - 1)];
+      size_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+      if (seq == ring.head + 1) {
+         write_entry(e);
+         atomic_store_explicit(&e->seq, ring.head + LOG_RING_SIZE,
+                               memory_order_release);
+         ring.head++;
+         continue;
+      }
+      unsigned long dropped = atomic_load(&ring.dropped);
+      if (dropped != reported) {
+         fprintf(stderr, "[lwqq log] %lu messages dropped, ring is full\n",
+                 dropped - reported);
+         reported = dropped;
+      }
+      fflush(stderr);
+      pthread_mutex_lock(&async_lock);
+      atomic_store(&ring.done, ring.head);
+      pthread_cond_broadcast(&done_cond);
+      atomic_store(&ring.sleeping, 1);
+      // producer may miss sleeping flag, so never sleep long
+      if (atomic_load(&ring.tail) == ring.head) {
+         struct timespec ts;
+         clock_gettime(CLOCK_REALTIME, &ts);
+         ts.tv_nsec += 50 * 1000000;
+         if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+         }
+         pthread_cond_timedwait(&wake_cond, &async_lock, &ts);
+      }
+      atomic_store(&ring.sleeping, 0);
+      pthread_mutex_unlock(&async_lock);
+   }
+   return NULL;
+}
+
+static void async_init(void)
+{
+   size_t i;
+   pthread_t tid;
+   for (i = 0; i < LOG_RING_SIZE; i++)
+      atomic_init(&ring.slot[i].seq, i);
+   pthread_create(&tid, NULL, log_thread, NULL);
+   pthread_detach(tid);
+   atexit(lwqq_log_flush);
+}
+
+/** @return 0 when message is recorded into ring */
+static int log_record(int kind, int level, const char* file, int line,
+                      const char* function, const char* fmt, va_list va)
+{
+   size_t pos = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+   LogEntry* e;
+   va_list copy;
+
+   if (!atomic_load_explicit(&async_mode, memory_order_relaxed))
+      return -1;
+   for (;;) {
+      e = &ring.slot[pos & (LOG_RING_SIZE - 1)];
+      size_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+         if (atomic_compare_exchange_weak_explicit(&ring.tail, &pos, pos + 1,
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed))
+            break;
+      } else if (dif < 0) {
+         atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+         return 0;
+      } else
+         pos = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+   }
+
+   e->kind = kind;
+   e->level = level;
+   e->fmt = fmt;
+   e->file = file;
+   e->line = line;
+   e->function = function;
+   e->time = time(NULL);
+   va_copy(copy, va);
+   if (args_encode(e, fmt, copy) != 0) {
+      // rare format we can't copy, format it here
+      char* str = malloc(LOG_LINE_SIZE);
+      vsnprintf(str, LOG_LINE_SIZE, fmt, va);
+      e->fmt = "%s";
+      e->data[0] = ARG_HEAP_STR;
+      memcpy(e->data + 1, &str, sizeof(str));
+   }
+   va_end(copy);
+   atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+   if (atomic_load_explicit(&ring.sleeping, memory_order_relaxed))
+      pthread_cond_signal(&wake_cond);
+   return 0;
+}
+
+LWQQ_EXPORT
+void lwqq_log_set_async(int enable)
+{
+   if (enable) {
+      pthread_once(&async_once, async_init);
+      atomic_store(&async_mode, 1);
+   } else {
+      atomic_store(&async_mode, 0);
+      lwqq_log_flush();
+   }
+}
+
+LWQQ_EXPORT
+void lwqq_log_flush()
+{
+   size_t target = atomic_load(&ring.tail);
+   if (target == 0)
+      return;
+   pthread_mutex_lock(&async_lock);
+   while (atomic_load(&ring.done) < target) {
+      struct timespec ts;
+      pthread_cond_signal(&wake_cond);
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec++;
+      pthread_cond_timedwait(&done_cond, &async_lock, &ts);
+   }
+   pthread_mutex_unlock(&async_lock);
+}
+
+LWQQ_EXPORT
+unsigned long lwqq_log_dropped() { return atomic_load(&ring.dropped); }
+
 /**
  * This is standard logger function
  *
@@ -43,24 +502,15 @@ LWQQ_EXPORT
 void lwqq_log(int level, const char* file, int line, const char* function,
               const char* msg, ...)
 {
-
-   char buf[128] = { 0 };
    va_list va;
-   time_t t = time(NULL);
-   struct tm* tm;
-   char date[256];
-
-   tm = localtime(&t);
-   strftime(date, sizeof(date), "%b %d %H:%M:%S", tm);
-
-   if (level > 1) {
-      snprintf(buf, sizeof(buf), "[%s] %s[%ld]: %s:%d %s: \n\t", date,
-               levels[level], (long)getpid(), file, line, function);
-      fprintf(stderr, "%s", buf);
+   va_start(va, msg);
+   if (log_record(ENTRY_LOG, level, file, line, function, msg, va) == 0) {
+      va_end(va);
+      return;
    }
+   write_log_header(level, time(NULL), file, line, function);
 
    // support long long msg printout
-   va_start(va, msg);
    vfprintf(stderr, msg, va);
    va_end(va);
    fflush(stderr);
@@ -77,12 +527,16 @@ const char* lwqq_log_time()
 }
 
 LWQQ_EXPORT
-void lwqq_verbose(int l, const char* str, ...)
+void(lwqq_verbose)(int l, const char* str, ...)
 {
-   static char buffer[81920];
+   static char buffer[LOG_LINE_SIZE];
    if (l <= LWQQ_VERBOSE_LEVEL_) {
       va_list args;
       va_start(args, str);
+      if (log_record(ENTRY_VERBOSE, l, NULL, 0, NULL, str, args) == 0) {
+         va_end(args);
+         return;
+      }
       vsnprintf(buffer, sizeof(buffer), str, args);
       va_end(args);
       if (redirect_func_)
@@ -51,12 +51,31 @@ const char* lwqq_log_time();
  * 5        Extra Verbose
  */
 void lwqq_verbose(int l, const char* str, ...);
+/* check level before arguments are evaluated */
+#define lwqq_verbose(l, ...)                                                   \
+   ((l) <= lwqq_log_get_level() ? (lwqq_verbose)(l, __VA_ARGS__) : (void)0)
 #define lwqq_puts(str) lwqq_verbose(1, "%s\n", str)
 
 void lwqq_log_set_level(int level);
 int lwqq_log_get_level();
 
+/**
+ * in async mode redirect func is called in logger thread
+ */
 void lwqq_log_redirect(LwqqLogRedirectFunc func);
+
+/**
+ * async mode: lwqq_log and lwqq_verbose only copy format and arguments into
+ * a lock free ring, a background thread formats and writes them.
+ * format string must be a literal or live forever, string arguments are
+ * copied. when ring is full, message is dropped and counted.
+ * disable it would flush all recorded messages first.
+ */
+void lwqq_log_set_async(int enable);
+/** wait until all recorded messages are written */
+void lwqq_log_flush();
+/** messages dropped since ring is full */
+unsigned long lwqq_log_dropped();
 #define LWQQ_VERBOSE_LV lwqq_log_get_level()
 
 #ifdef NDEBUG
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "login.h"
 #include "logger.h"
@@ -51,6 +52,8 @@ struct LoginStage{
   char* salt;
   char* check_sig_url;
   char randSalt;
+  LwqqTraceSpan span;
+  LwqqTraceSpan stage_span;
 };
 
 typedef LwqqAsyncEvent* (*LoginFunc)(LwqqClient*, struct LoginStage*);
@@ -194,18 +197,21 @@ done:
 }
 
 static int do_login_cb(LwqqHttpRequest* req, struct LoginStage* s);
+/** encrypt.js is read once, the runtime running it is pooled in lwjs.c */
+static char* encrypt_js = NULL;
+static pthread_once_t encrypt_js_once = PTHREAD_ONCE_INIT;
+static void encrypt_js_load()
+{
+   encrypt_js = lwqq_util_load_res("encrypt.js", 1);
+}
 /** stage 4 **/
 static LwqqAsyncEvent* do_login(LwqqClient* lc, struct LoginStage* s)
 {
    // caculate password
-   char* js_txt = lwqq_util_load_res("encrypt.js", 1);
-   lwqq_js_t* js = lwqq_js_init();
-   lwqq_js_load_buffer(js, js_txt);
+   pthread_once(&encrypt_js_once, encrypt_js_load);
    //replace(s->salt, '\\', '-');
-   char* enc = lwqq_js_enc_pwd(lc->password, s->salt,
-       lc->args->vf_image ? lc->args->vf_image->str : s->vcode, js);
-   s_free(js_txt);
-   lwqq_js_close(js);
+   char* enc = lwqq_js_pool_enc_pwd(encrypt_js, lc->password, s->salt,
+       lc->args->vf_image ? lc->args->vf_image->str : s->vcode);
 
    char url[1024];
    char refer[1024];
@@ -474,11 +480,14 @@ LwqqAsyncEvent* lwqq_login(LwqqClient* lc, LwqqStatus status)
    vp_do_repeat(lc->events->start_login, NULL);
 
    struct LoginStage* s = s_malloc0(sizeof(*s));
-   s->trigger = lwqq_async_event_new(NULL);
+   lwqq_trace_begin(&s->span, "login");
+   LwqqTraceCtx prev = lwqq_trace_resume(s->span.ctx);
+   LwqqAsyncEvent* trigger = s->trigger = lwqq_async_event_new(NULL);
    s->trigger->lc = lc;
    s->stage = 0;
    do_login_stage(lc, s);
-   return s->trigger;
+   lwqq_trace_resume(prev);
+   return trigger;
 }
 
 /**
@@ -654,7 +663,17 @@ static LoginFunc login_seq[] = {
   NULL
 };
 
-static void do_login_stage(LwqqClient* lc, struct LoginStage* s)
+static const char* login_stage_names[] = {
+  "get_login_sig",
+  "check_need_verify",
+  "get_verify_image",
+  "do_login",
+  "check_sig",
+  "set_online_status",
+  NULL
+};
+
+static void login_stage_next(LwqqClient* lc, struct LoginStage* s)
 {
    LwqqErrorCode err = LWQQ_EC_OK;
    if (!lwqq_client_valid(lc))
@@ -674,7 +693,11 @@ static void do_login_stage(LwqqClient* lc, struct LoginStage* s)
       goto done;
    }
 
+   // request of each stage is traced as child of stage span
+   lwqq_trace_begin(&s->stage_span, login_stage_names[s->stage]);
+   lwqq_trace_resume(s->stage_span.ctx);
    s->ev = login_seq[s->stage](lc, s);
+   lwqq_trace_resume(s->span.ctx);
    lwqq_async_add_event_listener(s->ev, _C_(2p, do_login_stage, lc, s));
    return;
 onfail:
@@ -684,8 +707,18 @@ done:
    vp_do_repeat(lc->events->login_complete, NULL);
    s->trigger->result = err;
    lwqq_async_event_finish(s->trigger);
+   lwqq_trace_end(&s->span, err ? "failed" : NULL);
    s_free(s->vcode);
    s_free(s->salt);
    s_free(s->check_sig_url);
    s_free(s);
 }
+
+static void do_login_stage(LwqqClient* lc, struct LoginStage* s)
+{
+   LwqqTraceCtx prev = lwqq_trace_resume(s->span.ctx);
+   // previous stage is finished when we are called back
+   lwqq_trace_end(&s->stage_span, NULL);
+   login_stage_next(lc, s);
+   lwqq_trace_resume(prev);
+}
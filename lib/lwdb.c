@@ -48,6 +48,8 @@ typedef struct LwdbExtension {
    const LwqqCommand* group_chg;
    const LwqqCommand* new_group;
    const LwqqCommand* ext_clean;
+   const LwqqCommand* start_login;
+   const LwqqCommand* roster_refresh;
 } LwdbExtension;
 
 static LwqqErrorCode lwdb_globaldb_add_new_user(struct LwdbGlobalDB* db,
@@ -1124,6 +1126,23 @@ int lwdb_userdb_write(LwdbUserDB* db, const char* key, const char* value)
    return sws_exec_sql(db->db, sql, NULL);
 }
 
+/** try the hash accepted last time first */
+static void db_load_hash(LwdbUserDB* db, LwqqClient* lc)
+{
+   const char* name = lwdb_userdb_read(db, "hash");
+   if (name && name[0])
+      lwqq_hash_set_beg(lc, name);
+}
+static void db_save_hash(LwdbUserDB* db, LwqqClient* lc)
+{
+   const LwqqHashEntry* entry = lwqq_hash_get_last(lc);
+   const char* saved;
+   if (!entry || !entry->name)
+      return;
+   saved = lwdb_userdb_read(db, "hash");
+   if (!saved || strcmp(saved, entry->name))
+      lwdb_userdb_write(db, "hash", entry->name);
+}
 static void db_extension_init(LwqqClient* lc, LwqqExtension* ext)
 {
    LwdbExtension* ext_ = (LwdbExtension*)ext;
@@ -1139,6 +1158,10 @@ static void db_extension_init(LwqqClient* lc, LwqqExtension* ext)
        _C_(2p, lwdb_userdb_insert_group_info, ext_->db, &lc->args->group));
    ext_->ext_clean = lwqq_add_event(lc->events->ext_clean,
                                     _C_(2p, lwqq_free_extension, lc, ext));
+   ext_->start_login = lwqq_add_event(lc->events->start_login,
+                                      _C_(2p, db_load_hash, ext_->db, lc));
+   ext_->roster_refresh = lwqq_add_event(lc->events->roster_refresh,
+                                         _C_(2p, db_save_hash, ext_->db, lc));
 }
 
 static void db_extension_remove(LwqqClient* lc, LwqqExtension* ext)
@@ -1148,10 +1171,14 @@ static void db_extension_remove(LwqqClient* lc, LwqqExtension* ext)
    vp_unlink(&lc->events->group_chg, ext_->group_chg);
    vp_unlink(&lc->events->new_group, ext_->new_group);
    vp_unlink(&lc->events->ext_clean, ext_->ext_clean);
+   vp_unlink(&lc->events->start_login, ext_->start_login);
+   vp_unlink(&lc->events->roster_refresh, ext_->roster_refresh);
    ext_->friend_chg = NULL;
    ext_->group_chg = NULL;
    ext_->new_group = NULL;
    ext_->ext_clean = NULL;
+   ext_->start_login = NULL;
+   ext_->roster_refresh = NULL;
 }
 
 LWQQ_EXPORT
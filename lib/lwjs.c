@@ -2,6 +2,7 @@
 #include "lwjs.h"
 #include "internal.h"
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,8 +15,36 @@ struct lwqq_js_t {
    JSRuntime* runtime;
    JSContext* context;
    JSObject* global;
+   uint64_t script; /** < key of script evaluated by pool, 0 if not pooled */
+   uint64_t used;
+   int busy;
+   LIST_ENTRY(lwqq_js_t) entries;
 };
 
+#define JS_POOL_MAX 4
+#define JS_MEMO_SIZE 64
+
+typedef struct JsMemo {
+   uint64_t script;
+   uint64_t used;
+   char* uin;
+   char* ptwebqq;
+   char* result;
+} JsMemo;
+
+/** runtimes of every client, the memo caches results of hash script */
+static struct {
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   LIST_HEAD(, lwqq_js_t) list;
+   int count; /** < pooled runtimes, including those being created */
+   int max;
+   int alive; /** < all runtimes, JS_ShutDown when it drops to zero */
+   uint64_t clock;
+   JsMemo memo[JS_MEMO_SIZE];
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+           LIST_HEAD_INITIALIZER(pool.list), 0, JS_POOL_MAX };
+
 static JSClass global_class
     = { "global",                   JSCLASS_GLOBAL_FLAGS | JSCLASS_NEW_RESOLVE,
         JS_PropertyStub,            JS_PropertyStub,
@@ -48,6 +77,9 @@ lwqq_js_t* lwqq_js_init()
    h->global = JS_NewGlobalObject(h->context, &global_class, NULL);
 #endif
    JS_InitStandardClasses(h->context, h->global);
+   pthread_mutex_lock(&pool.lock);
+   pool.alive++;
+   pthread_mutex_unlock(&pool.lock);
    return h;
 }
 
@@ -127,10 +159,239 @@ char* lwqq_js_enc_pwd(const char* pwd, const char* salt, const char* vcode,
 LWQQ_EXPORT
 void lwqq_js_close(lwqq_js_t* js)
 {
+   int last;
    JS_DestroyContext(js->context);
    JS_DestroyRuntime(js->runtime);
-   JS_ShutDown();
    s_free(js);
+   pthread_mutex_lock(&pool.lock);
+   last = --pool.alive == 0;
+   pthread_mutex_unlock(&pool.lock);
+   // it is process wide, pooled runtimes would be broken by it
+   if (last)
+      JS_ShutDown();
+}
+
+/** a runtime is used by one thread at a time, move it to current one */
+static void js_own(lwqq_js_t* js)
+{
+#ifdef JS_THREADSAFE
+#ifdef MOZJS_185
+   JS_SetContextThread(js->context);
+#else
+   JS_SetRuntimeThread(js->runtime);
+#endif
+#endif
+}
+
+static void js_disown(lwqq_js_t* js)
+{
+#ifdef JS_THREADSAFE
+#ifdef MOZJS_185
+   JS_ClearContextThread(js->context);
+#else
+   JS_ClearRuntimeThread(js->runtime);
+#endif
+#endif
+}
+
+/** FNV-1a, scripts are told apart by content */
+static uint64_t script_key(const char* script)
+{
+   uint64_t h = 14695981039346656037ULL;
+   for (; *script; script++) {
+      h ^= (unsigned char)*script;
+      h *= 1099511628211ULL;
+   }
+   return h ? h : 1;
+}
+
+static lwqq_js_t* pool_find_idle(uint64_t key, int other)
+{
+   lwqq_js_t* js, *found = NULL;
+   LIST_FOREACH(js, &pool.list, entries)
+   {
+      if (js->busy || (other ? js->script == key : js->script != key))
+         continue;
+      // least recently used one
+      if (!found || js->used < found->used)
+         found = js;
+   }
+   return found;
+}
+
+LWQQ_EXPORT
+void lwqq_js_pool_set_max(int max)
+{
+   pthread_mutex_lock(&pool.lock);
+   pool.max = max > 0 ? max : 1;
+   pthread_cond_broadcast(&pool.cond);
+   pthread_mutex_unlock(&pool.lock);
+}
+
+LWQQ_EXPORT
+lwqq_js_t* lwqq_js_pool_acquire(const char* script)
+{
+   if (!script)
+      return NULL;
+   uint64_t key = script_key(script);
+   lwqq_js_t* js, *evict = NULL;
+
+   pthread_mutex_lock(&pool.lock);
+   for (;;) {
+      if ((js = pool_find_idle(key, 0)))
+         break;
+      if (pool.count < pool.max)
+         break;
+      // all slots are taken, replace an idle runtime of another script
+      if ((evict = pool_find_idle(key, 1))) {
+         LIST_REMOVE(evict, entries);
+         break;
+      }
+      pthread_cond_wait(&pool.cond, &pool.lock);
+   }
+   if (js) {
+      js->busy = 1;
+      js->used = ++pool.clock;
+   } else if (!evict)
+      pool.count++;
+   pthread_mutex_unlock(&pool.lock);
+
+   if (js) {
+      js_own(js);
+#ifdef JS_THREADSAFE
+      JS_BeginRequest(js->context);
+#endif
+      return js;
+   }
+   if (evict) {
+      // the slot is kept for the new one
+      js_own(evict);
+      lwqq_js_close(evict);
+   }
+   // compile outside of lock, it is the slow part
+   js = lwqq_js_init();
+#ifdef JS_THREADSAFE
+   JS_BeginRequest(js->context);
+#endif
+   lwqq_js_load_buffer(js, script);
+   js->script = key;
+   js->busy = 1;
+   pthread_mutex_lock(&pool.lock);
+   js->used = ++pool.clock;
+   LIST_INSERT_HEAD(&pool.list, js, entries);
+   pthread_mutex_unlock(&pool.lock);
+   return js;
+}
+
+LWQQ_EXPORT
+void lwqq_js_pool_release(lwqq_js_t* js)
+{
+   if (!js)
+      return;
+#ifdef JS_THREADSAFE
+   JS_EndRequest(js->context);
+#endif
+   js_disown(js);
+   pthread_mutex_lock(&pool.lock);
+   js->busy = 0;
+   pthread_cond_signal(&pool.cond);
+   pthread_mutex_unlock(&pool.lock);
+}
+
+LWQQ_EXPORT
+void lwqq_js_pool_cleanup()
+{
+   lwqq_js_t* js;
+   int i;
+   pthread_mutex_lock(&pool.lock);
+   // pooled runtimes never have key 0, so this finds any idle one
+   while ((js = pool_find_idle(0, 1))) {
+      LIST_REMOVE(js, entries);
+      pool.count--;
+      pthread_mutex_unlock(&pool.lock);
+      js_own(js);
+      lwqq_js_close(js);
+      pthread_mutex_lock(&pool.lock);
+   }
+   for (i = 0; i < JS_MEMO_SIZE; i++) {
+      JsMemo* m = &pool.memo[i];
+      s_free(m->uin);
+      s_free(m->ptwebqq);
+      s_free(m->result);
+      memset(m, 0, sizeof(*m));
+   }
+   pthread_cond_broadcast(&pool.cond);
+   pthread_mutex_unlock(&pool.lock);
+}
+
+static char* memo_get(uint64_t key, const char* uin, const char* ptwebqq)
+{
+   char* ret = NULL;
+   int i;
+   pthread_mutex_lock(&pool.lock);
+   for (i = 0; i < JS_MEMO_SIZE; i++) {
+      JsMemo* m = &pool.memo[i];
+      if (m->script == key && strcmp(m->uin, uin) == 0
+          && strcmp(m->ptwebqq, ptwebqq) == 0) {
+         m->used = ++pool.clock;
+         ret = s_strdup(m->result);
+         break;
+      }
+   }
+   pthread_mutex_unlock(&pool.lock);
+   return ret;
+}
+
+static void memo_put(uint64_t key, const char* uin, const char* ptwebqq,
+                     const char* result)
+{
+   JsMemo* m = &pool.memo[0];
+   int i;
+   pthread_mutex_lock(&pool.lock);
+   for (i = 1; i < JS_MEMO_SIZE && m->script; i++) {
+      if (pool.memo[i].used < m->used)
+         m = &pool.memo[i];
+   }
+   s_free(m->uin);
+   s_free(m->ptwebqq);
+   s_free(m->result);
+   m->script = key;
+   m->used = ++pool.clock;
+   m->uin = s_strdup(uin);
+   m->ptwebqq = s_strdup(ptwebqq);
+   m->result = s_strdup(result);
+   pthread_mutex_unlock(&pool.lock);
+}
+
+LWQQ_EXPORT
+char* lwqq_js_pool_hash(const char* script, const char* uin,
+                        const char* ptwebqq)
+{
+   if (!script || !uin || !ptwebqq)
+      return NULL;
+   uint64_t key = script_key(script);
+   char* ret = memo_get(key, uin, ptwebqq);
+   if (ret)
+      return ret;
+   lwqq_js_t* js = lwqq_js_pool_acquire(script);
+   ret = lwqq_js_hash(uin, ptwebqq, js);
+   lwqq_js_pool_release(js);
+   if (ret)
+      memo_put(key, uin, ptwebqq, ret);
+   return ret;
+}
+
+LWQQ_EXPORT
+char* lwqq_js_pool_enc_pwd(const char* script, const char* pwd,
+                           const char* salt, const char* vcode)
+{
+   // not memoized, encryption is randomized
+   lwqq_js_t* js = lwqq_js_pool_acquire(script);
+   if (!js)
+      return NULL;
+   char* ret = lwqq_js_enc_pwd(pwd, salt, vcode, js);
+   lwqq_js_pool_release(js);
+   return ret;
 }
 #else
 
@@ -142,5 +403,25 @@ lwqq_js_t* lwqq_js_init() { return NULL; }
 
 LWQQ_EXPORT
 void lwqq_js_close(lwqq_js_t* js) {}
+
+LWQQ_EXPORT
+void lwqq_js_pool_set_max(int max) {}
+
+LWQQ_EXPORT
+void lwqq_js_pool_cleanup() {}
+
+LWQQ_EXPORT
+char* lwqq_js_pool_hash(const char* script, const char* uin,
+                        const char* ptwebqq)
+{
+   return NULL;
+}
+
+LWQQ_EXPORT
+char* lwqq_js_pool_enc_pwd(const char* script, const char* pwd,
+                           const char* salt, const char* vcode)
+{
+   return NULL;
+}
 #endif
 
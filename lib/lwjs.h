@@ -16,5 +16,26 @@ void lwqq_js_unload(lwqq_js_t* js, lwqq_jso_t* obj);
 char* lwqq_js_hash(const char* uin, const char* ptwebqq, lwqq_js_t* js);
 char* lwqq_js_enc_pwd(const char* pwd, const char* salt, const char* vcode,
                       lwqq_js_t* js);
+
+/**
+ * process wide pool of js runtimes, shared by all clients.
+ * a pooled runtime evaluates one script once and is reused by later calls,
+ * so memory and init time depend on pool size instead of client count.
+ * scripts are told apart by content.
+ */
+/** max runtimes in pool, default is 4 */
+void lwqq_js_pool_set_max(int max);
+#ifdef WITH_MOZJS
+/** get an idle runtime which evaluated script, blocks if pool is full */
+lwqq_js_t* lwqq_js_pool_acquire(const char* script);
+void lwqq_js_pool_release(lwqq_js_t* js);
+#endif
+/** destroy idle runtimes and drop memoized results */
+void lwqq_js_pool_cleanup();
+/** lwqq_js_hash in pool, results are memoized by uin and ptwebqq */
+char* lwqq_js_pool_hash(const char* script, const char* uin,
+                        const char* ptwebqq);
+char* lwqq_js_pool_enc_pwd(const char* script, const char* pwd,
+                           const char* salt, const char* vcode);
 #endif
 
@@ -0,0 +1,527 @@
+/**
+ * @file   media.c
+ * @brief  Content addressed cache of pictures and avatars
+ *
+ * disk store, a key is hashed with FNV-1a into 16 hex digits, the first two
+ * of them select one of 256 shard directories:
+ *
+ *    dir/ab/ab0123456789cdef
+ *
+ * each file is a text header followed by raw data:
+ *
+ *    LWQQMEDIA 1\n key\n etag\n last_modified\n url\n fetched\n size\n data
+ *
+ * a missing validator is an empty line. mtime of a file is its last use,
+ * the store is scanned once at open to rebuild the LRU order.
+ *
+ * the lock only guards the index, files are read, written and removed
+ * after it is released.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <utime.h>
+#else
+#include <sys/utime.h>
+#endif
+
+#include "media.h"
+#include "http.h"
+#include "smemory.h"
+#include "logger.h"
+#include "internal.h"
+#include "utility.h"
+
+#define MEDIA_MAGIC "LWQQMEDIA 1"
+#define MEDIA_BUCKETS 1024
+#define MEDIA_MEM_DEFAULT (16 * 1024 * 1024)
+#define MEDIA_DISK_DEFAULT (256 * 1024 * 1024)
+
+/** a key known to either tier, freed when neither has it */
+typedef struct MediaNode {
+   uint64_t hash;
+   char* key; /** < key of mem, hashes of two keys may collide */
+   LwqqMediaEntry* mem; /** < NULL if not in memory */
+   size_t disk_size; /** < 0 if not on disk */
+   time_t disk_used;
+   LIST_ENTRY(MediaNode) bucket;
+   TAILQ_ENTRY(MediaNode) mem_lru;
+   TAILQ_ENTRY(MediaNode) disk_lru;
+} MediaNode;
+
+static struct {
+   pthread_mutex_t lock;
+   int enabled;
+   char* dir;
+   size_t mem_budget;
+   size_t mem_bytes;
+   size_t disk_budget;
+   size_t disk_bytes;
+   unsigned gen; /** < increased each open, drops index updates of old store */
+   unsigned seq; /** < names temp files */
+   char** trash; /** < files evicted, removed after lock is released */
+   size_t n_trash;
+   LIST_HEAD(, MediaNode) buckets[MEDIA_BUCKETS];
+   TAILQ_HEAD(, MediaNode) mem_lru; /** < head is least recently used */
+   TAILQ_HEAD(, MediaNode) disk_lru;
+} media = { PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t key_hash(const char* key)
+{
+   uint64_t h = 14695981039346656037ULL;
+   for (; *key; key++) {
+      h ^= (unsigned char)*key;
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+static void node_path(uint64_t hash, char* buf, size_t size)
+{
+   snprintf(buf, size, "%s" LWQQ_PATH_SEP "%02x" LWQQ_PATH_SEP "%016llx",
+            media.dir, (unsigned)(hash >> 56), (unsigned long long)hash);
+}
+
+static MediaNode* node_get(uint64_t hash, int create)
+{
+   MediaNode* n;
+   LIST_FOREACH(n, &media.buckets[hash % MEDIA_BUCKETS], bucket)
+   {
+      if (n->hash == hash)
+         return n;
+   }
+   if (!create)
+      return NULL;
+   n = s_malloc0(sizeof(*n));
+   n->hash = hash;
+   LIST_INSERT_HEAD(&media.buckets[hash % MEDIA_BUCKETS], n, bucket);
+   return n;
+}
+
+static void node_release(MediaNode* n)
+{
+   if (n->mem || n->disk_size)
+      return;
+   LIST_REMOVE(n, bucket);
+   s_free(n);
+}
+
+static void entry_copy(LwqqMediaEntry* d, const LwqqMediaEntry* e)
+{
+   d->data = s_malloc(e->size + 1);
+   memcpy(d->data, e->data, e->size);
+   d->data[e->size] = '\0';
+   d->size = e->size;
+   d->etag = s_strdup(e->etag);
+   d->last_modified = s_strdup(e->last_modified);
+   d->url = s_strdup(e->url);
+   d->fetched = e->fetched;
+}
+
+static LwqqMediaEntry* entry_dup(const LwqqMediaEntry* e)
+{
+   LwqqMediaEntry* d = s_malloc0(sizeof(*d));
+   entry_copy(d, e);
+   return d;
+}
+
+LWQQ_EXPORT
+void lwqq_media_entry_free(LwqqMediaEntry* e)
+{
+   if (!e)
+      return;
+   s_free(e->data);
+   s_free(e->etag);
+   s_free(e->last_modified);
+   s_free(e->url);
+   memset(e, 0, sizeof(*e));
+}
+
+static void mem_drop(MediaNode* n)
+{
+   TAILQ_REMOVE(&media.mem_lru, n, mem_lru);
+   media.mem_bytes -= n->mem->size;
+   lwqq_media_entry_free(n->mem);
+   s_free(n->mem);
+   s_free(n->key);
+   n->mem = NULL;
+}
+
+static void disk_drop(MediaNode* n)
+{
+   char path[512];
+   node_path(n->hash, path, sizeof(path));
+   media.trash = s_realloc(media.trash, sizeof(char*) * (media.n_trash + 1));
+   media.trash[media.n_trash++] = s_strdup(path);
+   TAILQ_REMOVE(&media.disk_lru, n, disk_lru);
+   media.disk_bytes -= n->disk_size;
+   n->disk_size = 0;
+}
+
+static void mem_insert(MediaNode* n, const char* key, LwqqMediaEntry* e)
+{
+   MediaNode* old;
+   if (n->mem)
+      mem_drop(n);
+   // media larger than whole budget is only kept on disk
+   if (e->size > media.mem_budget) {
+      lwqq_media_entry_free(e);
+      s_free(e);
+      return;
+   }
+   n->mem = e;
+   n->key = s_strdup(key);
+   media.mem_bytes += e->size;
+   TAILQ_INSERT_TAIL(&media.mem_lru, n, mem_lru);
+   while (media.mem_bytes > media.mem_budget) {
+      old = TAILQ_FIRST(&media.mem_lru);
+      mem_drop(old);
+      node_release(old);
+   }
+}
+
+static void disk_account(MediaNode* n, size_t size, time_t used)
+{
+   MediaNode* old;
+   if (n->disk_size) {
+      TAILQ_REMOVE(&media.disk_lru, n, disk_lru);
+      media.disk_bytes -= n->disk_size;
+   }
+   n->disk_size = size ? size : 1;
+   n->disk_used = used;
+   media.disk_bytes += n->disk_size;
+   TAILQ_INSERT_TAIL(&media.disk_lru, n, disk_lru);
+   while (media.disk_bytes > media.disk_budget
+          && (old = TAILQ_FIRST(&media.disk_lru)) != n) {
+      disk_drop(old);
+      node_release(old);
+   }
+}
+
+/** unlock and remove evicted files */
+static void media_unlock()
+{
+   char** trash = media.trash;
+   size_t i, n = media.n_trash;
+   media.trash = NULL;
+   media.n_trash = 0;
+   pthread_mutex_unlock(&media.lock);
+   for (i = 0; i < n; i++) {
+      unlink(trash[i]);
+      s_free(trash[i]);
+   }
+   s_free(trash);
+}
+
+/** @param tmp unique temp name in the same directory of path */
+static int disk_write(const char* path, const char* tmp, const char* key,
+                      const LwqqMediaEntry* e)
+{
+   char dir[512];
+   FILE* f;
+   snprintf(dir, sizeof(dir), "%s", path);
+   *strrchr(dir, LWQQ_PATH_SEP[0]) = '\0';
+   mkdir(dir, 0700);
+   if (!(f = fopen(tmp, "wb")))
+      return -1;
+   fprintf(f, MEDIA_MAGIC "\n%s\n%s\n%s\n%s\n%ld\n%zu\n", key,
+           e->etag ? e->etag : "", e->last_modified ? e->last_modified : "",
+           e->url ? e->url : "", (long)e->fetched, e->size);
+   fwrite(e->data, 1, e->size, f);
+   int err = ferror(f);
+   if (fclose(f) || err) {
+      unlink(tmp);
+      return -1;
+   }
+#ifdef WIN32
+   unlink(path);
+#endif
+   if (rename(tmp, path)) {
+      unlink(tmp);
+      return -1;
+   }
+   return 0;
+}
+
+static char* read_line(FILE* f, char* buf, size_t size)
+{
+   if (!fgets(buf, size, f))
+      return NULL;
+   buf[strcspn(buf, "\n")] = '\0';
+   return buf;
+}
+
+/** @param limit a larger size is taken as broken */
+static LwqqMediaEntry* disk_read(const char* path, const char* key,
+                                 size_t limit)
+{
+   char line[LWQQ_MEDIA_KEY_LEN + 8], etag[256], lm[64], url[1024];
+   char fetched[32], size[32];
+   LwqqMediaEntry* e = NULL;
+   FILE* f;
+   if (!(f = fopen(path, "rb")))
+      return NULL;
+   if (!read_line(f, line, sizeof(line)) || strcmp(line, MEDIA_MAGIC)
+       || !read_line(f, line, sizeof(line)) || strcmp(line, key)
+       || !read_line(f, etag, sizeof(etag)) || !read_line(f, lm, sizeof(lm))
+       || !read_line(f, url, sizeof(url))
+       || !read_line(f, fetched, sizeof(fetched))
+       || !read_line(f, size, sizeof(size)))
+      goto done;
+   // a broken size must not allocate more than the store could hold
+   if (strtoul(size, NULL, 10) > limit)
+      goto done;
+   e = s_malloc0(sizeof(*e));
+   e->size = strtoul(size, NULL, 10);
+   e->data = s_malloc(e->size + 1);
+   if (fread(e->data, 1, e->size, f) != e->size) {
+      lwqq_media_entry_free(e);
+      s_free(e);
+      e = NULL;
+      goto done;
+   }
+   e->data[e->size] = '\0';
+   e->etag = etag[0] ? s_strdup(etag) : NULL;
+   e->last_modified = lm[0] ? s_strdup(lm) : NULL;
+   e->url = url[0] ? s_strdup(url) : NULL;
+   e->fetched = strtol(fetched, NULL, 10);
+done:
+   fclose(f);
+   if (e)
+      utime(path, NULL);
+   return e;
+}
+
+typedef struct ScanItem {
+   uint64_t hash;
+   size_t size;
+   time_t used;
+} ScanItem;
+
+static int scan_cmp(const void* a, const void* b)
+{
+   time_t x = ((const ScanItem*)a)->used, y = ((const ScanItem*)b)->used;
+   return (x > y) - (x < y);
+}
+
+/** list stored files, sorted by mtime, to rebuild disk LRU */
+static ScanItem* disk_scan(const char* root, size_t* count)
+{
+   char path[512];
+   ScanItem* items = NULL;
+   size_t n_item = 0, cap_item = 0;
+   struct dirent* d;
+   struct stat st;
+   int shard;
+
+   for (shard = 0; shard < 256; shard++) {
+      snprintf(path, sizeof(path), "%s" LWQQ_PATH_SEP "%02x", root, shard);
+      DIR* dir = opendir(path);
+      if (!dir)
+         continue;
+      while ((d = readdir(dir))) {
+         char* end;
+         uint64_t hash = strtoull(d->d_name, &end, 16);
+         if (strlen(d->d_name) != 16 || *end)
+            continue;
+         snprintf(path, sizeof(path),
+                  "%s" LWQQ_PATH_SEP "%02x" LWQQ_PATH_SEP "%s", root, shard,
+                  d->d_name);
+         if (stat(path, &st))
+            continue;
+         if (n_item == cap_item) {
+            cap_item = cap_item ? cap_item * 2 : 256;
+            items = s_realloc(items, sizeof(ScanItem) * cap_item);
+         }
+         items[n_item].hash = hash;
+         items[n_item].size = st.st_size;
+         items[n_item].used = st.st_mtime;
+         n_item++;
+      }
+      closedir(dir);
+   }
+   if (n_item)
+      qsort(items, n_item, sizeof(ScanItem), scan_cmp);
+   *count = n_item;
+   return items;
+}
+
+static void media_close()
+{
+   MediaNode* n, *next;
+   int i;
+   for (i = 0; i < MEDIA_BUCKETS; i++) {
+      for (n = LIST_FIRST(&media.buckets[i]); n; n = next) {
+         next = LIST_NEXT(n, bucket);
+         if (n->mem) {
+            lwqq_media_entry_free(n->mem);
+            s_free(n->mem);
+         }
+         s_free(n->key);
+         s_free(n);
+      }
+      LIST_INIT(&media.buckets[i]);
+   }
+   TAILQ_INIT(&media.mem_lru);
+   TAILQ_INIT(&media.disk_lru);
+   media.mem_bytes = media.disk_bytes = 0;
+   s_free(media.dir);
+   media.enabled = 0;
+}
+
+LWQQ_EXPORT
+int lwqq_media_cache_open(const char* dir, size_t mem_budget,
+                          size_t disk_budget)
+{
+   ScanItem* items = NULL;
+   size_t n_item = 0, i;
+   if (dir) {
+      mkdir(dir, 0700);
+      if (access(dir, W_OK)) {
+         lwqq_log(LOG_ERROR, "media cache %s is not writable\n", dir);
+         pthread_mutex_lock(&media.lock);
+         media_close();
+         media.gen++;
+         pthread_mutex_unlock(&media.lock);
+         return -1;
+      }
+      items = disk_scan(dir, &n_item);
+   }
+   pthread_mutex_lock(&media.lock);
+   media_close();
+   media.gen++;
+   media.mem_budget = mem_budget ? mem_budget : MEDIA_MEM_DEFAULT;
+   media.disk_budget = disk_budget ? disk_budget : MEDIA_DISK_DEFAULT;
+   media.dir = s_strdup(dir);
+   for (i = 0; i < n_item; i++)
+      disk_account(node_get(items[i].hash, 1), items[i].size, items[i].used);
+   media.enabled = 1;
+   media_unlock();
+   s_free(items);
+   return 0;
+}
+
+LWQQ_EXPORT
+void lwqq_media_cache_close(void)
+{
+   pthread_mutex_lock(&media.lock);
+   media_close();
+   media.gen++;
+   media_unlock();
+}
+
+LWQQ_EXPORT
+int lwqq_media_cache_enabled(void) { return media.enabled; }
+
+LWQQ_EXPORT
+int lwqq_media_cache_get(const char* key, LwqqMediaEntry* e)
+{
+   MediaNode* n;
+   LwqqMediaEntry* found;
+   uint64_t hash;
+   char path[512];
+   size_t limit;
+   unsigned gen;
+   if (!key || !e || !media.enabled)
+      return -1;
+   hash = key_hash(key);
+   pthread_mutex_lock(&media.lock);
+   if (!(n = node_get(hash, 0)))
+      goto miss;
+   if (n->mem && strcmp(n->key, key) == 0) {
+      TAILQ_REMOVE(&media.mem_lru, n, mem_lru);
+      TAILQ_INSERT_TAIL(&media.mem_lru, n, mem_lru);
+      entry_copy(e, n->mem);
+      pthread_mutex_unlock(&media.lock);
+      return 0;
+   }
+   if (!n->disk_size || !media.dir)
+      goto miss;
+   node_path(hash, path, sizeof(path));
+   limit = media.disk_budget;
+   gen = media.gen;
+   pthread_mutex_unlock(&media.lock);
+
+   // file keeps its key, a collided one is not taken
+   if (!(found = disk_read(path, key, limit)))
+      return -1;
+   *e = *found;
+   s_free(found);
+
+   pthread_mutex_lock(&media.lock);
+   if (gen == media.gen && (n = node_get(hash, 0)) && n->disk_size) {
+      disk_account(n, n->disk_size, time(NULL));
+      // promote, it is the newest one so it is not evicted at once
+      if (e->size <= media.mem_budget)
+         mem_insert(n, key, entry_dup(e));
+   }
+   media_unlock();
+   return 0;
+miss:
+   pthread_mutex_unlock(&media.lock);
+   return -1;
+}
+
+LWQQ_EXPORT
+void lwqq_media_cache_put(const char* key, const LwqqMediaEntry* e)
+{
+   MediaNode* n;
+   uint64_t hash;
+   char path[512], tmp[540];
+   unsigned gen;
+   if (!key || !e || !e->data || !media.enabled)
+      return;
+   hash = key_hash(key);
+   pthread_mutex_lock(&media.lock);
+   n = node_get(hash, 1);
+   mem_insert(n, key, entry_dup(e));
+   node_release(n);
+   if (!media.dir) {
+      pthread_mutex_unlock(&media.lock);
+      return;
+   }
+   node_path(hash, path, sizeof(path));
+   snprintf(tmp, sizeof(tmp), "%s.%u.tmp", path, media.seq++);
+   gen = media.gen;
+   pthread_mutex_unlock(&media.lock);
+
+   if (disk_write(path, tmp, key, e)) {
+      lwqq_log(LOG_WARNING, "media cache can't store %s\n", key);
+      return;
+   }
+
+   pthread_mutex_lock(&media.lock);
+   if (gen == media.gen)
+      disk_account(node_get(hash, 1), e->size, time(NULL));
+   media_unlock();
+}
+
+void lwqq__media_validate(LwqqHttpRequest* req, const LwqqMediaEntry* e)
+{
+   if (e->etag)
+      req->set_header(req, "If-None-Match", e->etag);
+   if (e->last_modified)
+      req->set_header(req, "If-Modified-Since", e->last_modified);
+}
+
+void lwqq__media_store(const char* key, LwqqHttpRequest* req)
+{
+   LwqqMediaEntry e = { 0 };
+   if (!req->response || !media.enabled)
+      return;
+   e.data = req->response;
+   e.size = req->resp_len;
+   e.etag = (char*)req->get_header(req, "ETag");
+   e.last_modified = (char*)req->get_header(req, "Last-Modified");
+   e.url = (char*)lwqq_http_get_url(req);
+   e.fetched = time(NULL);
+   lwqq_media_cache_put(key, &e);
+}
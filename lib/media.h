@@ -0,0 +1,63 @@
+/**
+ * @file   media.h
+ * @brief  Content addressed cache of pictures and avatars
+ *
+ * media is stored by key: cface by its guid, offpic by file path, avatar by
+ * uin or group code. recently used media stays in a memory LRU, and all of
+ * it is kept in a sharded directory on disk. each tier has a byte budget,
+ * the least recently used media is dropped first.
+ *
+ * cface and offpic never change, so a hit skips http. an avatar hit older
+ * than LWQQ_MEDIA_FRESH seconds is revalidated with If-None-Match and
+ * If-Modified-Since, a 304 answer reuses cached data.
+ */
+
+#ifndef LWQQ_MEDIA_H
+#define LWQQ_MEDIA_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define LWQQ_MEDIA_FRESH (24 * 3600)
+#define LWQQ_MEDIA_KEY_LEN 256
+
+typedef struct LwqqMediaEntry {
+   char* data;
+   size_t size;
+   char* etag; /** < ETag of response, NULL if none */
+   char* last_modified; /** < Last-Modified of response, NULL if none */
+   char* url;
+   time_t fetched; /** < last time server confirmed it */
+} LwqqMediaEntry;
+
+/**
+ * enable cache for every client. the previous cache is closed first.
+ * @param dir disk store, created if missing. NULL for memory only
+ * @param mem_budget bytes kept in memory, 0 for default 16MB
+ * @param disk_budget bytes kept on disk, 0 for default 256MB
+ * @return 0 on success, -1 if dir can't be used
+ */
+int lwqq_media_cache_open(const char* dir, size_t mem_budget,
+                          size_t disk_budget);
+/** drop memory tier and stop caching, disk store is kept */
+void lwqq_media_cache_close(void);
+int lwqq_media_cache_enabled(void);
+/**
+ * look up key in memory, then on disk. a disk hit is promoted to memory.
+ * @param e filled with copies, free with lwqq_media_entry_free
+ * @return 0 on hit, -1 on miss
+ */
+int lwqq_media_cache_get(const char* key, LwqqMediaEntry* e);
+/** insert or replace key in both tiers, e is copied */
+void lwqq_media_cache_put(const char* key, const LwqqMediaEntry* e);
+/** free members of e */
+void lwqq_media_entry_free(LwqqMediaEntry* e);
+
+struct LwqqHttpRequest;
+/** add conditional headers of cached e to req */
+void lwqq__media_validate(struct LwqqHttpRequest* req,
+                          const LwqqMediaEntry* e);
+/** put response of req under key, with its validators */
+void lwqq__media_store(const char* key, struct LwqqHttpRequest* req);
+
+#endif
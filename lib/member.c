@@ -0,0 +1,400 @@
+/**
+ * @file   member.c
+ * @brief  Lazy loaded group member lists
+ *
+ * packed arena layout, one block per group:
+ *
+ *    uint32 column[MEMBER_STR_COLS][count] | int32 stat[count]
+ *    | int32 client_type[count] | int32 mflag[count] | string table
+ *
+ * strings are stored as offset into the string table, offset 0 means NULL.
+ * same string in a group is only stored once.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "member.h"
+#include "smemory.h"
+#include "logger.h"
+#include "info.h"
+#include "internal.h"
+
+enum {
+   COL_UIN,
+   COL_QQ,
+   COL_NICK,
+   COL_CARD,
+   COL_GROUP_SIG,
+   COL_CATE_INDEX,
+   MEMBER_STR_COLS
+};
+
+/* malloc header and alignment, roughly */
+#define MALLOC_OVERHEAD 16
+
+typedef struct LwqqMemberArena LwqqMemberArena;
+
+typedef struct LwqqMemberStore {
+   LwqqClient* lc;
+   size_t budget;
+   size_t live; /** < bytes of materialized members */
+   size_t packed; /** < bytes of packed arena */
+   TAILQ_HEAD(, LwqqMemberArena) lru; /** < head is least recently used */
+} LwqqMemberStore;
+
+struct LwqqMemberArena {
+   LwqqMemberStore* store;
+   LwqqGroup* group;
+   size_t live; /** < estimated bytes of group->members */
+   int pins; /** < never evicted while pinned */
+   int is_packed;
+   uint32_t count;
+   char* block;
+   size_t block_len;
+   TAILQ_ENTRY(LwqqMemberArena) entries;
+};
+
+static char** member_str_ref(LwqqSimpleBuddy* sb, int col)
+{
+   switch (col) {
+   case COL_UIN:
+      return &sb->uin;
+   case COL_QQ:
+      return &sb->qq;
+   case COL_NICK:
+      return &sb->nick;
+   case COL_CARD:
+      return &sb->card;
+   case COL_GROUP_SIG:
+      return &sb->group_sig;
+   default:
+      return &sb->cate_index;
+   }
+}
+
+static size_t members_size(LwqqGroup* g)
+{
+   LwqqSimpleBuddy* sb;
+   size_t size = 0;
+   int col;
+   LIST_FOREACH(sb, &g->members, entries)
+   {
+      size += sizeof(*sb) + MALLOC_OVERHEAD;
+      for (col = 0; col < MEMBER_STR_COLS; col++) {
+         char* s = *member_str_ref(sb, col);
+         if (s)
+            size += strlen(s) + 1 + MALLOC_OVERHEAD;
+      }
+   }
+   return size;
+}
+
+static uint32_t str_hash(const char* s)
+{
+   uint32_t h = 2166136261u;
+   while (*s)
+      h = (h ^ (unsigned char)*s++) * 16777619u;
+   return h;
+}
+
+/** pack g->members into one block and free the list */
+static void arena_pack(LwqqMemberArena* a)
+{
+   LwqqGroup* g = a->group;
+   LwqqSimpleBuddy* sb, *next;
+   uint32_t count = 0, i;
+   size_t str_len = 1, n_slot = 16;
+   int col;
+
+   LIST_FOREACH(sb, &g->members, entries)
+   {
+      count++;
+      for (col = 0; col < MEMBER_STR_COLS; col++) {
+         char* s = *member_str_ref(sb, col);
+         if (s)
+            str_len += strlen(s) + 1;
+      }
+   }
+   while (n_slot < count * MEMBER_STR_COLS * 2)
+      n_slot *= 2;
+
+   size_t head = sizeof(uint32_t) * MEMBER_STR_COLS * count
+                 + sizeof(int32_t) * 3 * count;
+   char* block = s_malloc(head + str_len);
+   uint32_t* cols = (uint32_t*)block;
+   int32_t* stat = (int32_t*)(cols + MEMBER_STR_COLS * count);
+   int32_t* ctype = stat + count;
+   int32_t* mflag = ctype + count;
+   char* strs = block + head;
+   uint32_t* slot = s_malloc0(sizeof(*slot) * n_slot);
+   size_t used = 1;
+   strs[0] = '\0';
+
+   i = 0;
+   LIST_FOREACH(sb, &g->members, entries)
+   {
+      for (col = 0; col < MEMBER_STR_COLS; col++) {
+         char* s = *member_str_ref(sb, col);
+         uint32_t off = 0;
+         if (s) {
+            size_t h = str_hash(s) & (n_slot - 1);
+            while (slot[h] && strcmp(strs + slot[h], s) != 0)
+               h = (h + 1) & (n_slot - 1);
+            if (slot[h] == 0) {
+               size_t len = strlen(s) + 1;
+               memcpy(strs + used, s, len);
+               slot[h] = used;
+               used += len;
+            }
+            off = slot[h];
+         }
+         cols[col * count + i] = off;
+      }
+      stat[i] = sb->stat;
+      ctype[i] = sb->client_type;
+      mflag[i] = sb->mflag;
+      i++;
+   }
+   s_free(slot);
+
+   LIST_FOREACH_SAFE(sb, &g->members, entries, next)
+   {
+      LIST_REMOVE(sb, entries);
+      lwqq_simple_buddy_free(sb);
+   }
+
+   // shrink string table, duplicated strings are not copied
+   a->block_len = head + used;
+   a->block = s_realloc(block, a->block_len);
+   a->count = count;
+   a->is_packed = 1;
+   a->store->live -= a->live;
+   a->store->packed += a->block_len;
+   a->live = 0;
+}
+
+/** unpack block to g->members, and keep order */
+static void arena_unpack(LwqqMemberArena* a)
+{
+   LwqqGroup* g = a->group;
+   uint32_t count = a->count, i;
+   int col;
+   if (!a->is_packed)
+      return;
+   uint32_t* cols = (uint32_t*)a->block;
+   int32_t* stat = (int32_t*)(cols + MEMBER_STR_COLS * count);
+   int32_t* ctype = stat + count;
+   int32_t* mflag = ctype + count;
+   char* strs = (char*)(mflag + count);
+
+   for (i = count; i > 0; i--) {
+      LwqqSimpleBuddy* sb = lwqq_simple_buddy_new();
+      for (col = 0; col < MEMBER_STR_COLS; col++) {
+         uint32_t off = cols[col * count + i - 1];
+         if (off)
+            *member_str_ref(sb, col) = (col == COL_UIN) ? s_intern(strs + off)
+                                                        : s_strdup(strs + off);
+      }
+      sb->stat = stat[i - 1];
+      sb->client_type = ctype[i - 1];
+      sb->mflag = mflag[i - 1];
+      LIST_INSERT_HEAD(&g->members, sb, entries);
+   }
+
+   a->store->packed -= a->block_len;
+   s_free(a->block);
+   a->block_len = 0;
+   a->count = 0;
+   a->is_packed = 0;
+   a->live = members_size(g);
+   a->store->live += a->live;
+}
+
+/** pack least recently used groups until under budget, except keep and
+ * pinned ones */
+static void store_evict(LwqqMemberStore* store, LwqqMemberArena* keep)
+{
+   LwqqMemberArena* a, *next;
+   TAILQ_FOREACH_SAFE(a, &store->lru, entries, next)
+   {
+      if (store->live <= store->budget)
+         break;
+      if (a == keep || a->pins || a->is_packed)
+         continue;
+      lwqq_verbose(3, "[member evict %s %zu bytes]\n", a->group->name,
+                   a->live);
+      arena_pack(a);
+   }
+}
+
+static void arena_use(LwqqMemberArena* a)
+{
+   LwqqMemberStore* store = a->store;
+   TAILQ_REMOVE(&store->lru, a, entries);
+   TAILQ_INSERT_TAIL(&store->lru, a, entries);
+}
+
+LWQQ_EXPORT
+void lwqq_member_set_budget(LwqqClient* lc, size_t budget)
+{
+   LwqqMemberStore** pstore = lwqq__client_member_store(lc);
+   LwqqMemberStore* store = *pstore;
+   if (budget == 0) {
+      if (store) {
+         lwqq__member_store_free(store);
+         *pstore = NULL;
+      }
+      return;
+   }
+   if (budget < LWQQ_MEMBER_BUDGET_MIN)
+      budget = LWQQ_MEMBER_BUDGET_MIN;
+   if (store == NULL) {
+      store = s_malloc0(sizeof(*store));
+      store->lc = lc;
+      TAILQ_INIT(&store->lru);
+      *pstore = store;
+   }
+   store->budget = budget;
+   store_evict(store, NULL);
+}
+
+void lwqq__member_touch(LwqqClient* lc, LwqqGroup* g)
+{
+   LwqqMemberStore* store = *lwqq__client_member_store(lc);
+   LwqqMemberArena* a = g->arena;
+   if (store == NULL)
+      return;
+   if (a == NULL) {
+      a = g->arena = s_malloc0(sizeof(*a));
+      a->store = store;
+      a->group = g;
+      TAILQ_INSERT_TAIL(&store->lru, a, entries);
+   } else
+      arena_use(a);
+   if (a->is_packed)
+      arena_unpack(a);
+   else {
+      store->live -= a->live;
+      a->live = members_size(g);
+      store->live += a->live;
+   }
+   store_evict(store, a);
+}
+
+int lwqq__member_unpack(LwqqGroup* g)
+{
+   LwqqMemberArena* a = g->arena;
+   if (a == NULL)
+      return 0;
+   arena_use(a);
+   if (!a->is_packed)
+      return 0;
+   arena_unpack(a);
+   store_evict(a->store, a);
+   return 1;
+}
+
+void lwqq__member_repack(LwqqGroup* g)
+{
+   LwqqMemberArena* a = g->arena;
+   if (a && !a->is_packed && !a->pins)
+      arena_pack(a);
+}
+
+int lwqq__member_empty(LwqqGroup* g)
+{
+   LwqqMemberArena* a = g->arena;
+   if (a && a->is_packed)
+      return a->count == 0;
+   return LIST_EMPTY(&g->members);
+}
+
+LWQQ_EXPORT
+void lwqq_group_members_pin(LwqqClient* lc, LwqqGroup* g)
+{
+   if (!lc || !g)
+      return;
+   if (g->arena == NULL)
+      lwqq__member_touch(lc, g);
+   if (g->arena) {
+      g->arena->pins++;
+      lwqq__member_unpack(g);
+   }
+}
+
+LWQQ_EXPORT
+void lwqq_group_members_unpin(LwqqClient* lc, LwqqGroup* g)
+{
+   LwqqMemberArena* a = g ? g->arena : NULL;
+   if (!lc || a == NULL || a->pins == 0)
+      return;
+   if (--a->pins == 0)
+      store_evict(a->store, NULL);
+}
+
+void lwqq__member_detach(LwqqGroup* g)
+{
+   LwqqMemberArena* a = g->arena;
+   if (a == NULL)
+      return;
+   TAILQ_REMOVE(&a->store->lru, a, entries);
+   a->store->live -= a->live;
+   a->store->packed -= a->block_len;
+   g->arena = NULL;
+   s_free(a->block);
+   s_free(a);
+}
+
+void lwqq__member_store_free(LwqqMemberStore* store)
+{
+   LwqqMemberArena* a, *next;
+   if (store == NULL)
+      return;
+   TAILQ_FOREACH_SAFE(a, &store->lru, entries, next)
+   {
+      // leave lazy mode, members become a normal list again
+      arena_unpack(a);
+      lwqq__member_detach(a->group);
+   }
+   s_free(store);
+}
+
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_group_members_load(LwqqClient* lc, LwqqGroup* g)
+{
+   if (!lc || !g)
+      return NULL;
+   if (g->arena) {
+      lwqq__member_unpack(g);
+      return NULL;
+   }
+   if (!LIST_EMPTY(&g->members)) {
+      lwqq__member_touch(lc, g);
+      return NULL;
+   }
+   return lwqq_info_get_group_detail_info(lc, g, NULL);
+}
+
+LWQQ_EXPORT
+size_t lwqq_member_mem_usage(LwqqClient* lc, size_t* packed)
+{
+   LwqqMemberStore* store = *lwqq__client_member_store(lc);
+   LwqqGroup* g;
+   size_t live = 0;
+   if (packed)
+      *packed = store ? store->packed : 0;
+   if (store)
+      return store->live;
+   // not in lazy mode, count all groups
+   LIST_FOREACH(g, &lc->groups, entries)
+   {
+      live += members_size(g);
+   }
+   LIST_FOREACH(g, &lc->discus, entries)
+   {
+      live += members_size(g);
+   }
+   return live;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file   member.h
+ * @brief  Lazy loaded group member lists
+ *
+ * in lazy mode group members are only kept as LwqqSimpleBuddy list in
+ * group->members while they are used. when materialized members exceed the
+ * memory budget, least recently used groups are packed into a compact
+ * columnar arena (shared strings, stat/client_type/mflag in int columns),
+ * and unpacked again on next access.
+ *
+ * note: pointers to LwqqSimpleBuddy of an evicted group become invalid.
+ * any access which unpacks a group, a find included, may evict other
+ * groups to keep within budget. pin a group to keep its members.
+ */
+
+#ifndef LWQQ_MEMBER_H
+#define LWQQ_MEMBER_H
+
+#include "type.h"
+#include "async.h"
+
+struct LwqqMemberStore;
+
+/** budget is at least this, the most recently used group is never evicted */
+#define LWQQ_MEMBER_BUDGET_MIN (64 * 1024)
+
+/**
+ * enable lazy mode, and set memory budget of materialized members.
+ * @param budget bytes, 0 to disable lazy mode and unpack every group
+ */
+void lwqq_member_set_budget(LwqqClient* lc, size_t budget);
+
+/**
+ * make group members available in group->members.
+ * unpack from arena if evicted, or fetch from server on first access.
+ * @return NULL when members are available now, otherwise the event which
+ *         finished when fetched
+ */
+LwqqAsyncEvent* lwqq_group_members_load(LwqqClient* lc, LwqqGroup* g);
+
+/**
+ * keep members of g materialized until unpinned, pins are counted.
+ * does nothing when lazy mode is off
+ */
+void lwqq_group_members_pin(LwqqClient* lc, LwqqGroup* g);
+void lwqq_group_members_unpin(LwqqClient* lc, LwqqGroup* g);
+
+/**
+ * memory used by member lists of lc
+ * @param packed output bytes used by packed arena, can be NULL
+ * @return bytes used by materialized members
+ */
+size_t lwqq_member_mem_usage(LwqqClient* lc, size_t* packed);
+
+/** called after group->members refreshed, account size and evict others */
+void lwqq__member_touch(LwqqClient* lc, LwqqGroup* g);
+/**
+ * unpack members of g if it is evicted, call it before walking or changing
+ * group->members directly. other groups may be evicted to keep budget
+ * @return 1 if g was packed
+ */
+int lwqq__member_unpack(LwqqGroup* g);
+/** pack g again after a walk which unpacked it, unless it is pinned */
+void lwqq__member_repack(LwqqGroup* g);
+/** whether g has no members, also true for packed groups */
+int lwqq__member_empty(LwqqGroup* g);
+/** drop packed members of g, called by lwqq_group_free */
+void lwqq__member_detach(LwqqGroup* g);
+/** unpack every group and free member store */
+void lwqq__member_store_free(struct LwqqMemberStore* store);
+
+#endif
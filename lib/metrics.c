@@ -0,0 +1,338 @@
+/**
+ * @file   metrics.c
+ * @brief  Per endpoint http metrics
+ *
+ * histogram bucket index of value v (microseconds):
+ *
+ *    v < 8:  v
+ *    else:   8 + (msb(v) - 3) * 8 + next 3 bits after msb
+ */
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "smemory.h"
+#include "internal.h"
+
+#define SUB_COUNT (1 << LWQQ_HIST_SUB_BITS)
+/* endpoints beyond this are accounted to the empty endpoint '' */
+#define MAX_ENDPOINTS 256
+
+typedef struct Endpoint {
+   uint32_t hash;
+   LwqqHttpMetric m;
+} Endpoint;
+
+static struct {
+   pthread_mutex_t lock;
+   int disabled;
+   size_t count;
+   size_t cap;
+   Endpoint** items;
+} registry = { PTHREAD_MUTEX_INITIALIZER };
+
+static const char* phase_names[LWQQ_PHASE_MAX] = {
+   "namelookup", "connect", "appconnect", "starttransfer", "total", "queue"
+};
+
+/* prometheus bucket bounds, in microseconds */
+static const uint64_t le_bounds[] = { 1000,    5000,    10000,    25000,
+                                      50000,   100000,  250000,   500000,
+                                      1000000, 2500000, 5000000,  10000000,
+                                      30000000, 60000000 };
+
+static int msb64(uint64_t v)
+{
+   int n = 0;
+   while (v >>= 1)
+      n++;
+   return n;
+}
+
+static size_t bucket_index(uint64_t v)
+{
+   if (v < SUB_COUNT)
+      return v;
+   int msb = msb64(v);
+   int shift = msb - LWQQ_HIST_SUB_BITS;
+   size_t idx = SUB_COUNT + ((size_t)shift << LWQQ_HIST_SUB_BITS)
+                + ((v >> shift) & (SUB_COUNT - 1));
+   return idx < LWQQ_HIST_BUCKETS ? idx : LWQQ_HIST_BUCKETS - 1;
+}
+
+/** largest value which falls into bucket idx */
+static uint64_t bucket_upper(size_t idx)
+{
+   if (idx < SUB_COUNT)
+      return idx;
+   size_t k = idx - SUB_COUNT;
+   int shift = k >> LWQQ_HIST_SUB_BITS;
+   uint64_t sub = SUB_COUNT + (k & (SUB_COUNT - 1));
+   return ((sub + 1) << shift) - 1;
+}
+
+LWQQ_EXPORT
+void lwqq_histogram_record(LwqqHistogram* h, uint64_t us)
+{
+   h->buckets[bucket_index(us)]++;
+   h->count++;
+   h->sum += us;
+   if (us > h->max)
+      h->max = us;
+}
+
+LWQQ_EXPORT
+uint64_t lwqq_histogram_percentile(const LwqqHistogram* h, double p)
+{
+   if (h->count == 0)
+      return 0;
+   uint64_t rank = (uint64_t)(h->count * p / 100.0 + 0.5), seen = 0;
+   size_t i;
+   if (rank < 1)
+      rank = 1;
+   for (i = 0; i < LWQQ_HIST_BUCKETS; i++) {
+      seen += h->buckets[i];
+      if (seen >= rank) {
+         uint64_t up = bucket_upper(i);
+         return up < h->max ? up : h->max;
+      }
+   }
+   return h->max;
+}
+
+uint64_t lwqq__metrics_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void lwqq__http_endpoint(const char* url, char* buf, size_t sz)
+{
+   const char* p = url ? strstr(url, "://") : NULL;
+   size_t len = 0;
+   p = p ? strchr(p + 3, '/') : NULL;
+   if (p) {
+      p++;
+      while (p[len] && p[len] != '?' && p[len] != '#' && len < sz - 1)
+         len++;
+      memcpy(buf, p, len);
+   }
+   buf[len] = '\0';
+}
+
+static uint32_t str_hash(const char* s)
+{
+   uint32_t h = 2166136261u;
+   while (*s)
+      h = (h ^ (unsigned char)*s++) * 16777619u;
+   return h;
+}
+
+static Endpoint* endpoint_new(const char* name, uint32_t hash)
+{
+   if (registry.count == registry.cap) {
+      registry.cap = registry.cap ? registry.cap * 2 : 32;
+      registry.items = s_realloc(registry.items,
+                                 sizeof(Endpoint*) * registry.cap);
+   }
+   Endpoint* e = s_malloc0(sizeof(*e));
+   e->hash = hash;
+   strncpy(e->m.endpoint, name, sizeof(e->m.endpoint) - 1);
+   registry.items[registry.count++] = e;
+   return e;
+}
+
+/** find or create endpoint, must hold registry.lock */
+static LwqqHttpMetric* endpoint_get(const char* name)
+{
+   uint32_t hash = str_hash(name);
+   size_t i;
+   // overflow bucket '' is always items[0], reserved with the registry
+   if (registry.count == 0)
+      endpoint_new("", str_hash(""));
+   for (i = 0; i < registry.count; i++) {
+      Endpoint* e = registry.items[i];
+      if (e->hash == hash && strcmp(e->m.endpoint, name) == 0)
+         return &e->m;
+   }
+   if (registry.count >= MAX_ENDPOINTS)
+      return &registry.items[0]->m;
+   return &endpoint_new(name, hash)->m;
+}
+
+static void record_sec(LwqqHistogram* h, double sec)
+{
+   if (sec >= 0)
+      lwqq_histogram_record(h, (uint64_t)(sec * 1000000));
+}
+
+void lwqq__http_metrics_done(void* easy, int curl_code, int retry,
+                             int64_t queue_us)
+{
+   char name[LWQQ_METRIC_ENDPOINT_LEN];
+   char* url = NULL;
+   double t[LWQQ_PHASE_TOTAL + 1] = { 0 };
+   double down = 0, up = 0;
+   int i;
+
+   if (registry.disabled)
+      return;
+
+   curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+   curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME,
+                     &t[LWQQ_PHASE_NAMELOOKUP]);
+   curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME, &t[LWQQ_PHASE_CONNECT]);
+   curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME,
+                     &t[LWQQ_PHASE_APPCONNECT]);
+   curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME,
+                     &t[LWQQ_PHASE_STARTTRANSFER]);
+   curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME, &t[LWQQ_PHASE_TOTAL]);
+   curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD, &down);
+   curl_easy_getinfo(easy, CURLINFO_SIZE_UPLOAD, &up);
+   lwqq__http_endpoint(url, name, sizeof(name));
+
+   pthread_mutex_lock(&registry.lock);
+   LwqqHttpMetric* m = endpoint_get(name);
+   m->requests++;
+   if (retry)
+      m->retries++;
+   else if (curl_code != CURLE_OK)
+      m->errors++;
+   m->bytes_down += down > 0 ? (uint64_t)down : 0;
+   m->bytes_up += up > 0 ? (uint64_t)up : 0;
+   for (i = 0; i <= LWQQ_PHASE_TOTAL; i++) {
+      // appconnect is 0 for plain http and reused connection
+      if (i == LWQQ_PHASE_APPCONNECT && t[i] <= 0)
+         continue;
+      record_sec(&m->phase[i], t[i]);
+   }
+   if (queue_us >= 0)
+      lwqq_histogram_record(&m->phase[LWQQ_PHASE_QUEUE], queue_us);
+   pthread_mutex_unlock(&registry.lock);
+}
+
+LWQQ_EXPORT
+void lwqq_http_metrics_enable(int enable) { registry.disabled = !enable; }
+
+LWQQ_EXPORT
+void lwqq_http_metrics_reset(void)
+{
+   size_t i;
+   pthread_mutex_lock(&registry.lock);
+   for (i = 0; i < registry.count; i++)
+      s_free(registry.items[i]);
+   s_free(registry.items);
+   registry.count = registry.cap = 0;
+   pthread_mutex_unlock(&registry.lock);
+}
+
+LWQQ_EXPORT
+size_t lwqq_http_metrics_snapshot(LwqqHttpMetric** out)
+{
+   size_t i, n;
+   pthread_mutex_lock(&registry.lock);
+   n = registry.count;
+   *out = n ? s_malloc(sizeof(LwqqHttpMetric) * n) : NULL;
+   for (i = 0; i < n; i++)
+      (*out)[i] = registry.items[i]->m;
+   pthread_mutex_unlock(&registry.lock);
+   return n;
+}
+
+typedef struct TextBuf {
+   char* str;
+   size_t len;
+   size_t cap;
+} TextBuf;
+
+static void text_append(TextBuf* b, const char* fmt, ...)
+{
+   va_list args;
+   int n;
+   for (;;) {
+      va_start(args, fmt);
+      n = vsnprintf(b->str + b->len, b->cap - b->len, fmt, args);
+      va_end(args);
+      if (n >= 0 && b->len + n < b->cap)
+         break;
+      b->cap = b->cap * 2 + n + 1;
+      b->str = s_realloc(b->str, b->cap);
+   }
+   b->len += n;
+}
+
+static void dump_counter(TextBuf* b, const char* name, const char* help,
+                         LwqqHttpMetric* ms, size_t n, size_t offset)
+{
+   size_t i;
+   text_append(b, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+   for (i = 0; i < n; i++) {
+      uint64_t v = *(uint64_t*)((char*)&ms[i] + offset);
+      text_append(b, "%s{endpoint=\"%s\"} %llu\n", name, ms[i].endpoint,
+                  (unsigned long long)v);
+   }
+}
+
+static void dump_histogram(TextBuf* b, const char* endpoint, const char* phase,
+                           const LwqqHistogram* h)
+{
+   const char* name = "lwqq_http_phase_seconds";
+   uint64_t cum = 0;
+   size_t i = 0, j;
+   if (h->count == 0)
+      return;
+   for (j = 0; j < sizeof(le_bounds) / sizeof(le_bounds[0]); j++) {
+      while (i < LWQQ_HIST_BUCKETS && bucket_upper(i) <= le_bounds[j])
+         cum += h->buckets[i++];
+      text_append(b, "%s_bucket{endpoint=\"%s\",phase=\"%s\",le=\"%g\"} %llu\n",
+                  name, endpoint, phase, le_bounds[j] / 1e6,
+                  (unsigned long long)cum);
+   }
+   text_append(b, "%s_bucket{endpoint=\"%s\",phase=\"%s\",le=\"+Inf\"} %llu\n",
+               name, endpoint, phase, (unsigned long long)h->count);
+   text_append(b, "%s_sum{endpoint=\"%s\",phase=\"%s\"} %.6f\n", name,
+               endpoint, phase, h->sum / 1e6);
+   text_append(b, "%s_count{endpoint=\"%s\",phase=\"%s\"} %llu\n", name,
+               endpoint, phase, (unsigned long long)h->count);
+}
+
+LWQQ_EXPORT
+char* lwqq_http_metrics_prometheus(void)
+{
+   LwqqHttpMetric* ms = NULL;
+   size_t n = lwqq_http_metrics_snapshot(&ms), i;
+   int p;
+   TextBuf b = { s_malloc(4096), 0, 4096 };
+   b.str[0] = '\0';
+
+#define COUNTER(name, field, help)                                             \
+   dump_counter(&b, name, help, ms, n, offsetof(LwqqHttpMetric, field))
+   COUNTER("lwqq_http_requests_total", requests,
+           "Finished http transfers, include retried ones.");
+   COUNTER("lwqq_http_errors_total", errors,
+           "Http requests failed after all retries.");
+   COUNTER("lwqq_http_retries_total", retries, "Http request retries.");
+   COUNTER("lwqq_http_received_bytes_total", bytes_down,
+           "Bytes of http response body.");
+   COUNTER("lwqq_http_sent_bytes_total", bytes_up,
+           "Bytes of http request body.");
+#undef COUNTER
+
+   text_append(&b, "# HELP lwqq_http_phase_seconds Time from start of "
+                   "transfer to end of each curl phase, queue is time "
+                   "waited before transfer start.\n"
+                   "# TYPE lwqq_http_phase_seconds histogram\n");
+   for (i = 0; i < n; i++) {
+      for (p = 0; p < LWQQ_PHASE_MAX; p++)
+         dump_histogram(&b, ms[i].endpoint, phase_names[p], &ms[i].phase[p]);
+   }
+   s_free(ms);
+   return b.str;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file   metrics.h
+ * @brief  Per endpoint http metrics
+ *
+ * every http transfer is accounted to its endpoint, which is the url path
+ * without host and query, e.g. 'channel/poll2', 'api/get_group_info_ext2'.
+ * latency of each curl phase is kept in a log linear (HDR style) histogram
+ * with microsecond resolution and at most 12.5% relative error.
+ */
+
+#ifndef LWQQ_METRICS_H
+#define LWQQ_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** 8 linear sub buckets for each power of two, up to 2^40 us */
+#define LWQQ_HIST_SUB_BITS 3
+#define LWQQ_HIST_BUCKETS ((40 - LWQQ_HIST_SUB_BITS + 2) << LWQQ_HIST_SUB_BITS)
+
+#define LWQQ_METRIC_ENDPOINT_LEN 64
+
+typedef struct LwqqHistogram {
+   uint64_t count;
+   uint64_t sum; /** < microseconds */
+   uint64_t max;
+   uint32_t buckets[LWQQ_HIST_BUCKETS];
+} LwqqHistogram;
+
+typedef enum {
+   LWQQ_PHASE_NAMELOOKUP,
+   LWQQ_PHASE_CONNECT,
+   LWQQ_PHASE_APPCONNECT, /** < ssl handshake done */
+   LWQQ_PHASE_STARTTRANSFER, /** < first byte received */
+   LWQQ_PHASE_TOTAL,
+   LWQQ_PHASE_QUEUE, /** < wait in add_link before given to curl */
+   LWQQ_PHASE_MAX
+} LwqqMetricPhase;
+
+typedef struct LwqqHttpMetric {
+   char endpoint[LWQQ_METRIC_ENDPOINT_LEN];
+   uint64_t requests; /** < finished transfers, include retried ones */
+   uint64_t errors; /** < requests failed after all retry */
+   uint64_t retries;
+   uint64_t bytes_down;
+   uint64_t bytes_up;
+   LwqqHistogram phase[LWQQ_PHASE_MAX];
+} LwqqHttpMetric;
+
+/** metrics is enabled by default, disable to skip all accounting */
+void lwqq_http_metrics_enable(int enable);
+/** drop all collected metrics */
+void lwqq_http_metrics_reset(void);
+
+/**
+ * copy all endpoint metrics
+ * @param out output array, free it with s_free
+ * @return number of endpoints
+ */
+size_t lwqq_http_metrics_snapshot(LwqqHttpMetric** out);
+
+/**
+ * latency of the given percentile
+ * @param p percentile in [0,100]
+ * @return microseconds, upper bound of the bucket it falls into
+ */
+uint64_t lwqq_histogram_percentile(const LwqqHistogram* h, double p);
+void lwqq_histogram_record(LwqqHistogram* h, uint64_t us);
+
+/**
+ * dump all metrics in prometheus text exposition format
+ * @return text, free it with s_free
+ */
+char* lwqq_http_metrics_prometheus(void);
+
+/** 'http://host/channel/poll2?a=b' => 'channel/poll2' */
+void lwqq__http_endpoint(const char* url, char* buf, size_t sz);
+/** monotonic clock in microseconds */
+uint64_t lwqq__metrics_now(void);
+/**
+ * account a finished transfer of curl easy handle
+ * @param retry whether the request would be retried
+ * @param queue_us time waited before given to curl, -1 for sync request
+ */
+void lwqq__http_metrics_done(void* easy, int curl_code, int retry,
+                             int64_t queue_us);
+
+#endif
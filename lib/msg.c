@@ -9,9 +9,10 @@
  */
 #include <stdlib.h>
 #include <string.h>
-#include <stdlib.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "type.h"
 #include "smemory.h"
@@ -28,6 +29,8 @@
 #include "json.h"
 #include "login.h"
 #include "info.h"
+#include "media.h"
+#include "transfer.h"
 
 #define LWQQ_MT_BITS (~((-1) << 8))
 // if no async, we can only run a synced single thread
@@ -58,6 +61,24 @@ typedef struct LwqqRecvMsgList_ {
    pthread_t tid;
    int running;
 } LwqqRecvMsgList_;
+/**
+ * a picture downloading after its message is delivered. it downloads into
+ * scratch, a copy of content which is handed to content_ready when done.
+ * content is set to NULL when message is freed before that, and freeing
+ * message waits while content_ready is firing on another thread.
+ */
+typedef struct LwqqContentFuture {
+   LwqqClient* lc;
+   LwqqMsg* msg;
+   LwqqMsgContent* content;
+   LwqqMsgContent scratch;
+   int firing;
+   pthread_t thread; /** < thread firing content_ready */
+} LwqqContentFuture;
+
+static pthread_mutex_t future_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t future_cond = PTHREAD_COND_INITIALIZER;
+
 #define RET_WELLFORM_MSG 0
 #define RET_DELAYINS_MSG 1
 #define RET_UNKNOW_MSG -1
@@ -106,6 +127,18 @@ static void group_member_has_chged(LwqqClient* lc, LwqqGroup* g)
 void lwqq_msg_content_clean(LwqqMsgContent* c)
 {
    unsigned i;
+   if (c->future) {
+      // download keeps running, its result is dropped. message must stay
+      // alive while content_ready is using it, unless it is freed in there
+      pthread_mutex_lock(&future_lock);
+      while (c->future && c->future->firing
+             && !pthread_equal(c->future->thread, pthread_self()))
+         pthread_cond_wait(&future_cond, &future_lock);
+      if (c->future)
+         c->future->content = NULL;
+      c->future = NULL;
+      pthread_mutex_unlock(&future_lock);
+   }
    switch (c->type) {
       case LWQQ_CONTENT_STRING:
          s_free(c->data.str);
@@ -115,9 +148,11 @@ void lwqq_msg_content_clean(LwqqMsgContent* c)
          s_free(c->data.img.name);
          s_free(c->data.img.data);
          s_free(c->data.img.url);
+         s_free(c->data.img.path);
          break;
       case LWQQ_CONTENT_CFACE:
          s_free(c->data.cface.data);
+         s_free(c->data.cface.path);
          s_free(c->data.cface.name);
          s_free(c->data.cface.file_id);
          s_free(c->data.cface.key);
@@ -155,7 +190,7 @@ static int parse_content(json_t* json, const char* key, LwqqMsgMessage* opaque)
             /* Font name */
             name = json_parse_simple_value(ctent, "name");
             name = name ?: "Arial";
-            msg->f_name = json_unescape(name);
+            msg->f_name = s_intern_take(json_unescape(name));
 
             /* Font color */
             color = json_parse_simple_value(ctent, "color");
@@ -681,18 +716,18 @@ static void msg_message_free(LwqqMsg* opaque)
       return;
    }
 
-   s_free(msg->f_name);
+   s_release(msg->f_name);
    if (opaque->type == LWQQ_MS_GROUP_MSG) {
-      s_free(msg->group.send);
+      s_release(msg->group.send);
       s_free(msg->group.group_code);
    } else if (opaque->type == LWQQ_MS_SESS_MSG) {
       s_free(msg->sess.id);
       s_free(msg->sess.group_sig);
    } else if (opaque->type == LWQQ_MS_DISCU_MSG) {
-      s_free(msg->discu.send);
+      s_release(msg->discu.send);
       s_free(msg->discu.did);
    } else if (opaque->type == LWQQ_MS_GROUP_WEB_MSG) {
-      s_free(msg->group_web.send);
+      s_release(msg->group_web.send);
       s_free(msg->group_web.group_code);
    }
 
@@ -758,8 +793,8 @@ static void msg_offfile_free(void* opaque)
 static void msg_seq_free(LwqqMsg* msg)
 {
    LwqqMsgSeq* seq = (LwqqMsgSeq*)msg;
-   s_free(seq->from);
-   s_free(seq->to);
+   s_release(seq->from);
+   s_release(seq->to);
 }
 /**
  * Free a LwqqMsg object
@@ -843,8 +878,8 @@ void lwqq_msg_free(LwqqMsg* msg)
    } break;
    case LWQQ_MT_INPUT_NOTIFY: {
       LwqqMsgInputNotify* input = (LwqqMsgInputNotify*)msg;
-      s_free(input->from);
-      s_free(input->to);
+      s_release(input->from);
+      s_release(input->to);
    } break;
    case LWQQ_MT_SHAKE_MESSAGE:
       s_free(msg);
@@ -925,7 +960,7 @@ static int parse_new_msg(json_t* json, LwqqMsg* opaque)
    // if it failed means it is not group message.
    // so it equ NULL.
    if (opaque->type == LWQQ_MS_GROUP_MSG) {
-      msg->group.send = s_strdup(json_parse_simple_value(json, "send_uin"));
+      msg->group.send = s_intern(json_parse_simple_value(json, "send_uin"));
       msg->group.group_code
           = s_strdup(json_parse_simple_value(json, "group_code"));
       msg->group.info_seq = lwqq__json_get_int(json, "info_seq", 0);
@@ -933,13 +968,14 @@ static int parse_new_msg(json_t* json, LwqqMsg* opaque)
    } else if (opaque->type == LWQQ_MS_SESS_MSG) {
       msg->sess.id = s_strdup(json_parse_simple_value(json, "id"));
    } else if (opaque->type == LWQQ_MS_DISCU_MSG) {
-      msg->discu.send = s_strdup(json_parse_simple_value(json, "send_uin"));
+      msg->discu.send = s_intern(json_parse_simple_value(json, "send_uin"));
       msg->discu.did = s_strdup(json_parse_simple_value(json, "did"));
       msg->discu.info_seq = lwqq__json_get_int(json, "info_seq", 0);
       msg->discu.seq = lwqq__json_get_int(json, "seq", 0);
    } else if (opaque->type == LWQQ_MS_GROUP_WEB_MSG) {
       int err = 0;
-      msg->group_web.send = lwqq__json_get_value(json, "send_uin");
+      msg->group_web.send
+          = s_intern(json_parse_simple_value(json, "send_uin"));
       msg->group_web.group_code = lwqq__json_get_value(json, "group_code");
       msg->time = time(NULL);
       char* xml = lwqq__json_get_string(json, "xml");
@@ -1056,7 +1092,7 @@ static int parse_blist_change(json_t* json, void* opaque, void* _lc)
    ptr = ptr->child->child;
    while (ptr != NULL) {
       simple = lwqq_simple_buddy_new();
-      simple->uin = s_strdup(json_parse_simple_value(ptr, "uin"));
+      simple->uin = s_intern(json_parse_simple_value(ptr, "uin"));
       simple->cate_index = s_strdup(json_parse_simple_value(ptr, "groupid"));
       LIST_INSERT_HEAD(&change->added_friends, simple, entries);
       buddy = lwqq_buddy_new();
@@ -1258,8 +1294,8 @@ static int parse_input_notify(json_t* json, void* opaque)
     *
     */
    LwqqMsgInputNotify* input = opaque;
-   input->from = s_strdup(json_parse_simple_value(json, "from_uin"));
-   input->to = s_strdup(json_parse_simple_value(json, "to_uin"));
+   input->from = s_intern(json_parse_simple_value(json, "from_uin"));
+   input->to = s_intern(json_parse_simple_value(json, "to_uin"));
    return 0;
 }
 static int parse_shake_message(json_t* json, void* opaque)
@@ -1288,13 +1324,73 @@ const char* get_host_of_url(const char* url, char* buffer)
       strncpy(buffer, ptr, end - ptr);
    return buffer;
 }
+/** cface is keyed by its guid, offpic by its file path */
+static const char* picture_cache_key(LwqqMsgContent* c, char* buf,
+                                     size_t size)
+{
+   if (c->type == LWQQ_CONTENT_CFACE && c->data.cface.name)
+      snprintf(buf, size, "cface/%s", c->data.cface.name);
+   else if (c->type == LWQQ_CONTENT_OFFPIC && c->data.img.file_path)
+      snprintf(buf, size, "offpic/%s", c->data.img.file_path);
+   else
+      return NULL;
+   return buf;
+}
+/** write all of data to fd */
+static int write_fd(int fd, const char* data, size_t size)
+{
+   size_t n;
+   ssize_t w;
+   for (n = 0; n < size; n += w) {
+      if ((w = write(fd, data + n, size - n)) <= 0)
+         return -1;
+   }
+   return 0;
+}
+/** @return 1 if picture of c is filled from media cache.
+ * if fd is not -1 data is written to fd instead */
+static int set_content_picture_cached(LwqqMsgContent* c, int fd)
+{
+   char key[LWQQ_MEDIA_KEY_LEN];
+   LwqqMediaEntry e = { 0 };
+   if (!picture_cache_key(c, key, sizeof(key))
+       || lwqq_media_cache_get(key, &e))
+      return 0;
+   if (fd >= 0) {
+      if (write_fd(fd, e.data, e.size)) {
+         lwqq_media_entry_free(&e);
+         return 0;
+      }
+      s_free(e.data);
+   }
+   switch (c->type) {
+   case LWQQ_CONTENT_OFFPIC:
+      c->data.img.data = e.data;
+      c->data.img.size = e.size;
+      c->data.img.url = e.url;
+      break;
+   case LWQQ_CONTENT_CFACE:
+      c->data.cface.data = e.data;
+      c->data.cface.size = e.size;
+      c->data.cface.url = e.url;
+      break;
+   default:
+      break;
+   }
+   e.data = e.url = NULL;
+   lwqq_media_entry_free(&e);
+   return 1;
+}
 static int set_content_picture_data(LwqqHttpRequest* req, LwqqMsgContent* c)
 {
    int err = 0;
+   char key[LWQQ_MEDIA_KEY_LEN];
    if ((req->http_code != 200)) {
       err = LWQQ_EC_HTTP_ERROR;
       goto done;
    }
+   if (picture_cache_key(c, key, sizeof(key)))
+      lwqq__media_store(key, req);
    switch (c->type) {
    case LWQQ_CONTENT_OFFPIC:
       c->data.img.data = req->response;
@@ -1314,13 +1410,51 @@ done:
    lwqq_http_request_free(req);
    return err;
 }
+/** body is already in fd, only fill size and url */
+static int set_content_picture_saved(LwqqHttpRequest* req, LwqqMsgContent* c)
+{
+   int err = 0;
+   if ((req->http_code != 200)) {
+      err = LWQQ_EC_HTTP_ERROR;
+      goto done;
+   }
+   switch (c->type) {
+   case LWQQ_CONTENT_OFFPIC:
+      c->data.img.size = req->resp_len;
+      lwqq_override(c->data.img.url, s_strdup(lwqq_http_get_url(req)));
+      break;
+   case LWQQ_CONTENT_CFACE:
+      c->data.cface.size = req->resp_len;
+      lwqq_override(c->data.cface.url, s_strdup(lwqq_http_get_url(req)));
+      break;
+   default:
+      break;
+   }
+done:
+   lwqq_http_request_free(req);
+   return err;
+}
+/** send req, body goes into fd if it is not -1, else into c */
+static LwqqAsyncEvent* request_picture_data(LwqqHttpRequest* req,
+                                            LwqqMsgContent* c, int fd)
+{
+   const char* url = lwqq_http_get_url(req);
+   if (fd < 0)
+      return req->do_request_async(req, lwqq__hasnot_post(),
+                                   _C_(2p_i, set_content_picture_data, req, c));
+   lwqq_http_set_option(req, LWQQ_HTTP_SAVE_FD, fd);
+   return req->do_request_async(req, lwqq__hasnot_post(),
+                                _C_(2p_i, set_content_picture_saved, req, c));
+}
 static LwqqAsyncEvent* request_content_offpic(LwqqClient* lc, const char* f_uin,
-                                              LwqqMsgContent* c)
+                                              LwqqMsgContent* c, int fd)
 {
    LwqqHttpRequest* req;
    LwqqErrorCode error;
    LwqqErrorCode* err = &error;
    char url[512];
+   if (set_content_picture_cached(c, fd))
+      return NULL;
    char* file_path = url_encode(c->data.img.file_path);
 #ifdef OFFPIC_USE_WQQ
    const char* d_host = WQQ_D_HOST;
@@ -1339,30 +1473,31 @@ static LwqqAsyncEvent* request_content_offpic(LwqqClient* lc, const char* f_uin,
       goto done;
    }
    req->set_header(req, "Referer", refurl);
-   LwqqHttpRequest* req_cookie
-       = lwqq_http_create_default_request(lc, WEBQQ_HOST, 0);
-   lwqq_http_set_cookie(req, "p_skey",
-                        lwqq_http_get_cookie(req_cookie, "p_skey"), 0);
-   lwqq_http_set_cookie(req, "p_uin", lwqq_http_get_cookie(req_cookie, "p_uin"),
-                        0);
-   lwqq_http_request_free(req_cookie);
+   char* p_skey = lwqq_http_client_cookie(lc, WEBQQ_HOST, "p_skey");
+   char* p_uin = lwqq_http_client_cookie(lc, WEBQQ_HOST, "p_uin");
+   lwqq_http_set_cookie(req, "p_skey", p_skey, 0);
+   lwqq_http_set_cookie(req, "p_uin", p_uin, 0);
+   s_free(p_skey);
+   s_free(p_uin);
 
    lwqq_http_debug(req, 4);
 
-   return req->do_request_async(req, lwqq__hasnot_post(),
-                                _C_(2p_i, set_content_picture_data, req, c));
+   return request_picture_data(req, c, fd);
 done:
    lwqq_http_request_free(req);
    return NULL;
 }
 static LwqqAsyncEvent*
 request_content_cface(LwqqClient* lc, const char* group_code,
-                      const char* send_uin, LwqqMsgType type, LwqqMsgContent* c)
+                      const char* send_uin, LwqqMsgType type, LwqqMsgContent* c,
+                      int fd)
 {
    LwqqHttpRequest* req;
    LwqqErrorCode error;
    LwqqErrorCode* err = &error;
    char url[512];
+   if (set_content_picture_cached(c, fd))
+      return NULL;
    /*http://web2.qq.com/cgi-bin/get_group_pic?type=0&gid=3971957129&uin=4174682545&rip=120.196.211.216&rport=9072&fid=2857831080&pic=71A8E53B7F678D035656FECDA1BD7F31.jpg&vfwebqq=762a8682d17931d0cc647515e570435bd82e3a4e957bd052faa9615192eb7a3c4f1719006a7176c1&t=1343130567*/
    snprintf(url, sizeof(url), "%s/"
                               "get_group_pic?type=%d&gid=%s&uin=%s&rip=%s&"
@@ -1377,20 +1512,21 @@ request_content_cface(LwqqClient* lc, const char* group_code,
    req->set_header(req, "Referer", "http://web2.qq.com/webqq.html");
 
    lwqq_http_debug(req, 4);
-   return req->do_request_async(req, lwqq__hasnot_post(),
-                                _C_(2p_i, set_content_picture_data, req, c));
+   return request_picture_data(req, c, fd);
 done:
    lwqq_http_request_free(req);
    return NULL;
 }
 static LwqqAsyncEvent* request_content_cface2(LwqqClient* lc, int msg_id,
                                               const char* from_uin,
-                                              LwqqMsgContent* c)
+                                              LwqqMsgContent* c, int fd)
 {
    LwqqHttpRequest* req;
    LwqqErrorCode error;
    LwqqErrorCode* err = &error;
    char url[1024];
+   if (set_content_picture_cached(c, fd))
+      return NULL;
    /*http://d.web2.qq.com/channel/get_cface2?lcid=3588&guid=85930B6CCE38BDAEF176FA83F0491569.jpg&to=2217604723&count=5&time=1&clientid=6325200&psessionid=8368046764001d636f6e6e7365727665725f77656271714031302e3133342e362e31333800001c9b000000d8026e04009563e4146d0000000a403946423664616232666d00000028ceb438eb76f1bc88360fc303e9148cc5dac8652a7a4bb702ee6dcf9bb10adf571a48b8a76b599e44*/
    snprintf(url, sizeof(url), "%s/channel/"
                               "get_cface2?lcid=%d&to=%s&guid=%s&count=5&time=1&"
@@ -1401,8 +1537,127 @@ static LwqqAsyncEvent* request_content_cface2(LwqqClient* lc, int msg_id,
    req->set_header(req, "Referer", "http://web2.qq.com/webqq.html");
 
    lwqq_http_debug(req, 4);
-   return req->do_request_async(req, lwqq__hasnot_post(),
-                                _C_(2p_i, set_content_picture_data, req, c));
+   return request_picture_data(req, c, fd);
+}
+/** download picture of c if it is enabled by poll flags
+ * @return NULL if it is not downloaded, or it is filled from cache */
+static LwqqAsyncEvent* request_picture(LwqqClient* lc, LwqqMsgMessage* msg,
+                                       LwqqMsgContent* c)
+{
+   LwqqRecvMsgList_* list = (LwqqRecvMsgList_*)lc->msg_list;
+   if (c->type == LWQQ_CONTENT_OFFPIC
+       && list->flags & POLL_AUTO_DOWN_BUDDY_PIC) {
+      return request_content_offpic(lc, msg->super.from, c, -1);
+   } else if (c->type == LWQQ_CONTENT_CFACE) {
+      if (msg->super.super.type == LWQQ_MS_BUDDY_MSG)
+         return request_content_cface2(lc, msg->super.msg_id,
+                                       msg->super.from, c, -1);
+      if ((msg->super.super.type == LWQQ_MS_GROUP_MSG
+           && bit_get(list->flags, POLL_AUTO_DOWN_GROUP_PIC))
+          | (msg->super.super.type == LWQQ_MS_DISCU_MSG
+             && bit_get(list->flags, POLL_AUTO_DOWN_DISCU_PIC)))
+         return request_content_cface(lc, msg->group.group_code,
+                                      msg->group.send, msg->super.super.type,
+                                      c, -1);
+   }
+   return NULL;
+}
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_msg_save_picture(LwqqClient* lc, LwqqMsgMessage* msg,
+                                      LwqqMsgContent* c, int fd)
+{
+   if (!lc || !msg || !c || fd < 0)
+      return NULL;
+   if (c->type == LWQQ_CONTENT_OFFPIC)
+      return request_content_offpic(lc, msg->super.from, c, fd);
+   if (c->type != LWQQ_CONTENT_CFACE)
+      return NULL;
+   if (msg->super.super.type == LWQQ_MS_BUDDY_MSG)
+      return request_content_cface2(lc, msg->super.msg_id, msg->super.from,
+                                    c, fd);
+   return request_content_cface(lc, msg->group.group_code, msg->group.send,
+                                msg->super.super.type, c, fd);
+}
+/** move downloaded data of picture from src into dst */
+static void picture_move(LwqqMsgContent* dst, LwqqMsgContent* src)
+{
+   if (dst->type == LWQQ_CONTENT_OFFPIC) {
+      lwqq_override(dst->data.img.data, src->data.img.data);
+      lwqq_override(dst->data.img.url, src->data.img.url);
+      dst->data.img.size = src->data.img.size;
+      src->data.img.data = src->data.img.url = NULL;
+   } else {
+      lwqq_override(dst->data.cface.data, src->data.cface.data);
+      lwqq_override(dst->data.cface.url, src->data.cface.url);
+      dst->data.cface.size = src->data.cface.size;
+      src->data.cface.data = src->data.cface.url = NULL;
+   }
+}
+static void content_future_free(LwqqContentFuture* f)
+{
+   // scratch owns all its strings, future is never set on it
+   lwqq_msg_content_clean(&f->scratch);
+   s_free(f);
+}
+static void content_future_done(LwqqContentFuture* f, LwqqAsyncEvent* ev)
+{
+   int fire;
+   pthread_mutex_lock(&future_lock);
+   fire = f->content != NULL && lwqq_client_valid(f->lc);
+   if (fire) {
+      f->firing = 1;
+      f->thread = pthread_self();
+   }
+   pthread_mutex_unlock(&future_lock);
+   if (fire) {
+      // content of message is not touched, it may be read by user already
+      f->lc->args->msg = f->msg;
+      f->lc->args->content = &f->scratch;
+      vp_do_repeat(f->lc->events->content_ready, NULL);
+   }
+   pthread_mutex_lock(&future_lock);
+   if (f->content)
+      f->content->future = NULL;
+   f->content = NULL;
+   f->firing = 0;
+   pthread_cond_broadcast(&future_cond);
+   pthread_mutex_unlock(&future_lock);
+   content_future_free(f);
+}
+/** start download of c, message is delivered without waiting for it */
+static void request_picture_lazy(LwqqClient* lc, LwqqMsgMessage* msg,
+                                 LwqqMsgContent* c)
+{
+   LwqqContentFuture* f = s_malloc0(sizeof(*f));
+   LwqqMsgContent* s = &f->scratch;
+   LwqqAsyncEvent* ev;
+
+   // request reads key fields of scratch, downloaded data is put into it
+   *s = *c;
+   if (c->type == LWQQ_CONTENT_OFFPIC) {
+      s->data.img.name = s_strdup(c->data.img.name);
+      s->data.img.file_path = s_strdup(c->data.img.file_path);
+      s->data.img.data = s->data.img.url = s->data.img.path = NULL;
+   } else {
+      s->data.cface.name = s_strdup(c->data.cface.name);
+      s->data.cface.file_id = s_strdup(c->data.cface.file_id);
+      s->data.cface.key = s_strdup(c->data.cface.key);
+      s->data.cface.data = s->data.cface.url = s->data.cface.path = NULL;
+   }
+   s->future = NULL;
+   ev = request_picture(lc, msg, s);
+   if (ev == NULL) {
+      // not downloaded, or cache answered already. message is not
+      // delivered yet, so it is safe to fill content itself
+      picture_move(c, s);
+      content_future_free(f);
+      return;
+   }
+   f->lc = lc;
+   f->msg = (LwqqMsg*)msg;
+   f->content = c;
+   c->future = f;
+   lwqq_async_add_event_listener(ev, _C_(2p, content_future_done, f, ev));
 }
 static void lwqq_msg_request_picture(LwqqClient* lc, LwqqMsgMessage* msg,
                                      LwqqAsyncEvset** ptr)
@@ -1413,93 +1668,105 @@ static void lwqq_msg_request_picture(LwqqClient* lc, LwqqMsgMessage* msg,
    LwqqAsyncEvent* event;
    TAILQ_FOREACH(c, &msg->content, entries)
    {
-      event = NULL;
-      if (c->type == LWQQ_CONTENT_OFFPIC
-          && list->flags & POLL_AUTO_DOWN_BUDDY_PIC) {
-         if (set == NULL)
-            set = lwqq_async_evset_new();
-         event = request_content_offpic(lc, msg->super.from, c);
-         lwqq_async_evset_add_event(set, event);
-      } else if (c->type == LWQQ_CONTENT_CFACE) {
-         if (msg->super.super.type == LWQQ_MS_BUDDY_MSG)
-            event = request_content_cface2(lc, msg->super.msg_id,
-                                           msg->super.from, c);
-         else {
-            if ((msg->super.super.type == LWQQ_MS_GROUP_MSG
-                 && bit_get(list->flags, POLL_AUTO_DOWN_GROUP_PIC))
-                | (msg->super.super.type == LWQQ_MS_DISCU_MSG
-                   && bit_get(list->flags, POLL_AUTO_DOWN_DISCU_PIC)))
-               event = request_content_cface(lc, msg->group.group_code,
-                                             msg->group.send,
-                                             msg->super.super.type, c);
-         }
-         if (set == NULL && event != NULL)
-            set = lwqq_async_evset_new();
-         lwqq_async_evset_add_event(set, event);
+      if (c->type != LWQQ_CONTENT_OFFPIC && c->type != LWQQ_CONTENT_CFACE)
+         continue;
+      if (list->flags & POLL_LAZY_CONTENT) {
+         request_picture_lazy(lc, msg, c);
+         continue;
       }
+      event = request_picture(lc, msg, c);
+      if (set == NULL && event != NULL)
+         set = lwqq_async_evset_new();
+      lwqq_async_evset_add_event(set, event);
    }
    *ptr = set;
 }
+/** passerby is filled, add it and let messages waiting on it go */
+static void bind_passerby_done(LwqqClient* lc, LwqqBuddy* buddy, LwqqGroup* g,
+                               LwqqAsyncEvent* ev)
+{
+   add_passerby(lc, buddy, g);
+   lwqq_async_event_finish(ev);
+}
 static void lwqq_msg_message_bind_buddy(LwqqClient* lc, LwqqMsgMessage* msg,
                                         LwqqAsyncEvset** ptr)
 {
    LwqqAsyncEvset* set = *ptr;
+   LwqqAsyncEvset* bind;
    LwqqAsyncEvent* event = NULL;
    LwqqBuddy* buddy = NULL;
    LwqqGroup* g = NULL;
    const LwqqMsgType type = msg->super.super.type;
    const char* serv_id = (type == LWQQ_MS_DISCU_MSG) ? msg->discu.did
                                                      : msg->super.from;
+   char key[128];
 
    if (type == LWQQ_MS_BUDDY_MSG) {
       buddy = lc->find_buddy_by_uin(lc, serv_id);
       if (buddy == NULL) {
-         buddy = lwqq_buddy_new();
-         buddy->uin = s_strdup(serv_id);
+         // a burst of messages from same stranger shares one query
+         snprintf(key, sizeof(key), "stranger/%s", serv_id);
          if (set == NULL)
             set = lwqq_async_evset_new();
-         event = lwqq_info_get_stranger_info(lc, serv_id, buddy);
-         lwqq_async_evset_add_event(set, event);
-         event = lwqq_info_get_friend_qqnumber(lc, buddy);
-         lwqq_async_evset_add_event(set, event);
-         lwqq_async_add_evset_listener(set,
-                                       _C_(3p, add_passerby, lc, buddy, g));
-         msg->buddy.from = buddy;
-      } else {
-         msg->buddy.from = buddy;
+         if (!lwqq__flight_join(lc, key, set, (void**)&buddy)) {
+            buddy = lwqq_buddy_new();
+            buddy->uin = s_strdup(serv_id);
+            bind = lwqq_async_evset_new();
+            lwqq_async_evset_add_event(
+                bind, lwqq_info_get_stranger_info(lc, serv_id, buddy));
+            lwqq_async_evset_add_event(
+                bind, lwqq_info_get_friend_qqnumber(lc, buddy));
+            event = lwqq_async_event_new(NULL);
+            lwqq_async_evset_add_event(set, event);
+            lwqq_async_add_evset_listener(
+                bind, _C_(4p, bind_passerby_done, lc, buddy, g, event));
+            lwqq__flight_begin(lc, key, event, buddy);
+            // bind can't finish before this
+            lwqq_async_evset_unref(bind);
+         }
       }
+      msg->buddy.from = buddy;
    } else if (type == LWQQ_MS_GROUP_MSG || type == LWQQ_MS_DISCU_MSG) {
       g = lwqq_group_find_group_by_gid(lc, serv_id);
       if (g == NULL) {
+         snprintf(key, sizeof(key), "%s/%s",
+                  type == LWQQ_MS_GROUP_MSG ? "group" : "discu", serv_id);
          if (set == NULL)
             set = lwqq_async_evset_new();
-         if (type == LWQQ_MS_GROUP_MSG) {
-            g = lwqq_group_new(LWQQ_GROUP_QUN);
-            g->gid = s_strdup(serv_id);
-            g->code = s_strdup(msg->group.group_code);
-            event = lwqq_info_get_group_qqnumber(lc, g);
+         if (!lwqq__flight_join(lc, key, set, (void**)&g)) {
+            bind = lwqq_async_evset_new();
+            if (type == LWQQ_MS_GROUP_MSG) {
+               g = lwqq_group_new(LWQQ_GROUP_QUN);
+               g->gid = s_strdup(serv_id);
+               g->code = s_strdup(msg->group.group_code);
+               lwqq_async_evset_add_event(bind,
+                                          lwqq_info_get_group_qqnumber(lc, g));
+            } else {
+               g = lwqq_group_new(LWQQ_GROUP_DISCU);
+               g->did = s_strdup(msg->discu.did);
+            }
+            lwqq_async_evset_add_event(
+                bind, lwqq_info_get_group_detail_info(lc, g, NULL));
+            event = lwqq_async_event_new(NULL);
             lwqq_async_evset_add_event(set, event);
-         } else {
-            g = lwqq_group_new(LWQQ_GROUP_DISCU);
-            g->did = s_strdup(msg->discu.did);
+            lwqq_async_add_evset_listener(
+                bind, _C_(4p, bind_passerby_done, lc, buddy, g, event));
+            lwqq__flight_begin(lc, key, event, g);
+            lwqq_async_evset_unref(bind);
          }
-         event = lwqq_info_get_group_detail_info(lc, g, NULL);
-         lwqq_async_evset_add_event(set, event);
-         lwqq_async_add_evset_listener(set,
-                                       _C_(3p, add_passerby, lc, buddy, g));
-         msg->group.from = g;
-      } else {
-         msg->group.from = g;
       }
+      msg->group.from = g;
    }
+   // its avatar is going to be shown
+   lwqq_info_prefetch_touch(lc, buddy, g);
    *ptr = set;
 }
 
 static int parse_msg_seq(json_t* json, LwqqMsg* msg)
 {
    LwqqMsgSeq* seq = (LwqqMsgSeq*)msg;
-   seq->from = s_strdup(json_parse_simple_value(json, "from_uin"));
-   seq->to = s_strdup(json_parse_simple_value(json, "to_uin"));
+   seq->from = s_intern(json_parse_simple_value(json, "from_uin"));
+   seq->to = s_intern(json_parse_simple_value(json, "to_uin"));
    seq->msg_id = s_atoi(json_parse_simple_value(json, "msg_id"), 0);
    seq->msg_id2 = s_atoi(json_parse_simple_value(json, "msg_id2"), 0);
    return 0;
@@ -1835,6 +2102,11 @@ static void* start_poll_msg(void* msg_list)
    return NULL;
 }
 
+int lwqq__msglist_running(LwqqClient* lc)
+{
+   return lc->msg_list && ((LwqqRecvMsgList_*)lc->msg_list)->running;
+}
+
 LWQQ_EXPORT
 void lwqq_msglist_poll(LwqqRecvMsgList* list, LwqqPollOption flags)
 {
@@ -1986,12 +2258,220 @@ static struct ds content_parse_string(LwqqMsgMessage* msg, int msg_type,
    return str;
 }
 
+/**
+ * server side name of an uploaded picture, keyed by hash of its content.
+ * a cface can be reused in any message of same kind, an offpic only with
+ * the peer it is uploaded to.
+ */
+typedef struct UploadEntry {
+   uint64_t hash;
+   size_t size;
+   LwqqContentType type;
+   LwqqMsgType msg_type; /** < cface only */
+   char* to; /** < offpic only */
+   char* name;
+   char* file_path; /** < offpic only */
+   size_t file_size; /** < offpic size reported by server */
+   time_t expire;
+   LwqqMsgContent* pending; /** < content which is uploading */
+   TAILQ_ENTRY(UploadEntry) entries;
+} UploadEntry;
+
+typedef struct LwqqUploadCache {
+   pthread_mutex_t lock;
+   TAILQ_HEAD(, UploadEntry) lru; /** < head is least recently used */
+   int count;
+} LwqqUploadCache;
+
+#define UPLOAD_CACHE_MAX 512
+
+static void upload_entry_free(UploadEntry* e)
+{
+   s_free(e->to);
+   s_free(e->name);
+   s_free(e->file_path);
+   s_free(e);
+}
+void lwqq__upload_cache_free(LwqqUploadCache* cache)
+{
+   UploadEntry* e;
+   if (!cache)
+      return;
+   while ((e = TAILQ_FIRST(&cache->lru))) {
+      TAILQ_REMOVE(&cache->lru, e, entries);
+      upload_entry_free(e);
+   }
+   pthread_mutex_destroy(&cache->lock);
+   s_free(cache);
+}
+static LwqqUploadCache* upload_cache(LwqqClient* lc)
+{
+   static pthread_mutex_t create_lock = PTHREAD_MUTEX_INITIALIZER;
+   LwqqUploadCache** pcache = lwqq__client_upload_cache(lc);
+   pthread_mutex_lock(&create_lock);
+   if (*pcache == NULL) {
+      LwqqUploadCache* cache = s_malloc0(sizeof(*cache));
+      pthread_mutex_init(&cache->lock, NULL);
+      TAILQ_INIT(&cache->lru);
+      *pcache = cache;
+   }
+   pthread_mutex_unlock(&create_lock);
+   return *pcache;
+}
+#define FNV_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+/** FNV-1a of a whole file, done once when content is filled */
+static int upload_file_hash(const char* path, size_t size,
+                            unsigned long long* hash)
+{
+   char buf[8192];
+   size_t len, i, total = 0;
+   uint64_t h = FNV_BASIS;
+   FILE* f = fopen(path, "rb");
+   if (!f)
+      return -1;
+   while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+      for (i = 0; i < len; i++)
+         h = (h ^ (unsigned char)buf[i]) * FNV_PRIME;
+      total += len;
+   }
+   fclose(f);
+   *hash = h;
+   // file is changed between stat and read
+   return total == size ? 0 : -1;
+}
+/** FNV-1a of picture in data, or the one taken from its file path */
+static int upload_hash(LwqqMsgContent* c, uint64_t* hash, size_t* size)
+{
+   int cface = c->type == LWQQ_CONTENT_CFACE;
+   const char* data = cface ? c->data.cface.data : c->data.img.data;
+   size_t i, total = cface ? c->data.cface.size : c->data.img.size;
+   uint64_t h = FNV_BASIS;
+   if (cface ? c->data.cface.path : c->data.img.path)
+      h = cface ? c->data.cface.hash : c->data.img.hash;
+   else if (data) {
+      for (i = 0; i < total; i++)
+         h = (h ^ (unsigned char)data[i]) * FNV_PRIME;
+   } else
+      return -1;
+   *hash = h;
+   *size = total;
+   return 0;
+}
+static UploadEntry* upload_cache_find(LwqqUploadCache* cache, uint64_t hash,
+                                      size_t size, LwqqContentType type,
+                                      LwqqMsgType msg_type, const char* to)
+{
+   UploadEntry* e, *next;
+   time_t now = time(NULL);
+   TAILQ_FOREACH_SAFE(e, &cache->lru, entries, next)
+   {
+      if (!e->pending && e->expire < now) {
+         TAILQ_REMOVE(&cache->lru, e, entries);
+         upload_entry_free(e);
+         cache->count--;
+         continue;
+      }
+      if (e->hash != hash || e->size != size || e->type != type)
+         continue;
+      if (type == LWQQ_CONTENT_CFACE ? e->msg_type != msg_type
+                                     : strcmp(e->to, to) != 0)
+         continue;
+      return e;
+   }
+   return NULL;
+}
+/**
+ * fill c with server name of same picture uploaded before.
+ * on miss c is remembered as pending, see upload_cache_done.
+ * @return 1 if c needn't upload
+ */
+static int upload_cache_apply(LwqqClient* lc, LwqqMsgContent* c,
+                              LwqqMsgType msg_type, const char* to)
+{
+   LwqqUploadCache* cache = upload_cache(lc);
+   UploadEntry* e;
+   uint64_t hash;
+   size_t size;
+   if (upload_hash(c, &hash, &size))
+      return 0;
+   pthread_mutex_lock(&cache->lock);
+   e = upload_cache_find(cache, hash, size, c->type, msg_type, to);
+   if (e && !e->pending) {
+      TAILQ_REMOVE(&cache->lru, e, entries);
+      TAILQ_INSERT_TAIL(&cache->lru, e, entries);
+      if (c->type == LWQQ_CONTENT_CFACE) {
+         lwqq_override(c->data.cface.name, s_strdup(e->name));
+         s_free(c->data.cface.data);
+         s_free(c->data.cface.path);
+         c->data.cface.size = 0;
+      } else {
+         lwqq_override(c->data.img.name, s_strdup(e->name));
+         lwqq_override(c->data.img.file_path, s_strdup(e->file_path));
+         s_free(c->data.img.data);
+         s_free(c->data.img.path);
+         c->data.img.size = e->file_size;
+      }
+      pthread_mutex_unlock(&cache->lock);
+      return 1;
+   }
+   if (e == NULL) {
+      // least recently used is dropped first
+      while (cache->count >= UPLOAD_CACHE_MAX) {
+         UploadEntry* old = TAILQ_FIRST(&cache->lru);
+         TAILQ_REMOVE(&cache->lru, old, entries);
+         upload_entry_free(old);
+         cache->count--;
+      }
+      e = s_malloc0(sizeof(*e));
+      e->hash = hash;
+      e->size = size;
+      e->type = c->type;
+      e->msg_type = msg_type;
+      e->to = c->type == LWQQ_CONTENT_OFFPIC ? s_strdup(to) : NULL;
+      e->pending = c;
+      TAILQ_INSERT_TAIL(&cache->lru, e, entries);
+      cache->count++;
+   }
+   pthread_mutex_unlock(&cache->lock);
+   return 0;
+}
+/** upload of c is finished, keep its server name if ok */
+static void upload_cache_done(LwqqClient* lc, LwqqMsgContent* c, int ok)
+{
+   LwqqUploadCache* cache = upload_cache(lc);
+   UploadEntry* e;
+   pthread_mutex_lock(&cache->lock);
+   TAILQ_FOREACH(e, &cache->lru, entries)
+   {
+      if (e->pending == c)
+         break;
+   }
+   if (e && ok) {
+      e->pending = NULL;
+      e->expire = time(NULL) + LWQQ_UPLOAD_CACHE_TTL;
+      if (c->type == LWQQ_CONTENT_CFACE)
+         e->name = s_strdup(c->data.cface.name);
+      else {
+         e->name = s_strdup(c->data.img.name);
+         e->file_path = s_strdup(c->data.img.file_path);
+         e->file_size = c->data.img.size;
+      }
+   } else if (e) {
+      TAILQ_REMOVE(&cache->lru, e, entries);
+      upload_entry_free(e);
+      cache->count--;
+   }
+   pthread_mutex_unlock(&cache->lock);
+}
+
 static LwqqAsyncEvent*
 lwqq_msg_upload_offline_pic(LwqqClient* lc, LwqqMsgContent* c, const char* to)
 {
    if (c->type != LWQQ_CONTENT_OFFPIC)
       return NULL;
-   if (!c->data.img.data || !c->data.img.name || !c->data.img.size)
+   if (!(c->data.img.data || c->data.img.path) || !c->data.img.name
+       || !c->data.img.size)
       return NULL;
 
    LwqqHttpRequest* req;
@@ -2025,7 +2505,10 @@ lwqq_msg_upload_offline_pic(LwqqClient* lc, LwqqMsgContent* c, const char* to)
    s_free(skey);
    req->add_form(req, LWQQ_FORM_CONTENT, "appid", "1002101");
    req->add_form(req, LWQQ_FORM_CONTENT, "peeruin", to); ///<what this means?
-   req->add_file_content(req, "file", filename, buffer, size, NULL);
+   if (c->data.img.path)
+      req->add_file_path(req, "file", filename, c->data.img.path, NULL);
+   else
+      req->add_file_content(req, "file", filename, buffer, size, NULL);
    snprintf(piece, sizeof(piece), "%d", fileid++);
    req->add_form(req, LWQQ_FORM_CONTENT, "fileid", piece);
    req->add_form(req, LWQQ_FORM_CONTENT, "vfwebqq", lc->vfwebqq);
@@ -2039,6 +2522,8 @@ static int upload_offline_pic_back(LwqqHttpRequest* req, LwqqMsgContent* c,
                                    const char* to)
 {
    json_t* json = NULL;
+   LwqqClient* lc = LWQQ_HTTP_EV(req)->lc;
+   int ok = 0;
    if (req->http_code != 200) {
       goto done;
    }
@@ -2053,15 +2538,17 @@ static int upload_offline_pic_back(LwqqHttpRequest* req, LwqqMsgContent* c,
    c->data.img.size = atol(json_parse_simple_value(json, "filesize"));
    lwqq_override(c->data.img.file_path, lwqq__json_get_value(json, "filepath"));
    if (!strcmp(c->data.img.file_path, "")) {
-      LwqqClient* lc = LWQQ_HTTP_EV(req)->lc;
       lc->args->serv_id = to;
       lc->args->content = c;
       lc->args->err = LWQQ_EC_ERROR;
       vp_do_repeat(lc->events->upload_fail, NULL);
-   }
+   } else
+      ok = 1;
    lwqq_override(c->data.img.name, lwqq__json_get_value(json, "filename"));
    s_free(c->data.img.data);
+   s_free(c->data.img.path);
 done:
+   upload_cache_done(lc, c, ok);
    lwqq__clean_json_and_req(json, req);
    return 0;
 }
@@ -2138,6 +2625,7 @@ static int upload_cface_back(LwqqHttpRequest* req, LwqqMsgContent* c,
    c->data.cface.name = s_strdup(file);
 
 done:
+   upload_cache_done(LWQQ_HTTP_EV(req)->lc, c, !err);
    if (err) {
       LwqqClient* lc = LWQQ_HTTP_EV(req)->lc;
       lc->args->serv_id = to;
@@ -2147,6 +2635,7 @@ done:
       s_free(c->data.cface.name);
    }
    s_free(c->data.cface.data);
+   s_free(c->data.cface.path);
    c->data.cface.size = 0;
    lwqq_http_request_free(req);
    return err;
@@ -2156,7 +2645,8 @@ static LwqqAsyncEvent* lwqq_msg_upload_cface(LwqqClient* lc, LwqqMsgContent* c,
 {
    if (c->type != LWQQ_CONTENT_CFACE)
       return NULL;
-   if (!c->data.cface.name || !c->data.cface.data || !c->data.cface.size)
+   if (!c->data.cface.name || !(c->data.cface.data || c->data.cface.path)
+       || !c->data.cface.size)
       return NULL;
    const char* filename = c->data.cface.name;
    const char* buffer = c->data.cface.data;
@@ -2186,7 +2676,11 @@ static LwqqAsyncEvent* lwqq_msg_upload_cface(LwqqClient* lc, LwqqMsgContent* c,
       req->add_form(req, LWQQ_FORM_CONTENT, "f",
                     "EQQ.View.ChatBox.uploadCustomFaceCallback");
    }
-   req->add_file_content(req, "custom_face", filename, buffer, size, NULL);
+   if (c->data.cface.path)
+      req->add_file_path(req, "custom_face", filename, c->data.cface.path,
+                         NULL);
+   else
+      req->add_file_content(req, "custom_face", filename, buffer, size, NULL);
    snprintf(fileid_str, sizeof(fileid_str), "%d", fileid++);
 
    return req->do_request_async(req, lwqq__hasnot_post(),
@@ -2232,18 +2726,7 @@ static void lwqq_msg_incre_seq(LwqqClient* lc, LwqqMsg* send)
    if (g->last_seq != 0)
       ++g->last_seq;
 }
-/**
- *
- *
- * @param lc
- * @param sendmsg
- * @note sess message can not send picture
- *
- * @return 1 means ok
- *         0 means failed or send failed
- */
-LWQQ_EXPORT
-LwqqAsyncEvent* lwqq_msg_send(LwqqClient* lc, LwqqMsgMessage* msg)
+static LwqqAsyncEvent* msg_send(LwqqClient* lc, LwqqMsgMessage* msg)
 {
    LwqqHttpRequest* req = NULL;
    char data[8192] = { 0 };
@@ -2257,23 +2740,36 @@ LwqqAsyncEvent* lwqq_msg_send(LwqqClient* lc, LwqqMsgMessage* msg)
    // this would check msg content to see if it need do upload picture first
    LwqqMsgContent* c;
    int will_upload = 0;
+   long delay = 0;
    LwqqAsyncEvent* event;
    LwqqAsyncEvset* evset = NULL;
+   LwqqMsgType type = mmsg->super.super.type;
    if (mmsg->upload_retry >= 0) {
       TAILQ_FOREACH(c, &mmsg->content, entries)
       {
          event = NULL;
          int should_query_gface = 0;
-         if (c->type == LWQQ_CONTENT_CFACE && c->data.cface.data > 0) {
-            event = lwqq_msg_upload_cface(lc, c, mmsg->super.super.type,
-                                          mmsg->super.to);
+         if (c->type == LWQQ_CONTENT_CFACE
+             && (c->data.cface.data || c->data.cface.path)) {
+            if (!upload_cache_apply(lc, c, type, NULL)) {
+               event = lwqq_msg_upload_cface(lc, c, type, mmsg->super.to);
+               if (!event)
+                  upload_cache_done(lc, c, 0);
+               delay = 5000;
+            }
             // only group message need gface sig
-            if (msg->super.super.type != LWQQ_MS_BUDDY_MSG && !lc->gface_sig)
+            if (type != LWQQ_MS_BUDDY_MSG && !lc->gface_sig)
                should_query_gface = 1;
-         } else if (c->type == LWQQ_CONTENT_OFFPIC && c->data.img.data > 0)
+         } else if (c->type == LWQQ_CONTENT_OFFPIC
+                    && (c->data.img.data || c->data.img.path)
+                    && !upload_cache_apply(lc, c, type, mmsg->super.to)) {
             event = lwqq_msg_upload_offline_pic(lc, c, mmsg->super.to);
+            if (!event)
+               upload_cache_done(lc, c, 0);
+            delay = 5000;
+         }
 
-         if (event) {
+         if (event || should_query_gface) {
             if (evset == NULL)
                evset = lwqq_async_evset_new();
             lwqq_async_evset_add_event(evset, event);
@@ -2286,9 +2782,10 @@ LwqqAsyncEvent* lwqq_msg_send(LwqqClient* lc, LwqqMsgMessage* msg)
    mmsg->upload_retry--;
    if (will_upload) {
       event = lwqq_async_event_new(NULL);
-      // add a delay to make server have a slip to sendout customface
+      // add a delay to make server have a slip to sendout customface,
+      // a picture server already has doesn't need it
       lwqq_async_add_evset_listener(
-          evset, _C_(4p, msg_send_delay, lc, msg, event, 5000L));
+          evset, _C_(4p, msg_send_delay, lc, msg, event, delay));
       lwqq_async_evset_unref(evset);
 
       // if we need upload first. we break this send msg
@@ -2366,6 +2863,43 @@ failed:
    return NULL;
 }
 
+/**
+ *
+ *
+ * @param lc
+ * @param sendmsg
+ * @note sess message can not send picture
+ *
+ * @return 1 means ok
+ *         0 means failed or send failed
+ */
+static void msg_send_span_end(LwqqTraceSpan* span, LwqqAsyncEvent* ev)
+{
+   char arg[32];
+   snprintf(arg, sizeof(arg), "result=%d", ev ? ev->result : LWQQ_EC_ERROR);
+   lwqq_trace_end(span, arg);
+   s_free(span);
+}
+
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_msg_send(LwqqClient* lc, LwqqMsgMessage* msg)
+{
+   if (!LWQQ_TRACE_ON())
+      return msg_send(lc, msg);
+   // uploads, the delayed resend and the send request are children of it.
+   // it ends when returned event finishes, that is after all of them
+   LwqqTraceSpan* span = s_malloc0(sizeof(*span));
+   lwqq_trace_begin(span, "msg_send");
+   LwqqTraceCtx prev = lwqq_trace_resume(span->ctx);
+   LwqqAsyncEvent* ev = msg_send(lc, msg);
+   lwqq_trace_resume(prev);
+   if (ev == NULL)
+      msg_send_span_end(span, NULL);
+   else
+      lwqq_async_add_event_listener(ev, _C_(2p, msg_send_span_end, span, ev));
+   return ev;
+}
+
 LWQQ_EXPORT
 int lwqq_msg_send_text(LwqqClient* lc, int type, const char* to,
                        const char* message)
@@ -2457,6 +2991,15 @@ const char* lwqq_msg_offfile_get_url(LwqqMsgOffFile* msg)
    s_free(file_name);
    return url;
 }
+
+LWQQ_EXPORT
+LwqqTransfer* lwqq_msg_offfile_transfer(LwqqClient* lc, LwqqMsgOffFile* msg,
+                                        const char* saveto)
+{
+   if (!lc || !msg || !saveto)
+      return NULL;
+   return lwqq_transfer_new(lc, lwqq_msg_offfile_get_url(msg), saveto);
+}
 #if 0
 static int file_download_finish(LwqqHttpRequest* req,void* data)
 {
@@ -2718,6 +3261,58 @@ LwqqMsgContent* lwqq_msg_fill_upload_offline_pic(const char* filename,
    return c;
 }
 
+/** @return size of regular file path, 0 if it can't be uploaded */
+static size_t upload_file_size(const char* path)
+{
+   struct stat st;
+   if (!path || stat(path, &st) || !S_ISREG(st.st_mode))
+      return 0;
+   return st.st_size;
+}
+static const char* upload_file_name(const char* path)
+{
+   const char* name = strrchr(path, LWQQ_PATH_SEP[0]);
+   return name ? name + 1 : path;
+}
+
+LWQQ_EXPORT
+LwqqMsgContent* lwqq_msg_fill_upload_cface_file(const char* path)
+{
+   size_t size = upload_file_size(path);
+   if (size == 0)
+      return NULL;
+   LwqqMsgContent* c = s_malloc0(sizeof(*c));
+   c->type = LWQQ_CONTENT_CFACE;
+   c->data.cface.name = s_strdup(upload_file_name(path));
+   c->data.cface.path = s_strdup(path);
+   c->data.cface.size = size;
+   if (upload_file_hash(path, size, &c->data.cface.hash)) {
+      lwqq_msg_content_clean(c);
+      s_free(c);
+      return NULL;
+   }
+   return c;
+}
+
+LWQQ_EXPORT
+LwqqMsgContent* lwqq_msg_fill_upload_offline_pic_file(const char* path)
+{
+   size_t size = upload_file_size(path);
+   if (size == 0)
+      return NULL;
+   LwqqMsgContent* c = s_malloc0(sizeof(*c));
+   c->type = LWQQ_CONTENT_OFFPIC;
+   c->data.img.name = s_strdup(upload_file_name(path));
+   c->data.img.path = s_strdup(path);
+   c->data.img.size = size;
+   if (upload_file_hash(path, size, &c->data.img.hash)) {
+      lwqq_msg_content_clean(c);
+      s_free(c);
+      return NULL;
+   }
+   return c;
+}
+
 LWQQ_EXPORT
 LwqqMsgOffFile* lwqq_msg_fill_upload_offline_file(const char* filename,
                                                   const char* from,
@@ -68,6 +68,9 @@ typedef enum {
    POLL_AUTO_DOWN_BUDDY_PIC = 1 << 1,
    POLL_AUTO_DOWN_DISCU_PIC = 1 << 2,
    POLL_REMOVE_DUPLICATED_MSG = 1 << 3,
+   /** deliver messages at once, pictures are resolved later and
+    * events->content_ready is fired for each of them */
+   POLL_LAZY_CONTENT = 1 << 4,
 } LwqqPollOption;
 
 typedef enum {
@@ -106,6 +109,8 @@ typedef struct LwqqMsgContent {
          char* file_path;
          char* url;
          int success;
+         char* path; /** < local file to upload instead of data */
+         unsigned long long hash; /** < FNV-1a of path, taken when filled */
       } img;
       struct {
          char* name;
@@ -116,6 +121,8 @@ typedef struct LwqqMsgContent {
          char* url;
          char serv_ip[24];
          char serv_port[8];
+         char* path; /** < local file to upload instead of data */
+         unsigned long long hash; /** < FNV-1a of path, taken when filled */
       } cface;
       struct {
          char* name;
@@ -123,6 +130,8 @@ typedef struct LwqqMsgContent {
       } ext;
    } data;
    TAILQ_ENTRY(LwqqMsgContent) entries;
+   /** not NULL while picture is still downloading, see POLL_LAZY_CONTENT */
+   struct LwqqContentFuture* future;
 } LwqqMsgContent;
 
 typedef TAILQ_HEAD(LwqqMsgContentHead, LwqqMsgContent) LwqqMsgContentHead;
@@ -449,6 +458,14 @@ int lwqq_msg_check_lost(LwqqClient* lc, LwqqMsg** p_msg, LwqqGroup* g);
  * @event : trigger group_member_chg event
  */
 void lwqq_msg_check_member_chg(LwqqClient* lc, LwqqMsg** p_msg, LwqqGroup* g);
+/**
+ * download picture of c straight into fd, data of c stays empty and only
+ * size and url are filled. a cached picture is written at once.
+ * @param fd written from its current offset, owned by caller
+ * @return NULL if it is written from cache or c is not a picture
+ */
+LwqqAsyncEvent* lwqq_msg_save_picture(LwqqClient* lc, LwqqMsgMessage* msg,
+                                      LwqqMsgContent* c, int fd);
 
 /* LwqqRecvMsg API end */
 //
@@ -464,10 +481,26 @@ LwqqAsyncEvent* lwqq_msg_remove_uploaded_cface(LwqqClient* lc,
 LwqqMsgContent* lwqq_msg_fill_upload_offline_pic(const char* filename,
                                                  const void* buffer,
                                                  size_t buf_size);
+// an uploaded picture is remembered by its content for this long, sending
+// same picture again in this time reuses it without upload
+#define LWQQ_UPLOAD_CACHE_TTL (3600)
+// same as above, but picture stays in file path and is streamed from it
+// while uploading, so it is never copied into memory. file is hashed here
+// for upload cache, NULL if it can't be read
+LwqqMsgContent* lwqq_msg_fill_upload_cface_file(const char* path);
+LwqqMsgContent* lwqq_msg_fill_upload_offline_pic_file(const char* path);
 
 // get file url from a receieve offline msg
 // then use this url to download file whatever you like
 const char* lwqq_msg_offfile_get_url(LwqqMsgOffFile* msg);
+typedef struct LwqqTransfer LwqqTransfer;
+/**
+ * download a receieved offline file into saveto by parallel ranges,
+ * an interrupted download of same file and saveto is resumed.
+ * @see transfer.h, start it with lwqq_transfer_start
+ */
+LwqqTransfer* lwqq_msg_offfile_transfer(LwqqClient* lc, LwqqMsgOffFile* msg,
+                                        const char* saveto);
 // helper function : fill a message content with upload offline file
 // then use upload_offline_file function to do upload
 LwqqMsgOffFile* lwqq_msg_fill_upload_offline_file(const char* filename,
@@ -0,0 +1,499 @@
+/**
+ * @file   sendq.c
+ * @brief  Per conversation send queue with rate shaping
+ *
+ * a conversation is ready when it has messages and none of them is in
+ * flight or in backoff. ready conversations are served round robin, each
+ * send costs one token of the bucket, which is refilled lazily from the
+ * monotonic clock. when tokens run out a timer pumps the queue again once
+ * next token is due.
+ *
+ * timers, dispatched pumps and sends in flight hold a reference of the
+ * queue, so it outlives the client. the client drops its own one when it
+ * is freed, which cancels messages not yet sent. a send itself is dispatched,
+ * so it reads the client on the thread which frees it.
+ *
+ * while polling is stopped a message can't be sent, its conversation is held
+ * and checked again after a backoff, without using a retry.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sendq.h"
+#include "async.h"
+#include "smemory.h"
+#include "logger.h"
+#include "internal.h"
+
+#define SENDQ_BUCKETS 64
+#define SENDQ_KEY_LEN 128
+
+typedef struct SendItem {
+   LwqqMsgMessage* msg;
+   LwqqAsyncEvent* done; /** < returned to caller of push */
+   uint64_t pushed;
+   int retry;
+   TAILQ_ENTRY(SendItem) entries;
+} SendItem;
+
+typedef struct SendConv {
+   char key[SENDQ_KEY_LEN];
+   int busy; /** < head item is in flight or in backoff */
+   int ready; /** < linked in ready list */
+   TAILQ_HEAD(, SendItem) items;
+   LIST_ENTRY(SendConv) bucket;
+   TAILQ_ENTRY(SendConv) ready_entries;
+} SendConv;
+
+typedef struct LwqqSendQueue {
+   pthread_mutex_t lock;
+   LwqqClient* lc; /** < NULL once client is freed */
+   void (*dispatch)(LwqqCommand, unsigned long timeout);
+   int ref;
+   double rate;
+   unsigned burst;
+   unsigned window;
+   int max_retry;
+   unsigned backoff;
+   double tokens;
+   uint64_t refilled;
+   int timer; /** < a pump is dispatched with delay */
+   LwqqSendqStats stats;
+   LIST_HEAD(, SendConv) buckets[SENDQ_BUCKETS];
+   TAILQ_HEAD(, SendConv) ready;
+} LwqqSendQueue;
+
+static pthread_mutex_t sendq_create_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sendq_pump(LwqqSendQueue* q);
+
+static LwqqSendQueue* sendq_get(LwqqClient* lc)
+{
+   LwqqSendQueue** slot = lwqq__client_send_queue(lc);
+   LwqqSendQueue* q;
+   pthread_mutex_lock(&sendq_create_lock);
+   q = *slot;
+   if (q == NULL) {
+      int i;
+      q = s_malloc0(sizeof(*q));
+      pthread_mutex_init(&q->lock, NULL);
+      q->lc = lc;
+      q->dispatch = lc->dispatch;
+      q->ref = 1;
+      q->rate = LWQQ_SENDQ_RATE;
+      q->burst = LWQQ_SENDQ_BURST;
+      q->window = LWQQ_SENDQ_WINDOW;
+      q->max_retry = LWQQ_SENDQ_RETRY;
+      q->backoff = LWQQ_SENDQ_BACKOFF;
+      q->tokens = q->burst;
+      q->refilled = lwqq__metrics_now();
+      for (i = 0; i < SENDQ_BUCKETS; i++)
+         LIST_INIT(&q->buckets[i]);
+      TAILQ_INIT(&q->ready);
+      *slot = q;
+   }
+   pthread_mutex_unlock(&sendq_create_lock);
+   return q;
+}
+
+static void conv_key(char* buf, size_t sz, LwqqMsgType type, const char* to)
+{
+   snprintf(buf, sz, "%d/%s", type, to ? to : "");
+}
+
+static unsigned conv_bucket(const char* key)
+{
+   unsigned h = 2166136261u;
+   while (*key)
+      h = (h ^ (unsigned char)*key++) * 16777619u;
+   return h % SENDQ_BUCKETS;
+}
+
+static SendConv* conv_find(LwqqSendQueue* q, const char* key)
+{
+   SendConv* conv;
+   LIST_FOREACH(conv, &q->buckets[conv_bucket(key)], bucket)
+   {
+      if (strcmp(conv->key, key) == 0)
+         return conv;
+   }
+   return NULL;
+}
+
+/** caller holds lock */
+static void conv_make_ready(LwqqSendQueue* q, SendConv* conv, int first)
+{
+   if (conv->busy || conv->ready || TAILQ_EMPTY(&conv->items))
+      return;
+   if (first)
+      TAILQ_INSERT_HEAD(&q->ready, conv, ready_entries);
+   else
+      TAILQ_INSERT_TAIL(&q->ready, conv, ready_entries);
+   conv->ready = 1;
+}
+
+/** caller holds lock, drops conv if nothing is left in it */
+static void conv_release(LwqqSendQueue* q, SendConv* conv)
+{
+   conv->busy = 0;
+   if (!TAILQ_EMPTY(&conv->items)) {
+      conv_make_ready(q, conv, 0);
+      return;
+   }
+   LIST_REMOVE(conv, bucket);
+   q->stats.conversations--;
+   s_free(conv);
+}
+
+/** caller holds lock, takes head item off conv */
+static SendItem* conv_pop(LwqqSendQueue* q, SendConv* conv)
+{
+   SendItem* item = TAILQ_FIRST(&conv->items);
+   TAILQ_REMOVE(&conv->items, item, entries);
+   q->stats.queued--;
+   conv_release(q, conv);
+   return item;
+}
+
+static void item_finish(SendItem* item, int result)
+{
+   item->done->result = result;
+   lwqq_async_event_finish(item->done);
+   s_free(item);
+}
+
+static void sendq_unref(LwqqSendQueue* q)
+{
+   SendConv* conv, *conv_next;
+   int i, last;
+   pthread_mutex_lock(&q->lock);
+   last = --q->ref == 0;
+   pthread_mutex_unlock(&q->lock);
+   if (!last)
+      return;
+   // every item is finished by now, only empty conversations are left
+   for (i = 0; i < SENDQ_BUCKETS; i++) {
+      LIST_FOREACH_SAFE(conv, &q->buckets[i], bucket, conv_next)
+      {
+         s_free(conv);
+      }
+   }
+   pthread_mutex_destroy(&q->lock);
+   s_free(q);
+}
+
+static void sendq_tick(LwqqSendQueue* q)
+{
+   pthread_mutex_lock(&q->lock);
+   q->timer = 0;
+   pthread_mutex_unlock(&q->lock);
+   sendq_pump(q);
+   sendq_unref(q);
+}
+
+static void sendq_kick(LwqqSendQueue* q)
+{
+   sendq_pump(q);
+   sendq_unref(q);
+}
+
+/**
+ * caller holds lock. takes one token and the next ready conversation, which
+ * holds a reference until its send is done.
+ * @param wait set to ms until next token when the bucket is empty and no
+ *        timer is armed yet, 0 otherwise. the timer holds a reference too
+ */
+static SendConv* sendq_take(LwqqSendQueue* q, unsigned long* wait)
+{
+   uint64_t now = lwqq__metrics_now();
+   SendConv* conv;
+   *wait = 0;
+   q->tokens += (now - q->refilled) / 1e6 * q->rate;
+   if (q->tokens > q->burst)
+      q->tokens = q->burst;
+   q->refilled = now;
+
+   if (q->lc == NULL || TAILQ_EMPTY(&q->ready)
+       || q->stats.inflight >= q->window)
+      return NULL;
+   if (q->tokens < 1.0) {
+      if (!q->timer) {
+         *wait = (1.0 - q->tokens) / q->rate * 1000 + 1;
+         q->timer = 1;
+         q->ref++;
+      }
+      return NULL;
+   }
+   q->tokens -= 1.0;
+   conv = TAILQ_FIRST(&q->ready);
+   TAILQ_REMOVE(&q->ready, conv, ready_entries);
+   conv->ready = 0;
+   conv->busy = 1;
+   q->stats.inflight++;
+   q->ref++;
+   return conv;
+}
+
+static void sendq_requeue(LwqqSendQueue* q, SendConv* conv)
+{
+   SendItem* item = NULL;
+   pthread_mutex_lock(&q->lock);
+   if (q->lc == NULL)
+      // client is freed during backoff
+      item = conv_pop(q, conv);
+   else {
+      conv->busy = 0;
+      // it has waited enough, don't make it wait for a whole round again
+      conv_make_ready(q, conv, 1);
+   }
+   pthread_mutex_unlock(&q->lock);
+   if (item)
+      item_finish(item, LWQQ_EC_CANCELED);
+   else
+      sendq_pump(q);
+   sendq_unref(q);
+}
+
+static int sendq_should_retry(int err)
+{
+   switch (err) {
+   case LWQQ_EC_NETWORK_ERROR:
+   case LWQQ_EC_HTTP_ERROR:
+   case LWQQ_EC_SSL_ERROR:
+   case LWQQ_EC_TIMEOUT_OVER:
+   case LWQQ_EC_NOT_JSON_FORMAT:
+      return 1;
+   default:
+      return 0;
+   }
+}
+
+static void sendq_sent(LwqqSendQueue* q, SendConv* conv, LwqqAsyncEvent* ev)
+{
+   int err = ev ? ev->result : LWQQ_EC_ERROR;
+   SendItem* item;
+
+   pthread_mutex_lock(&q->lock);
+   q->stats.inflight--;
+   item = TAILQ_FIRST(&conv->items);
+   if (q->lc && err != LWQQ_EC_OK && sendq_should_retry(err)
+       && item->retry < q->max_retry) {
+      // full jitter over upper half, so retries of a broadcast spread out
+      int shift = item->retry < 16 ? item->retry : 16;
+      unsigned long ms = (unsigned long)q->backoff << shift;
+      ms = ms / 2 + (unsigned long)(drand48() * (ms / 2 + 1));
+      item->retry++;
+      q->stats.retried++;
+      q->ref++; // for requeue
+      pthread_mutex_unlock(&q->lock);
+      lwqq_log(LOG_NOTICE, "send to %s failed(%d), retry in %lums\n",
+               conv->key, err, ms);
+      q->dispatch(_C_(2p, sendq_requeue, q, conv), ms);
+      sendq_pump(q);
+      sendq_unref(q);
+      return;
+   }
+   conv_pop(q, conv);
+   if (err == LWQQ_EC_OK) {
+      q->stats.sent++;
+      lwqq_histogram_record(&q->stats.latency,
+                            lwqq__metrics_now() - item->pushed);
+   } else
+      q->stats.failed++;
+   pthread_mutex_unlock(&q->lock);
+
+   item_finish(item, err);
+   sendq_pump(q);
+   sendq_unref(q);
+}
+
+/** send head item of conv, runs on dispatch thread of client */
+static void sendq_send(LwqqSendQueue* q, SendConv* conv)
+{
+   SendItem* item;
+   LwqqClient* lc;
+   pthread_mutex_lock(&q->lock);
+   lc = q->lc;
+   item = TAILQ_FIRST(&conv->items);
+   if (lc == NULL || !lwqq_client_valid(lc)) {
+      q->stats.inflight--;
+      conv_pop(q, conv);
+      pthread_mutex_unlock(&q->lock);
+      item_finish(item, LWQQ_EC_CANCELED);
+      sendq_unref(q);
+      return;
+   }
+   if (!lwqq__msglist_running(lc)) {
+      // hold conv, reference of it is kept by requeue
+      q->stats.inflight--;
+      q->tokens += 1.0;
+      pthread_mutex_unlock(&q->lock);
+      q->dispatch(_C_(2p, sendq_requeue, q, conv), q->backoff);
+      return;
+   }
+   pthread_mutex_unlock(&q->lock);
+
+   LwqqAsyncEvent* ev = lwqq_msg_send(lc, item->msg);
+   if (ev == NULL)
+      sendq_sent(q, conv, NULL);
+   else
+      lwqq_async_add_event_listener(ev, _C_(3p, sendq_sent, q, conv, ev));
+}
+
+static void sendq_pump(LwqqSendQueue* q)
+{
+   SendConv* conv;
+   unsigned long wait;
+   for (;;) {
+      pthread_mutex_lock(&q->lock);
+      conv = sendq_take(q, &wait);
+      pthread_mutex_unlock(&q->lock);
+      if (wait)
+         q->dispatch(_C_(p, sendq_tick, q), wait);
+      if (conv == NULL)
+         break;
+      // client is only read where it is freed
+      q->dispatch(_C_(2p, sendq_send, q, conv), 0);
+   }
+}
+
+LWQQ_EXPORT
+void lwqq_sendq_set_rate(LwqqClient* lc, double rate, unsigned burst,
+                         unsigned window)
+{
+   LwqqSendQueue* q = sendq_get(lc);
+   pthread_mutex_lock(&q->lock);
+   q->rate = rate > 0 ? rate : LWQQ_SENDQ_RATE;
+   q->burst = burst ? burst : LWQQ_SENDQ_BURST;
+   q->window = window ? window : LWQQ_SENDQ_WINDOW;
+   if (q->tokens > q->burst)
+      q->tokens = q->burst;
+   pthread_mutex_unlock(&q->lock);
+}
+
+LWQQ_EXPORT
+void lwqq_sendq_set_retry(LwqqClient* lc, int max_retry, unsigned backoff_ms)
+{
+   LwqqSendQueue* q = sendq_get(lc);
+   pthread_mutex_lock(&q->lock);
+   q->max_retry = max_retry > 0 ? max_retry : 0;
+   q->backoff = backoff_ms ? backoff_ms : LWQQ_SENDQ_BACKOFF;
+   pthread_mutex_unlock(&q->lock);
+}
+
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_sendq_push(LwqqClient* lc, LwqqMsgMessage* msg)
+{
+   if (!lc || !msg)
+      return NULL;
+   LwqqSendQueue* q = sendq_get(lc);
+   LwqqMsgType type = msg->super.super.type;
+   const char* to = msg->super.to;
+   char key[SENDQ_KEY_LEN];
+   SendConv* conv;
+   SendItem* item = s_malloc0(sizeof(*item));
+
+   if (type == LWQQ_MS_DISCU_MSG && msg->discu.did)
+      to = msg->discu.did;
+   conv_key(key, sizeof(key), type, to);
+   item->msg = msg;
+   item->done = lwqq_async_event_new(NULL);
+   item->done->lc = lc;
+   item->pushed = lwqq__metrics_now();
+
+   pthread_mutex_lock(&q->lock);
+   conv = conv_find(q, key);
+   if (conv == NULL) {
+      conv = s_malloc0(sizeof(*conv));
+      strcpy(conv->key, key);
+      TAILQ_INIT(&conv->items);
+      LIST_INSERT_HEAD(&q->buckets[conv_bucket(key)], conv, bucket);
+      q->stats.conversations++;
+   }
+   TAILQ_INSERT_TAIL(&conv->items, item, entries);
+   q->stats.queued++;
+   conv_make_ready(q, conv, 0);
+   LwqqAsyncEvent* ret = item->done;
+   q->ref++;
+   pthread_mutex_unlock(&q->lock);
+
+   // let the loop start it, so listener of ret can be added in time
+   q->dispatch(_C_(p, sendq_kick, q), 0);
+   return ret;
+}
+
+LWQQ_EXPORT
+size_t lwqq_sendq_depth(LwqqClient* lc, LwqqMsgType type, const char* to)
+{
+   LwqqSendQueue* q = *lwqq__client_send_queue(lc);
+   char key[SENDQ_KEY_LEN];
+   SendConv* conv;
+   SendItem* item;
+   size_t n = 0;
+   if (q == NULL)
+      return 0;
+   pthread_mutex_lock(&q->lock);
+   if (to == NULL)
+      n = q->stats.queued;
+   else {
+      conv_key(key, sizeof(key), type, to);
+      conv = conv_find(q, key);
+      if (conv) {
+         TAILQ_FOREACH(item, &conv->items, entries)
+         {
+            n++;
+         }
+      }
+   }
+   pthread_mutex_unlock(&q->lock);
+   return n;
+}
+
+LWQQ_EXPORT
+void lwqq_sendq_stats(LwqqClient* lc, LwqqSendqStats* stats)
+{
+   LwqqSendQueue* q = *lwqq__client_send_queue(lc);
+   if (q == NULL) {
+      memset(stats, 0, sizeof(*stats));
+      return;
+   }
+   pthread_mutex_lock(&q->lock);
+   *stats = q->stats;
+   pthread_mutex_unlock(&q->lock);
+}
+
+void lwqq__send_queue_free(LwqqSendQueue* q)
+{
+   TAILQ_HEAD(, SendItem) canceled = TAILQ_HEAD_INITIALIZER(canceled);
+   SendConv* conv;
+   SendItem* item, *item_next;
+   int i;
+   if (q == NULL)
+      return;
+   pthread_mutex_lock(&q->lock);
+   q->lc = NULL;
+   for (i = 0; i < SENDQ_BUCKETS; i++) {
+      LIST_FOREACH(conv, &q->buckets[i], bucket)
+      {
+         // head of a busy conversation is finished by its send or backoff
+         item = TAILQ_FIRST(&conv->items);
+         if (conv->busy)
+            item = TAILQ_NEXT(item, entries);
+         for (; item; item = item_next) {
+            item_next = TAILQ_NEXT(item, entries);
+            TAILQ_REMOVE(&conv->items, item, entries);
+            TAILQ_INSERT_TAIL(&canceled, item, entries);
+            q->stats.queued--;
+         }
+      }
+   }
+   pthread_mutex_unlock(&q->lock);
+   TAILQ_FOREACH_SAFE(item, &canceled, entries, item_next)
+   {
+      item_finish(item, LWQQ_EC_CANCELED);
+   }
+   sendq_unref(q);
+}
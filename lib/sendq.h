@@ -0,0 +1,63 @@
+/**
+ * @file   sendq.h
+ * @brief  Per conversation send queue with rate shaping
+ *
+ * messages to one conversation are sent one by one in the order they are
+ * pushed, messages to different conversations are sent in parallel. every
+ * send takes a token from a bucket of the client, so a broadcast goes out as
+ * fast as the bucket allows but never above it. a send which fails in
+ * transport is retried after an exponential backoff with jitter, later
+ * messages of the conversation wait for it.
+ */
+
+#ifndef LWQQ_SENDQ_H
+#define LWQQ_SENDQ_H
+
+#include "type.h"
+#include "msg.h"
+#include "metrics.h"
+
+#define LWQQ_SENDQ_RATE 5.0 /** < tokens refilled each second */
+#define LWQQ_SENDQ_BURST 10 /** < tokens a bucket holds */
+#define LWQQ_SENDQ_WINDOW 8 /** < sends in flight of a client */
+#define LWQQ_SENDQ_RETRY 3
+#define LWQQ_SENDQ_BACKOFF 500 /** < first retry delay in ms */
+
+typedef struct LwqqSendqStats {
+   size_t queued; /** < messages waiting, include the ones in backoff */
+   size_t inflight;
+   size_t conversations; /** < conversations which have messages */
+   uint64_t sent;
+   uint64_t failed; /** < messages failed after all retry */
+   uint64_t retried;
+   LwqqHistogram latency; /** < push to server answer of sent messages */
+} LwqqSendqStats;
+
+/**
+ * shape sends of lc, takes effect on next send
+ * @param rate tokens each second, 0 for default
+ * @param burst max tokens, 0 for default
+ * @param window max sends in flight, 0 for default
+ */
+void lwqq_sendq_set_rate(LwqqClient* lc, double rate, unsigned burst,
+                         unsigned window);
+/**
+ * @param max_retry times a failed send is retried, 0 disables retry
+ * @param backoff_ms delay of first retry, doubled for each next one
+ */
+void lwqq_sendq_set_retry(LwqqClient* lc, int max_retry, unsigned backoff_ms);
+/**
+ * queue msg to its conversation, which is its type and receiver.
+ * msg must be kept until the event finishes, same as lwqq_msg_send.
+ * @return event finishes with result of the last try, or LWQQ_EC_CANCELED
+ *         when client is freed before msg is sent
+ */
+LwqqAsyncEvent* lwqq_sendq_push(LwqqClient* lc, LwqqMsgMessage* msg);
+/**
+ * messages waiting in conversation of type and to
+ * @param to receiver, NULL for all conversations of lc
+ */
+size_t lwqq_sendq_depth(LwqqClient* lc, LwqqMsgType type, const char* to);
+void lwqq_sendq_stats(LwqqClient* lc, LwqqSendqStats* stats);
+
+#endif
@@ -11,7 +11,11 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "internal.h"
+#include "smemory.h"
 
 LWQQ_EXPORT
 void* s_malloc(size_t size) { return size ? malloc(size) : NULL; }
@@ -47,6 +51,338 @@ long s_atol(const char* s, long init)
    long ret = strtol(s, &end, 10);
    return (end == s) ? init : ret;
 }
+/** string of an entry is put one byte after it, so a shared copy is never
+ * aligned to 4 like anything from malloc. s_unintern tells them apart by
+ * address, without looking into the table */
+struct intern_entry {
+   struct intern_entry* next;
+   uint32_t hash;
+   int ref;
+};
+#define intern_str(e) ((char*)((e) + 1) + 1)
+#define is_interned(s) (((uintptr_t)(s)&3) != 0)
+
+static struct {
+   pthread_mutex_t lock;
+   atomic_int enabled;
+   struct intern_entry** bucket;
+   size_t n_bucket;
+   size_t count;
+   size_t bytes;
+   size_t hits;
+} intern_tb = { PTHREAD_MUTEX_INITIALIZER };
+
+static uint32_t intern_hash(const char* s)
+{
+   uint32_t h = 2166136261u;
+   while (*s)
+      h = (h ^ (unsigned char)*s++) * 16777619u;
+   return h;
+}
+
+static void intern_grow()
+{
+   size_t n = intern_tb.n_bucket ? intern_tb.n_bucket * 2 : 256, i;
+   struct intern_entry** b = s_calloc(n, sizeof(*b));
+   struct intern_entry* e, *next;
+   for (i = 0; i < intern_tb.n_bucket; i++) {
+      for (e = intern_tb.bucket[i]; e; e = next) {
+         next = e->next;
+         e->next = b[e->hash & (n - 1)];
+         b[e->hash & (n - 1)] = e;
+      }
+   }
+   free(intern_tb.bucket);
+   intern_tb.bucket = b;
+   intern_tb.n_bucket = n;
+}
+
+LWQQ_EXPORT
+void s_intern_enable(int enable)
+{
+   // table is kept when disabled, shared copies are still released by it
+   atomic_store(&intern_tb.enabled, !!enable);
+}
+
+LWQQ_EXPORT
+char* s_intern(const char* s)
+{
+   if (!s)
+      return NULL;
+   if (!atomic_load_explicit(&intern_tb.enabled, memory_order_relaxed))
+      return strdup(s);
+   uint32_t hash = intern_hash(s);
+   struct intern_entry* e;
+   pthread_mutex_lock(&intern_tb.lock);
+   if (intern_tb.count >= intern_tb.n_bucket)
+      intern_grow();
+   struct intern_entry** head
+       = &intern_tb.bucket[hash & (intern_tb.n_bucket - 1)];
+   for (e = *head; e; e = e->next) {
+      if (e->hash == hash && strcmp(intern_str(e), s) == 0) {
+         e->ref++;
+         intern_tb.hits++;
+         goto done;
+      }
+   }
+   size_t len = strlen(s) + 1;
+   e = s_malloc(sizeof(*e) + 1 + len);
+   memcpy(intern_str(e), s, len);
+   e->hash = hash;
+   e->ref = 1;
+   e->next = *head;
+   *head = e;
+   intern_tb.count++;
+   intern_tb.bytes += sizeof(*e) + 1 + len;
+done:
+   pthread_mutex_unlock(&intern_tb.lock);
+   return intern_str(e);
+}
+
+LWQQ_EXPORT
+char* s_intern_take(char* s)
+{
+   if (!s || !atomic_load_explicit(&intern_tb.enabled, memory_order_relaxed))
+      return s;
+   char* ret = s_intern(s);
+   free(s);
+   return ret;
+}
+
+LWQQ_EXPORT
+void s_unintern(char* s)
+{
+   struct intern_entry* e, **prev;
+   if (!s)
+      return;
+   // a normal string, table is not touched
+   if (!is_interned(s)) {
+      free(s);
+      return;
+   }
+   e = (struct intern_entry*)(s - 1) - 1;
+   pthread_mutex_lock(&intern_tb.lock);
+   if (--e->ref == 0) {
+      prev = &intern_tb.bucket[e->hash & (intern_tb.n_bucket - 1)];
+      while (*prev != e)
+         prev = &(*prev)->next;
+      *prev = e->next;
+      intern_tb.count--;
+      intern_tb.bytes -= sizeof(*e) + 1 + strlen(s) + 1;
+      free(e);
+   }
+   pthread_mutex_unlock(&intern_tb.lock);
+}
+
+LWQQ_EXPORT
+void s_intern_stats(size_t* count, size_t* bytes, size_t* hits)
+{
+   pthread_mutex_lock(&intern_tb.lock);
+   if (count)
+      *count = intern_tb.count;
+   if (bytes)
+      *bytes = intern_tb.bytes;
+   if (hits)
+      *hits = intern_tb.hits;
+   pthread_mutex_unlock(&intern_tb.lock);
+}
+
+#define SLAB_MAX 32
+#define SLAB_CHUNK 64
+#define SLAB_CACHE 64
+#define SLAB_ALIGN(n) (((n) + 15) & ~(size_t)15)
+
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static SSlab* slab_list;
+static SSlab* slab_by_id[SLAB_MAX];
+static int slab_count;
+
+static void slab_register(SSlab* slab)
+{
+   pthread_mutex_lock(&slab_lock);
+   if (slab->id == 0) {
+      slab->size = SLAB_ALIGN(slab->size ?: sizeof(void*));
+      slab->next = slab_list;
+      slab_list = slab;
+      if (slab_count < SLAB_MAX)
+         slab_by_id[slab_count] = slab;
+      // id is 1 based, 0 means not registered yet.
+      // publish id at last, so size is valid when others see it
+      __atomic_store_n(&slab->id, ++slab_count, __ATOMIC_RELEASE);
+   }
+   pthread_mutex_unlock(&slab_lock);
+}
+
+#ifdef WITH_SLAB
+struct slab_cache {
+   void* head;
+   int n;
+};
+static __thread struct slab_cache slab_tcache[SLAB_MAX];
+static __thread int slab_thread_init;
+static pthread_key_t slab_key;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+
+#define slab_next(p) (*(void**)(p))
+
+/** thread exits, give its cached objects back to depot */
+static void slab_thread_exit(void* data)
+{
+   struct slab_cache* tcache = data;
+   int i, n;
+   void* p;
+   pthread_mutex_lock(&slab_lock);
+   n = slab_count < SLAB_MAX ? slab_count : SLAB_MAX;
+   for (i = 0; i < n; i++) {
+      SSlab* slab = slab_by_id[i];
+      struct slab_cache* c = &tcache[i];
+      while ((p = c->head)) {
+         c->head = slab_next(p);
+         slab_next(p) = slab->depot;
+         slab->depot = p;
+         slab->n_depot++;
+      }
+      c->n = 0;
+   }
+   pthread_mutex_unlock(&slab_lock);
+}
+
+static void slab_key_create()
+{
+   pthread_key_create(&slab_key, slab_thread_exit);
+}
+
+/** first cache use of this thread, so it is drained when thread exits */
+static void slab_thread_attach()
+{
+   pthread_once(&slab_key_once, slab_key_create);
+   pthread_setspecific(slab_key, slab_tcache);
+   slab_thread_init = 1;
+}
+
+/* move up to SLAB_CACHE/2 objects from depot into cache, or a new chunk */
+static void slab_refill(SSlab* slab, struct slab_cache* c)
+{
+   void* p;
+   int n = 0;
+   pthread_mutex_lock(&slab_lock);
+   while (slab->depot && n < SLAB_CACHE / 2) {
+      p = slab->depot;
+      slab->depot = slab_next(p);
+      slab_next(p) = c->head;
+      c->head = p;
+      n++;
+   }
+   slab->n_depot -= n;
+   if (n == 0) {
+      char* chunk = malloc(slab->size * SLAB_CHUNK);
+      if (chunk) {
+         for (n = 0; n < SLAB_CHUNK; n++) {
+            p = chunk + slab->size * n;
+            slab_next(p) = c->head;
+            c->head = p;
+         }
+         slab->chunks++;
+      }
+   }
+   c->n += n;
+   pthread_mutex_unlock(&slab_lock);
+}
+
+static void slab_drain(SSlab* slab, struct slab_cache* c)
+{
+   void* p;
+   int n = 0;
+   pthread_mutex_lock(&slab_lock);
+   while (c->head && n < SLAB_CACHE / 2) {
+      p = c->head;
+      c->head = slab_next(p);
+      slab_next(p) = slab->depot;
+      slab->depot = p;
+      n++;
+   }
+   slab->n_depot += n;
+   c->n -= n;
+   pthread_mutex_unlock(&slab_lock);
+}
+#endif
+
+LWQQ_EXPORT
+void* s_slab_alloc(SSlab* slab)
+{
+   if (__atomic_load_n(&slab->id, __ATOMIC_ACQUIRE) == 0)
+      slab_register(slab);
+#ifdef WITH_SLAB
+   struct slab_cache* c = (slab->id <= SLAB_MAX) ? &slab_tcache[slab->id - 1]
+                                                 : NULL;
+   void* p;
+   if (c == NULL) {
+      // too many slabs, fallback to malloc
+      __sync_fetch_and_add(&slab->allocs, 1);
+      return s_malloc0(slab->size);
+   }
+   if (c->head == NULL) {
+      if (!slab_thread_init)
+         slab_thread_attach();
+      slab_refill(slab, c);
+   }
+   p = c->head;
+   if (p == NULL)
+      return NULL;
+   c->head = slab_next(p);
+   c->n--;
+   memset(p, 0, slab->size);
+   __sync_fetch_and_add(&slab->allocs, 1);
+   return p;
+#else
+   __sync_fetch_and_add(&slab->allocs, 1);
+   return s_malloc0(slab->size);
+#endif
+}
+
+LWQQ_EXPORT
+void s_slab_free(SSlab* slab, void* ptr)
+{
+   if (ptr == NULL)
+      return;
+   __sync_fetch_and_add(&slab->frees, 1);
+#ifdef WITH_SLAB
+   if (slab->id > SLAB_MAX) {
+      free(ptr);
+      return;
+   }
+   struct slab_cache* c = &slab_tcache[slab->id - 1];
+   if (!slab_thread_init)
+      slab_thread_attach();
+   slab_next(ptr) = c->head;
+   c->head = ptr;
+   if (++c->n > SLAB_CACHE)
+      slab_drain(slab, c);
+#else
+   free(ptr);
+#endif
+}
+
+LWQQ_EXPORT
+size_t s_slab_stats(SSlabStat* stats, size_t max)
+{
+   SSlab* slab;
+   size_t n = 0;
+   pthread_mutex_lock(&slab_lock);
+   for (slab = slab_list; slab; slab = slab->next, n++) {
+      if (n >= max)
+         continue;
+      stats[n].name = slab->name;
+      stats[n].size = slab->size;
+      stats[n].allocs = slab->allocs;
+      stats[n].frees = slab->frees;
+      stats[n].in_use = slab->allocs - slab->frees;
+      stats[n].reserved = slab->size * SLAB_CHUNK * slab->chunks;
+   }
+   pthread_mutex_unlock(&slab_lock);
+   return n;
+}
+
 #if 0
 LWQQ_EXPORT
 char *s_strndup(const char *s1, size_t n)
@@ -11,6 +11,8 @@
 #ifndef SMEMORY_H
 #define SMEMORY_H
 
+#include <stddef.h>
+
 void* s_malloc(size_t size);
 void* s_malloc0(size_t size);
 void* s_calloc(size_t nmemb, size_t lsize);
@@ -20,6 +22,63 @@ char* s_strdup(const char* s1);
 long s_atol(const char* s, long init);
 #define s_atoi(s, init) s_atol(s, init)
 #define s_free(p) (p = p ? free(p), NULL : NULL)
+
+/**
+ * string interning, disabled by default.
+ * when enabled s_intern returns a shared refcounted copy, otherwise it is
+ * same as s_strdup. strings from s_intern must be freed by s_release, which
+ * also accepts normal allocated strings, so it is safe to toggle at any time.
+ */
+void s_intern_enable(int enable);
+char* s_intern(const char* s);
+/** intern an allocated string, s is freed (or kept as the shared copy) */
+char* s_intern_take(char* s);
+void s_unintern(char* s);
+#define s_release(p) (p = p ? s_unintern(p), NULL : NULL)
+/**
+ * @param count output count of unique strings
+ * @param bytes output bytes held by the table
+ * @param hits  output count of s_intern calls which shared an existing copy
+ */
+void s_intern_stats(size_t* count, size_t* bytes, size_t* hits);
+/**
+ * slab of fixed size objects.
+ * freed objects are kept in a small per thread cache and a shared free list,
+ * memory is never given back to system. built without WITH_SLAB it is only a
+ * counted s_malloc0/free. objects are always zeroed.
+ */
+typedef struct SSlab {
+   const char* name;
+   size_t size;
+   int id; /** < index of thread cache, assigned at first alloc */
+   void* depot; /** < shared free list */
+   size_t n_depot;
+   long allocs;
+   long frees;
+   long chunks;
+   struct SSlab* next;
+} SSlab;
+#define S_SLAB_INIT(name, type)                                                \
+   {                                                                           \
+      name, sizeof(type)                                                       \
+   }
+void* s_slab_alloc(SSlab* slab);
+void s_slab_free(SSlab* slab, void* ptr);
+
+typedef struct SSlabStat {
+   const char* name;
+   size_t size;
+   long allocs; /** < total allocations */
+   long frees; /** < total frees */
+   long in_use;
+   size_t reserved; /** < bytes got from system */
+} SSlabStat;
+/**
+ * fill allocation counters of each slab which has been used.
+ * @return count of slabs, may greater than max
+ */
+size_t s_slab_stats(SSlabStat* stats, size_t max);
+
 #if 0
 char *s_strndup(const char *s1, size_t n);
 int s_vasprintf(char **buf, const char * format, va_list arg);
@@ -0,0 +1,664 @@
+/**
+ * @file   snapshot.c
+ * @brief  Binary roster snapshot
+ *
+ * file layout (host byte order, it is a local cache, not an exchange format):
+ *
+ *    header | categories | buddies | groups | members | string table
+ *
+ * every record is fixed size, strings are stored as offset into the string
+ * table, offset 0 means NULL. same string is only stored once.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include "snapshot.h"
+#include "smemory.h"
+#include "logger.h"
+#include "info.h"
+#include "internal.h"
+#include "utility.h"
+#include "member.h"
+
+#define SNAPSHOT_MAGIC 0x5351574c /* LWQS */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct SnapHeader {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t size; /** < whole file size, a truncated file is rejected */
+   uint32_t n_cate;
+   uint32_t n_buddy;
+   uint32_t n_group;
+   uint32_t n_member;
+   uint32_t cate_off;
+   uint32_t buddy_off;
+   uint32_t group_off;
+   uint32_t member_off;
+   uint32_t str_off;
+   uint32_t str_len;
+   uint32_t reserved;
+   int64_t saved; /** < the time snapshot written */
+} SnapHeader;
+
+typedef struct SnapCate {
+   int32_t index;
+   int32_t sort;
+   uint32_t name;
+   uint32_t reserved;
+} SnapCate;
+
+typedef struct SnapBuddy {
+   uint32_t uin;
+   uint32_t qqnumber;
+   uint32_t nick;
+   uint32_t markname;
+   uint32_t long_nick;
+   uint32_t face;
+   uint32_t flag;
+   int32_t cate_index;
+   int32_t stat;
+   int32_t client_type;
+   int32_t level;
+   uint32_t reserved;
+   int64_t last_modify;
+} SnapBuddy;
+
+typedef struct SnapGroup {
+   int32_t type;
+   uint32_t name;
+   uint32_t gid;
+   uint32_t account;
+   uint32_t code;
+   uint32_t markname;
+   uint32_t face;
+   uint32_t memo;
+   uint32_t owner;
+   uint32_t flag;
+   int32_t mask;
+   int32_t info_seq;
+   uint32_t member_beg;
+   uint32_t member_cnt;
+   int64_t last_modify;
+} SnapGroup;
+
+typedef struct SnapMember {
+   uint32_t uin;
+   uint32_t qq;
+   uint32_t nick;
+   uint32_t card;
+   int32_t stat;
+   int32_t client_type;
+   int32_t mflag;
+   uint32_t reserved;
+} SnapMember;
+
+struct snap_buf {
+   char* d;
+   size_t p;
+   size_t s;
+};
+
+typedef struct SnapWriter {
+   struct snap_buf str;
+   uint32_t* slot; /** < open address hash of string offset, 0 is empty */
+   size_t n_slot;
+   size_t used;
+} SnapWriter;
+
+/** owned by the dispatched flush, ext is NULL when extension is removed */
+typedef struct SnapshotFlush {
+   struct SnapshotExt* ext;
+} SnapshotFlush;
+
+typedef struct SnapshotExt {
+   LwqqExtension super;
+   LwqqClient* lc;
+   char* path;
+   SnapshotFlush* pending;
+   void* map;
+   size_t map_len;
+   const LwqqCommand* refresh;
+   const LwqqCommand* clean;
+} SnapshotExt;
+
+static void* buf_put(struct snap_buf* b, const void* ptr, size_t len)
+{
+   if (b->p + len > b->s) {
+      b->s = (b->s + len) * 2;
+      b->d = s_realloc(b->d, b->s);
+   }
+   void* ret = b->d + b->p;
+   if (ptr)
+      memcpy(ret, ptr, len);
+   else
+      memset(ret, 0, len);
+   b->p += len;
+   return ret;
+}
+
+static uint32_t str_hash(const char* s)
+{
+   uint32_t h = 2166136261u;
+   while (*s) {
+      h ^= (unsigned char)*s++;
+      h *= 16777619u;
+   }
+   return h;
+}
+
+static void writer_rehash(SnapWriter* w)
+{
+   size_t n = w->n_slot ? w->n_slot * 2 : 1024;
+   uint32_t* slot = s_malloc0(sizeof(*slot) * n);
+   size_t i;
+   for (i = 0; i < w->n_slot; i++) {
+      if (!w->slot[i])
+         continue;
+      size_t idx = str_hash(w->str.d + w->slot[i]) & (n - 1);
+      while (slot[idx])
+         idx = (idx + 1) & (n - 1);
+      slot[idx] = w->slot[i];
+   }
+   s_free(w->slot);
+   w->slot = slot;
+   w->n_slot = n;
+}
+
+static uint32_t intern(SnapWriter* w, const char* s)
+{
+   if (s == NULL)
+      return 0;
+   if (w->used * 2 >= w->n_slot)
+      writer_rehash(w);
+   size_t idx = str_hash(s) & (w->n_slot - 1);
+   while (w->slot[idx]) {
+      if (strcmp(w->str.d + w->slot[idx], s) == 0)
+         return w->slot[idx];
+      idx = (idx + 1) & (w->n_slot - 1);
+   }
+   uint32_t off = w->str.p;
+   buf_put(&w->str, s, strlen(s) + 1);
+   w->slot[idx] = off;
+   w->used++;
+   return off;
+}
+
+static void write_groups(SnapWriter* w, struct snap_buf* groups,
+                         struct snap_buf* members, LwqqGroup* g)
+{
+   LwqqSimpleBuddy* sb;
+   for (; g != NULL; g = LIST_NEXT(g, entries)) {
+      SnapGroup* r = buf_put(groups, NULL, sizeof(*r));
+      r->type = g->type;
+      r->name = intern(w, g->name);
+      r->gid = intern(w, g->gid);
+      r->account = intern(w, g->account);
+      r->code = intern(w, g->code);
+      r->markname = intern(w, g->markname);
+      r->face = intern(w, g->face);
+      r->memo = intern(w, g->memo);
+      r->owner = intern(w, g->owner);
+      r->flag = intern(w, g->flag);
+      r->mask = g->mask;
+      r->info_seq = g->info_seq;
+      r->last_modify = g->last_modify;
+      r->member_beg = members->p / sizeof(SnapMember);
+      // packed groups in lazy mode, unpack one by one keeps memory bounded
+      int packed = lwqq__member_unpack(g);
+      LIST_FOREACH(sb, &g->members, entries)
+      {
+         SnapMember* m = buf_put(members, NULL, sizeof(*m));
+         m->uin = intern(w, sb->uin);
+         m->qq = intern(w, sb->qq);
+         m->nick = intern(w, sb->nick);
+         m->card = intern(w, sb->card);
+         m->stat = sb->stat;
+         m->client_type = sb->client_type;
+         m->mflag = sb->mflag;
+      }
+      if (packed)
+         lwqq__member_repack(g);
+      // members is another buffer, so r is still valid here
+      r->member_cnt = members->p / sizeof(SnapMember) - r->member_beg;
+   }
+}
+
+static int write_file(const char* path, const void* data, size_t len)
+{
+   char tmp[512];
+   int fd;
+   snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+   // create parent dir
+   char* dir = s_strdup(path);
+   char* end = strrchr(dir, LWQQ_PATH_SEP[0]);
+   if (end) {
+      *end = '\0';
+      mkdir(dir, 0700);
+   }
+   s_free(dir);
+
+   fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd < 0)
+      return -1;
+   const char* ptr = data;
+   while (len > 0) {
+      ssize_t n = write(fd, ptr, len);
+      if (n <= 0) {
+         close(fd);
+         unlink(tmp);
+         return -1;
+      }
+      ptr += n;
+      len -= n;
+   }
+#ifndef WIN32
+   fsync(fd);
+#endif
+   close(fd);
+#ifdef WIN32
+   unlink(path);
+#endif
+   if (rename(tmp, path) != 0) {
+      unlink(tmp);
+      return -1;
+   }
+   return 0;
+}
+
+LWQQ_EXPORT
+LwqqErrorCode lwqq_snapshot_save(LwqqClient* lc, const char* path)
+{
+   if (!lc || !path)
+      return LWQQ_EC_NULL_POINTER;
+
+   SnapWriter w = { { 0 } };
+   struct snap_buf cates = { 0 }, buddies = { 0 }, groups = { 0 },
+                   members = { 0 }, out = { 0 };
+   LwqqFriendCategory* c;
+   LwqqBuddy* b;
+   int ret;
+
+   // offset 0 is reserved for NULL
+   buf_put(&w.str, "", 1);
+
+   LIST_FOREACH(c, &lc->categories, entries)
+   {
+      SnapCate* r = buf_put(&cates, NULL, sizeof(*r));
+      r->index = c->index;
+      r->sort = c->sort;
+      r->name = intern(&w, c->name);
+   }
+   LIST_FOREACH(b, &lc->friends, entries)
+   {
+      SnapBuddy* r = buf_put(&buddies, NULL, sizeof(*r));
+      r->uin = intern(&w, b->uin);
+      r->qqnumber = intern(&w, b->qqnumber);
+      r->nick = intern(&w, b->nick);
+      r->markname = intern(&w, b->markname);
+      r->long_nick = intern(&w, b->long_nick);
+      r->face = intern(&w, b->face);
+      r->flag = intern(&w, b->flag);
+      r->cate_index = b->cate_index;
+      r->stat = b->stat;
+      r->client_type = b->client_type;
+      r->level = b->level;
+      r->last_modify = b->last_modify;
+   }
+   write_groups(&w, &groups, &members, LIST_FIRST(&lc->groups));
+   write_groups(&w, &groups, &members, LIST_FIRST(&lc->discus));
+
+   SnapHeader* h = buf_put(&out, NULL, sizeof(*h));
+   h->magic = SNAPSHOT_MAGIC;
+   h->version = SNAPSHOT_VERSION;
+   h->n_cate = cates.p / sizeof(SnapCate);
+   h->n_buddy = buddies.p / sizeof(SnapBuddy);
+   h->n_group = groups.p / sizeof(SnapGroup);
+   h->n_member = members.p / sizeof(SnapMember);
+   h->saved = time(NULL);
+#define PUT_SECTION(sec, field)                                                \
+   do {                                                                        \
+      buf_put(&out, NULL, SNAPSHOT_ALIGN(out.p) - out.p);                      \
+      ((SnapHeader*)out.d)->field = out.p;                                     \
+      if (sec.p)                                                               \
+         buf_put(&out, sec.d, sec.p);                                          \
+      s_free(sec.d);                                                           \
+   } while (0)
+   PUT_SECTION(cates, cate_off);
+   PUT_SECTION(buddies, buddy_off);
+   PUT_SECTION(groups, group_off);
+   PUT_SECTION(members, member_off);
+   ((SnapHeader*)out.d)->str_len = w.str.p;
+   PUT_SECTION(w.str, str_off);
+#undef PUT_SECTION
+   ((SnapHeader*)out.d)->size = out.p;
+
+   ret = write_file(path, out.d, out.p);
+   if (ret)
+      lwqq_log(LOG_ERROR, "write snapshot %s failed\n", path);
+   else
+      lwqq_verbose(2, "[snapshot saved: %s %lu bytes, %lu strings]\n", path,
+                   (unsigned long)out.p, (unsigned long)w.used);
+
+   s_free(w.slot);
+   s_free(out.d);
+   return ret ? LWQQ_EC_ERROR : LWQQ_EC_OK;
+}
+
+static void* map_file(const char* path, size_t* len)
+{
+   struct stat st;
+   void* map;
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return NULL;
+   if (fstat(fd, &st) != 0 || st.st_size < sizeof(SnapHeader)) {
+      close(fd);
+      return NULL;
+   }
+   *len = st.st_size;
+#ifndef WIN32
+   map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      map = NULL;
+#else
+   map = s_malloc(*len);
+   if (read(fd, map, *len) != *len)
+      s_free(map);
+#endif
+   close(fd);
+   return map;
+}
+
+static void unmap_file(void* map, size_t len)
+{
+   if (!map)
+      return;
+#ifndef WIN32
+   munmap(map, len);
+#else
+   s_free(map);
+#endif
+}
+
+#define SECTION_VALID(h, off, n, type)                                         \
+   (h->off <= h->size && (h->size - h->off) / sizeof(type) >= h->n)
+
+static const SnapHeader* snapshot_check(const void* map, size_t len)
+{
+   const SnapHeader* h = map;
+   if (!map || len < sizeof(*h))
+      return NULL;
+   if (h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION
+       || h->size != len)
+      return NULL;
+   if (!SECTION_VALID(h, cate_off, n_cate, SnapCate)
+       || !SECTION_VALID(h, buddy_off, n_buddy, SnapBuddy)
+       || !SECTION_VALID(h, group_off, n_group, SnapGroup)
+       || !SECTION_VALID(h, member_off, n_member, SnapMember))
+      return NULL;
+   if (h->str_len == 0 || h->str_off > h->size
+       || h->size - h->str_off < h->str_len)
+      return NULL;
+   // string table must end with zero, so any offset is a valid c string
+   if (((const char*)map)[h->str_off + h->str_len - 1] != '\0')
+      return NULL;
+   return h;
+}
+
+static char* snap_str(const SnapHeader* h, uint32_t off)
+{
+   if (off == 0 || off >= h->str_len)
+      return NULL;
+   return s_strdup((const char*)h + h->str_off + off);
+}
+
+static const char* snap_str_ref(const SnapHeader* h, uint32_t off)
+{
+   if (off == 0 || off >= h->str_len)
+      return NULL;
+   return (const char*)h + h->str_off + off;
+}
+
+static void restore_groups(LwqqClient* lc, const SnapHeader* h)
+{
+   const SnapGroup* groups = (const void*)((const char*)h + h->group_off);
+   const SnapMember* members = (const void*)((const char*)h + h->member_off);
+   long i;
+   uint32_t j;
+   // restore in reverse order, because LIST_INSERT_HEAD reverse it again
+   for (i = (long)h->n_group - 1; i >= 0; i--) {
+      const SnapGroup* r = &groups[i];
+      LwqqGroup* g = lwqq_group_new(r->type);
+      g->name = snap_str(h, r->name);
+      g->gid = snap_str(h, r->gid);
+      g->account = snap_str(h, r->account);
+      g->code = snap_str(h, r->code);
+      g->markname = snap_str(h, r->markname);
+      g->face = snap_str(h, r->face);
+      g->memo = snap_str(h, r->memo);
+      g->owner = snap_str(h, r->owner);
+      g->flag = snap_str(h, r->flag);
+      g->mask = r->mask;
+      g->info_seq = r->info_seq;
+      g->last_modify = r->last_modify;
+      if (r->member_beg <= h->n_member
+          && h->n_member - r->member_beg >= r->member_cnt) {
+         for (j = r->member_cnt; j > 0; j--) {
+            const SnapMember* m = &members[r->member_beg + j - 1];
+            LwqqSimpleBuddy* sb = lwqq_simple_buddy_new();
+            sb->uin = s_intern(snap_str_ref(h, m->uin));
+            sb->qq = snap_str(h, m->qq);
+            sb->nick = snap_str(h, m->nick);
+            sb->card = snap_str(h, m->card);
+            sb->stat = m->stat;
+            sb->client_type = m->client_type;
+            sb->mflag = m->mflag;
+            LIST_INSERT_HEAD(&g->members, sb, entries);
+         }
+      }
+      if (g->type == LWQQ_GROUP_DISCU)
+         LIST_INSERT_HEAD(&lc->discus, g, entries);
+      else
+         LIST_INSERT_HEAD(&lc->groups, g, entries);
+   }
+}
+
+static LwqqErrorCode snapshot_restore(LwqqClient* lc, const SnapHeader* h)
+{
+   const SnapCate* cates = (const void*)((const char*)h + h->cate_off);
+   const SnapBuddy* buddies = (const void*)((const char*)h + h->buddy_off);
+   long i;
+
+   for (i = (long)h->n_cate - 1; i >= 0; i--) {
+      LwqqFriendCategory* c = lwqq_category_find_by_id(lc, cates[i].index);
+      if (c == NULL) {
+         c = s_malloc0(sizeof(*c));
+         c->index = cates[i].index;
+         LIST_INSERT_HEAD(&lc->categories, c, entries);
+      }
+      c->sort = cates[i].sort;
+      lwqq_override(c->name, snap_str(h, cates[i].name));
+   }
+   for (i = (long)h->n_buddy - 1; i >= 0; i--) {
+      const SnapBuddy* r = &buddies[i];
+      LwqqBuddy* b = lwqq_buddy_new();
+      b->uin = snap_str(h, r->uin);
+      b->qqnumber = snap_str(h, r->qqnumber);
+      b->nick = snap_str(h, r->nick);
+      b->markname = snap_str(h, r->markname);
+      b->long_nick = snap_str(h, r->long_nick);
+      b->face = snap_str(h, r->face);
+      b->flag = snap_str(h, r->flag);
+      b->cate_index = r->cate_index;
+      b->stat = r->stat;
+      b->client_type = r->client_type;
+      b->level = r->level;
+      b->last_modify = r->last_modify;
+      LIST_INSERT_HEAD(&lc->friends, b, entries);
+   }
+   restore_groups(lc, h);
+   return LWQQ_EC_OK;
+}
+
+static LwqqErrorCode snapshot_load_map(LwqqClient* lc, const char* path,
+                                       void** p_map, size_t* p_len)
+{
+   size_t len = 0;
+   void* map;
+   const SnapHeader* h;
+
+   if (!lc || !path)
+      return LWQQ_EC_NULL_POINTER;
+   if (!LIST_EMPTY(&lc->friends) || !LIST_EMPTY(&lc->groups))
+      return LWQQ_EC_ERROR;
+   if (access(path, F_OK) != 0)
+      return LWQQ_EC_FILE_NOT_EXIST;
+
+   map = map_file(path, &len);
+   h = snapshot_check(map, len);
+   if (h == NULL) {
+      lwqq_log(LOG_WARNING, "snapshot %s is broken, ignore it\n", path);
+      unmap_file(map, len);
+      return LWQQ_EC_ERROR;
+   }
+   snapshot_restore(lc, h);
+   lwqq_verbose(2, "[snapshot restored: %u friends %u groups %u members]\n",
+                h->n_buddy, h->n_group, h->n_member);
+   if (p_map) {
+      *p_map = map;
+      *p_len = len;
+   } else
+      unmap_file(map, len);
+   return LWQQ_EC_OK;
+}
+
+LWQQ_EXPORT
+LwqqErrorCode lwqq_snapshot_load(LwqqClient* lc, const char* path)
+{
+   return snapshot_load_map(lc, path, NULL, NULL);
+}
+
+LWQQ_EXPORT
+const char* lwqq_snapshot_default_path(LwqqClient* lc, char* buf, size_t sz)
+{
+   if (!lc || !buf)
+      return NULL;
+   snprintf(buf, sz, LWQQ_CACHE_DIR LWQQ_PATH_SEP "%s.roster", lc->username);
+   return buf;
+}
+
+LWQQ_EXPORT
+int lwqq_snapshot_group_unchanged(LwqqExtension* ext, LwqqGroup* g)
+{
+   if (!ext || !g)
+      return 0;
+   // server gives no version of member list, and last_modify is only a
+   // local time of lwdb. so members restored from snapshot are fetched
+   // once, then they are kept up to date by the session itself
+   return g->member_refresh > 0 && !lwqq__member_empty(g);
+}
+
+LWQQ_EXPORT
+LwqqAsyncEvset* lwqq_snapshot_refresh_groups(LwqqClient* lc,
+                                             LwqqExtension* ext)
+{
+   if (!lc)
+      return NULL;
+   LwqqAsyncEvset* set = NULL;
+   LwqqGroup* g;
+   int skipped = 0;
+   LIST_FOREACH(g, &lc->groups, entries)
+   {
+      if (lwqq_snapshot_group_unchanged(ext, g)) {
+         skipped++;
+         continue;
+      }
+      if (set == NULL)
+         set = lwqq_async_evset_new();
+      lwqq_async_evset_add_event(
+          set, lwqq_info_get_group_detail_info(lc, g, NULL));
+   }
+   lwqq_verbose(2, "[snapshot: %d groups unchanged]\n", skipped);
+   return set;
+}
+
+static void snapshot_flush(LwqqClient* lc, SnapshotFlush* flush)
+{
+   SnapshotExt* ext = flush->ext;
+   s_free(flush);
+   // extension is removed while flush is pending
+   if (ext == NULL)
+      return;
+   ext->pending = NULL;
+   lwqq_snapshot_save(lc, ext->path);
+}
+
+static void snapshot_refreshed(LwqqClient* lc, SnapshotExt* ext)
+{
+   if (ext->pending)
+      return;
+   ext->pending = s_malloc0(sizeof(SnapshotFlush));
+   ext->pending->ext = ext;
+   lc->dispatch(_C_(2p, snapshot_flush, lc, ext->pending),
+                LWQQ_SNAPSHOT_DELAY);
+}
+
+static void snapshot_remove(LwqqClient* lc, LwqqExtension* ext)
+{
+   SnapshotExt* ext_ = (SnapshotExt*)ext;
+   vp_unlink(&lc->events->roster_refresh, ext_->refresh);
+   vp_unlink(&lc->events->ext_clean, ext_->clean);
+   ext_->refresh = NULL;
+   ext_->clean = NULL;
+   if (ext_->pending) {
+      // the flush is still dispatched, it frees the token and does nothing
+      ext_->pending->ext = NULL;
+      ext_->pending = NULL;
+      lwqq_snapshot_save(lc, ext_->path);
+   }
+   unmap_file(ext_->map, ext_->map_len);
+   ext_->map = NULL;
+   ext_->lc = NULL;
+   s_free(ext_->path);
+}
+
+static void snapshot_free(LwqqClient* lc, LwqqExtension* ext)
+{
+   snapshot_remove(lc, ext);
+   s_free(ext);
+}
+
+static void snapshot_init(LwqqClient* lc, LwqqExtension* ext)
+{
+   SnapshotExt* ext_ = (SnapshotExt*)ext;
+   ext_->lc = lc;
+   snapshot_load_map(lc, ext_->path, &ext_->map, &ext_->map_len);
+   ext_->refresh = lwqq_add_event(lc->events->roster_refresh,
+                                  _C_(2p, snapshot_refreshed, lc, ext_));
+   ext_->clean = lwqq_add_event(lc->events->ext_clean,
+                                _C_(2p, snapshot_free, lc, ext_));
+}
+
+LWQQ_EXPORT
+LwqqExtension* lwqq_make_snapshot_extension(LwqqClient* lc, const char* path)
+{
+   char buf[512];
+   SnapshotExt* ext = s_malloc0(sizeof(*ext));
+   ext->super.init = snapshot_init;
+   ext->super.remove = snapshot_remove;
+   ext->path = s_strdup(path ?: lwqq_snapshot_default_path(lc, buf, sizeof(buf)));
+   return (LwqqExtension*)ext;
+}
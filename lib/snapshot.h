@@ -0,0 +1,60 @@
+/**
+ * @file   snapshot.h
+ * @brief  Binary roster snapshot
+ *
+ * a snapshot is a compact binary image of the whole roster of a client:
+ * categories, friends, groups, discus and group members. every string is
+ * interned into a single string table. it is written atomically (write to a
+ * temp file, then rename) and mmapped when restored, so a client is usable
+ * before any roster request is finished.
+ */
+
+#ifndef LWQQ_SNAPSHOT_H
+#define LWQQ_SNAPSHOT_H
+
+#include "type.h"
+#include "async.h"
+
+/** delay {?} ms to coalesce roster refresh before write snapshot */
+#define LWQQ_SNAPSHOT_DELAY 3000
+
+/**
+ * write whole roster of lc to path.
+ * it writes to 'path.tmp' first and rename it, so a crash never leaves a
+ * broken snapshot behind.
+ */
+LwqqErrorCode lwqq_snapshot_save(LwqqClient* lc, const char* path);
+
+/**
+ * restore roster from snapshot into lc.
+ * only restore when lc has no friends and no groups.
+ * @return LWQQ_EC_FILE_NOT_EXIST when no snapshot,
+ *         LWQQ_EC_ERROR when snapshot is broken or version mismatch
+ */
+LwqqErrorCode lwqq_snapshot_load(LwqqClient* lc, const char* path);
+
+/** return the default snapshot path: LWQQ_CACHE_DIR/<username>.roster */
+const char* lwqq_snapshot_default_path(LwqqClient* lc, char* buf, size_t sz);
+
+/**
+ * make an extension which restores roster from snapshot when it is added,
+ * and write snapshot back after each successful roster refresh.
+ * @param path NULL to use default path
+ */
+LwqqExtension* lwqq_make_snapshot_extension(LwqqClient* lc, const char* path);
+
+/**
+ * check whether members of group need no refresh. members restored from
+ * snapshot always need one, since server gives no version of them.
+ * @param ext the snapshot extension
+ */
+int lwqq_snapshot_group_unchanged(LwqqExtension* ext, LwqqGroup* g);
+
+/**
+ * refresh group members in background, skip groups which are unchanged.
+ * @return NULL if no group need refresh
+ */
+LwqqAsyncEvset* lwqq_snapshot_refresh_groups(LwqqClient* lc,
+                                             LwqqExtension* ext);
+
+#endif
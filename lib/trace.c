@@ -0,0 +1,223 @@
+/**
+ * @file   trace.c
+ * @brief  Causal span tracing across async event chains
+ *
+ * each ring has a single writer, its owner thread. a record is guarded by a
+ * sequence number: odd while it is written, even when it is complete. the
+ * dumper drops records whose sequence changed while it copied them.
+ * rings are never freed, a ring of an exited thread is adopted by the next
+ * new thread.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "metrics.h"
+#include "smemory.h"
+#include "internal.h"
+
+typedef struct TraceRecord {
+   atomic_uint_fast64_t seq;
+   uint32_t tid;
+   const char* name;
+   uint64_t trace_id;
+   uint64_t span_id;
+   uint64_t parent_id;
+   uint64_t start;
+   uint64_t dur;
+   char arg[LWQQ_TRACE_ARG_LEN];
+} TraceRecord;
+
+typedef struct TraceRing {
+   atomic_uint_fast64_t head;
+   atomic_int owned;
+   uint32_t tid;
+   struct TraceRing* next;
+   TraceRecord rec[LWQQ_TRACE_RING_SIZE];
+} TraceRing;
+
+int lwqq__trace_enabled = 0;
+
+static TraceRing* _Atomic rings = NULL;
+static atomic_uint_fast64_t next_id = 1;
+static atomic_uint next_tid = 1;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static __thread TraceRing* my_ring = NULL;
+static __thread LwqqTraceCtx current = { 0, 0 };
+
+static void ring_release(void* p)
+{
+   TraceRing* r = p;
+   atomic_store_explicit(&r->owned, 0, memory_order_release);
+}
+
+static void ring_key_init(void) { pthread_key_create(&ring_key, ring_release); }
+
+static TraceRing* ring_get(void)
+{
+   TraceRing* r = my_ring;
+   if (r)
+      return r;
+   pthread_once(&ring_once, ring_key_init);
+   for (r = atomic_load(&rings); r; r = r->next) {
+      int free_ = 0;
+      if (atomic_compare_exchange_strong(&r->owned, &free_, 1))
+         break;
+   }
+   if (r == NULL) {
+      r = s_malloc0(sizeof(*r));
+      atomic_init(&r->owned, 1);
+      r->next = atomic_load(&rings);
+      while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+         ;
+   }
+   r->tid = atomic_fetch_add(&next_tid, 1);
+   pthread_setspecific(ring_key, r);
+   my_ring = r;
+   return r;
+}
+
+static uint64_t new_id(void)
+{
+   return atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed);
+}
+
+LWQQ_EXPORT
+void lwqq_trace_enable(int enable) { lwqq__trace_enabled = enable; }
+
+LWQQ_EXPORT
+LwqqTraceCtx lwqq_trace_current(void) { return current; }
+
+LWQQ_EXPORT
+LwqqTraceCtx lwqq_trace_resume(LwqqTraceCtx ctx)
+{
+   LwqqTraceCtx prev = current;
+   current = ctx;
+   return prev;
+}
+
+LWQQ_EXPORT
+void lwqq_trace_begin(LwqqTraceSpan* span, const char* name)
+{
+   if (!LWQQ_TRACE_ON()) {
+      span->ctx.trace_id = 0;
+      return;
+   }
+   span->ctx.trace_id = current.trace_id ? current.trace_id : new_id();
+   span->ctx.span_id = new_id();
+   span->parent_id = current.span_id;
+   span->name = name;
+   span->start = lwqq__metrics_now();
+}
+
+static void ring_push(uint64_t trace_id, uint64_t span_id, uint64_t parent_id,
+                      const char* name, const char* arg, uint64_t start,
+                      uint64_t dur)
+{
+   TraceRing* ring = ring_get();
+   uint64_t idx = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   TraceRecord* r = &ring->rec[idx % LWQQ_TRACE_RING_SIZE];
+
+   atomic_store_explicit(&r->seq, idx * 2 + 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+   r->tid = ring->tid;
+   r->name = name;
+   r->trace_id = trace_id;
+   r->span_id = span_id;
+   r->parent_id = parent_id;
+   r->start = start;
+   r->dur = dur;
+   r->arg[0] = '\0';
+   if (arg)
+      strncat(r->arg, arg, sizeof(r->arg) - 1);
+   atomic_store_explicit(&r->seq, idx * 2 + 2, memory_order_release);
+   atomic_store_explicit(&ring->head, idx + 1, memory_order_release);
+}
+
+LWQQ_EXPORT
+void lwqq_trace_end(LwqqTraceSpan* span, const char* arg)
+{
+   if (!LWQQ_TRACE_ON() || span->ctx.trace_id == 0)
+      return;
+   ring_push(span->ctx.trace_id, span->ctx.span_id, span->parent_id,
+             span->name, arg, span->start, lwqq__metrics_now() - span->start);
+   span->ctx.trace_id = 0;
+}
+
+LWQQ_EXPORT
+void lwqq_trace_record(const LwqqTraceCtx* parent, const char* name,
+                       const char* arg, uint64_t start, uint64_t dur)
+{
+   if (!LWQQ_TRACE_ON() || parent->trace_id == 0)
+      return;
+   ring_push(parent->trace_id, new_id(), parent->span_id, name, arg, start,
+             dur);
+}
+
+static void json_string(FILE* f, const char* s)
+{
+   fputc('"', f);
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         fputc('\\', f);
+      if ((unsigned char)*s < 0x20)
+         fprintf(f, "\\u%04x", *s);
+      else
+         fputc(*s, f);
+   }
+   fputc('"', f);
+}
+
+static void dump_record(FILE* f, const TraceRecord* r, int first)
+{
+   // nestable async events, one track per trace, nested by time
+   fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+   json_string(f, r->name);
+   fprintf(f, ",\"cat\":\"lwqq\",\"ph\":\"b\",\"id\":\"0x%llx\","
+              "\"pid\":1,\"tid\":%u,\"ts\":%llu,\"args\":{\"span\":%llu,"
+              "\"parent\":%llu,\"arg\":",
+           (unsigned long long)r->trace_id, r->tid,
+           (unsigned long long)r->start, (unsigned long long)r->span_id,
+           (unsigned long long)r->parent_id);
+   json_string(f, r->arg);
+   fprintf(f, "}},\n{\"name\":");
+   json_string(f, r->name);
+   fprintf(f, ",\"cat\":\"lwqq\",\"ph\":\"e\",\"id\":\"0x%llx\","
+              "\"pid\":1,\"tid\":%u,\"ts\":%llu}",
+           (unsigned long long)r->trace_id, r->tid,
+           (unsigned long long)(r->start + r->dur));
+}
+
+LWQQ_EXPORT
+size_t lwqq_trace_dump(FILE* f)
+{
+   TraceRing* ring;
+   TraceRecord copy;
+   size_t n = 0;
+   fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   for (ring = atomic_load(&rings); ring; ring = ring->next) {
+      uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+      uint64_t idx = head > LWQQ_TRACE_RING_SIZE
+                         ? head - LWQQ_TRACE_RING_SIZE
+                         : 0;
+      for (; idx < head; idx++) {
+         TraceRecord* r = &ring->rec[idx % LWQQ_TRACE_RING_SIZE];
+         uint64_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+         if (seq != idx * 2 + 2)
+            continue;
+         memcpy(&copy, r, sizeof(copy));
+         atomic_thread_fence(memory_order_acquire);
+         if (atomic_load_explicit(&r->seq, memory_order_relaxed) != seq)
+            continue;
+         copy.arg[sizeof(copy.arg) - 1] = '\0';
+         dump_record(f, &copy, n == 0);
+         n++;
+      }
+   }
+   fprintf(f, "\n]}\n");
+   return n;
+}
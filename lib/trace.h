@@ -0,0 +1,70 @@
+/**
+ * @file   trace.h
+ * @brief  Causal span tracing across async event chains
+ *
+ * every thread has a current trace context. a span begun on a thread becomes
+ * child of the current context. async events, evsets and dispatches remember
+ * the context where they are created, and restore it when their callbacks
+ * run, so spans follow the chain of callbacks across threads.
+ *
+ * finished spans are written into a fixed size ring owned by the ending
+ * thread without any lock, old spans are overwritten. when tracing is
+ * disabled every call returns after checking a global flag.
+ */
+
+#ifndef LWQQ_TRACE_H
+#define LWQQ_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** spans kept by each thread */
+#define LWQQ_TRACE_RING_SIZE 4096
+#define LWQQ_TRACE_ARG_LEN 40
+
+typedef struct LwqqTraceCtx {
+   uint64_t trace_id; /** < 0 means no trace */
+   uint64_t span_id;
+} LwqqTraceCtx;
+
+typedef struct LwqqTraceSpan {
+   LwqqTraceCtx ctx;
+   uint64_t parent_id;
+   const char* name; /** < must be a static string */
+   uint64_t start;
+} LwqqTraceSpan;
+
+extern int lwqq__trace_enabled;
+#define LWQQ_TRACE_ON() (lwqq__trace_enabled)
+
+void lwqq_trace_enable(int enable);
+
+/**
+ * begin span as child of current context of this thread, or a new trace if
+ * there is none. it doesn't change current context.
+ */
+void lwqq_trace_begin(LwqqTraceSpan* span, const char* name);
+/**
+ * record span into ring of this thread
+ * @param arg extra text shown with span, can be NULL
+ */
+void lwqq_trace_end(LwqqTraceSpan* span, const char* arg);
+/** record a span which is already finished */
+void lwqq_trace_record(const LwqqTraceCtx* parent, const char* name,
+                       const char* arg, uint64_t start, uint64_t dur);
+
+/**
+ * set current context of this thread
+ * @return previous context, pass it to lwqq_trace_resume to restore
+ */
+LwqqTraceCtx lwqq_trace_resume(LwqqTraceCtx ctx);
+LwqqTraceCtx lwqq_trace_current(void);
+
+/**
+ * dump spans of all threads in chrome trace event format (json), load it
+ * in chrome://tracing or perfetto. spans of one trace share one async track.
+ * @return number of spans written
+ */
+size_t lwqq_trace_dump(FILE* f);
+
+#endif
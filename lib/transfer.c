@@ -0,0 +1,645 @@
+/**
+ * @file   transfer.c
+ * @brief  Parallel chunked download with resume
+ *
+ * the first request is a probe, which asks the first missing chunk. a 206
+ * answer tells the size of file and that ranges work, then the rest of
+ * chunks are fetched by a window of requests. a 200 answer is the whole
+ * file, it is written as it comes and can't be resumed.
+ *
+ * journal is a text header followed by one byte each chunk, '1' is done:
+ *
+ *    LWQQXFER 1\n url\n total\n chunk_size\n etag\n 0110...
+ *
+ * a journal is trusted only if url, size and etag of file still match.
+ */
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "transfer.h"
+#include "async.h"
+#include "http.h"
+#include "smemory.h"
+#include "logger.h"
+#include "metrics.h"
+#include "internal.h"
+
+#define XFER_MAGIC "LWQQXFER 1"
+
+#ifdef WIN32
+#include <io.h>
+#define XFER_OPEN (O_RDWR | O_CREAT | O_BINARY)
+/* no pwrite on windows, seek and write can't be split by another chunk */
+static ssize_t xfer_pwrite(int fd, const void* buf, size_t n, uint64_t off)
+{
+   static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+   ssize_t w = -1;
+   pthread_mutex_lock(&lock);
+   if (_lseeki64(fd, off, SEEK_SET) == (__int64)off)
+      w = write(fd, buf, n);
+   pthread_mutex_unlock(&lock);
+   return w;
+}
+#define pwrite xfer_pwrite
+#else
+#define XFER_OPEN (O_RDWR | O_CREAT)
+#endif
+
+typedef enum { CHUNK_PENDING, CHUNK_RUNNING, CHUNK_DONE } ChunkState;
+
+typedef struct XferChunk {
+   LwqqTransfer* t;
+   LwqqHttpRequest* req; /** < current request, NULL if none */
+   size_t index;
+   uint64_t start;
+   uint64_t end; /** < inclusive, UINT64_MAX if unknown */
+   uint64_t written; /** < bytes of chunk on disk */
+   uint64_t base; /** < written when current request started */
+   long code; /** < http code of current request, 0 before body */
+   int tries;
+   ChunkState state;
+} XferChunk;
+
+struct LwqqTransfer {
+   pthread_mutex_t lock;
+   LwqqClient* lc;
+   char* url;
+   char* path;
+   char* journal;
+   int fd;
+   int jfd;
+   size_t jhead; /** < header bytes of journal */
+   unsigned parallel;
+   size_t chunk_size;
+   int ranged; /** < -1 until probe answers */
+   uint64_t total;
+   char* etag;
+   XferChunk** chunks;
+   size_t nchunk;
+   XferChunk* probe;
+   unsigned running;
+   int err;
+   atomic_int canceled; /** < set by lwqq_transfer_cancel from any thread */
+   uint64_t done;
+   uint64_t resumed;
+   uint64_t started;
+   LwqqProgressFunc progress;
+   void* prog_data;
+   time_t last_prog;
+   LwqqAsyncEvent* ev;
+};
+
+static void xfer_pump(LwqqTransfer* t);
+
+static XferChunk* chunk_new(LwqqTransfer* t, size_t index)
+{
+   XferChunk* c = s_malloc0(sizeof(*c));
+   c->t = t;
+   c->index = index;
+   c->start = (uint64_t)index * t->chunk_size;
+   c->end = c->start + t->chunk_size - 1;
+   if (t->total && c->end >= t->total)
+      c->end = t->total - 1;
+   return c;
+}
+
+static void chunks_free(LwqqTransfer* t)
+{
+   XferChunk** chunks;
+   size_t i, n;
+   pthread_mutex_lock(&t->lock);
+   chunks = t->chunks;
+   n = t->nchunk;
+   t->chunks = NULL;
+   t->nchunk = 0;
+   pthread_mutex_unlock(&t->lock);
+   for (i = 0; i < n; i++)
+      s_free(chunks[i]);
+   s_free(chunks);
+}
+
+/** layout of t->total and t->chunk_size, every chunk is pending */
+static void chunks_build(LwqqTransfer* t)
+{
+   size_t i, n = (t->total + t->chunk_size - 1) / t->chunk_size;
+   XferChunk** chunks = s_malloc0(sizeof(*chunks) * (n ? n : 1));
+   chunks_free(t);
+   for (i = 0; i < n; i++)
+      chunks[i] = chunk_new(t, i);
+   pthread_mutex_lock(&t->lock);
+   t->chunks = chunks;
+   t->nchunk = n;
+   pthread_mutex_unlock(&t->lock);
+}
+
+/** value of last response header name, NULL if missing */
+static const char* xfer_header(LwqqHttpRequest* req, const char* name,
+                               char* buf, size_t sz)
+{
+   struct curl_slist* h;
+   const char* v = NULL;
+   size_t len = strlen(name);
+   for (h = req->recv_head; h; h = h->next) {
+      if (strncasecmp(h->data, name, len) == 0 && h->data[len] == ':')
+         v = h->data + len + 1;
+   }
+   if (v == NULL)
+      return NULL;
+   v += strspn(v, " \t");
+   snprintf(buf, sz, "%.*s", (int)strcspn(v, "\r\n"), v);
+   return buf;
+}
+
+static int journal_load(LwqqTransfer* t)
+{
+   FILE* f = fopen(t->journal, "r");
+   char line[2048];
+   unsigned long long total, chunk;
+   size_t i;
+   int ch;
+   if (f == NULL)
+      return -1;
+   if (!fgets(line, sizeof(line), f) || strncmp(line, XFER_MAGIC, 10))
+      goto failed;
+   if (!fgets(line, sizeof(line), f) || strcspn(line, "\n") != strlen(t->url)
+       || strncmp(line, t->url, strlen(t->url)))
+      goto failed;
+   if (!fgets(line, sizeof(line), f) || sscanf(line, "%llu", &total) != 1)
+      goto failed;
+   if (!fgets(line, sizeof(line), f) || sscanf(line, "%llu", &chunk) != 1
+       || chunk == 0)
+      goto failed;
+   if (!fgets(line, sizeof(line), f))
+      goto failed;
+   line[strcspn(line, "\n")] = '\0';
+   t->total = total;
+   t->chunk_size = chunk;
+   s_free(t->etag);
+   t->etag = line[0] ? s_strdup(line) : NULL;
+   chunks_build(t);
+   for (i = 0; i < t->nchunk && (ch = fgetc(f)) != EOF; i++) {
+      XferChunk* c = t->chunks[i];
+      if (ch == '1') {
+         c->state = CHUNK_DONE;
+         c->written = c->end - c->start + 1;
+         t->resumed += c->written;
+      }
+   }
+   t->done = t->resumed;
+   fclose(f);
+   return 0;
+failed:
+   fclose(f);
+   return -1;
+}
+
+static int journal_write(LwqqTransfer* t)
+{
+   char head[2400];
+   size_t i;
+   int n;
+   if (t->jfd < 0)
+      t->jfd = open(t->journal, XFER_OPEN, 0644);
+   if (t->jfd < 0)
+      return -1;
+   n = snprintf(head, sizeof(head), XFER_MAGIC "\n%s\n%llu\n%llu\n%s\n",
+                t->url, (unsigned long long)t->total,
+                (unsigned long long)t->chunk_size, t->etag ? t->etag : "");
+   if (n >= (int)sizeof(head) || ftruncate(t->jfd, 0)
+       || pwrite(t->jfd, head, n, 0) != n)
+      return -1;
+   t->jhead = n;
+   for (i = 0; i < t->nchunk; i++) {
+      char ch = t->chunks[i]->state == CHUNK_DONE ? '1' : '0';
+      if (pwrite(t->jfd, &ch, 1, n + i) != 1)
+         return -1;
+   }
+   return 0;
+}
+
+static void journal_mark(LwqqTransfer* t, XferChunk* c)
+{
+   if (t->jfd >= 0 && pwrite(t->jfd, "1", 1, t->jhead + c->index) != 1)
+      lwqq_log(LOG_WARNING, "can't update journal %s\n", t->journal);
+}
+
+/** account bytes and tell progress at most once a second */
+static int xfer_advance(LwqqTransfer* t, int64_t bytes)
+{
+   time_t now = time(NULL);
+   int report;
+   pthread_mutex_lock(&t->lock);
+   t->done += bytes;
+   report = t->progress && now > t->last_prog;
+   if (report)
+      t->last_prog = now;
+   pthread_mutex_unlock(&t->lock);
+   return report ? t->progress(t->prog_data, t->done, t->total) : 0;
+}
+
+static size_t chunk_sink(XferChunk* c, const char* ptr, size_t size)
+{
+   LwqqTransfer* t = c->t;
+   size_t n;
+   ssize_t w;
+   if (ptr == NULL) {
+      // http retried it, body starts over
+      xfer_advance(t, -(int64_t)(c->written - c->base));
+      c->written = c->base;
+      c->code = 0;
+      return 0;
+   }
+   if (atomic_load(&t->canceled)) {
+      lwqq_http_cancel(c->req);
+      return 0;
+   }
+   if (c->code == 0) {
+      curl_easy_getinfo(c->req->req, CURLINFO_RESPONSE_CODE, &c->code);
+      if (c->code == 200 && c == t->probe) {
+         // server ignores range, whole file comes from the beginning
+         pthread_mutex_lock(&t->lock);
+         t->done = t->resumed = 0;
+         pthread_mutex_unlock(&t->lock);
+         c->start = c->written = c->base = 0;
+         c->end = UINT64_MAX;
+         t->ranged = 0;
+      } else if (c->code == 200) {
+         lwqq_log(LOG_WARNING, "range of %s is ignored\n", t->url);
+         lwqq_http_cancel(c->req);
+         return 0;
+      }
+   }
+   // error page is left to chunk_back
+   if (c->code != 200 && c->code != 206)
+      return size;
+   for (n = 0; n < size; n += w) {
+      w = pwrite(t->fd, ptr + n, size - n, c->start + c->written + n);
+      if (w <= 0)
+         return 0;
+   }
+   c->written += size;
+   if (xfer_advance(t, size))
+      atomic_store(&t->canceled, 1);
+   return size;
+}
+
+static int chunk_back(LwqqHttpRequest* req, XferChunk* c);
+
+static void chunk_request(LwqqTransfer* t, XferChunk* c)
+{
+   char range[64];
+   LwqqHttpRequest* req
+       = lwqq_http_create_default_request(t->lc, t->url, NULL);
+   // pieces of an encoded body can't be put together
+   req->set_header(req, "Accept-Encoding", "identity");
+   if (t->ranged) {
+      if (c->end == UINT64_MAX)
+         snprintf(range, sizeof(range), "bytes=%llu-",
+                  (unsigned long long)(c->start + c->written));
+      else
+         snprintf(range, sizeof(range), "bytes=%llu-%llu",
+                  (unsigned long long)(c->start + c->written),
+                  (unsigned long long)c->end);
+      req->set_header(req, "Range", range);
+   }
+   lwqq_http_set_option(req, LWQQ_HTTP_SAVE_SINK, (LwqqHttpSinkFunc)chunk_sink,
+                        c, (size_t)0);
+   c->req = req;
+   c->base = c->written;
+   c->code = 0;
+   c->state = CHUNK_RUNNING;
+   t->running++;
+   req->do_request_async(req, 0, NULL, _C_(2p_i, chunk_back, req, c));
+}
+
+/** drop what c got by current request */
+static void chunk_drop(XferChunk* c)
+{
+   xfer_advance(c->t, -(int64_t)(c->written - c->base));
+   c->written = c->base;
+}
+
+/** @return 1 if response covers rest of c exactly */
+static int chunk_complete(XferChunk* c, LwqqHttpRequest* req,
+                          unsigned long long* total)
+{
+   char buf[256];
+   unsigned long long a, b;
+   if (req->http_code != 206
+       || !xfer_header(req, "Content-Range", buf, sizeof(buf))
+       || sscanf(buf, "bytes %llu-%llu/%llu", &a, &b, total) != 3)
+      return 0;
+   if (a != c->start + c->base) {
+      // it is written at wrong place
+      chunk_drop(c);
+      return 0;
+   }
+   if (c->end == UINT64_MAX || c->end > b)
+      c->end = b;
+   return c->written == c->end - c->start + 1;
+}
+
+/**
+ * probe tells size of file. chunks of journal are kept if file is still
+ * the same, else they are laid out again.
+ */
+static void probe_layout(LwqqTransfer* t, LwqqHttpRequest* req,
+                         uint64_t total)
+{
+   XferChunk* p = t->probe;
+   XferChunk* c;
+   char etag[256];
+   const char* e = xfer_header(req, "ETag", etag, sizeof(etag));
+
+   if (t->nchunk
+       && (total != t->total || (e && t->etag && strcmp(e, t->etag)))) {
+      lwqq_log(LOG_NOTICE, "%s is changed, download it again\n", t->url);
+      chunks_free(t);
+   }
+   if (t->nchunk == 0) {
+      t->total = total;
+      s_free(t->etag);
+      t->etag = s_strdup(e);
+      chunks_build(t);
+      pthread_mutex_lock(&t->lock);
+      t->done = p->written;
+      t->resumed = 0;
+      pthread_mutex_unlock(&t->lock);
+   }
+   t->ranged = 1;
+   c = p->index < t->nchunk ? t->chunks[p->index] : NULL;
+   if (c && c->state != CHUNK_DONE && c->start == p->start
+       && c->end == p->end) {
+      c->state = CHUNK_DONE;
+      c->written = p->written;
+   } else
+      xfer_advance(t, -(int64_t)p->written);
+   t->probe = NULL;
+   s_free(p);
+
+#ifdef HAVE_POSIX_FALLOCATE
+   if (posix_fallocate(t->fd, 0, total) && ftruncate(t->fd, total))
+#else
+   if (ftruncate(t->fd, total))
+#endif
+      lwqq_log(LOG_WARNING, "can't allocate %s\n", t->path);
+   if (journal_write(t)) {
+      lwqq_log(LOG_WARNING, "can't write journal %s\n", t->journal);
+      if (t->jfd >= 0)
+         close(t->jfd);
+      t->jfd = -1;
+   }
+}
+
+static int chunk_back(LwqqHttpRequest* req, XferChunk* c)
+{
+   LwqqTransfer* t = c->t;
+   int err = LWQQ_HTTP_EV(req)->err;
+   unsigned long long total = 0;
+   int complete = 0;
+   char buf[256];
+
+   t->running--;
+   c->req = NULL;
+   c->state = CHUNK_PENDING;
+   if (err == LWQQ_EC_OK && c == t->probe && req->http_code == 200) {
+      // whole file is here, journal is of no use
+      complete = 1;
+      chunks_free(t);
+      t->total = c->written;
+   } else if (err == LWQQ_EC_OK && c == t->probe && req->http_code == 416
+              && xfer_header(req, "Content-Range", buf, sizeof(buf))
+              && sscanf(buf, "bytes */%llu", &total) == 1) {
+      if (t->nchunk) {
+         // file shrank since journal was written
+         chunks_free(t);
+         pthread_mutex_lock(&t->lock);
+         t->done = t->resumed = 0;
+         pthread_mutex_unlock(&t->lock);
+         c->index = c->start = c->written = 0;
+         c->end = t->chunk_size - 1;
+         goto done;
+      } else if (total == 0) {
+         complete = 1;
+         t->ranged = 0;
+         t->total = 0;
+      }
+   } else if (err == LWQQ_EC_OK && chunk_complete(c, req, &total)) {
+      if (c == t->probe) {
+         // probe is freed, its data is taken by a chunk
+         probe_layout(t, req, total);
+         goto done;
+      }
+      complete = 1;
+      journal_mark(t, c);
+   }
+
+   if (complete)
+      c->state = CHUNK_DONE;
+   else if (atomic_load(&t->canceled))
+      ;
+   else if (c->tries++ < LWQQ_TRANSFER_RETRY
+            && (err != LWQQ_EC_OK || req->http_code == 206)) {
+      // a ranged chunk goes on from where it stopped
+      if (t->ranged <= 0)
+         chunk_drop(c);
+      lwqq_log(LOG_NOTICE, "chunk %zu of %s failed(%d,%d), retry\n",
+               c->index, t->url, err, req->http_code);
+   } else {
+      lwqq_log(LOG_WARNING, "chunk %zu of %s failed(%d,%d)\n", c->index,
+               t->url, err, req->http_code);
+      if (t->err == LWQQ_EC_OK)
+         t->err = err != LWQQ_EC_OK ? err : LWQQ_EC_HTTP_ERROR;
+   }
+done:
+   lwqq_http_request_free(req);
+   xfer_pump(t);
+   return err;
+}
+
+static void xfer_finish(LwqqTransfer* t)
+{
+   LwqqAsyncEvent* ev = t->ev;
+   int err = atomic_load(&t->canceled) ? LWQQ_EC_CANCELED : t->err;
+   if (err == LWQQ_EC_OK) {
+      // file may be longer from an earlier download
+      if (ftruncate(t->fd, t->total))
+         lwqq_log(LOG_WARNING, "can't truncate %s\n", t->path);
+      unlink(t->journal);
+   }
+   close(t->fd);
+   t->fd = -1;
+   if (t->jfd >= 0)
+      close(t->jfd);
+   t->jfd = -1;
+   lwqq_verbose(3, "transfer %s finished(%d)\n", t->url, err);
+   t->ev = NULL;
+   ev->result = err;
+   lwqq_async_event_finish(ev);
+}
+
+static void xfer_pump(LwqqTransfer* t)
+{
+   XferChunk* c;
+   size_t i;
+   int complete = 1;
+   if (t->ev == NULL)
+      return;
+   if (t->probe) {
+      c = t->probe;
+      if (c->state == CHUNK_DONE)
+         goto done;
+      if (c->state == CHUNK_PENDING && !atomic_load(&t->canceled) && !t->err)
+         chunk_request(t, c);
+      if (t->running == 0)
+         goto done;
+      return;
+   }
+   for (i = 0; i < t->nchunk; i++) {
+      c = t->chunks[i];
+      if (c->state == CHUNK_PENDING && !atomic_load(&t->canceled) && !t->err
+          && t->running < t->parallel)
+         chunk_request(t, c);
+      complete &= c->state == CHUNK_DONE;
+   }
+   if (!complete && t->running)
+      return;
+done:
+   xfer_finish(t);
+}
+
+LWQQ_EXPORT
+LwqqTransfer* lwqq_transfer_new(LwqqClient* lc, const char* url,
+                                const char* path)
+{
+   if (!lc || !url || !path)
+      return NULL;
+   LwqqTransfer* t = s_malloc0(sizeof(*t));
+   size_t len = strlen(path) + sizeof(LWQQ_TRANSFER_JOURNAL);
+   pthread_mutex_init(&t->lock, NULL);
+   t->lc = lc;
+   t->url = s_strdup(url);
+   t->path = s_strdup(path);
+   t->journal = s_malloc(len);
+   snprintf(t->journal, len, "%s" LWQQ_TRANSFER_JOURNAL, path);
+   t->fd = t->jfd = -1;
+   t->parallel = LWQQ_TRANSFER_PARALLEL;
+   t->chunk_size = LWQQ_TRANSFER_CHUNK;
+   t->ranged = -1;
+   return t;
+}
+
+LWQQ_EXPORT
+void lwqq_transfer_set(LwqqTransfer* t, unsigned parallel, size_t chunk_size)
+{
+   if (!t)
+      return;
+   t->parallel = parallel ? parallel : LWQQ_TRANSFER_PARALLEL;
+   t->chunk_size = chunk_size ? chunk_size : LWQQ_TRANSFER_CHUNK;
+}
+
+LWQQ_EXPORT
+void lwqq_transfer_on_progress(LwqqTransfer* t, LwqqProgressFunc progress,
+                               void* data)
+{
+   if (!t)
+      return;
+   t->progress = progress;
+   t->prog_data = data;
+}
+
+LWQQ_EXPORT
+LwqqAsyncEvent* lwqq_transfer_start(LwqqTransfer* t)
+{
+   size_t i;
+   if (!t || t->ev)
+      return NULL;
+   t->fd = open(t->path, XFER_OPEN, 0644);
+   if (t->fd < 0) {
+      lwqq_log(LOG_ERROR, "can't open %s\n", t->path);
+      return NULL;
+   }
+   t->ev = lwqq_async_event_new(NULL);
+   t->ev->lc = t->lc;
+   t->started = lwqq__metrics_now();
+   t->last_prog = time(NULL);
+
+   // probe the first chunk journal doesn't have
+   i = 0;
+   if (journal_load(t) == 0) {
+      while (i < t->nchunk && t->chunks[i]->state == CHUNK_DONE)
+         i++;
+   }
+   if (t->nchunk && i == t->nchunk) {
+      // complete except journal is left
+      t->ranged = 1;
+      LwqqAsyncEvent* ev = t->ev;
+      lwqq_client_dispatch(t->lc, _C_(p, xfer_pump, t));
+      return ev;
+   }
+   if (t->nchunk)
+      lwqq_verbose(3, "resume %s from %llu bytes\n", t->path,
+                   (unsigned long long)t->resumed);
+   t->probe = chunk_new(t, i);
+   LwqqAsyncEvent* ev = t->ev;
+   lwqq_client_dispatch(t->lc, _C_(p, xfer_pump, t));
+   return ev;
+}
+
+LWQQ_EXPORT
+void lwqq_transfer_cancel(LwqqTransfer* t)
+{
+   if (t)
+      atomic_store(&t->canceled, 1);
+}
+
+LWQQ_EXPORT
+void lwqq_transfer_stats(LwqqTransfer* t, LwqqTransferStats* stats)
+{
+   size_t i;
+   memset(stats, 0, sizeof(*stats));
+   if (!t)
+      return;
+   pthread_mutex_lock(&t->lock);
+   stats->total = t->total;
+   stats->done = t->done;
+   stats->resumed = t->resumed;
+   stats->running = t->running;
+   if (t->started) {
+      stats->elapsed = (lwqq__metrics_now() - t->started) / 1e6;
+      if (stats->elapsed > 0)
+         stats->speed = (t->done - t->resumed) / stats->elapsed;
+   }
+   stats->chunks = t->nchunk;
+   for (i = 0; i < t->nchunk; i++)
+      stats->chunks_done += t->chunks[i]->state == CHUNK_DONE;
+   pthread_mutex_unlock(&t->lock);
+}
+
+LWQQ_EXPORT
+void lwqq_transfer_free(LwqqTransfer* t)
+{
+   if (!t)
+      return;
+   if (t->fd >= 0)
+      close(t->fd);
+   if (t->jfd >= 0)
+      close(t->jfd);
+   chunks_free(t);
+   s_free(t->probe);
+   s_free(t->etag);
+   s_free(t->url);
+   s_free(t->path);
+   s_free(t->journal);
+   pthread_mutex_destroy(&t->lock);
+   s_free(t);
+}
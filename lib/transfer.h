@@ -0,0 +1,65 @@
+/**
+ * @file   transfer.h
+ * @brief  Parallel chunked download with resume
+ *
+ * a download is split into chunks, which are fetched with http range
+ * requests in parallel and written into a preallocated file with pwrite.
+ * finished chunks are recorded in a journal beside the file, a transfer
+ * started again with the same url and path fetches only what is missing.
+ * a chunk which drops its connection is requested again from where it
+ * stopped. a server without range support gets a single plain download.
+ */
+
+#ifndef LWQQ_TRANSFER_H
+#define LWQQ_TRANSFER_H
+
+#include <stdint.h>
+#include "type.h"
+
+#define LWQQ_TRANSFER_CHUNK (1024 * 1024)
+#define LWQQ_TRANSFER_PARALLEL 4
+#define LWQQ_TRANSFER_RETRY 3 /** < retries of each chunk */
+/** journal is path with this suffix, removed when transfer is complete */
+#define LWQQ_TRANSFER_JOURNAL ".lwqq-part"
+
+typedef struct LwqqAsyncEvent LwqqAsyncEvent;
+typedef struct LwqqTransfer LwqqTransfer;
+
+typedef struct LwqqTransferStats {
+   uint64_t total; /** < size of file, 0 until server tells it */
+   uint64_t done; /** < bytes on disk, include resumed ones */
+   uint64_t resumed; /** < bytes done by a previous transfer */
+   double elapsed; /** < seconds since start */
+   double speed; /** < bytes per second since start, resumed not counted */
+   size_t chunks;
+   size_t chunks_done;
+   unsigned running; /** < requests in flight */
+} LwqqTransferStats;
+
+/**
+ * @param url file to download
+ * @param path file to write, created if missing
+ */
+LwqqTransfer* lwqq_transfer_new(LwqqClient* lc, const char* url,
+                                const char* path);
+/**
+ * @param parallel max requests in flight, 0 for default
+ * @param chunk_size bytes of a chunk, 0 for default. a resumed transfer
+ *        keeps chunk size of its journal
+ */
+void lwqq_transfer_set(LwqqTransfer* t, unsigned parallel, size_t chunk_size);
+/** progress is called at most once a second, nonzero return cancels */
+void lwqq_transfer_on_progress(LwqqTransfer* t, LwqqProgressFunc progress,
+                               void* data);
+/**
+ * @return event finishes with LWQQ_EC_OK when whole file is written,
+ *         journal is kept when it fails. NULL if path can't be opened
+ */
+LwqqAsyncEvent* lwqq_transfer_start(LwqqTransfer* t);
+/** stop all requests, event finishes with LWQQ_EC_CANCELED */
+void lwqq_transfer_cancel(LwqqTransfer* t);
+void lwqq_transfer_stats(LwqqTransfer* t, LwqqTransferStats* stats);
+/** free it when event is finished, or when it is never started */
+void lwqq_transfer_free(LwqqTransfer* t);
+
+#endif
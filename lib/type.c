@@ -21,6 +21,7 @@
 #include "http.h"
 #include "internal.h"
 #include "utility.h"
+#include "member.h"
 
 LWQQ_EXPORT
 const LwqqFeatures lwqq_features()
@@ -101,6 +102,10 @@ typedef struct LwqqClient_ {
    LwqqHashEntry* hash_idx;
    int hash_next; /* if first call hash_auto, it shouldn't goto next. if isn't,
                                                    it should try next entry */
+   struct LwqqMemberStore* member_store; /* lazy member mode, see member.h */
+   struct LwqqUploadCache* upload_cache; /* uploaded pictures, see msg.c */
+   struct LwqqSendQueue* send_queue; /* see sendq.h */
+   struct LwqqAvatarPrefetch* avatar_prefetch; /* see info.c */
 } LwqqClient_;
 
 /**
@@ -167,6 +172,26 @@ struct LwqqHttpHandle* lwqq_get_http_handle(LwqqClient* lc)
    return ((LwqqClient_*)lc)->http;
 }
 
+struct LwqqMemberStore** lwqq__client_member_store(LwqqClient* lc)
+{
+   return &((LwqqClient_*)lc)->member_store;
+}
+
+struct LwqqUploadCache** lwqq__client_upload_cache(LwqqClient* lc)
+{
+   return &((LwqqClient_*)lc)->upload_cache;
+}
+
+struct LwqqSendQueue** lwqq__client_send_queue(LwqqClient* lc)
+{
+   return &((LwqqClient_*)lc)->send_queue;
+}
+
+struct LwqqAvatarPrefetch** lwqq__client_avatar_prefetch(LwqqClient* lc)
+{
+   return &((LwqqClient_*)lc)->avatar_prefetch;
+}
+
 void lwqq_vc_free(LwqqVerifyCode* vc)
 {
    if (vc) {
@@ -240,6 +265,9 @@ void lwqq_client_free(LwqqClient* client)
    vp_cancel(client->events->friend_chg);
    vp_cancel(client->events->group_chg);
    vp_cancel(client->events->start_logout);
+   vp_cancel(client->events->roster_refresh);
+   vp_cancel(client->events->content_ready);
+   vp_cancel(client->events->delete_buddy);
    s_free(client->events);
    s_free(client->args);
 
@@ -269,6 +297,10 @@ void lwqq_client_free(LwqqClient* client)
       LIST_REMOVE(d_entry, entries);
       lwqq_group_free(d_entry);
    }
+   lwqq__member_store_free(((LwqqClient_*)client)->member_store);
+   lwqq__upload_cache_free(lc_->upload_cache);
+   lwqq__send_queue_free(lc_->send_queue);
+   lwqq__avatar_prefetch_free(lc_->avatar_prefetch);
 
    /* Free msg_list */
    lwqq_msglist_close(client->msg_list);
@@ -346,7 +378,7 @@ void lwqq_simple_buddy_free(LwqqSimpleBuddy* buddy)
    if (!buddy)
       return;
 
-   s_free(buddy->uin);
+   s_release(buddy->uin);
    s_free(buddy->qq);
    s_free(buddy->cate_index);
    s_free(buddy->nick);
@@ -485,6 +517,7 @@ void lwqq_group_free(LwqqGroup* group)
    s_free(group->option);
 
    s_free(group->avatar);
+   lwqq__member_detach(group);
 
    /* Free Group members list */
    LIST_FOREACH_SAFE(m_entry, &group->members, entries, m_next)
@@ -565,6 +598,7 @@ LwqqSimpleBuddy* lwqq_group_find_group_member_by_uin(LwqqGroup* group,
 
    if (!group || !uin)
       return NULL;
+   lwqq__member_unpack(group);
 
    LIST_FOREACH(member, &group->members, entries)
    {
@@ -616,6 +650,33 @@ char* lwqq_hash_auto(const char* uin, const char* ptwebqq, void* lc)
    return lc_->hash_idx->func(uin, ptwebqq, lc_->hash_idx->data);
 }
 
+LWQQ_EXPORT
+char* lwqq_hash_parallel(const char* uin, const char* ptwebqq, void* lc)
+{
+   // used as a plain hash, it is the last successful one
+   LwqqClient_* lc_ = lc;
+   lwqq_verbose(2, "[using hash: %s]\n", lc_->hash_idx->name);
+   return lc_->hash_idx->func(uin, ptwebqq, lc_->hash_idx->data);
+}
+
+LWQQ_EXPORT
+int lwqq_hash_list(LwqqClient* lc, const LwqqHashEntry* list[], int size)
+{
+   if (!lc)
+      return 0;
+   LwqqClient_* lc_ = (LwqqClient_*)lc;
+   LwqqHashEntry* entry = lc_->hash_beg;
+   int n = 0;
+   while (n < size && entry->name) {
+      list[n++] = entry;
+      if ((++entry)->name == NULL)
+         entry = lc_->hash_entry;
+      if (entry == lc_->hash_beg)
+         break;
+   }
+   return n;
+}
+
 LWQQ_EXPORT
 int lwqq_hash_all_finished(LwqqClient* lc)
 {
@@ -276,6 +276,10 @@ Discu: (with lwdb) the only one and stable key reference
 
    LIST_ENTRY(LwqqGroup) entries;
    LIST_HEAD(, LwqqSimpleBuddy) members; /** < QQ Group members */
+   struct LwqqMemberArena* arena; /** < lazy mode only, see member.h */
+   /** readonly: last time members are fetched from server,
+    * 0 if never, such as restored from snapshot */
+   time_t member_refresh;
 } LwqqGroup;
 #define lwqq_member_is_founder(member, group)                                  \
    (strcmp(member->uin, group->owner) == 0)
@@ -394,6 +398,23 @@ typedef struct LwqqEvents {
    LwqqCommand group_chg;
    /** a safe event last chance do http request ( must be synced) */
    LwqqCommand start_logout;
+   /** friends, groups, discus list or group members successfully refreshed
+    *  from server
+    */
+   LwqqCommand roster_refresh;
+   /** a picture of a message delivered with POLL_LAZY_CONTENT is resolved,
+    *  fired even if download failed, then data of content is NULL.
+    *  content is a copy of the picture in msg, which is left unchanged. it
+    *  is freed after the event, take its data by setting data to NULL.
+    *  msg stays valid until the event returns
+    *  modify : msg <- message, content <- copy of the picture
+    */
+   LwqqCommand content_ready;
+   /** a friend is gone from friend list refreshed from server,
+    *  the last chance to visit buddy, do not free it
+    *  modify : deleted_buddy <- the buddy
+    */
+   LwqqCommand delete_buddy;
 } LwqqEvents;
 
 LwqqEvents* lwqq_client_get_events(LwqqClient* lc);
@@ -408,6 +429,18 @@ typedef struct LwqqArguments {
    struct LwqqMsgContent* content;
    LwqqErrorCode err;
    char* hash_result;
+   /** count of members added and removed by group member refresh.
+    * only valid in group_member_chg fired by group detail refresh */
+   int member_added;
+   int member_removed;
+   const LwqqBuddy* deleted_buddy;
+   /** message of content, only valid in content_ready */
+   struct LwqqMsg* msg;
+   /** members added and removed by group member refresh, member_added and
+    * member_removed are their counts. removed ones are not in group any
+    * more, and are freed after the event */
+   const LwqqSimpleBuddy* const* added_members;
+   const LwqqSimpleBuddy* const* removed_members;
 } LwqqArguments;
 
 LwqqArguments* lwqq_client_get_args(LwqqClient* lc);
@@ -549,6 +582,13 @@ LwqqSimpleBuddy* lwqq_group_find_group_member_by_uin(LwqqGroup* group,
 /** auto select hash function, it try one form system queue, if failed, try
  * next one, you can set begin postion to start scan */
 char* lwqq_hash_auto(const char* uin, const char* ptwebqq, void* lc);
+/** probe every hash at once, pass it to lwqq_info_get_friends_info. the first
+ * accepted one wins and becomes begin postion. as a plain hash function it
+ * is the last successful one */
+char* lwqq_hash_parallel(const char* uin, const char* ptwebqq, void* lc);
+/* fill list with registered hash, begin postion first.
+ * @return count of entries */
+int lwqq_hash_list(LwqqClient* lc, const LwqqHashEntry* list[], int size);
 /* check we have already tried all hash */
 int lwqq_hash_all_finished(LwqqClient* lc);
 /* register a new js entry for auto select.
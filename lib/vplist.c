@@ -1,6 +1,7 @@
 #include "vplist.h"
 #include <string.h>
 #include <stdarg.h>
+#include "smemory.h"
 
 #ifdef WIN32
 #include "lwqq_export.h"
@@ -8,6 +9,8 @@
 #define LWQQ_EXPORT
 #endif
 
+static SSlab link_slab = S_SLAB_INIT("vp_command", vp_command);
+
 struct vp_d_table {
    const char* id;
    VP_DISPATCH d;
@@ -58,7 +61,7 @@ void vp_do(vp_command cmd, void* retval)
       vp_end(n->data);
       p = n;
       n = n->next;
-      free(p);
+      s_slab_free(&link_slab, p);
    }
 }
 
@@ -94,7 +97,7 @@ void vp_cancel(vp_command cmd)
       vp_end(n->data);
       p = n;
       n = n->next;
-      free(p);
+      s_slab_free(&link_slab, p);
    }
 }
 
@@ -103,7 +106,7 @@ const vp_command* vp_link(vp_command* head, vp_command* elem)
    vp_command* cmd = head;
    while (cmd->next)
       cmd = cmd->next;
-   vp_command* item = malloc(sizeof(vp_command));
+   vp_command* item = s_slab_alloc(&link_slab);
    memcpy(item, elem, sizeof(vp_command));
    memset(elem, 0, sizeof(vp_command));
    cmd->next = item;
@@ -120,202 +123,23 @@ void vp_unlink(vp_command* head, const vp_command* elem)
          *p_cmd = elem->next;
          ((vp_command*)elem)->next = NULL;
          vp_cancel(*elem);
-         free((void*)elem);
+         s_slab_free(&link_slab, (void*)elem);
          return;
       }
       p_cmd = &(*p_cmd)->next;
    }
 }
 
-LWQQ_EXPORT
-void vp_func_void(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void);
-   if (!func) {
-      // because malloc(0) make compiler confused
-      // let it as 1,it would freed nature
-      vp_init(*vp, 1);
-      return;
-   }
-   ((f)func)();
-}
+/* arguments of these all fit in VP_INLINE_WORDS */
+LWQQ_EXPORT VP_DISPATCHER_0(void, void)
+LWQQ_EXPORT VP_DISPATCHER_1(p, void, void*)
+LWQQ_EXPORT VP_DISPATCHER_2(2p, void, void*, void*)
+LWQQ_EXPORT VP_DISPATCHER_3(2pi, void, void*, void*, int)
+LWQQ_EXPORT VP_DISPATCHER_3(3p, void, void*, void*, void*)
+LWQQ_EXPORT VP_DISPATCHER_4(3pi, void, void*, void*, void*, int)
+LWQQ_EXPORT VP_DISPATCHER_4(4p, void, void*, void*, void*, void*)
+LWQQ_EXPORT VP_DISPATCHER_2(pi, void, void*, int)
 
-LWQQ_EXPORT
-void vp_func_p(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*));
-      vp_dump(*vp, *va, void*);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   ((f)func)(p1);
-}
-
-LWQQ_EXPORT
-void vp_func_2p(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*, void*);
-   if (!func) {
-      va_list va;
-      va_copy(va, *(va_list*)q);
-      vp_init(*vp, sizeof(void*) * 2);
-      vp_dump(*vp, va, void*);
-      vp_dump(*vp, va, void*);
-      va_end(va);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   ((f)func)(p1, p2);
-}
-
-LWQQ_EXPORT
-void vp_func_2pi(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*, void*, int);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) * 2 + sizeof(int));
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, int);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   int p3 = vp_arg(*vp, int);
-   ((f)func)(p1, p2, p3);
-}
-
-LWQQ_EXPORT
-void vp_func_3p(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*, void*, void*);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) * 3);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   void* p3 = vp_arg(*vp, void*);
-   ((f)func)(p1, p2, p3);
-}
-
-LWQQ_EXPORT
-void vp_func_3pi(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*, void*, void*, int);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) * 3 + sizeof(int));
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, int);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   void* p3 = vp_arg(*vp, void*);
-   int p4 = vp_arg(*vp, int);
-   ((f)func)(p1, p2, p3, p4);
-}
-
-LWQQ_EXPORT
-void vp_func_4p(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*, void*, void*, void*);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) * 4);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   void* p3 = vp_arg(*vp, void*);
-   void* p4 = vp_arg(*vp, void*);
-   ((f)func)(p1, p2, p3, p4);
-}
-
-LWQQ_EXPORT
-void vp_func_pi(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef void (*f)(void*, int);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) + sizeof(int));
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, int);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   int p2 = vp_arg(*vp, int);
-   ((f)func)(p1, p2);
-}
-
-LWQQ_EXPORT
-void vp_func_p_i(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef int (*f)(void*);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) * 2);
-      vp_dump(*vp, *va, void*);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   int ret = ((f)func)(p1);
-   if (q)
-      *(int*)q = ret;
-}
-
-LWQQ_EXPORT
-void vp_func_2p_i(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef int (*f)(void*, void*);
-   if (!func) {
-      va_list* va = q;
-      vp_init(*vp, sizeof(void*) * 2);
-      vp_dump(*vp, *va, void*);
-      vp_dump(*vp, *va, void*);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   int ret = ((f)func)(p1, p2);
-   if (q)
-      *(int*)q = ret;
-}
-
-LWQQ_EXPORT
-void vp_func_3p_i(VP_CALLBACK func, vp_list* vp, void* q)
-{
-   typedef int (*f)(void*, void*, void*);
-   if (!func) {
-      va_list va;
-      va_copy(va, *(va_list*)q);
-      vp_init(*vp, sizeof(void*) * 3);
-      vp_dump(*vp, va, void*);
-      vp_dump(*vp, va, void*);
-      vp_dump(*vp, va, void*);
-      va_end(va);
-      return;
-   }
-   void* p1 = vp_arg(*vp, void*);
-   void* p2 = vp_arg(*vp, void*);
-   void* p3 = vp_arg(*vp, void*);
-   int ret = ((f)func)(p1, p2, p3);
-   if (q)
-      *(int*)q = ret;
-}
+LWQQ_EXPORT VP_DISPATCHER_1(p_i, int, void*)
+LWQQ_EXPORT VP_DISPATCHER_2(2p_i, int, void*, void*)
+LWQQ_EXPORT VP_DISPATCHER_3(3p_i, int, void*, void*, void*)
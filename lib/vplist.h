@@ -12,10 +12,14 @@
 
 #include <stdlib.h>
 
+/** arguments up to {?} words are stored inside vp_list, no heap alloc */
+#define VP_INLINE_WORDS 4
 typedef struct {
-   void* st;
+   void* st; /** < heap buffer, NULL when arguments are inline */
    void* cur;
    size_t sz;
+   /* never point into it before vp_start, vp_list is copied by value */
+   void* in[VP_INLINE_WORDS];
 } vp_list;
 typedef void (*VP_CALLBACK)(void);
 typedef void (*VP_DISPATCH)(VP_CALLBACK, vp_list*, void*);
@@ -26,24 +30,107 @@ typedef struct vp_command {
    struct vp_command* next;
 } vp_command;
 
-#define vp_init(vp, size)                                                      \
-   do {                                                                        \
-      (vp).st = (vp).cur = malloc(size);                                       \
-      (vp).sz = size;                                                          \
-   } while (0)
-#define _ptr_self_inc(ptr, sz) ((ptr += sz) - sz)
+static inline void vp_list_init(vp_list* vp, size_t size)
+{
+   vp->sz = size;
+   vp->st = (size > sizeof(vp->in)) ? malloc(size) : NULL;
+   vp->cur = vp->st ? vp->st : (void*)vp->in;
+}
+static inline void vp_list_start(vp_list* vp)
+{
+   vp->cur = vp->st ? vp->st : (void*)vp->in;
+}
+static inline void vp_list_end(vp_list* vp)
+{
+   free(vp->st);
+   vp->cur = vp->st = NULL;
+   vp->sz = 0;
+}
+static inline void* vp_list_next(vp_list* vp, size_t size)
+{
+   char* p = vp->cur;
+   vp->cur = p + size;
+   return p;
+}
+/* vp_dump and vp_arg take a type, so they stay macros */
+#define vp_init(vp, size) vp_list_init(&(vp), size)
 #define vp_dump(vp, va, type)                                                  \
    do {                                                                        \
       type t = va_arg((va), type);                                             \
-      memcpy(_ptr_self_inc((vp).cur, sizeof(type)), &t, sizeof(type));         \
+      memcpy(vp_list_next(&(vp), sizeof(type)), &t, sizeof(type));             \
    } while (0)
-#define vp_start(vp) (vp).cur = (vp).st
-#define vp_arg(vp, type) *(type*)(_ptr_self_inc((vp).cur, sizeof(type)))
-#define vp_end(vp)                                                             \
+#define vp_start(vp) vp_list_start(&(vp))
+#define vp_arg(vp, type) (*(type*)vp_list_next(&(vp), sizeof(type)))
+#define vp_end(vp) vp_list_end(&(vp))
+
+/**
+ * generate dispatcher vp_func_<name> for callback R func(T1, ...).
+ * R is void or int, int result is written to retval when it is not NULL.
+ * arguments are read into locals first, order of evaluation of call
+ * arguments is unspecified.
+ * example: VP_DISPATCHER_2(2p_i, int, void*, void*)
+ */
+#define VP_RET_void(call) call
+#define VP_RET_int(call)                                                       \
    do {                                                                        \
-      free((vp).st), (vp).cur = (vp).st = NULL;                                \
-      (vp).sz = 0;                                                             \
+      int ret = call;                                                          \
+      if (q)                                                                   \
+         *(int*)q = ret;                                                       \
    } while (0)
+#define VP_DISPATCHER_BEGIN(name, size)                                        \
+   void vp_func_##name(VP_CALLBACK func, vp_list* vp, void* q)                 \
+   {                                                                           \
+      va_list va;                                                              \
+      if (!func) {                                                             \
+         va_copy(va, *(va_list*)q);                                            \
+         vp_init(*vp, size);
+#define VP_DISPATCHER_LOAD                                                     \
+   va_end(va);                                                                 \
+   return;                                                                     \
+   }
+#define VP_DISPATCHER_CALL(R, call)                                            \
+   VP_RET_##R(call);                                                           \
+   }
+#define VP_DISPATCHER_0(name, R)                                               \
+   VP_DISPATCHER_BEGIN(name, 0)                                                \
+   VP_DISPATCHER_LOAD                                                          \
+   VP_DISPATCHER_CALL(R, ((R(*)(void))func)())
+#define VP_DISPATCHER_1(name, R, T1)                                           \
+   VP_DISPATCHER_BEGIN(name, sizeof(T1))                                       \
+   vp_dump(*vp, va, T1);                                                       \
+   VP_DISPATCHER_LOAD                                                          \
+   T1 a1 = vp_arg(*vp, T1);                                                    \
+   VP_DISPATCHER_CALL(R, ((R(*)(T1))func)(a1))
+#define VP_DISPATCHER_2(name, R, T1, T2)                                       \
+   VP_DISPATCHER_BEGIN(name, sizeof(T1) + sizeof(T2))                          \
+   vp_dump(*vp, va, T1);                                                       \
+   vp_dump(*vp, va, T2);                                                       \
+   VP_DISPATCHER_LOAD                                                          \
+   T1 a1 = vp_arg(*vp, T1);                                                    \
+   T2 a2 = vp_arg(*vp, T2);                                                    \
+   VP_DISPATCHER_CALL(R, ((R(*)(T1, T2))func)(a1, a2))
+#define VP_DISPATCHER_3(name, R, T1, T2, T3)                                   \
+   VP_DISPATCHER_BEGIN(name, sizeof(T1) + sizeof(T2) + sizeof(T3))             \
+   vp_dump(*vp, va, T1);                                                       \
+   vp_dump(*vp, va, T2);                                                       \
+   vp_dump(*vp, va, T3);                                                       \
+   VP_DISPATCHER_LOAD                                                          \
+   T1 a1 = vp_arg(*vp, T1);                                                    \
+   T2 a2 = vp_arg(*vp, T2);                                                    \
+   T3 a3 = vp_arg(*vp, T3);                                                    \
+   VP_DISPATCHER_CALL(R, ((R(*)(T1, T2, T3))func)(a1, a2, a3))
+#define VP_DISPATCHER_4(name, R, T1, T2, T3, T4)                               \
+   VP_DISPATCHER_BEGIN(name, sizeof(T1) + sizeof(T2) + sizeof(T3) + sizeof(T4))\
+   vp_dump(*vp, va, T1);                                                       \
+   vp_dump(*vp, va, T2);                                                       \
+   vp_dump(*vp, va, T3);                                                       \
+   vp_dump(*vp, va, T4);                                                       \
+   VP_DISPATCHER_LOAD                                                          \
+   T1 a1 = vp_arg(*vp, T1);                                                    \
+   T2 a2 = vp_arg(*vp, T2);                                                    \
+   T3 a3 = vp_arg(*vp, T3);                                                    \
+   T4 a4 = vp_arg(*vp, T4);                                                    \
+   VP_DISPATCHER_CALL(R, ((R(*)(T1, T2, T3, T4))func)(a1, a2, a3, a4))
 
 vp_command vp_make_command(VP_DISPATCH, VP_CALLBACK, ...);
 void vp_do(vp_command, void* retval);
@@ -14,7 +14,8 @@ class vp_list(Structure):
     _fields_ = [
             ('st',c_voidp),
             ('cur',c_voidp),
-            ('sz',c_size_t)
+            ('sz',c_size_t),
+            ('in',c_voidp*4) # VP_INLINE_WORDS
             ]
     pass 
 
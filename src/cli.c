@@ -280,18 +280,14 @@ static char* hash_load_js(const char* str1, const char* str2,
 {
    req->do_request(req, 0, NULL);
    const char* hashjs = req->response;
-   lwqq_js_t* js = lwqq_js_init();
-   lwqq_js_load_buffer(js, hashjs);
-   char* ret = lwqq_js_hash(str1, str2, js);
-   lwqq_js_close(js);
-   return ret;
+   return lwqq_js_pool_hash(hashjs, str1, str2);
 }
 #endif
 
 static void* info_thread(void* lc)
 {
    // auto select hash, ofcourse include js
-   lwqq_info_get_friends_info(lc, NULL, NULL);
+   lwqq_info_get_friends_info(lc, lwqq_hash_parallel, NULL);
    // FIXME also we should save last used js, and make next load would be
    // faster
    return NULL;